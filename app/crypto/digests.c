@@ -122,17 +122,12 @@ int ICACHE_FLASH_ATTR crypto_hash (const digest_mech_info_t *mi,
 }
 
 
-int ICACHE_FLASH_ATTR crypto_hmac (const digest_mech_info_t *mi,
-   const char *data, size_t data_len,
+void ICACHE_FLASH_ATTR crypto_hmac_pads (const digest_mech_info_t *mi,
+   void *ctx,
    const char *key, size_t key_len,
-   uint8_t *digest)
+   uint8_t *k_ipad, uint8_t *k_opad)
 {
-  if (!mi)
-    return EINVAL;
-
-  void *ctx = (void *)os_malloc (mi->ctx_size);
-  if (!ctx)
-    return ENOMEM;
+  uint8_t digest[mi->digest_size];
 
   // If key too long, it needs to be hashed before use
   if (key_len > mi->block_size)
@@ -145,9 +140,6 @@ int ICACHE_FLASH_ATTR crypto_hmac (const digest_mech_info_t *mi,
   }
 
   const size_t bs = mi->block_size;
-  uint8_t k_ipad[bs];
-  uint8_t k_opad[bs];
-
   os_memset (k_ipad, 0x36, bs);
   os_memset (k_opad, 0x5c, bs);
   size_t i;
@@ -156,16 +148,50 @@ int ICACHE_FLASH_ATTR crypto_hmac (const digest_mech_info_t *mi,
     k_ipad[i] ^= key[i];
     k_opad[i] ^= key[i];
   }
+}
+
 
+void ICACHE_FLASH_ATTR crypto_hmac_begin (const digest_mech_info_t *mi,
+   void *ctx, const uint8_t *k_ipad)
+{
   mi->create (ctx);
-  mi->update (ctx, k_ipad, bs);
-  mi->update (ctx, data, data_len);
+  mi->update (ctx, k_ipad, mi->block_size);
+}
+
+
+void ICACHE_FLASH_ATTR crypto_hmac_finalize (const digest_mech_info_t *mi,
+   void *ctx, const uint8_t *k_opad,
+   uint8_t *digest)
+{
   mi->finalize (digest, ctx);
 
   mi->create (ctx);
-  mi->update (ctx, k_opad, bs);
+  mi->update (ctx, k_opad, mi->block_size);
   mi->update (ctx, digest, mi->digest_size);
   mi->finalize (digest, ctx);
+}
+
+
+int ICACHE_FLASH_ATTR crypto_hmac (const digest_mech_info_t *mi,
+   const char *data, size_t data_len,
+   const char *key, size_t key_len,
+   uint8_t *digest)
+{
+  if (!mi)
+    return EINVAL;
+
+  void *ctx = (void *)os_malloc (mi->ctx_size);
+  if (!ctx)
+    return ENOMEM;
+
+  const size_t bs = mi->block_size;
+  uint8_t k_ipad[bs];
+  uint8_t k_opad[bs];
+
+  crypto_hmac_pads (mi, ctx, key, key_len, k_ipad, k_opad);
+  crypto_hmac_begin (mi, ctx, k_ipad);
+  mi->update (ctx, data, data_len);
+  crypto_hmac_finalize (mi, ctx, k_opad, digest);
 
   os_free (ctx);
   return 0;
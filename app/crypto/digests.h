@@ -67,6 +67,31 @@ int crypto_hash (const digest_mech_info_t *mi, const char *data, size_t data_len
  */
 int crypto_hmac (const digest_mech_info_t *mi, const char *data, size_t data_len, const char *key, size_t key_len, uint8_t *digest);
 
+/**
+ * Derive the HMAC inner and outer pads from a key, for the streaming
+ * HMAC functions below. A key longer than a block is hashed first.
+ * @param mi       A mech from @c crypto_digest_mech().
+ * @param ctx      Scratch context of @c mi->ctx_size bytes.
+ * @param key      The key to use.
+ * @param key_len  Number of bytes the @c key comprises.
+ * @param k_ipad   Output buffer of @c mi->block_size bytes.
+ * @param k_opad   Output buffer of @c mi->block_size bytes.
+ */
+void crypto_hmac_pads (const digest_mech_info_t *mi, void *ctx, const char *key, size_t key_len, uint8_t *k_ipad, uint8_t *k_opad);
+
+/**
+ * Start a HMAC in @c ctx; the message then goes through @c mi->update.
+ * @param k_ipad   Inner pad from @c crypto_hmac_pads().
+ */
+void crypto_hmac_begin (const digest_mech_info_t *mi, void *ctx, const uint8_t *k_ipad);
+
+/**
+ * Complete a HMAC started with @c crypto_hmac_begin().
+ * @param k_opad   Outer pad from @c crypto_hmac_pads().
+ * @param digest   Output buffer, must be at least @c mi->digest_size in size.
+ */
+void crypto_hmac_finalize (const digest_mech_info_t *mi, void *ctx, const uint8_t *k_opad, uint8_t *digest);
+
 /**
  * Perform ASCII Hex encoding. Does not null-terminate the buffer.
  *
@@ -11,6 +11,7 @@
 #include "ets_sys.h"
 #include "osapi.h"
 #include "gpio.h"
+#include "user_interface.h"
 
 #include "driver/i2c_master.h"
 
@@ -330,3 +331,219 @@ i2c_master_writeByte(uint8 wrdata)
         i2c_master_wait(5);
     }
 }
+
+/******************************************************************************
+ * Fast mode engine
+ *
+ * The functions above pace the bus with os_delay_us(5), which cannot get
+ * below 100kHz. The ones below time every SCL phase against the CPU cycle
+ * counter instead and write the GPIO set/clear registers directly, so the
+ * bus runs at up to 400kHz at 80 or 160MHz. They live in IRAM because a
+ * flash cache miss in the middle of a bit costs more than the bit itself.
+ * Slaves may stretch SCL; an interrupt only stretches the current phase.
+*******************************************************************************/
+#define I2C_FAST_STRETCH_US 1000
+
+LOCAL uint32 i2c_fast_speed = 400000;
+LOCAL uint32 t_low, t_high, t_stretch;  // in cpu cycles
+LOCAL uint32 t_mark;                    // cycle count the last edge was due
+
+static inline uint32 ICACHE_RAM_ATTR
+i2c_ccount(void)
+{
+    uint32 r;
+    __asm__ __volatile__("rsr %0,ccount":"=a" (r));
+    return r;
+}
+
+#define SDA_MASK    (1 << pinSDA)
+#define SCL_MASK    (1 << pinSCL)
+#define SDA_HIGH()  GPIO_REG_WRITE(GPIO_OUT_W1TS_ADDRESS, SDA_MASK)
+#define SDA_LOW()   GPIO_REG_WRITE(GPIO_OUT_W1TC_ADDRESS, SDA_MASK)
+#define SCL_LOW()   GPIO_REG_WRITE(GPIO_OUT_W1TC_ADDRESS, SCL_MASK)
+#define SDA_READ()  ((GPIO_REG_READ(GPIO_IN_ADDRESS) & SDA_MASK) != 0)
+#define SCL_READ()  ((GPIO_REG_READ(GPIO_IN_ADDRESS) & SCL_MASK) != 0)
+
+// Edges are scheduled on t_mark, not on when the previous one actually
+// happened, so the time spent on register accesses does not add up and
+// the period stays exact. After an interrupt has made us late, restart
+// timing from now rather than cut the next phase short
+static inline void ICACHE_RAM_ATTR
+i2c_fast_delay(uint32 cycles)
+{
+    uint32 now;
+    while ((now = i2c_ccount()) - t_mark < cycles);
+    t_mark = (now - t_mark < 2 * cycles) ? t_mark + cycles : now;
+}
+
+// release SCL and wait for it to go high, the slave may hold it low
+LOCAL void ICACHE_RAM_ATTR
+i2c_fast_scl_high(void)
+{
+    uint32 start;
+
+    GPIO_REG_WRITE(GPIO_OUT_W1TS_ADDRESS, SCL_MASK);
+    if (!SCL_READ()) {
+        start = i2c_ccount();
+        while (!SCL_READ() && i2c_ccount() - start < t_stretch);
+        t_mark = i2c_ccount();
+    }
+}
+
+// one clock with SDA set to bit, returns SDA as sampled at the end of high
+LOCAL uint8 ICACHE_RAM_ATTR
+i2c_fast_bit(uint8 bit)
+{
+    uint8 r;
+
+    if (bit) {
+        SDA_HIGH();
+    } else {
+        SDA_LOW();
+    }
+    i2c_fast_delay(t_low);
+    i2c_fast_scl_high();
+    i2c_fast_delay(t_high);
+    r = SDA_READ();
+    SCL_LOW();
+    return r;
+}
+
+/******************************************************************************
+ * FunctionName : i2c_master_fast_setup
+ * Description  : set the clock of the fast mode engine
+ * Parameters   : uint32 speed - SCL frequency in Hz, 400000 at most
+ * Returns      : uint32 - the frequency that will be used
+*******************************************************************************/
+uint32 ICACHE_FLASH_ATTR
+i2c_master_fast_setup(uint32 speed)
+{
+    if (speed > 400000) {
+        speed = 400000;
+    }
+    i2c_fast_speed = speed;
+    return speed;
+}
+
+/******************************************************************************
+ * FunctionName : i2c_master_fast_start
+ * Description  : send a start or repeated start in fast mode
+ * Parameters   : NONE
+ * Returns      : NONE
+*******************************************************************************/
+void ICACHE_RAM_ATTR
+i2c_master_fast_start(void)
+{
+    // the cpu clock may have been changed since the last transaction.
+    // SCL low must be >= 1.3us for 400kHz, the rest of the period is high
+    uint32 mhz = system_get_cpu_freq();
+    uint32 period = mhz * 1000000 / i2c_fast_speed;
+
+    t_low = mhz * 13 / 10;
+    if (t_low < period / 2) {
+        t_low = period / 2;
+    }
+    t_high = period - t_low;
+    t_stretch = mhz * I2C_FAST_STRETCH_US;
+
+    SDA_HIGH();
+    t_mark = i2c_ccount();
+    i2c_fast_delay(t_low);
+    i2c_fast_scl_high();
+    i2c_fast_delay(t_high);     // repeated start setup time
+    SDA_LOW();
+    i2c_fast_delay(t_high);     // start hold time
+    SCL_LOW();
+    m_nLastSDA = 0;
+    m_nLastSCL = 0;
+}
+
+/******************************************************************************
+ * FunctionName : i2c_master_fast_stop
+ * Description  : send a stop in fast mode
+ * Parameters   : NONE
+ * Returns      : NONE
+*******************************************************************************/
+void ICACHE_RAM_ATTR
+i2c_master_fast_stop(void)
+{
+    SDA_LOW();
+    i2c_fast_delay(t_low);
+    i2c_fast_scl_high();
+    i2c_fast_delay(t_high);
+    SDA_HIGH();
+    i2c_fast_delay(t_low);      // bus free time before the next start
+    m_nLastSDA = 1;
+    m_nLastSCL = 1;
+}
+
+/******************************************************************************
+ * FunctionName : i2c_master_fast_writeByte
+ * Description  : write one byte and clock in the ack in fast mode
+ * Parameters   : uint8 wrdata - write value
+ * Returns      : uint8 - ack value, 0 or 1 like i2c_master_getAck
+*******************************************************************************/
+uint8 ICACHE_RAM_ATTR
+i2c_master_fast_writeByte(uint8 wrdata)
+{
+    uint8 mask;
+
+    for (mask = 0x80; mask; mask >>= 1) {
+        i2c_fast_bit(wrdata & mask);
+    }
+    return i2c_fast_bit(1);
+}
+
+/******************************************************************************
+ * FunctionName : i2c_master_fast_readByte
+ * Description  : read one byte and clock out the ack in fast mode
+ * Parameters   : uint8 level - ack level to send, 0 ack or 1 nack
+ * Returns      : uint8 - readed value
+*******************************************************************************/
+uint8 ICACHE_RAM_ATTR
+i2c_master_fast_readByte(uint8 level)
+{
+    uint8 retVal = 0;
+    uint8 i;
+
+    for (i = 0; i < 8; i++) {
+        retVal = (retVal << 1) | i2c_fast_bit(1);
+    }
+    i2c_fast_bit(level);
+    return retVal;
+}
+
+/******************************************************************************
+ * FunctionName : i2c_master_fast_write
+ * Description  : write a block in fast mode, stops at the first nack
+ * Parameters   : const uint8 *data, uint32 len
+ * Returns      : uint32 - number of bytes acked
+*******************************************************************************/
+uint32 ICACHE_RAM_ATTR
+i2c_master_fast_write(const uint8 *data, uint32 len)
+{
+    uint32 i;
+
+    for (i = 0; i < len; i++) {
+        if (i2c_master_fast_writeByte(data[i])) {
+            break;
+        }
+    }
+    return i;
+}
+
+/******************************************************************************
+ * FunctionName : i2c_master_fast_read
+ * Description  : read a block in fast mode, the last byte is nacked
+ * Parameters   : uint8 *data, uint32 len
+ * Returns      : NONE
+*******************************************************************************/
+void ICACHE_RAM_ATTR
+i2c_master_fast_read(uint8 *data, uint32 len)
+{
+    uint32 i;
+
+    for (i = 0; i < len; i++) {
+        data[i] = i2c_master_fast_readByte(i == len - 1);
+    }
+}
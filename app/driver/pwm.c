@@ -21,21 +21,22 @@
 // #define PWM_DBG os_printf
 #define PWM_DBG
 
-LOCAL struct pwm_single_param pwm_single_toggle[2][PWM_CHANNEL + 1];
-LOCAL struct pwm_single_param *pwm_single;
-
 LOCAL struct pwm_param pwm;
 
 // LOCAL uint8 pwm_out_io_num[PWM_CHANNEL] = {PWM_0_OUT_IO_NUM, PWM_1_OUT_IO_NUM, PWM_2_OUT_IO_NUM};
-LOCAL int8 pwm_out_io_num[PWM_CHANNEL] = {-1, -1, -1, -1, -1, -1};
-
-LOCAL uint8 pwm_channel_toggle[2];
-LOCAL uint8 *pwm_channel;
+LOCAL int8 pwm_out_io_num[PWM_CHANNEL] = {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1};
 
-LOCAL uint8 pwm_toggle = 1;
-LOCAL uint8 pwm_timer_down = 1;
+// Double buffered timelines. The interrupt runs pwm_active and takes the
+// other one only at a period boundary, and only when pwm_pending is set.
+// pwm_start clears pwm_pending before it writes, so the slot it writes
+// is never in use.
+LOCAL struct pwm_single_param pwm_timeline[2][PWM_CHANNEL + 1];
+LOCAL uint8 pwm_timeline_len[2];
+LOCAL volatile uint8 pwm_active = 0;
+LOCAL volatile uint8 pwm_pending = 0;
+LOCAL uint8 pwm_current = 0;               // next event of the active timeline
 
-LOCAL uint8 pwm_current_channel = 0;
+LOCAL volatile uint8 pwm_timer_down = 1;
 
 LOCAL uint16 pwm_gpio = 0;
 
@@ -63,30 +64,59 @@ typedef enum {
     TM_EDGE_INT   = 0,
 } TIMER_INT_MODE;
 
-LOCAL void ICACHE_FLASH_ATTR
-pwm_insert_sort(struct pwm_single_param pwm[], uint8 n)
+/******************************************************************************
+ * FunctionName : pwm_build_timeline
+ * Description  : precompute the events of one period. Entries are in time
+ *                order, h_time is the delay from the previous event in timer
+ *                ticks. The last entry is the period boundary: it sets all
+ *                pins that have a duty and clears those at duty 0. Channels
+ *                whose edges fall on the same tick share one entry.
+ * Parameters   : struct pwm_single_param *tl : PWM_CHANNEL + 1 entries
+ *                uint32 period : in us
+ *                uint16 *duty : each channel's duty, 0 ~ PWM_DEPTH
+ *                uint16 *mask : each channel's gpio bit
+ *                uint8 n : number of channels
+ * Returns      : uint8 : number of entries
+*******************************************************************************/
+LOCAL uint8 ICACHE_FLASH_ATTR
+pwm_build_timeline(struct pwm_single_param *tl, uint32 period, const uint16 *duty, const uint16 *mask, uint8 n)
 {
-    uint8 i;
-
-    for (i = 1; i < n; i++) {
-        if (pwm[i].h_time < pwm[i - 1].h_time) {
-            int8 j = i - 1;
-            struct pwm_single_param tmp;
-
-            os_memcpy(&tmp, &pwm[i], sizeof(struct pwm_single_param));
-            os_memcpy(&pwm[i], &pwm[i - 1], sizeof(struct pwm_single_param));
-
-            while (tmp.h_time < pwm[j].h_time) {
-                os_memcpy(&pwm[j + 1], &pwm[j], sizeof(struct pwm_single_param));
-                j--;
-                if (j < 0) {
-                	break;
-                }
-            }
-
-            os_memcpy(&pwm[j + 1], &tmp, sizeof(struct pwm_single_param));
+    uint32 end = US_TO_RTC_TIMER_TICKS(period);
+    uint32 now = 0, t;
+    uint16 set = 0, clear = 0;
+    uint8 i, j, k = 0;
+
+    for (i = 0; i < n; i++) {
+        t = US_TO_RTC_TIMER_TICKS(period * duty[i] / PWM_DEPTH);
+        if (t == 0) {
+            clear |= mask[i];
+            continue;
+        }
+        set |= mask[i];
+        if (t >= end) {
+            continue;
+        }
+        // insert the clear edge in time order, h_time holds absolute times
+        for (j = 0; j < k && tl[j].h_time < t; j++);
+        if (j < k && tl[j].h_time == t) {
+            tl[j].gpio_clear |= mask[i];
+            continue;
         }
+        os_memmove(&tl[j + 1], &tl[j], (k - j) * sizeof(struct pwm_single_param));
+        tl[j].h_time = t;
+        tl[j].gpio_set = 0;
+        tl[j].gpio_clear = mask[i];
+        k++;
     }
+    for (i = 0; i < k; i++) {
+        t = tl[i].h_time;
+        tl[i].h_time = t - now;
+        now = t;
+    }
+    tl[k].h_time = end - now;
+    tl[k].gpio_set = set;
+    tl[k].gpio_clear = clear;
+    return k + 1;
 }
 
 LOCAL volatile uint8 critical = 0;
@@ -100,94 +130,49 @@ LOCAL volatile uint8 critical = 0;
     (c) = 0;                                    \
 } while (0)
 
+/******************************************************************************
+ * FunctionName : pwm_start
+ * Description  : apply the current duties and frequency. The new timeline
+ *                takes over at the next period boundary, so no period is
+ *                cut short or stretched.
+ * Parameters   : NONE
+ * Returns      : NONE
+*******************************************************************************/
 void ICACHE_FLASH_ATTR
 pwm_start(void)
 {
-    uint8 i, j;
-    PWM_DBG("--Function pwm_start() is called\n");
-    PWM_DBG("pwm_gpio:%x,pwm_channel_num:%d\n",pwm_gpio,pwm_channel_num);
-    PWM_DBG("pwm_out_io_num[0]:%d,[1]:%d,[2]:%d\n",pwm_out_io_num[0],pwm_out_io_num[1],pwm_out_io_num[2]);
-    PWM_DBG("pwm.period:%d,pwm.duty[0]:%d,[1]:%d,[2]:%d\n",pwm.period,pwm.duty[0],pwm.duty[1],pwm.duty[2]);
+    uint16 mask[PWM_CHANNEL];
+    struct pwm_single_param *tl;
+    uint8 i, slot;
 
     LOCK_PWM(critical);   // enter critical
 
-    struct pwm_single_param *local_single = pwm_single_toggle[pwm_toggle ^ 0x01];
-    uint8 *local_channel = &pwm_channel_toggle[pwm_toggle ^ 0x01];
+    // take back a timeline that is still waiting, then the other slot is ours
+    pwm_pending = 0;
+    slot = pwm_active ^ 0x01;
+    tl = pwm_timeline[slot];
 
-    // step 1: init PWM_CHANNEL+1 channels param
     for (i = 0; i < pwm_channel_num; i++) {
-        uint32 us = pwm.period * pwm.duty[i] / PWM_DEPTH;
-        local_single[i].h_time = US_TO_RTC_TIMER_TICKS(us);
-        PWM_DBG("i:%d us:%d ht:%d\n",i,us,local_single[i].h_time);
-        local_single[i].gpio_set = 0;
-        local_single[i].gpio_clear = 1 << pin_num[pwm_out_io_num[i]];
+        mask[i] = 1 << pin_num[pwm_out_io_num[i]];
     }
+    pwm_timeline_len[slot] = pwm_build_timeline(tl, pwm.period, pwm.duty, mask, pwm_channel_num);
+    PWM_DBG("pwm_start: %d events, period:%d\n", pwm_timeline_len[slot], pwm.period);
 
-    local_single[pwm_channel_num].h_time = US_TO_RTC_TIMER_TICKS(pwm.period);
-    local_single[pwm_channel_num].gpio_set = pwm_gpio;
-    local_single[pwm_channel_num].gpio_clear = 0;
-    PWM_DBG("i:%d period:%d ht:%d\n",pwm_channel_num,pwm.period,local_single[pwm_channel_num].h_time);
-    // step 2: sort, small to big
-    pwm_insert_sort(local_single, pwm_channel_num + 1);
-
-    *local_channel = pwm_channel_num + 1;
-    PWM_DBG("1channel:%d,single[0]:%d,[1]:%d,[2]:%d,[3]:%d\n",*local_channel,local_single[0].h_time,local_single[1].h_time,local_single[2].h_time,local_single[3].h_time);
-    // step 3: combine same duty channels
-    for (i = pwm_channel_num; i > 0; i--) {
-        if (local_single[i].h_time == local_single[i - 1].h_time) {
-            local_single[i - 1].gpio_set |= local_single[i].gpio_set;
-            local_single[i - 1].gpio_clear |= local_single[i].gpio_clear;
-
-            for (j = i + 1; j < *local_channel; j++) {
-                os_memcpy(&local_single[j - 1], &local_single[j], sizeof(struct pwm_single_param));
-            }
-
-            (*local_channel)--;
-        }
-    }
-    PWM_DBG("2channel:%d,single[0]:%d,[1]:%d,[2]:%d,[3]:%d\n",*local_channel,local_single[0].h_time,local_single[1].h_time,local_single[2].h_time,local_single[3].h_time);
-    // step 4: cacl delt time
-    for (i = *local_channel - 1; i > 0; i--) {
-        local_single[i].h_time -= local_single[i - 1].h_time;
-    }
-
-    // step 5: last channel needs to clean
-    local_single[*local_channel-1].gpio_clear = 0;
-
-    // step 6: if first channel duty is 0, remove it
-    if (local_single[0].h_time == 0) {
-        local_single[*local_channel - 1].gpio_set &= ~local_single[0].gpio_clear;
-        local_single[*local_channel - 1].gpio_clear |= local_single[0].gpio_clear;
-
-        for (i = 1; i < *local_channel; i++) {
-            os_memcpy(&local_single[i - 1], &local_single[i], sizeof(struct pwm_single_param));
-        }
-
-        (*local_channel)--;
-    }
-
-    // if timer is down, need to set gpio and start timer
     if (pwm_timer_down == 1) {
-        pwm_channel = local_channel;
-        pwm_single = local_single;
-        // start
-        gpio_output_set(local_single[0].gpio_set, local_single[0].gpio_clear, pwm_gpio, 0);
+        pwm_active = slot;
+        pwm_current = 0;
+        gpio_output_set(tl[pwm_timeline_len[slot] - 1].gpio_set, tl[pwm_timeline_len[slot] - 1].gpio_clear, pwm_gpio, 0);
 
-        // yeah, if all channels' duty is 0 or 255, don't need to start timer, otherwise start...
-        if (*local_channel != 1) {
+        // if all channels' duty is 0 or full, the timer is not needed
+        if (pwm_timeline_len[slot] != 1) {
             pwm_timer_down = 0;
-            RTC_REG_WRITE(FRC1_LOAD_ADDRESS, local_single[0].h_time);
+            RTC_REG_WRITE(FRC1_LOAD_ADDRESS, tl[0].h_time);
         }
-    }
-
-    if (pwm_toggle == 1) {
-        pwm_toggle = 0;
     } else {
-        pwm_toggle = 1;
+        pwm_pending = 1;
     }
 
     UNLOCK_PWM(critical);   // leave critical
-    PWM_DBG("3channel:%d,single[0]:%d,[1]:%d,[2]:%d,[3]:%d\n",*local_channel,local_single[0].h_time,local_single[1].h_time,local_single[2].h_time,local_single[3].h_time);
 }
 
 /******************************************************************************
@@ -308,33 +293,31 @@ pwm_get_freq(uint8 channel)
 LOCAL void ICACHE_RAM_ATTR
 pwm_tim1_intr_handler(void)
 {
-    uint8 local_toggle = pwm_toggle;                        // pwm_toggle may change outside
-    RTC_CLR_REG_MASK(FRC1_INT_ADDRESS, FRC1_INT_CLR_MASK);
+    struct pwm_single_param *tl;
+    uint8 n = pwm_timeline_len[pwm_active];
 
-    if (pwm_current_channel >= (*pwm_channel - 1)) {        // *pwm_channel may change outside
-        pwm_single = pwm_single_toggle[local_toggle];
-        pwm_channel = &pwm_channel_toggle[local_toggle];
-
-        gpio_output_set(pwm_single[*pwm_channel - 1].gpio_set,
-                        pwm_single[*pwm_channel - 1].gpio_clear,
-                        pwm_gpio,
-                        0);
-
-        pwm_current_channel = 0;
+    RTC_CLR_REG_MASK(FRC1_INT_ADDRESS, FRC1_INT_CLR_MASK);
 
-        if (*pwm_channel != 1) {
-            RTC_REG_WRITE(FRC1_LOAD_ADDRESS, pwm_single[pwm_current_channel].h_time);
-        } else {
+    if (pwm_current >= n - 1) {
+        // period boundary, the only point where a new timeline is taken
+        if (pwm_pending) {
+            pwm_active ^= 0x01;
+            pwm_pending = 0;
+            n = pwm_timeline_len[pwm_active];
+        }
+        tl = pwm_timeline[pwm_active];
+        gpio_output_set(tl[n - 1].gpio_set, tl[n - 1].gpio_clear, pwm_gpio, 0);
+        pwm_current = 0;
+        if (n == 1) {
             pwm_timer_down = 1;
+            return;
         }
     } else {
-        gpio_output_set(pwm_single[pwm_current_channel].gpio_set,
-                        pwm_single[pwm_current_channel].gpio_clear,
-                        pwm_gpio, 0);
-
-        pwm_current_channel++;
-        RTC_REG_WRITE(FRC1_LOAD_ADDRESS, pwm_single[pwm_current_channel].h_time);
+        tl = pwm_timeline[pwm_active];
+        gpio_output_set(tl[pwm_current].gpio_set, tl[pwm_current].gpio_clear, pwm_gpio, 0);
+        pwm_current++;
     }
+    RTC_REG_WRITE(FRC1_LOAD_ADDRESS, tl[pwm_current].h_time);
 }
 
 /******************************************************************************
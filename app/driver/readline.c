@@ -11,24 +11,6 @@ extern UartDevice UartDev;
 
 #define uart_putc uart0_putc
 
-bool uart_getc(char *c){
-    RcvMsgBuff *pRxBuff = &(UartDev.rcv_buff);
-    if(pRxBuff->pWritePos == pRxBuff->pReadPos){   // empty
-        return false;
-    }
-    // ETS_UART_INTR_DISABLE();
-    ETS_INTR_LOCK();
-    *c = (char)*(pRxBuff->pReadPos);
-    if (pRxBuff->pReadPos == (pRxBuff->pRcvMsgBuff + RX_BUFF_SIZE)) {
-        pRxBuff->pReadPos = pRxBuff->pRcvMsgBuff ; 
-    } else {
-        pRxBuff->pReadPos++;
-    }
-    // ETS_UART_INTR_ENABLE();
-    ETS_INTR_UNLOCK();
-    return true;
-}
-
 #if 0
 int readline4lua(const char *prompt, char *buffer, int length){
     char ch;
@@ -145,6 +145,7 @@ void spi_mast_set_mosi(uint8 spi_no, uint8 offset, uint8 bitlen, uint32 data)
     if (bitlen > 32)
         return; // handle invalid input number
 
+    spi_mast_blkwait(spi_no);
     while(READ_PERI_REG(SPI_CMD(spi_no)) & SPI_USR);
 
     // determine which SPI_Wn register is addressed
@@ -200,6 +201,7 @@ uint32 spi_mast_get_miso(uint8 spi_no, uint8 offset, uint8 bitlen)
     if (spi_no > 1)
         return 0; // handle invalid input number
 
+    spi_mast_blkwait(spi_no);
     while(READ_PERI_REG(SPI_CMD(spi_no)) & SPI_USR);
 
     // determine which SPI_Wn register is addressed
@@ -255,6 +257,7 @@ void spi_mast_transaction(uint8 spi_no, uint8 cmd_bitlen, uint16 cmd_data, uint8
     if (spi_no > 1)
         return; // handle invalid input number
 
+    spi_mast_blkwait(spi_no);
     while(READ_PERI_REG(SPI_CMD(spi_no)) & SPI_USR);
 
     // default disable COMMAND, ADDR, MOSI, DUMMY, MISO, and DOUTDIN (aka full-duplex)
@@ -304,6 +307,232 @@ void spi_mast_transaction(uint8 spi_no, uint8 cmd_bitlen, uint16 cmd_data, uint8
     while(READ_PERI_REG(SPI_CMD(spi_no)) & SPI_USR);
 }
 
+/******************************************************************************
+ * Block transfers
+ *
+ * The functions below move up to 64 bytes per transaction through the whole
+ * W0..W15 buffer instead of one word per call. Bytes go out in the order
+ * given; with SPI_WR_BYTE_ORDER set the MSB of W0 is sent first.
+*******************************************************************************/
+#define SPI_BLK_SIZE 64
+
+// state of an asynchronous block write, shared with the interrupt
+static struct {
+    const uint8 *data;
+    uint32 left;
+    spi_blk_done_fn done;
+    volatile uint8 busy;
+} spi_blk[2];
+
+// pack len bytes into whole words, MSB first
+static inline void ICACHE_RAM_ATTR
+spi_blk_pack(uint32 *w, const uint8 *p, uint32 len)
+{
+    uint32 i;
+
+    for (i = 0; i + 4 <= len; i += 4, p += 4) {
+        *w++ = (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+    }
+    if (i < len) {
+        uint32 v = 0, shift = 24;
+        for (; i < len; i++, shift -= 8) {
+            v |= *p++ << shift;
+        }
+        *w = v;
+    }
+}
+
+// copy the packed words to W0.. and start sending len bytes
+static inline void ICACHE_RAM_ATTR
+spi_blk_start(uint8 spi_no, const uint32 *w, uint32 len)
+{
+    uint32 i;
+
+    for (i = 0; i < (len + 3) >> 2; i++) {
+        WRITE_PERI_REG(SPI_W0(spi_no) + i*4, w[i]);
+    }
+    WRITE_PERI_REG(SPI_USER1(spi_no), ((len*8 - 1) & SPI_USR_MOSI_BITLEN) << SPI_USR_MOSI_BITLEN_S);
+    SET_PERI_REG_MASK(SPI_CMD(spi_no), SPI_USR);
+}
+
+// set up the user mode for data phase only transactions
+static void
+spi_blk_mode(uint8 spi_no, uint32 mode)
+{
+    while(READ_PERI_REG(SPI_CMD(spi_no)) & SPI_USR);
+    CLEAR_PERI_REG_MASK(SPI_USER(spi_no), SPI_USR_COMMAND|SPI_USR_ADDR|SPI_USR_MOSI|SPI_USR_DUMMY|SPI_USR_MISO|
+                                          SPI_DOUTDIN|SPI_USR_MOSI_HIGHPART|SPI_USR_MISO_HIGHPART);
+    SET_PERI_REG_MASK(SPI_USER(spi_no), mode);
+}
+
+/******************************************************************************
+ * FunctionName : spi_mast_blkwrite
+ * Description  : Send a block of bytes in transactions of up to 64 bytes.
+ *                The next chunk is packed while the current one is on the bus.
+ * Parameters   :   uint8 spi_no - SPI module number, Only "SPI" and "HSPI" are valid
+ *                  const uint8 *data - bytes to send
+ *                  uint32 len   - number of bytes
+*******************************************************************************/
+void spi_mast_blkwrite(uint8 spi_no, const uint8 *data, uint32 len)
+{
+    uint32 w[SPI_BLK_SIZE / 4];
+    uint32 n;
+
+    if (spi_no > 1 || len == 0)
+        return; // handle invalid input number
+
+    spi_mast_blkwait(spi_no);
+    spi_blk_mode(spi_no, SPI_USR_MOSI);
+    n = len < SPI_BLK_SIZE ? len : SPI_BLK_SIZE;
+    spi_blk_pack(w, data, n);
+    while (1)
+    {
+        while(READ_PERI_REG(SPI_CMD(spi_no)) & SPI_USR);
+        spi_blk_start(spi_no, w, n);
+        data += n;
+        len  -= n;
+        if (len == 0)
+            break;
+        n = len < SPI_BLK_SIZE ? len : SPI_BLK_SIZE;
+        spi_blk_pack(w, data, n);
+    }
+    while(READ_PERI_REG(SPI_CMD(spi_no)) & SPI_USR);
+}
+
+/******************************************************************************
+ * FunctionName : spi_mast_blkread
+ * Description  : Receive a block of bytes in full-duplex transactions of up
+ *                to 64 bytes, sending fill meanwhile.
+ * Parameters   :   uint8 spi_no - SPI module number, Only "SPI" and "HSPI" are valid
+ *                  uint8 *data  - receive buffer
+ *                  uint32 len   - number of bytes
+ *                  uint8 fill   - byte sent for every byte received
+*******************************************************************************/
+void spi_mast_blkread(uint8 spi_no, uint8 *data, uint32 len, uint8 fill)
+{
+    uint32 w[SPI_BLK_SIZE / 4];
+    uint32 i, n, v;
+
+    if (spi_no > 1 || len == 0)
+        return; // handle invalid input number
+
+    spi_mast_blkwait(spi_no);
+    spi_blk_mode(spi_no, SPI_USR_MOSI|SPI_DOUTDIN);
+    v = fill * 0x01010101;
+    for (i = 0; i < SPI_BLK_SIZE / 4; i++) {
+        w[i] = v;
+    }
+    while (len > 0)
+    {
+        n = len < SPI_BLK_SIZE ? len : SPI_BLK_SIZE;
+        spi_blk_start(spi_no, w, n);
+        while(READ_PERI_REG(SPI_CMD(spi_no)) & SPI_USR);
+        for (i = 0; i < n; i++) {
+            if ((i & 3) == 0) {
+                v = READ_PERI_REG(SPI_W0(spi_no) + i);
+            }
+            *data++ = v >> 24;
+            v <<= 8;
+        }
+        len -= n;
+    }
+}
+
+/******************************************************************************
+ * FunctionName : spi_mast_blk_isr
+ * Description  : Transaction done interrupt of spi_mast_blkwrite_async, loads
+ *                the next chunk or reports completion.
+ * Parameters   : void *arg - not used
+*******************************************************************************/
+static void ICACHE_RAM_ATTR
+spi_mast_blk_isr(void *arg)
+{
+    uint32 w[SPI_BLK_SIZE / 4];
+    uint32 n;
+    spi_blk_done_fn done;
+
+    if (!(READ_PERI_REG(SPI_SLAVE(HSPI)) & SPI_TRANS_DONE))
+        return;
+    CLEAR_PERI_REG_MASK(SPI_SLAVE(HSPI), SPI_TRANS_DONE);
+
+    if (spi_blk[HSPI].left > 0)
+    {
+        n = spi_blk[HSPI].left < SPI_BLK_SIZE ? spi_blk[HSPI].left : SPI_BLK_SIZE;
+        spi_blk_pack(w, spi_blk[HSPI].data, n);
+        spi_blk[HSPI].data += n;
+        spi_blk[HSPI].left -= n;
+        spi_blk_start(HSPI, w, n);
+        return;
+    }
+    CLEAR_PERI_REG_MASK(SPI_SLAVE(HSPI), SPI_TRANS_DONE_EN);
+    done = spi_blk[HSPI].done;
+    spi_blk[HSPI].data = NULL;
+    spi_blk[HSPI].busy = 0;
+    if (done)
+        done(HSPI);
+}
+
+/******************************************************************************
+ * FunctionName : spi_mast_blkwrite_async
+ * Description  : Like spi_mast_blkwrite but returns at once. Each following
+ *                chunk is loaded from the transaction done interrupt, done is
+ *                called from the interrupt after the last one. data must stay
+ *                valid until then. Only HSPI is supported, SPI is the flash.
+ * Parameters   :   uint8 spi_no - SPI module number, only "HSPI" is valid
+ *                  const uint8 *data - bytes to send
+ *                  uint32 len   - number of bytes
+ *                  spi_blk_done_fn done - completion callback
+ * Returns      : bool - false if spi_no is not HSPI
+*******************************************************************************/
+bool spi_mast_blkwrite_async(uint8 spi_no, const uint8 *data, uint32 len, spi_blk_done_fn done)
+{
+    uint32 w[SPI_BLK_SIZE / 4];
+    uint32 n;
+
+    if (spi_no != HSPI)
+        return false;
+
+    spi_mast_blkwait(spi_no);
+    spi_blk_mode(spi_no, SPI_USR_MOSI);
+    n = len < SPI_BLK_SIZE ? len : SPI_BLK_SIZE;
+    spi_blk_pack(w, data, n);
+    spi_blk[spi_no].data = data + n;
+    spi_blk[spi_no].left = len - n;
+    spi_blk[spi_no].done = done;
+    spi_blk[spi_no].busy = 1;
+
+    ETS_SPI_INTR_ATTACH(spi_mast_blk_isr, NULL);
+    CLEAR_PERI_REG_MASK(SPI_SLAVE(spi_no), SPI_TRANS_DONE);
+    SET_PERI_REG_MASK(SPI_SLAVE(spi_no), SPI_TRANS_DONE_EN);
+    ETS_SPI_INTR_ENABLE();
+    spi_blk_start(spi_no, w, n);
+    return true;
+}
+
+/******************************************************************************
+ * FunctionName : spi_mast_blkwait
+ * Description  : Wait until an asynchronous block write has finished.
+ * Parameters   :   uint8 spi_no - SPI module number, Only "SPI" and "HSPI" are valid
+*******************************************************************************/
+void spi_mast_blkwait(uint8 spi_no)
+{
+    if (spi_no > 1)
+        return; // handle invalid input number
+
+    while (spi_blk[spi_no].busy);
+}
+
+/******************************************************************************
+ * FunctionName : spi_mast_blkbusy
+ * Description  : Check for an asynchronous block write in progress.
+ * Parameters   :   uint8 spi_no - SPI module number, Only "SPI" and "HSPI" are valid
+ * Returns      : bool
+*******************************************************************************/
+bool spi_mast_blkbusy(uint8 spi_no)
+{
+    return spi_no <= 1 && spi_blk[spi_no].busy;
+}
+
 
 /******************************************************************************
  * FunctionName : spi_byte_write_espslave
@@ -29,10 +29,39 @@
 // For event signalling
 static uint8 task = USER_TASK_PRIO_MAX;
 static os_signal_t sig;
+static os_signal_t sig_sent;
 
 // UartDev is defined and initialized in rom code.
 extern UartDevice UartDev;
 
+// UART0 receive ring. The interrupt handler only moves rx_head and the
+// task only moves rx_tail, one slot always stays free. Without a ring the
+// bytes wait in the rx fifo and the task reads them from there.
+static uint8 *rx_buf;
+static uint16 rx_size;
+static volatile uint16 rx_head, rx_tail;
+static volatile uint32 rx_overflow;
+static volatile bool rx_posted;
+// wake the task at this many bytes or on the terminator; always when
+// the line goes idle or the ring is full
+static uint16 rx_threshold = 1;
+static sint16 rx_terminator = -1;
+
+// UART0 transmit ring. The task only moves tx_head and whoever drains it,
+// the interrupt handler or the task with the interrupt masked, only moves
+// tx_tail. Without a ring the task writes the fifo itself.
+static uint8 *tx_buf;
+static uint16 tx_size;
+static volatile uint16 tx_head, tx_tail;
+// post sig_sent once the ring and the fifo have run empty
+static volatile bool tx_notify;
+
+#define RX_FIFO_COUNT() ((READ_PERI_REG(UART_STATUS(UART0)) >> UART_RXFIFO_CNT_S) & UART_RXFIFO_CNT)
+#define TX_FIFO_COUNT() ((READ_PERI_REG(UART_STATUS(UART0)) >> UART_TXFIFO_CNT_S) & UART_TXFIFO_CNT)
+#define TX_FIFO_THRESHOLD(n) WRITE_PERI_REG(UART_CONF1(UART0), \
+    (READ_PERI_REG(UART_CONF1(UART0)) & ~(UART_TXFIFO_EMPTY_THRHD << UART_TXFIFO_EMPTY_THRHD_S)) \
+    | (((n) & UART_TXFIFO_EMPTY_THRHD) << UART_TXFIFO_EMPTY_THRHD_S))
+
 LOCAL void ICACHE_RAM_ATTR
 uart0_rx_intr_handler(void *para);
 
@@ -50,8 +79,7 @@ uart_config(uint8 uart_no)
     if (uart_no == UART1) {
         PIN_FUNC_SELECT(PERIPHS_IO_MUX_GPIO2_U, FUNC_U1TXD_BK);
     } else {
-        /* rcv_buff size if 0x100 */
-        ETS_UART_INTR_ATTACH(uart0_rx_intr_handler,  &(UartDev.rcv_buff));
+        ETS_UART_INTR_ATTACH(uart0_rx_intr_handler, NULL);
         PIN_PULLUP_DIS(PERIPHS_IO_MUX_U0TXD_U);
         PIN_FUNC_SELECT(PERIPHS_IO_MUX_U0TXD_U, FUNC_U0TXD);
         PIN_PULLUP_EN(PERIPHS_IO_MUX_U0RXD_U);
@@ -70,13 +98,17 @@ uart_config(uint8 uart_no)
     SET_PERI_REG_MASK(UART_CONF0(uart_no), UART_RXFIFO_RST | UART_TXFIFO_RST);
     CLEAR_PERI_REG_MASK(UART_CONF0(uart_no), UART_RXFIFO_RST | UART_TXFIFO_RST);
 
-    //set rx fifo trigger
-    WRITE_PERI_REG(UART_CONF1(uart_no), (UartDev.rcv_buff.TrigLvl & UART_RXFIFO_FULL_THRHD) << UART_RXFIFO_FULL_THRHD_S);
+    //set rx fifo trigger, and the idle time after which a partly filled fifo interrupts
+    //set the tx fifo level below which the ring refills it
+    WRITE_PERI_REG(UART_CONF1(uart_no), ((RX_FIFO_TRIG & UART_RXFIFO_FULL_THRHD) << UART_RXFIFO_FULL_THRHD_S)
+                   | ((RX_FIFO_TOUT & UART_RX_TOUT_THRHD) << UART_RX_TOUT_THRHD_S)
+                   | UART_RX_TOUT_EN
+                   | ((TX_FIFO_EMPTY & UART_TXFIFO_EMPTY_THRHD) << UART_TXFIFO_EMPTY_THRHD_S));
 
     //clear all interrupt
     WRITE_PERI_REG(UART_INT_CLR(uart_no), 0xffff);
-    //enable rx_interrupt
-    SET_PERI_REG_MASK(UART_INT_ENA(uart_no), UART_RXFIFO_FULL_INT_ENA);
+    //enable rx_interrupt, tx_interrupt is enabled while there is something to send
+    SET_PERI_REG_MASK(UART_INT_ENA(uart_no), UART_RXFIFO_FULL_INT_ENA | UART_RXFIFO_TOUT_INT_ENA | UART_RXFIFO_OVF_INT_ENA);
 }
 
 
@@ -122,6 +154,9 @@ uart0_alt(uint8 on)
 STATUS ICACHE_FLASH_ATTR
 uart_tx_one_char(uint8 uart, uint8 TxChar)
 {
+    if (uart == UART0 && tx_buf)
+        return uart_tx_write((const char *)&TxChar, 1, true) == 1 ? OK : FAIL;
+
     while (true)
     {
       uint32 fifo_cnt = READ_PERI_REG(UART_STATUS(uart)) & (UART_TXFIFO_CNT<<UART_TXFIFO_CNT_S);
@@ -168,12 +203,7 @@ uart1_write_char(char c)
 void ICACHE_FLASH_ATTR
 uart0_tx_buffer(uint8 *buf, uint16 len)
 {
-  uint16 i;
-
-  for (i = 0; i < len; i++)
-  {
-    uart_tx_one_char(UART0, buf[i]);
-  }
+  uart_tx_write((const char *)buf, len, true);
 }
 
 /******************************************************************************
@@ -185,10 +215,17 @@ uart0_tx_buffer(uint8 *buf, uint16 len)
 *******************************************************************************/
 void ICACHE_FLASH_ATTR uart0_sendStr(const char *str)
 {
+    const char *p;
+
     while(*str)
     {
-        // uart_tx_one_char(UART0, *str++);
-        uart0_putc(*str++);
+        // runs without line ends go to the ring in one piece
+        for (p = str; *p && *p != '\n' && *p != '\r'; p++)
+            ;
+        uart_tx_write(str, p - str, true);
+        if (*p)
+            uart0_putc(*p++);
+        str = p;
     }
 }
 
@@ -202,22 +239,45 @@ void ICACHE_FLASH_ATTR uart0_putc(const char c)
 {
   if (c == '\n')
   {
-    uart_tx_one_char(UART0, '\r');
-    uart_tx_one_char(UART0, '\n');
+    uart_tx_write("\r\n", 2, true);
   }
   else if (c == '\r')
   {
   }
   else
   {
-    uart_tx_one_char(UART0, c);
+    uart_tx_write(&c, 1, true);
   }
 }
 
+/******************************************************************************
+ * FunctionName : uart0_tx_fill
+ * Description  : Internal used function
+ *                moves the transmit ring into the tx fifo as far as it goes.
+ *                Called by the interrupt handler, or by the task with the
+ *                uart interrupt masked
+ * Parameters   : NONE
+ * Returns      : NONE
+*******************************************************************************/
+LOCAL void ICACHE_RAM_ATTR
+uart0_tx_fill(void)
+{
+    uint16 head = tx_head, tail = tx_tail;
+    uint16 room = UART_TX_FIFO_SIZE - 1 - TX_FIFO_COUNT();
+
+    while (tail != head && room > 0) {
+        WRITE_PERI_REG(UART_FIFO(UART0), tx_buf[tail]);
+        tail = tail + 1 == tx_size ? 0 : tail + 1;
+        room--;
+    }
+    tx_tail = tail;
+}
+
 /******************************************************************************
  * FunctionName : uart0_rx_intr_handler
  * Description  : Internal used function
- *                UART0 interrupt handler, add self handle code inside
+ *                UART0 interrupt handler, moves the rx fifo into the receive
+ *                ring and the transmit ring into the tx fifo
  * Parameters   : void *para - point to ETS_UART_INTR_ATTACH's arg
  * Returns      : NONE
 *******************************************************************************/
@@ -227,48 +287,344 @@ uart0_rx_intr_handler(void *para)
     /* uart0 and uart1 intr combine togther, when interrupt occur, see reg 0x3ff20020, bit2, bit0 represents
      * uart1 and uart0 respectively
      */
-    RcvMsgBuff *pRxBuff = (RcvMsgBuff *)para;
+    uint32 status = READ_PERI_REG(UART_INT_ST(UART0));
+    uint16 head = rx_head, next, count;
     uint8 RcvChar;
-    bool got_input = false;
+    bool wake = false;
+
+    if (status & UART_TXFIFO_EMPTY_INT_ST) {
+        uart0_tx_fill();
+        if (tx_tail == tx_head) {
+            if (tx_notify && TX_FIFO_COUNT() > 0) {
+                // the ring is out, wait for the fifo to follow
+                TX_FIFO_THRESHOLD(1);
+            } else {
+                CLEAR_PERI_REG_MASK(UART_INT_ENA(UART0), UART_TXFIFO_EMPTY_INT_ENA);
+                if (tx_notify && task != USER_TASK_PRIO_MAX)
+                    tx_notify = !system_os_post(task, sig_sent, UART0);
+            }
+        }
+        WRITE_PERI_REG(UART_INT_CLR(UART0), UART_TXFIFO_EMPTY_INT_CLR);
+    }
 
-    if (UART_RXFIFO_FULL_INT_ST != (READ_PERI_REG(UART_INT_ST(UART0)) & UART_RXFIFO_FULL_INT_ST)) {
+    if (!(status & (UART_RXFIFO_FULL_INT_ST | UART_RXFIFO_TOUT_INT_ST | UART_RXFIFO_OVF_INT_ST))) {
         return;
     }
 
-    WRITE_PERI_REG(UART_INT_CLR(UART0), UART_RXFIFO_FULL_INT_CLR);
+    if (!rx_buf) {
+        // the bytes stay in the fifo, quiet until the task has read them
+        if (status & UART_RXFIFO_OVF_INT_ST)
+            rx_overflow++;
+        CLEAR_PERI_REG_MASK(UART_INT_ENA(UART0), UART_RXFIFO_FULL_INT_ENA | UART_RXFIFO_TOUT_INT_ENA);
+        WRITE_PERI_REG(UART_INT_CLR(UART0), UART_RXFIFO_FULL_INT_CLR | UART_RXFIFO_TOUT_INT_CLR | UART_RXFIFO_OVF_INT_CLR);
+        if (!rx_posted && task != USER_TASK_PRIO_MAX)
+            rx_posted = system_os_post(task, sig, UART0);
+        return;
+    }
 
     while (READ_PERI_REG(UART_STATUS(UART0)) & (UART_RXFIFO_CNT << UART_RXFIFO_CNT_S)) {
         RcvChar = READ_PERI_REG(UART_FIFO(UART0)) & 0xFF;
 
-        /* you can add your handle code below.*/
+        next = head + 1 == rx_size ? 0 : head + 1;
+        if (next == rx_tail) {
+            // the ring is full, new bytes are lost
+            rx_overflow++;
+            continue;
+        }
+        rx_buf[head] = RcvChar;
+        head = next;
+        if (RcvChar == rx_terminator)
+            wake = true;
+    }
+    rx_head = head;
+
+    // the hardware fifo overflowed before it could be drained
+    if (status & UART_RXFIFO_OVF_INT_ST)
+        rx_overflow++;
+    WRITE_PERI_REG(UART_INT_CLR(UART0), UART_RXFIFO_FULL_INT_CLR | UART_RXFIFO_TOUT_INT_CLR | UART_RXFIFO_OVF_INT_CLR);
+
+    count = head >= rx_tail ? head - rx_tail : head + rx_size - rx_tail;
+    if ((status & UART_RXFIFO_TOUT_INT_ST) || count >= rx_threshold || count == rx_size - 1)
+        wake = true;
+    if (wake && count > 0 && !rx_posted && task != USER_TASK_PRIO_MAX)
+        rx_posted = system_os_post(task, sig, UART0);
+}
 
-        *(pRxBuff->pWritePos) = RcvChar;
+/******************************************************************************
+ * FunctionName : uart_rx_setup
+ * Description  : replace the receive ring, keeping what it holds
+ * Parameters   : uint16 size - bytes the ring holds, at most 0xFFFE
+ * Returns      : false if there is not enough memory
+*******************************************************************************/
+bool ICACHE_FLASH_ATTR
+uart_rx_setup(uint16 size)
+{
+    uint8 *buf = (uint8 *)os_malloc(size + 1);
+    uint8 *old = rx_buf;
+    uint16 n = 0;
 
-        // insert here for get one command line from uart
-        if (RcvChar == '\r' || RcvChar == '\n' ) {
-            pRxBuff->BuffState = WRITE_OVER;
-        }
-        
-        if (pRxBuff->pWritePos == (pRxBuff->pRcvMsgBuff + RX_BUFF_SIZE)) {
-            // overflow ...we may need more error handle here.
-            pRxBuff->pWritePos = pRxBuff->pRcvMsgBuff ;
-        } else {
-            pRxBuff->pWritePos++;
-        }
+    if (!buf)
+        return false;
+    ETS_UART_INTR_DISABLE();
+    while (rx_buf && rx_tail != rx_head && n < size) {
+        buf[n++] = rx_buf[rx_tail];
+        rx_tail = rx_tail + 1 == rx_size ? 0 : rx_tail + 1;
+    }
+    rx_buf = buf;
+    rx_size = size + 1;
+    rx_tail = 0;
+    rx_head = n;
+    if (rx_threshold > size || rx_threshold == 0)   // 0 without a ring
+        rx_threshold = size;
+    // the handler moves what waits in the fifo into the ring
+    SET_PERI_REG_MASK(UART_INT_ENA(UART0), UART_RXFIFO_FULL_INT_ENA | UART_RXFIFO_TOUT_INT_ENA);
+    ETS_UART_INTR_ENABLE();
+    if (old)
+        os_free(old);
+    return true;
+}
 
-        if (pRxBuff->pWritePos == pRxBuff->pReadPos){   // overflow one byte, need push pReadPos one byte ahead
-            if (pRxBuff->pReadPos == (pRxBuff->pRcvMsgBuff + RX_BUFF_SIZE)) {
-                pRxBuff->pReadPos = pRxBuff->pRcvMsgBuff ; 
-            } else {
-                pRxBuff->pReadPos++;
-            }
-        }
+// bytes the ring holds
+uint16 ICACHE_FLASH_ATTR
+uart_rx_size(void)
+{
+    return rx_buf ? rx_size - 1 : UART_RX_FIFO_SIZE;
+}
+
+// bytes waiting in the ring
+uint16 ICACHE_FLASH_ATTR
+uart_rx_count(void)
+{
+    uint16 head = rx_head;
 
-        got_input = true;
+    if (!rx_buf)
+        return RX_FIFO_COUNT();
+    return head >= rx_tail ? head - rx_tail : head + rx_size - rx_tail;
+}
+
+// bytes up to and including the first c, 0 if c has not arrived. The fifo
+// cannot be looked into, all it holds is handed on.
+uint16 ICACHE_FLASH_ATTR
+uart_rx_find(uint8 c)
+{
+    uint16 head = rx_head, i = rx_tail, n = 0;
+
+    if (!rx_buf)
+        return RX_FIFO_COUNT();
+    while (i != head) {
+        n++;
+        if (rx_buf[i] == c)
+            return n;
+        i = i + 1 == rx_size ? 0 : i + 1;
     }
+    return 0;
+}
 
-    if (got_input && task != USER_TASK_PRIO_MAX)
-      system_os_post (task, sig, UART0);
+// takes up to len bytes out of the ring
+uint16 ICACHE_FLASH_ATTR
+uart_rx_read(char *buf, uint16 len)
+{
+    uint16 head = rx_head, tail = rx_tail, n = 0, run;
+
+    if (!rx_buf) {
+        while (n < len && RX_FIFO_COUNT() > 0)
+            buf[n++] = READ_PERI_REG(UART_FIFO(UART0)) & 0xFF;
+        ETS_UART_INTR_DISABLE();
+        SET_PERI_REG_MASK(UART_INT_ENA(UART0), UART_RXFIFO_FULL_INT_ENA | UART_RXFIFO_TOUT_INT_ENA);
+        ETS_UART_INTR_ENABLE();
+        return n;
+    }
+    while (n < len && tail != head) {
+        run = (head > tail ? head : rx_size) - tail;
+        if (run > len - n)
+            run = len - n;
+        os_memcpy(buf + n, rx_buf + tail, run);
+        n += run;
+        tail += run;
+        if (tail == rx_size)
+            tail = 0;
+    }
+    rx_tail = tail;
+    return n;
+}
+
+bool ICACHE_FLASH_ATTR
+uart_getc(char *c)
+{
+    return uart_rx_read(c, 1) == 1;
+}
+
+/******************************************************************************
+ * FunctionName : uart_rx_trigger
+ * Description  : when the interrupt handler signals the task
+ * Parameters   : uint16 threshold - bytes in the ring that wake the task
+ *                sint16 terminator - byte that wakes the task, -1 for none
+ * Returns      : NONE
+*******************************************************************************/
+void ICACHE_FLASH_ATTR
+uart_rx_trigger(uint16 threshold, sint16 terminator)
+{
+    rx_threshold = threshold > 0 && threshold < rx_size ? threshold : rx_size - 1;
+    rx_terminator = terminator;
+}
+
+// Called from the task on the input signal: bytes arriving from now on
+// post it again
+void ICACHE_FLASH_ATTR
+uart_rx_ack(void)
+{
+    rx_posted = false;
+}
+
+// posts the input signal for bytes a task run left in the ring
+void ICACHE_FLASH_ATTR
+uart_rx_wake(void)
+{
+    if (!rx_posted && task != USER_TASK_PRIO_MAX)
+        rx_posted = system_os_post(task, sig, UART0);
+}
+
+// bytes lost because the ring or the fifo was full
+uint32 ICACHE_FLASH_ATTR
+uart_rx_overflow(bool reset)
+{
+    uint32 n = rx_overflow;
+    if (reset) {
+        ETS_UART_INTR_DISABLE();
+        rx_overflow -= n;
+        ETS_UART_INTR_ENABLE();
+    }
+    return n;
+}
+
+// Lets the handler refill the fifo from what the task queued
+LOCAL void ICACHE_FLASH_ATTR
+uart0_tx_kick(void)
+{
+    ETS_UART_INTR_DISABLE();
+    TX_FIFO_THRESHOLD(TX_FIFO_EMPTY);
+    SET_PERI_REG_MASK(UART_INT_ENA(UART0), UART_TXFIFO_EMPTY_INT_ENA);
+    ETS_UART_INTR_ENABLE();
+}
+
+// Drains the ring by polling, which works with interrupts off as well
+LOCAL void ICACHE_FLASH_ATTR
+uart0_tx_poll(void)
+{
+    ETS_UART_INTR_DISABLE();
+    uart0_tx_fill();
+    ETS_UART_INTR_ENABLE();
+}
+
+/******************************************************************************
+ * FunctionName : uart_tx_setup
+ * Description  : replace the transmit ring once what it holds has gone out
+ * Parameters   : uint16 size - bytes the ring holds, at most 0xFFFE; 0 to
+ *                write the fifo directly
+ * Returns      : false if there is not enough memory
+*******************************************************************************/
+bool ICACHE_FLASH_ATTR
+uart_tx_setup(uint16 size)
+{
+    uint8 *buf = NULL, *old = tx_buf;
+
+    if (size > 0 && !(buf = (uint8 *)os_malloc(size + 1)))
+        return false;
+    uart_tx_flush();
+    ETS_UART_INTR_DISABLE();
+    tx_buf = buf;
+    tx_size = size + 1;
+    tx_head = tx_tail = 0;
+    ETS_UART_INTR_ENABLE();
+    if (old)
+        os_free(old);
+    return true;
+}
+
+// bytes the ring holds
+uint16 ICACHE_FLASH_ATTR
+uart_tx_size(void)
+{
+    return tx_size - 1;
+}
+
+// bytes that can be queued without waiting
+uint16 ICACHE_FLASH_ATTR
+uart_tx_free(void)
+{
+    uint16 tail = tx_tail;
+    return tail > tx_head ? tail - tx_head - 1 : tail + tx_size - tx_head - 1;
+}
+
+/******************************************************************************
+ * FunctionName : uart_tx_write
+ * Description  : queue bytes for UART0, without line end translation
+ * Parameters   : const char *buf - bytes to send
+ *                uint16 len - how many
+ *                bool block - wait for room rather than stop at a full ring
+ * Returns      : the number of bytes queued
+*******************************************************************************/
+uint16 ICACHE_FLASH_ATTR
+uart_tx_write(const char *buf, uint16 len, bool block)
+{
+    uint16 head = tx_head, tail, n = 0, run;
+
+    if (!tx_buf) {
+        for (n = 0; n < len; n++)
+            uart_tx_one_char(UART0, buf[n]);
+        return n;
+    }
+
+    while (n < len) {
+        tail = tx_tail;
+        if (tail > head)
+            run = tail - head - 1;
+        else
+            run = tx_size - head - (tail == 0 ? 1 : 0);
+        if (run == 0) {
+            if (!block)
+                break;
+            tx_head = head;
+            uart0_tx_poll();
+            continue;
+        }
+        if (run > len - n)
+            run = len - n;
+        os_memcpy(tx_buf + head, buf + n, run);
+        n += run;
+        head += run;
+        if (head == tx_size)
+            head = 0;
+    }
+    tx_head = head;
+    if (n > 0)
+        uart0_tx_kick();
+    return n;
+}
+
+// blocks until the ring and the fifo are empty
+void ICACHE_FLASH_ATTR
+uart_tx_flush(void)
+{
+    while (tx_buf && tx_tail != tx_head)
+        uart0_tx_poll();
+    while (TX_FIFO_COUNT() > 0)
+        ;
+}
+
+// true while the ring and the fifo are empty
+bool ICACHE_FLASH_ATTR
+uart_tx_idle(void)
+{
+    return (!tx_buf || tx_tail == tx_head) && TX_FIFO_COUNT() == 0;
+}
+
+// posts the sent signal once everything queued so far has gone out
+void ICACHE_FLASH_ATTR
+uart_tx_notify(void)
+{
+    tx_notify = true;
+    uart0_tx_kick();
 }
 
 /******************************************************************************
@@ -277,14 +633,20 @@ uart0_rx_intr_handler(void *para)
  * Parameters   : UartBautRate uart0_br - uart0 bautrate
  *                UartBautRate uart1_br - uart1 bautrate
  *                uint8        task_prio - task priority to signal on input
- *                os_signal_t  sig_input - signal to post
+ *                os_signal_t  sig_input - signal to post on input
+ *                os_signal_t  sig_output - signal to post once output is sent
  * Returns      : NONE
 *******************************************************************************/
 void ICACHE_FLASH_ATTR
-uart_init(UartBautRate uart0_br, UartBautRate uart1_br, uint8 task_prio, os_signal_t sig_input)
+uart_init(UartBautRate uart0_br, UartBautRate uart1_br, uint8 task_prio, os_signal_t sig_input, os_signal_t sig_output)
 {
     task = task_prio;
     sig = sig_input;
+    sig_sent = sig_output;
+    rx_buf = (uint8 *)os_malloc(RX_BUFF_SIZE + 1);
+    rx_size = rx_buf ? RX_BUFF_SIZE + 1 : 1;
+    tx_buf = (uint8 *)os_malloc(TX_BUFF_SIZE + 1);
+    tx_size = tx_buf ? TX_BUFF_SIZE + 1 : 1;
 
     // rom use 74880 baut_rate, here reinitialize
     UartDev.baut_rate = uart0_br;
@@ -302,6 +664,9 @@ uart_init(UartBautRate uart0_br, UartBautRate uart1_br, uint8 task_prio, os_sign
 void ICACHE_FLASH_ATTR
 uart_setup(uint8 uart_no)
 {
+    // pending output goes out with the old settings
+    if (uart_no == UART0)
+        uart_tx_flush();
     ETS_UART_INTR_DISABLE();
     uart_config(uart_no);
     ETS_UART_INTR_ENABLE();
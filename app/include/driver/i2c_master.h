@@ -71,4 +71,12 @@ void i2c_master_send_nack(void);
 uint8 i2c_master_get_pinSDA();
 uint8 i2c_master_get_pinSCL();
 
+uint32 i2c_master_fast_setup(uint32 speed);
+void i2c_master_fast_start(void);
+void i2c_master_fast_stop(void);
+uint8 i2c_master_fast_writeByte(uint8 wrdata);
+uint8 i2c_master_fast_readByte(uint8 level);
+uint32 i2c_master_fast_write(const uint8 *data, uint32 len);
+void i2c_master_fast_read(uint8 *data, uint32 len);
+
 #endif
@@ -27,6 +27,15 @@ uint32 spi_get_miso(uint8 spi_no, uint8 offset, uint8 bitlen);
 void spi_mast_transaction(uint8 spi_no, uint8 cmd_bitlen, uint16 cmd_data, uint8 addr_bitlen, uint32 addr_data,
                           uint16 mosi_bitlen, uint8 dummy_bitlen, sint16 miso_bitlen);
 
+// block transfers of up to 64 bytes per transaction
+typedef void (*spi_blk_done_fn)(uint8 spi_no);
+void spi_mast_blkwrite(uint8 spi_no, const uint8 *data, uint32 len);
+void spi_mast_blkread(uint8 spi_no, uint8 *data, uint32 len, uint8 fill);
+// done is called from the interrupt, HSPI only
+bool spi_mast_blkwrite_async(uint8 spi_no, const uint8 *data, uint32 len, spi_blk_done_fn done);
+void spi_mast_blkwait(uint8 spi_no);
+bool spi_mast_blkbusy(uint8 spi_no);
+
 //transmit data to esp8266 slave buffer,which needs 16bit transmission ,
 //first byte is master command 0x04, second byte is master data
 void spi_byte_write_espslave(uint8 spi_no,uint8 data);
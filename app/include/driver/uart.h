@@ -6,8 +6,13 @@
 #include "c_types.h"
 #include "os_type.h"
 
-#define RX_BUFF_SIZE    0x100
-#define TX_BUFF_SIZE    100
+#define RX_BUFF_SIZE    0x100   // default size of the UART0 receive ring
+#define RX_FIFO_TRIG    64      // interrupt when the rx fifo holds this many bytes,
+#define RX_FIFO_TOUT    2       // or after this many idle byte times
+#define TX_BUFF_SIZE    0x100   // default size of the UART0 transmit ring
+#define TX_FIFO_EMPTY   16      // refill the tx fifo when it holds fewer bytes
+#define UART_TX_FIFO_SIZE 128
+#define UART_RX_FIFO_SIZE 128
 
 typedef enum {
     FIVE_BITS = 0x0,
@@ -101,12 +106,31 @@ typedef struct {
     int                      buff_uart_no;  //indicate which uart use tx/rx buffer
 } UartDevice;
 
-void uart_init(UartBautRate uart0_br, UartBautRate uart1_br, uint8 task_prio, os_signal_t sig_input);
+void uart_init(UartBautRate uart0_br, UartBautRate uart1_br, uint8 task_prio, os_signal_t sig_input, os_signal_t sig_output);
 void uart0_alt(uint8 on);
 void uart0_sendStr(const char *str);
 void uart0_putc(const char c);
 void uart0_tx_buffer(uint8 *buf, uint16 len);
 void uart_setup(uint8 uart_no);
 STATUS uart_tx_one_char(uint8 uart, uint8 TxChar);
+
+bool uart_rx_setup(uint16 size);
+uint16 uart_rx_size(void);
+uint16 uart_rx_count(void);
+uint16 uart_rx_find(uint8 c);
+uint16 uart_rx_read(char *buf, uint16 len);
+bool uart_getc(char *c);
+void uart_rx_trigger(uint16 threshold, sint16 terminator);
+void uart_rx_ack(void);
+void uart_rx_wake(void);
+uint32 uart_rx_overflow(bool reset);
+
+bool uart_tx_setup(uint16 size);
+uint16 uart_tx_size(void);
+uint16 uart_tx_free(void);
+uint16 uart_tx_write(const char *buf, uint16 len, bool block);
+void uart_tx_flush(void);
+bool uart_tx_idle(void);
+void uart_tx_notify(void);
 #endif
 
@@ -94,6 +94,10 @@ typedef struct _remot_info{
 /** A callback prototype to inform about events for a espconn */
 typedef void (* espconn_recv_callback)(void *arg, char *pdata, unsigned short len);
 typedef void (* espconn_sent_callback)(void *arg);
+/** A callback prototype to hand a received TCP pbuf chain to the application.
+ *  The callee owns p and must release it with pbuf_free(). */
+struct pbuf;
+typedef void (* espconn_recv_pbuf_callback)(void *arg, struct pbuf *p);
 
 /** A espconn descriptor */
 struct espconn {
@@ -110,6 +114,8 @@ struct espconn {
 	espconn_sent_callback sent_callback;
 	uint8 link_cnt;
 	void *reverse;
+	/** Zero-copy TCP receive, takes precedence over recv_callback if set */
+	espconn_recv_pbuf_callback recv_pbuf_callback;
 };
 
 enum espconn_option{
@@ -480,6 +486,30 @@ extern sint8 espconn_regist_connectcb(struct espconn *espconn, espconn_connect_c
 
 extern sint8 espconn_regist_recvcb(struct espconn *espconn, espconn_recv_callback recv_cb);
 
+/******************************************************************************
+ * FunctionName : espconn_regist_recvpbufcb
+ * Description  : used to specify the function that should be called with the
+ * 				  raw pbuf chain when recv data from host over plain TCP. The
+ * 				  pbuf is not copied; the callback must pbuf_free() it.
+ * Parameters   : espconn -- espconn to set the recv callback
+ * 				  recv_cb -- recv callback function, NULL to use recv_callback
+ * Returns      : none
+*******************************************************************************/
+
+extern sint8 espconn_regist_recvpbufcb(struct espconn *espconn, espconn_recv_pbuf_callback recv_cb);
+
+/******************************************************************************
+ * FunctionName : espconn_recved
+ * Description  : acknowledge data handed to the recv pbuf callback once it has
+ * 				  been released, reopening the TCP receive window by len bytes.
+ * 				  Does nothing if the connection has gone in the meantime.
+ * Parameters   : espconn -- the espconn the data was received on
+ * 				  len -- the number of bytes released
+ * Returns      : none
+*******************************************************************************/
+
+extern void espconn_recved(struct espconn *espconn, uint16 len);
+
 /******************************************************************************
  * FunctionName : espconn_regist_reconcb
  * Description  : used to specify the function that should be called when connection 
@@ -50,10 +50,14 @@
  * letting the build system detect automatically (via nm) which modules need
  * to be linked in.
  */
+/* Each ROM table entry goes into its own .lua_rotable.<luaname> section,
+ * which the linker script sorts by name. This keeps the lua_rotable array
+ * ordered so that global lookups can use a binary search.
+ */
 #define NODEMCU_MODULE(cfgname, luaname, map, initfunc) \
   const LOCK_IN_SECTION(".lua_libs") \
     luaL_Reg MODULE_PASTE_(lua_lib_,cfgname) = { luaname, initfunc }; \
-  const LOCK_IN_SECTION(".lua_rotable") \
+  const LOCK_IN_SECTION(".lua_rotable." luaname) \
     luaR_table MODULE_EXPAND_PASTE_(cfgname,MODULE_EXPAND_PASTE_(_module_selected,MODULE_PASTE_(LUA_USE_MODULES_,cfgname))) \
     = { luaname, map }
 
@@ -64,7 +68,7 @@
     luaL_Reg MODULE_PASTE_(lua_lib_,name) = { luaname, initfunc }
 
 #define BUILTIN_LIB(name, luaname, map) \
-  const LOCK_IN_SECTION(".lua_rotable") \
+  const LOCK_IN_SECTION(".lua_rotable." luaname) \
     luaR_table MODULE_PASTE_(lua_rotable_,name) = { luaname, map }
 
 #if !(MIN_OPT_LEVEL==2 && LUA_OPTIMIZE_MEMORY==2)
@@ -29,6 +29,9 @@
 
 #define NODE_ERROR
 
+// count allocations per call site for node.heapstats() and node.heapdump()
+// #define HEAP_STATS
+
 #ifdef NODE_DEBUG
 #define NODE_DBG c_printf
 #else
@@ -54,6 +57,10 @@
 #define BUILD_SPIFFS	1
 
 #define SPIFFS_CACHE 1
+#define SPIFFS_CACHE_STATS 1
+// default cache size in pages of 256 bytes, 1..29; the cache is allocated
+// when the fs is mounted, see myspiffs_mount()
+#define SPIFFS_CACHE_PAGES 2
 
 // #define LUA_NUMBER_INTEGRAL
 
@@ -67,8 +74,19 @@
 #define READLINE_INTERVAL 80
 #define LUA_TASK_PRIO USER_TASK_PRIO_0
 #define LUA_PROCESS_LINE_SIG 2
+#define LUA_EGC_STEP_SIG 3
+#define LUA_GPIO_SIG 4
+#define LUA_SPI_SIG 5
+#define LUA_UART_SENT_SIG 6
 #define LUA_OPTIMIZE_DEBUG      2
 
+// Reserve a flash region for execute-in-place bytecode (node.xip), between
+// the firmware and the file system. A multiple of 16KB; the file system
+// moves up by this much, so enabling it means reformatting. With
+// SPIFFS_FIXED_LOCATION the file system stays put and the region is the
+// LUA_XIP_SIZE bytes below it, which must be clear of the firmware.
+// #define LUA_XIP_SIZE 0x10000
+
 #ifdef DEVKIT_VERSION_0_9
 #define KEYLED_INTERVAL	80
 
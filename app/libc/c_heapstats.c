@@ -0,0 +1,158 @@
+/*
+ * c_heapstats.c
+ *
+ * Per call site allocation counters, and the wrappers c_malloc() and
+ * friends turn into. Only counts and sizes are kept, no per-block header,
+ * so blocks may still be freed with os_free() and memory from the SDK may
+ * be passed to c_free().
+ */
+
+#include "user_config.h"
+#ifdef HEAP_STATS
+
+#include "c_string.h"
+#include "c_heapstats.h"
+#include "user_interface.h"
+
+heap_stats heap_stats_data;
+
+void heap_stats_reset(void)
+{
+  c_memset(&heap_stats_data, 0, sizeof(heap_stats_data));
+}
+
+// open addressing on (file, line); file names are literals, compare by address
+static heap_site *find_site(const char *file, int line)
+{
+  uint32_t h = ((uint32_t)(size_t)file >> 2) ^ ((uint32_t)line * 2654435761u);
+  int i;
+
+  for (i = 0; i < HEAP_STATS_SITES; i++) {
+    heap_site *s = &heap_stats_data.sites[(h + i) % HEAP_STATS_SITES];
+    if (s->file == NULL) {
+      s->file = file;
+      s->line = line;
+      return s;
+    }
+    if (s->file == file && s->line == line)
+      return s;
+  }
+  return NULL;
+}
+
+void heap_stats_alloc(const char *file, int line, uint32_t size, bool ok, bool resize)
+{
+  heap_site *s = find_site(file, line);
+
+  if (s == NULL)
+    heap_stats_data.overflow++;
+  if (!ok) {
+    heap_stats_data.failed++;
+    if (s)
+      s->failed++;
+    return;
+  }
+  if (resize)
+    heap_stats_data.reallocs++;
+  else
+    heap_stats_data.allocs++;
+  heap_stats_data.bytes += size;
+  if (s) {
+    s->count++;
+    s->bytes += size;
+  }
+}
+
+void heap_stats_free(void)
+{
+  heap_stats_data.frees++;
+}
+
+void heap_stats_sample(uint32_t free_heap)
+{
+  if (heap_stats_data.min_free == 0 || free_heap < heap_stats_data.min_free)
+    heap_stats_data.min_free = free_heap;
+}
+
+void heap_stats_lua(uint32_t lua_bytes)
+{
+  if (lua_bytes > heap_stats_data.lua_peak)
+    heap_stats_data.lua_peak = lua_bytes;
+}
+
+// the Lua allocator has a fixed signature, so the luaM_* macros leave their
+// call site here for l_alloc() to pick up
+void heap_stats_lua_site(const char *file, int line)
+{
+  heap_stats_data.lua_file = file;
+  heap_stats_data.lua_line = line;
+}
+
+bool heap_stats_take_lua_site(const char **file, int *line)
+{
+  if (heap_stats_data.lua_file == NULL)
+    return false;
+  *file = heap_stats_data.lua_file;
+  *line = heap_stats_data.lua_line;
+  heap_stats_data.lua_file = NULL;
+  return true;
+}
+
+// percentage of the free heap that is not part of the largest block
+int heap_stats_frag(uint32_t free_heap, uint32_t largest)
+{
+  if (free_heap == 0 || largest >= free_heap)
+    return 0;
+  return (int)(((uint64_t)(free_heap - largest) * 100) / free_heap);
+}
+
+// the wrappers behind c_malloc() and friends, see c_stdlib.h
+
+void *heap_stats_malloc(size_t size, const char *file, int line)
+{
+  void *p = os_malloc(size);
+  heap_stats_alloc(file, line, size, p != NULL, false);
+  heap_stats_sample(system_get_free_heap_size());
+  return p;
+}
+
+void *heap_stats_zalloc(size_t size, const char *file, int line)
+{
+  void *p = os_zalloc(size);
+  heap_stats_alloc(file, line, size, p != NULL, false);
+  heap_stats_sample(system_get_free_heap_size());
+  return p;
+}
+
+void *heap_stats_realloc(void *ptr, size_t size, const char *file, int line)
+{
+  void *p = os_realloc(ptr, size);
+  heap_stats_alloc(file, line, size, p != NULL, ptr != NULL);
+  heap_stats_sample(system_get_free_heap_size());
+  return p;
+}
+
+void heap_stats_release(void *ptr)
+{
+  if (ptr)
+    heap_stats_free();
+  os_free(ptr);
+}
+
+// the heap has no API for its largest free block, probe for it instead
+uint32_t heap_stats_largest(void)
+{
+  uint32_t size = system_get_free_heap_size();
+
+  while (size > 16) {
+    void *p = os_malloc(size);
+    if (p) {
+      os_free(p);
+      return size;
+    }
+    size -= size / 16 + 1;
+  }
+  return 0;
+}
+
+#endif /* HEAP_STATS */
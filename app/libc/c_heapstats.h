@@ -0,0 +1,58 @@
+/*
+ * c_heapstats.h
+ *
+ * Allocation accounting behind c_malloc() and friends when HEAP_STATS is
+ * defined in user_config.h.
+ */
+
+#ifndef _C_HEAPSTATS_H_
+#define _C_HEAPSTATS_H_
+
+#include "c_stddef.h"
+#include "c_types.h"
+
+#ifndef HEAP_STATS_SITES
+#define HEAP_STATS_SITES 64
+#endif
+
+typedef struct heap_site {
+  const char *file;   // NULL for an unused slot
+  uint16_t line;
+  uint16_t failed;
+  uint32_t count;
+  uint32_t bytes;
+} heap_site;
+
+typedef struct heap_stats {
+  uint32_t allocs;
+  uint32_t reallocs;    // of an existing block, not counted in allocs
+  uint32_t frees;
+  uint32_t failed;
+  uint32_t bytes;       // requested in total
+  uint32_t min_free;    // lowest free heap seen after an allocation, 0 if none yet
+  uint32_t lua_peak;    // highest Lua heap usage
+  uint32_t overflow;    // allocations from sites that did not fit the table
+  const char *lua_file; // luaM_* call the Lua allocator is serving, see lmem.h
+  int lua_line;
+  heap_site sites[HEAP_STATS_SITES];
+} heap_stats;
+
+extern heap_stats heap_stats_data;
+
+void heap_stats_reset(void);
+void heap_stats_alloc(const char *file, int line, uint32_t size, bool ok, bool resize);
+void heap_stats_free(void);
+void heap_stats_sample(uint32_t free_heap);
+void heap_stats_lua(uint32_t lua_bytes);
+int heap_stats_frag(uint32_t free_heap, uint32_t largest);
+void heap_stats_lua_site(const char *file, int line);
+bool heap_stats_take_lua_site(const char **file, int *line);
+
+// allocator wrappers
+void *heap_stats_malloc(size_t size, const char *file, int line);
+void *heap_stats_zalloc(size_t size, const char *file, int line);
+void *heap_stats_realloc(void *ptr, size_t size, const char *file, int line);
+void heap_stats_release(void *ptr);
+uint32_t heap_stats_largest(void);
+
+#endif /* _C_HEAPSTATS_H_ */
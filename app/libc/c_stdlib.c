@@ -32,6 +32,7 @@ const char *c_getenv(const char *__string)
     }
     return NULL;
 }
+
 // make sure there is enough memory before real malloc, otherwise malloc will panic and reset
 // void *c_malloc(size_t __size){
 //  if(__size>system_get_free_heap_size()){
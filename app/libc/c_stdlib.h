@@ -9,6 +9,7 @@
 
 #include "c_stddef.h"
 #include "mem.h"
+#include "user_config.h"
 
 #define EXIT_FAILURE 1
 #define EXIT_SUCCESS 0
@@ -29,10 +30,18 @@
 #define os_realloc(p, s) mem_realloc((p), (s))
 #endif
 
+#ifdef HEAP_STATS
+#include "c_heapstats.h"
+#define c_free(p) heap_stats_release(p)
+#define c_malloc(s) heap_stats_malloc((s), __FILE__, __LINE__)
+#define c_zalloc(s) heap_stats_zalloc((s), __FILE__, __LINE__)
+#define c_realloc(p, s) heap_stats_realloc((p), (s), __FILE__, __LINE__)
+#else
 #define c_free os_free
 #define c_malloc os_malloc
 #define c_zalloc os_zalloc
 #define c_realloc os_realloc
+#endif
 
 #define c_abs	abs
 #define c_atoi	atoi
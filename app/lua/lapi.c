@@ -760,6 +760,10 @@ LUA_API int lua_setmetatable (lua_State *L, int objindex) {
   switch (ttype(obj)) {
     case LUA_TTABLE: {
       hvalue(obj)->metatable = mt;
+#if LUA_USE_ICACHE
+      if (hvalue(obj)->icached)
+        luaE_icacheflush(L);
+#endif
       if (mt && !isrometa)
         luaC_objbarriert(L, hvalue(obj), mt);
       break;
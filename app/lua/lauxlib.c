@@ -653,8 +653,7 @@ LUALIB_API int luaL_loadfile (lua_State *L, const char *filename) {
 
 typedef struct LoadFSF {
   int extraline;
-  int f;
-  char buff[LUAL_BUFFERSIZE];
+  fs_buf fb;
 } LoadFSF;
 
 
@@ -671,10 +670,7 @@ static const char *getFSF (lua_State *L, void *ud, size_t *size) {
     return "\n";
   }
 
-  if (fs_eof(lf->f)) return NULL;
-  *size = fs_read(lf->f, lf->buff, sizeof(lf->buff));
-
-  return (*size > 0) ? lf->buff : NULL;
+  return fs_buf_next(&lf->fb, size);  /* parse straight from the read-ahead buffer */
 }
 
 
@@ -688,8 +684,8 @@ static int errfsfile (lua_State *L, const char *what, int fnameindex) {
 
 LUALIB_API int luaL_loadfsfile (lua_State *L, const char *filename) {
   LoadFSF lf;
-  int status, readstatus;
-  int c;
+  int status;
+  int c, f;
   int fnameindex = lua_gettop(L) + 1;  /* index of filename on the stack */
   lf.extraline = 0;
   if (filename == NULL) {
@@ -697,29 +693,29 @@ LUALIB_API int luaL_loadfsfile (lua_State *L, const char *filename) {
   }
   else {
     lua_pushfstring(L, "@%s", filename);
-    lf.f = fs_open(filename, FS_RDONLY);
-    if (lf.f < FS_OPEN_OK) return errfsfile(L, "open", fnameindex);
+    f = fs_open(filename, FS_RDONLY);
+    if (f < FS_OPEN_OK) return errfsfile(L, "open", fnameindex);
   }
-  // if(fs_size(lf.f)>LUAL_BUFFERSIZE)
+  // if(fs_size(f)>LUAL_BUFFERSIZE)
   //   return luaL_error(L, "file is too big");
-  c = fs_getc(lf.f);
+  fs_buf_init(&lf.fb, f);
+  c = fs_buf_getc(&lf.fb);
   if (c == '#') {  /* Unix exec. file? */
     lf.extraline = 1;
-    while ((c = fs_getc(lf.f)) != EOF && c != '\n') ;  /* skip first line */
-    if (c == '\n') c = fs_getc(lf.f);
+    while ((c = fs_buf_getc(&lf.fb)) != EOF && c != '\n') ;  /* skip first line */
+    if (c == '\n') c = fs_buf_getc(&lf.fb);
   }
   if (c == LUA_SIGNATURE[0] && filename) {  /* binary file? */
-    fs_close(lf.f);
-    lf.f = fs_open(filename, FS_RDONLY);  /* reopen in binary mode */
-    if (lf.f < FS_OPEN_OK) return errfsfile(L, "reopen", fnameindex);
+    fs_seek(f, 0, FS_SEEK_SET);  /* rewind, no text mode to reopen from */
+    fs_buf_init(&lf.fb, f);
     /* skip eventual `#!...' */
-   while ((c = fs_getc(lf.f)) != EOF && c != LUA_SIGNATURE[0]) ;
+   while ((c = fs_buf_getc(&lf.fb)) != EOF && c != LUA_SIGNATURE[0]) ;
     lf.extraline = 0;
   }
-  fs_ungetc(c, lf.f);
+  fs_buf_ungetc(c, &lf.fb);
   status = lua_load(L, getFSF, &lf, lua_tostring(L, -1));
 
-  if (filename) fs_close(lf.f);  /* close file (even in case of errors) */
+  if (filename) fs_close(f);  /* close file (even in case of errors) */
   lua_remove(L, fnameindex);
   return status;
 }
@@ -780,29 +776,42 @@ static int l_check_memlimit(lua_State *L, size_t needbytes) {
 }
 
 
+#if defined(HEAP_STATS) && !defined(LUA_CROSS_COMPILER)
+#define l_realloc(p, s)  heap_stats_realloc((p), (s), site_file, site_line)
+#else
+#define l_realloc(p, s)  c_realloc((p), (s))
+#endif
+
 static void *l_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
   lua_State *L = (lua_State *)ud;
   int mode = L == NULL ? 0 : G(L)->egcmode;
   void *nptr;
+#if defined(HEAP_STATS) && !defined(LUA_CROSS_COMPILER)
+  const char *site_file = __FILE__;
+  int site_line = __LINE__;
+  heap_stats_take_lua_site(&site_file, &site_line);  /* the luaM_* caller */
+#endif
 
   if (nsize == 0) {
     c_free(ptr);
     return NULL;
   }
   if (L != NULL && (mode & EGC_ALWAYS)) /* always collect memory if requested */
-    luaC_fullgc(L);
+    legc_fullgc(L);
   if(nsize > osize && L != NULL) {
 #if defined(LUA_STRESS_EMERGENCY_GC)
-    luaC_fullgc(L);
+    legc_fullgc(L);
 #endif
     if(G(L)->memlimit > 0 && (mode & EGC_ON_MEM_LIMIT) && l_check_memlimit(L, nsize - osize))
       return NULL;
   }
-  nptr = (void *)c_realloc(ptr, nsize);
+  nptr = (void *)l_realloc(ptr, nsize);
   if (nptr == NULL && L != NULL && (mode & EGC_ON_ALLOC_FAILURE)) {
-    luaC_fullgc(L); /* emergency full collection. */
-    nptr = (void *)c_realloc(ptr, nsize); /* try allocation again */
+    legc_fullgc(L); /* emergency full collection. */
+    nptr = (void *)l_realloc(ptr, nsize); /* try allocation again */
   }
+  if (nptr != NULL && L != NULL && (mode & EGC_STEP) && nsize > osize)
+    legc_request_step(L); /* let the Lua task catch up with the garbage */
   return nptr;
 }
 
@@ -499,7 +499,8 @@ const LUA_REG_TYPE base_funcs_list[] = {
 #endif
 
 
-static int luaB_index(lua_State *L) {
+/* not static: the VM lookup cache recognises it as the _G __index */
+int luaB_index(lua_State *L) {
 #if LUA_OPTIMIZE_MEMORY == 2
   int fres;
   if ((fres = luaR_findfunction(L, base_funcs_list)) != 0)
@@ -1,13 +1,114 @@
 // Lua EGC (Emergeny Garbage Collector) interface
 
+#define LUAC_CROSS_FILE
+
+#include "lua.h"
 #include "legc.h"
 #include "lstate.h"
+#include "lgc.h"
 #include "c_types.h"
+#include C_HEADER_STRING
+#ifndef LUA_CROSS_COMPILER
+#include "user_interface.h"
+#define legc_now() system_get_time()
+#else
+#include <time.h>
+#define legc_now() ((unsigned)((double)clock() * 1000000 / CLOCKS_PER_SEC))
+#endif
+
+static legc_stats_t stats;
+static unsigned step_budget = LEGC_STEP_US;   // us per task step in EGC_STEP mode
+static bool step_posted;
+
+static void legc_record(unsigned start, int full) {
+   unsigned us = legc_now() - start;
+   int i;
+
+   for (i = 0; i < LEGC_HIST_BUCKETS - 1 && us >= (LEGC_HIST_US << i); i++)
+     ;
+   stats.hist[i]++;
+   stats.count++;
+   if (full)
+     stats.full++;
+   stats.total_us += us;
+   if (us > stats.max_us)
+     stats.max_us = us;
+}
 
-void legc_set_mode(lua_State *L, int mode, unsigned limit) {
+// limit is the memory limit for EGC_ON_MEM_LIMIT, step_us the time budget
+// of one task step for EGC_STEP (0 for the default).
+void legc_set_mode(lua_State *L, int mode, unsigned limit, unsigned step_us) {
    global_State *g = G(L); 
    
    g->egcmode = mode;
    g->memlimit = limit;
+   step_budget = step_us ? step_us : LEGC_STEP_US;
+   if (mode & EGC_STEP)
+     legc_request_step(L);
 }
 
+void legc_fullgc(lua_State *L) {
+   unsigned start = legc_now();
+
+   luaC_fullgc(L);
+   legc_record(start, 1);
+}
+
+// Queue a task step unless one is pending or there is nothing to do yet:
+// a new cycle is started once half of the way to the normal GC threshold.
+void legc_request_step(lua_State *L) {
+   global_State *g = G(L);
+
+   if (step_posted || !(g->egcmode & EGC_STEP))
+     return;
+   if (g->gcstate == GCSpause && g->totalbytes < g->GCthreshold / 2)
+     return;
+#ifndef LUA_CROSS_COMPILER
+   step_posted = system_os_post(LUA_TASK_PRIO, LUA_EGC_STEP_SIG, 0);
+#else
+   step_posted = true;    // the host tests play the Lua task, see app/test
+#endif
+}
+
+typedef struct {
+   unsigned start;
+   int more;
+} legc_step_t;
+
+// Run collector steps for at most step_budget us. Called protected, as the
+// steps may run __gc metamethods.
+static int legc_step_cp(lua_State *L) {
+   legc_step_t *s = (legc_step_t *)lua_touserdata(L, 1);
+
+   do {
+     s->more = luaC_onestep(L);
+   } while (s->more && legc_now() - s->start < step_budget);
+   return 0;
+}
+
+// Run on LUA_EGC_STEP_SIG from the Lua task, between other signals: do one
+// time bounded slice of the cycle, then post again if it is not finished.
+void legc_task_step(lua_State *L) {
+   legc_step_t s;
+
+   if (!step_posted)
+     return;
+   step_posted = false;
+   if (L == NULL || !(G(L)->egcmode & EGC_STEP))
+     return;
+   s.start = legc_now();
+   s.more = 1;
+   if (lua_cpcall(L, legc_step_cp, &s) != 0) {
+     luai_writestringerror("gc: %s\n", lua_tostring(L, -1));
+     lua_pop(L, 1);
+   }
+   legc_record(s.start, 0);
+   if (s.more)
+     legc_request_step(L);
+}
+
+void legc_get_stats(legc_stats_t *s, int reset) {
+   *s = stats;
+   if (reset)
+     c_memset(&stats, 0, sizeof(stats));
+}
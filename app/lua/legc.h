@@ -10,8 +10,29 @@
 #define EGC_ON_ALLOC_FAILURE  1   // run EGC on allocation failure
 #define EGC_ON_MEM_LIMIT      2   // run EGC when an upper memory limit is hit
 #define EGC_ALWAYS            4   // always run EGC before an allocation
+#define EGC_STEP              8   // run time bounded GC steps as Lua task signals
 
-void legc_set_mode(lua_State *L, int mode, unsigned limit);
+// default time budget of one EGC_STEP task step, in us
+#define LEGC_STEP_US          1000
 
-#endif
+// pause histogram: bucket i counts pauses under LEGC_HIST_US << i us, the
+// last one all longer pauses
+#define LEGC_HIST_BUCKETS     8
+#define LEGC_HIST_US          128
+
+// collector pause statistics, in microseconds
+typedef struct {
+  unsigned count;       // timed collector runs
+  unsigned full;        // of which full collections
+  unsigned max_us;
+  unsigned total_us;
+  unsigned hist[LEGC_HIST_BUCKETS];
+} legc_stats_t;
 
+void legc_set_mode(lua_State *L, int mode, unsigned limit, unsigned step_us);
+void legc_fullgc(lua_State *L);
+void legc_request_step(lua_State *L);
+void legc_task_step(lua_State *L);
+void legc_get_stats(legc_stats_t *stats, int reset);
+
+#endif
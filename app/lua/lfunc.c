@@ -142,6 +142,7 @@ Proto *luaF_newproto (lua_State *L) {
 
 
 void luaF_freeproto (lua_State *L, Proto *f) {
+  luaE_icacheflush(L);  /* its instruction addresses may be reused */
   luaM_freearray(L, f->p, f->sizep, Proto *);
   luaM_freearray(L, f->k, f->sizek, TValue);
   luaM_freearray(L, f->locvars, f->sizelocvars, struct LocVar);
@@ -156,6 +157,8 @@ void luaF_freeproto (lua_State *L, Proto *f) {
     luaM_freearray(L, f->lineinfo, f->sizelineinfo, int);
 #endif
   }
+  else
+    G(L)->roprotos--;
   luaM_free(L, f);
 }
 
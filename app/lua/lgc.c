@@ -652,6 +652,23 @@ void luaC_step (lua_State *L) {
   unset_block_gc(L);
 }
 
+/*
+** A single unit of collector work, for callers that meter the time spent
+** themselves. Returns 0 once the collector is back in the pause state.
+*/
+int luaC_onestep (lua_State *L) {
+  global_State *g = G(L);
+  if(is_block_gc(L)) return 0;
+  set_block_gc(L);
+  if (g->estimate > g->totalbytes)
+    g->estimate = g->totalbytes;
+  singlestep(L);
+  if (g->gcstate == GCSpause)
+    setthreshold(g);
+  unset_block_gc(L);
+  return g->gcstate != GCSpause;
+}
+
 int luaC_sweepstrgc (lua_State *L) {
   global_State *g = G(L);
   if (g->gcstate == GCSsweepstring) {
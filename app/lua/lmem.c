@@ -17,6 +17,12 @@
 #include "lobject.h"
 #include "lstate.h"
 
+#if defined(HEAP_STATS) && !defined(LUA_CROSS_COMPILER)
+#include "c_heapstats.h"
+/* the site is that of the caller of these, not of lmem.c */
+#undef luaM_realloc_
+#undef luaM_growaux_
+#endif
 
 
 /*
@@ -80,6 +86,9 @@ void *luaM_realloc_ (lua_State *L, void *block, size_t osize, size_t nsize) {
     luaD_throw(L, LUA_ERRMEM);
   lua_assert((nsize == 0) == (block == NULL));
   g->totalbytes = (g->totalbytes - osize) + nsize;
+#if defined(HEAP_STATS) && !defined(LUA_CROSS_COMPILER)
+  heap_stats_lua(g->totalbytes);
+#endif
   return block;
 }
 
@@ -49,5 +49,14 @@ LUAI_FUNC void *luaM_growaux_ (lua_State *L, void *block, int *size,
                                size_t size_elem, int limit,
                                const char *errormsg);
 
+#if defined(HEAP_STATS) && !defined(LUA_CROSS_COMPILER)
+/* let l_alloc count the block against the line that asked for it */
+#include "c_heapstats.h"
+#define luaM_realloc_(L,b,os,s) \
+	(heap_stats_lua_site(__FILE__, __LINE__), (luaM_realloc_)(L,b,os,s))
+#define luaM_growaux_(L,b,s,e,l,m) \
+	(heap_stats_lua_site(__FILE__, __LINE__), (luaM_growaux_)(L,b,s,e,l,m))
+#endif
+
 #endif
 
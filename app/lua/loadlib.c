@@ -21,6 +21,7 @@
 #ifndef LUA_CROSS_COMPILER
 #include "flash_fs.h"
 #endif
+#include "lxip.h"
 
 #include "lauxlib.h"
 #include "lualib.h"
@@ -458,6 +459,25 @@ static int loader_preload (lua_State *L) {
 }
 
 
+#if defined(LUA_XIP_SIZE) && !defined(LUA_CROSS_COMPILER)
+static int loader_XIP (lua_State *L) {
+  const char *name = luaL_checkstring(L, 1);
+  const lxip_entry *e = NULL;
+  size_t size;
+  const char *image = lxip_region(NULL, &size);
+  if (image != NULL)
+    e = lxip_find(image, size, name);
+  if (e == NULL) {
+    lua_pushfstring(L, "\n\tno xip image " LUA_QS, name);
+    return 1;
+  }
+  if (lxip_load(L, e) != 0)
+    loaderror(L, "(xip)");
+  return 1;  /* library loaded successfully */
+}
+#endif
+
+
 static const int sentinel_ = 0;
 #define sentinel	((void *)&sentinel_)
 
@@ -643,7 +663,11 @@ static const luaL_Reg ll_funcs[] = {
 
 
 static const lua_CFunction loaders[] =
+#if defined(LUA_XIP_SIZE) && !defined(LUA_CROSS_COMPILER)
+  {loader_preload, loader_XIP, loader_Lua, loader_C, loader_Croot, NULL};
+#else
   {loader_preload, loader_Lua, loader_C, loader_Croot, NULL};
+#endif
 
 #if LUA_OPTIMIZE_MEMORY > 0
 #undef MIN_OPT_LEVEL
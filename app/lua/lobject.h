@@ -518,6 +518,9 @@ typedef struct Table {
   CommonHeader;
   lu_byte flags;  /* 1<<p means tagmethod(p) is not present */
   lu_byte lsizenode;  /* log2 of size of `node' array */
+#if LUA_USE_ICACHE
+  lu_byte icached;  /* the VM lookup cache has held lines for it */
+#endif
   struct Table *metatable;
   TValue *array;  /* array part */
   Node *node;
@@ -16,16 +16,45 @@
 /* Externally defined read-only table array */
 extern const luaR_table lua_rotable[];
 
-/* Find a global "read only table" in the constant lua_rotable array */
+/* Number of entries in lua_rotable, counted on first use */
+static unsigned luaR_nglobals = 0;
+
+/* Compare a counted string against a C string, strcmp style. The name
+   may hold an embedded '\0', which stops c_strncmp early, so the lengths
+   decide a tie rather than reading strkey[len] past a shorter key. */
+static int luaR_keycmp(const char *name, unsigned len, const char *strkey) {
+  int res = c_strncmp(name, strkey, len);
+  if (res == 0) {
+    size_t keylen = c_strlen(strkey);
+    if (keylen != len)
+      res = keylen > len ? -1 : 1;
+  }
+  return res;
+}
+
+/* Find a global "read only table" in the constant lua_rotable array.
+   The linker emits the array sorted by name (see .lua_rotable.* in
+   ld/nodemcu.ld), so this is a binary search. */
 void* luaR_findglobal(const char *name, unsigned len) {
-  unsigned i;
+  unsigned lo, hi;
 
-  if (c_strlen(name) > LUA_MAX_ROTABLE_NAME)
+  if (len > LUA_MAX_ROTABLE_NAME)
     return NULL;
-  for (i=0; lua_rotable[i].name; i ++)
-    if (*lua_rotable[i].name != '\0' && c_strlen(lua_rotable[i].name) == len && !c_strncmp(lua_rotable[i].name, name, len)) {
-      return (void*)(lua_rotable[i].pentries);
-    }
+  if (luaR_nglobals == 0)
+    while (lua_rotable[luaR_nglobals].name)
+      luaR_nglobals ++;
+  lo = 0;
+  hi = luaR_nglobals;
+  while (lo < hi) {
+    unsigned mid = (lo + hi) / 2;
+    int res = luaR_keycmp(name, len, lua_rotable[mid].name);
+    if (res == 0)
+      return (void*)(lua_rotable[mid].pentries);
+    if (res < 0)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
   return NULL;
 }
 
@@ -69,6 +98,44 @@ const TValue* luaR_findentry(void *data, const char *strkey, luaR_numkey numkey,
   return luaR_auxfind((const luaR_entry*)data, strkey, numkey, ppos);
 }
 
+#if LUAR_CACHE_LINES > 0
+/* Lookaside cache of (rotable, string key) -> entry position. Lines are
+   indexed by the precomputed Lua string hash, so a hit costs a single
+   key compare instead of a walk over the whole map. */
+static struct {
+  const luaR_entry *pentries;
+  unsigned pos;
+} luaR_cache[LUAR_CACHE_LINES];
+
+#define luaR_cacheline(p, key) \
+  ((((unsigned)(size_t)(p) >> 2) ^ (key)->tsv.hash) & (LUAR_CACHE_LINES - 1))
+#endif
+
+/* Find a string keyed entry in a rotable using the Lua string directly */
+const TValue* luaR_findstrentry(void *data, const TString *key) {
+  const luaR_entry *pentries = (const luaR_entry*)data;
+  const char *strkey = getstr(key);
+  const TValue *res;
+  unsigned pos;
+#if LUAR_CACHE_LINES > 0
+  unsigned line = luaR_cacheline(pentries, key);
+
+  if (luaR_cache[line].pentries == pentries) {
+    const luaR_entry *pentry = pentries + luaR_cache[line].pos;
+    if (!luaR_keycmp(strkey, key->tsv.len, pentry->key.id.strkey))
+      return &pentry->value;
+  }
+#endif
+  res = luaR_auxfind(pentries, strkey, 0, &pos);
+#if LUAR_CACHE_LINES > 0
+  if (res) {
+    luaR_cache[line].pentries = pentries;
+    luaR_cache[line].pos = pos;
+  }
+#endif
+  return res;
+}
+
 /* Find the metatable of a given table */
 void* luaR_getmeta(void *data) {
 #ifdef LUA_META_ROTABLES
@@ -37,6 +37,11 @@
 /* Maximum length of a rotable name and of a string key*/
 #define LUA_MAX_ROTABLE_NAME      32
 
+/* Number of lines in the rotable string lookup cache (power of 2, 0 disables) */
+#ifndef LUAR_CACHE_LINES
+#define LUAR_CACHE_LINES          32
+#endif
+
 /* Type of a numeric key in a rotable */
 typedef int luaR_numkey;
 
@@ -68,6 +73,7 @@ typedef struct
 void* luaR_findglobal(const char *key, unsigned len);
 int luaR_findfunction(lua_State *L, const luaR_entry *ptable);
 const TValue* luaR_findentry(void *data, const char *strkey, luaR_numkey numkey, unsigned *ppos);
+const TValue* luaR_findstrentry(void *data, const TString *key);
 void luaR_getcstr(char *dest, const TString *src, size_t maxsize);
 void luaR_next(lua_State *L, void *data, TValue *key, TValue *val);
 void* luaR_getmeta(void *data);
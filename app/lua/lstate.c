@@ -182,6 +182,7 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->gcpause = LUAI_GCPAUSE;
   g->gcstepmul = LUAI_GCMUL;
   g->gcdept = 0;
+  g->roprotos = 0;
 #ifdef EGC_INITIAL_MODE
   g->egcmode = EGC_INITIAL_MODE;
 #else
@@ -193,6 +194,10 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->memlimit = 0;
 #endif
   for (i=0; i<NUM_TAGS; i++) g->mt[i] = NULL;
+#if LUA_USE_ICACHE
+  g->icache_gen = 0;
+  for (i=0; i<LUAI_ICACHESIZE; i++) g->icache[i].pc = NULL;
+#endif
   if (luaD_rawrunprotected(L, f_luaopen, NULL) != 0) {
     /* memory allocation error: free partial state */
     close_state(L);
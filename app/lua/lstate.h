@@ -62,6 +62,23 @@ typedef struct CallInfo {
 #define isLua(ci)	(ttisfunction((ci)->func) && f_isLua(ci))
 
 
+#if LUA_USE_ICACHE
+/*
+** one line of the VM lookup cache, keyed by instruction address
+*/
+typedef struct ICacheLine {
+  const Instruction *pc;  /* instruction that did the lookup */
+  const void *t;  /* rotable, metatable or env table it was done on */
+  lu_int32 gen;  /* value of `icache_gen' when filled */
+  TValue v;  /* the (non collectable) result */
+} ICacheLine;
+
+#define luaE_icacheflush(L)	(G(L)->icache_gen++)
+#else
+#define luaE_icacheflush(L)	((void)0)
+#endif
+
+
 /*
 ** `global state', shared by all threads of this state
 */
@@ -88,12 +105,17 @@ typedef struct global_State {
   int gcpause;  /* size of pause between successive GCs */
   int gcstepmul;  /* GC `granularity' */
   int egcmode;    /* emergency garbage collection operation mode */
+  int roprotos;  /* Protos with their code in flash, see lxip.c */
   lua_CFunction panic;  /* to be called in unprotected errors */
   TValue l_registry;
   struct lua_State *mainthread;
   UpVal uvhead;  /* head of double-linked list of all open upvalues */
   struct Table *mt[NUM_TAGS];  /* metatables for basic types */
   TString *tmname[TM_N];  /* array with tag-method names */
+#if LUA_USE_ICACHE
+  lu_int32 icache_gen;  /* bumped to invalidate all cache lines */
+  ICacheLine icache[LUAI_ICACHESIZE];
+#endif
 } global_State;
 
 
@@ -496,6 +496,9 @@ Table *luaH_new (lua_State *L, int narray, int nhash) {
   incr_top(L);
   t->metatable = NULL;
   t->flags = cast_byte(~0);
+#if LUA_USE_ICACHE
+  t->icached = 0;
+#endif
   /* temporary values (kept only if some malloc fails) */
   t->array = NULL;
   t->sizearray = 0;
@@ -509,6 +512,10 @@ Table *luaH_new (lua_State *L, int narray, int nhash) {
 
 
 void luaH_free (lua_State *L, Table *t) {
+#if LUA_USE_ICACHE
+  if (t->icached)  /* its address may be reused by another table */
+    luaE_icacheflush(L);
+#endif
   if (t->node != dummynode)
     luaM_freearray(L, t->node, sizenode(t), Node);
   luaM_freearray(L, t->array, t->sizearray, TValue);
@@ -598,12 +605,10 @@ const TValue *luaH_getstr (Table *t, TString *key) {
 
 /* same thing for rotables */
 const TValue *luaH_getstr_ro (void *t, TString *key) {
-  char keyname[LUA_MAX_ROTABLE_NAME + 1];
   const TValue *res;  
   if (!t)
     return luaO_nilobject;
-  luaR_getcstr(keyname, key, LUA_MAX_ROTABLE_NAME);   
-  res = luaR_findentry(t, keyname, 0, NULL);
+  res = luaR_findstrentry(t, key);
   return res ? res : luaO_nilobject;
 }
 
@@ -655,9 +660,26 @@ const TValue *luaH_get_ro (void *t, const TValue *key) {
 }
 
 
+/*
+** A string key going from nil to a value in a table the VM cache has
+** resolved globals through may shadow one of them; replacing a
+** metamethod may change what any `__index' resolves to.
+*/
+#if LUA_USE_ICACHE
+#define checkicache(L,t,key,p) \
+  { if ((t->icached && ttisnil(p)) || \
+        (getstr(key)[0] == '_' && getstr(key)[1] == '_')) \
+      luaE_icacheflush(L); }
+#else
+#define checkicache(L,t,key,p)	((void)0)
+#endif
+
+
 TValue *luaH_set (lua_State *L, Table *t, const TValue *key) {
   const TValue *p = luaH_get(t, key);
   t->flags = 0;
+  if (ttisstring(key))
+    checkicache(L, t, rawtsvalue(key), p);
   if (p != luaO_nilobject)
     return cast(TValue *, p);
   else {
@@ -683,6 +705,7 @@ TValue *luaH_setnum (lua_State *L, Table *t, int key) {
 
 TValue *luaH_setstr (lua_State *L, Table *t, TString *key) {
   const TValue *p = luaH_getstr(t, key);
+  checkicache(L, t, key, p);
   if (p != luaO_nilobject)
     return cast(TValue *, p);
   else {
@@ -428,6 +428,8 @@ static int pmain (lua_State *L) {
 
 static void dojob(lua_Load *load);
 static bool readline(lua_Load *load);
+extern uint16_t uart_rx_count(void);
+extern void uart_rx_wake(void);
 char line_buffer[LUA_MAXINPUT];
 
 #ifdef LUA_RPC
@@ -458,16 +460,24 @@ int lua_main (int argc, char **argv) {
   dojob(&gLoad);
 
   NODE_DBG("Heap size::%d.\n",system_get_free_heap_size());
-  legc_set_mode( L, EGC_ALWAYS, 4096 );
-  // legc_set_mode( L, EGC_ON_MEM_LIMIT, 4096 );
+  legc_set_mode( L, EGC_ALWAYS, 4096, 0 );
+  // legc_set_mode( L, EGC_ON_MEM_LIMIT, 4096, 0 );
   // lua_close(L);
   return (status || s.status) ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
 void lua_handle_input (bool force)
 {
-  if (force || readline (&gLoad))
+  if (force || readline (&gLoad)) {
     dojob (&gLoad);
+    if (uart_rx_count() > 0)
+      uart_rx_wake();
+  }
+}
+
+void lua_handle_egc (void)
+{
+  legc_task_step (gLoad.L);
 }
 
 void donejob(lua_Load *load){
@@ -536,19 +546,20 @@ static void dojob(lua_Load *load){
 #ifndef uart_putc
 #define uart_putc uart0_putc
 #endif
+extern bool uart_getc(char *c);
 extern bool uart_on_data_cb(const char *buf, size_t len);
+extern void uart_on_data_rx(void);
 extern bool uart0_echo;
 extern bool run_input;
-extern uint16_t need_len;
-extern int16_t end_char;
 static char last_nl_char = '\0';
 static bool readline(lua_Load *load){
   // NODE_DBG("readline() is called.\n");
   bool need_dojob = false;
   char ch;
-  while (uart_getc(&ch))
+  do {
+  /* one line at a time, the rest waits in the ring until it has run */
+  while (!need_dojob && run_input && uart_getc(&ch))
   {
-    if(run_input)
     {
       char tmp_last_nl_char = last_nl_char;
       // reset marker, will be finally set below when newline is processed
@@ -622,25 +633,14 @@ static bool readline(lua_Load *load){
     load->line[load->line_position] = ch;
     load->line_position++;
 
-    if(!run_input)
-    {
-      if( ((need_len!=0) && (load->line_position >= need_len)) || \
-        (load->line_position >= load->len) || \
-        ((end_char>=0) && ((unsigned char)ch==(unsigned char)end_char)) )
-      {
-        uart_on_data_cb(load->line, load->line_position);
-        load->line_position = 0;
-      }
-    }
-
     ch = 0;
   }
-  
-  if( (load->line_position > 0) && (!run_input) && (need_len==0) && (end_char<0) )
-  {
-    uart_on_data_cb(load->line, load->line_position);
-    load->line_position = 0;
-  }
+
+  /* raw data goes to uart.on("data") straight from the receive ring, its
+     callback may switch back to the interpreter */
+  if (!run_input)
+    uart_on_data_rx();
+  } while (!need_dojob && run_input && uart_rx_count() > 0);
 
   return need_dojob;
 }
@@ -395,6 +395,7 @@ int lua_main( int argc, char **argv );
 
 #ifndef LUA_CROSS_COMPILER
 void lua_handle_input (bool force);
+void lua_handle_egc (void);
 #endif
 
 /******************************************************************************
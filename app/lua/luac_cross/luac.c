@@ -25,6 +25,7 @@
 #include "lopcodes.h"
 #include "lstring.h"
 #include "lundump.h"
+#include "lxip.h"
 
 #define PROGNAME	"luac"		/* default program name */
 #define	OUTPUT		PROGNAME ".out"	/* default output file */
@@ -32,6 +33,8 @@
 static int listing=0;			/* list bytecodes? */
 static int dumping=1;			/* dump bytecodes? */
 static int stripping=0;			/* strip debug information? */
+static int xip=0;			/* one execute-in-place image entry per file? */
+static char* image=NULL;		/* image read back for verification */
 static char Output[]={ OUTPUT };	/* default output file name */
 static const char* output=Output;	/* actual output file name */
 static const char* progname=PROGNAME;	/* actual program name */
@@ -64,6 +67,7 @@ static void usage(const char* message)
  "  -p       parse only\n"
  "  -s       strip debug information\n"
  "  -v       show version information\n"
+ "  -x       write an execute-in-place image, one entry per file, and verify it\n"
  "  -cci bits       cross-compile with given integer size\n"
  "  -ccn type bits  cross-compile with given lua_Number type and size\n"
  "  -cce endian     cross-compile with given endianness ('big' or 'little')\n"
@@ -105,6 +109,8 @@ static int doargs(int argc, char* argv[])
    stripping=1;
   else if (IS("-v"))			/* show version */
    ++version;
+  else if (IS("-x"))			/* execute-in-place image */
+   xip=1;
   else if (IS("-cci")) /* target integer size */
   {
    int s = target.sizeof_int = atoi(argv[++i])/8;
@@ -135,6 +141,7 @@ static int doargs(int argc, char* argv[])
   else					/* unknown option */
    usage(argv[i]);
  }
+ if (xip && !dumping) usage(LUA_QL("-x") " and " LUA_QL("-p") " cannot be combined");
  if (i==argc && (listing || !dumping))
  {
   dumping=0;
@@ -184,6 +191,115 @@ static int writer(lua_State* L, const void* p, size_t size, void* u)
  return (fwrite(p,size,1,(FILE*)u)!=1) && (size!=0);
 }
 
+/* chunk dumped to memory before its entry header is written */
+typedef struct {
+ char* b;
+ size_t n, size;
+} Chunk;
+
+static int chunkwriter(lua_State* L, const void* p, size_t size, void* u)
+{
+ Chunk* c=(Chunk*)u;
+ UNUSED(L);
+ if (c->n+size>c->size)
+ {
+  c->size=(c->n+size)*2;
+  c->b=realloc(c->b,c->size);
+  if (c->b==NULL) fatal("not enough memory");
+ }
+ memcpy(c->b+c->n,p,size);
+ c->n+=size;
+ return 0;
+}
+
+static void put32(FILE* D, uint32_t x)
+{
+ unsigned char b[4];
+ int i;
+ for (i=0; i<4; i++)
+  b[target.little_endian ? i : 3-i]=(unsigned char)(x>>(8*i));
+ if (fwrite(b,4,1,D)!=1) cannot("write");
+}
+
+/* entry name: the file name without directory and extension */
+static void entryname(const char* filename, char* name)
+{
+ const char* p=strrchr(filename,'/');
+ size_t n;
+ p=(p==NULL) ? filename : p+1;
+ n=strcspn(p,".");
+ if (n>=LXIP_NAME_MAX) fatal("file name too long for an image entry");
+ memset(name,0,LXIP_NAME_MAX);
+ memcpy(name,p,n);
+}
+
+static void writeimage(lua_State* L, int argc, char** argv)
+{
+ static const char pad[4]={0,0,0,0};
+ Chunk c={NULL,0,0};
+ char name[LXIP_NAME_MAX];
+ FILE* D= (output==NULL) ? stdout : fopen(output,"wb");
+ int i;
+ if (D==NULL) cannot("open");
+ for (i=0; i<argc; i++)
+ {
+  int result;
+  if (IS("-")) fatal("cannot name an image entry for stdin");
+  entryname(argv[i],name);
+  c.n=0;
+  lua_lock(L);
+  result=luaU_dump_crosscompile(L,toproto(L,i-argc),chunkwriter,&c,stripping,target);
+  lua_unlock(L);
+  if (result==LUA_ERR_CC_INTOVERFLOW) fatal("value too big or small for target integer type");
+  if (result==LUA_ERR_CC_NOTINTEGER) fatal("target lua_Number is integral but fractional value found");
+  put32(D,LXIP_MAGIC);
+  put32(D,c.n);
+  if (fwrite(name,LXIP_NAME_MAX,1,D)!=1 || fwrite(c.b,c.n,1,D)!=1) cannot("write");
+  if (lxip_align(c.n)>c.n && fwrite(pad,lxip_align(c.n)-c.n,1,D)!=1) cannot("write");
+ }
+ free(c.b);
+ if (ferror(D)) cannot("write");
+ if (fclose(D)) cannot("close");
+}
+
+/* load every entry back in place, the way the target does */
+static void verifyimage(lua_State* L, int argc)
+{
+ const lxip_entry* e=NULL;
+ FILE* f;
+ long size;
+ int n=0;
+ if (!target.little_endian || target.sizeof_int!=sizeof(int) ||
+     target.sizeof_lua_Number!=sizeof(lua_Number) ||
+     target.lua_Number_integral!=(((lua_Number)0.5)==0))
+ {
+  fprintf(stderr,"%s: image for a different target not verified\n",progname);
+  return;
+ }
+ if (output==NULL) return;
+ f=fopen(output,"rb");
+ if (f==NULL) cannot("open");
+ fseek(f,0,SEEK_END);
+ size=ftell(f);
+ rewind(f);
+ image=malloc(size+1);
+ if (image==NULL) fatal("not enough memory");
+ if (size>0 && fread(image,size,1,f)!=1) cannot("read");
+ fclose(f);
+ while ((e=lxip_next(image,size,e))!=NULL)
+ {
+  if (lxip_load(L,e)!=0) fatal(lua_tostring(L,-1));
+  if (G(L)->roprotos==0) fatal("image functions not loaded in place");
+  if (listing) luaU_print(toproto(L,-1),listing>1);
+  lua_pop(L,1);
+  n++;
+ }
+ if (n!=argc || lxip_used(image,size)!=(size_t)size) fatal("image does not verify");
+ /* node.xip.erase() relies on the count of them going back to 0 */
+ lua_gc(L,LUA_GCCOLLECT,0);
+ if (G(L)->roprotos!=0) fatal("image functions not freed");
+}
+
 struct Smain {
  int argc;
  char** argv;
@@ -202,6 +318,12 @@ static int pmain(lua_State* L)
   const char* filename=IS("-") ? NULL : argv[i];
   if (luaL_loadfile(L,filename)!=0) fatal(lua_tostring(L,-1));
  }
+ if (xip)
+ {
+  writeimage(L,argc,argv);
+  verifyimage(L,argc);
+  return 0;
+ }
  f=combine(L,argc);
  if (listing) luaU_print(f,listing>1);
  if (dumping)
@@ -241,5 +363,6 @@ int main(int argc, char* argv[])
  s.argv=argv;
  if (lua_cpcall(L,pmain,&s)!=0) fatal(lua_tostring(L,-1));
  lua_close(L);
+ free(image);				/* read-only strings of the state pointed into it */
  return EXIT_SUCCESS;
 }
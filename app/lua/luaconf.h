@@ -902,6 +902,27 @@ typedef long int32_t;
 #define LUA_META_ROTABLES 
 #endif
 
+/*
+@@ LUA_USE_ICACHE enables a small per-VM cache in front of the rotable and
+** rotable-backed global lookups done by OP_GETGLOBAL, OP_GETTABLE and
+** OP_SELF with constant keys, so repeated module.func accesses skip the
+** string scan. The cache is flushed whenever a table change could make
+** an entry stale.
+** It is on for the target build with LUA_OPTIMIZE_MEMORY=2, define it to
+** 0 or 1 to override that.
+@@ LUAI_ICACHESIZE is the number of cache lines (must be a power of 2).
+*/
+#ifndef LUA_USE_ICACHE
+#if (LUA_OPTIMIZE_MEMORY == 2) && !defined(LUA_CROSS_COMPILER)
+#define LUA_USE_ICACHE		1
+#else
+#define LUA_USE_ICACHE		0
+#endif
+#endif
+#ifndef LUAI_ICACHESIZE
+#define LUAI_ICACHESIZE		16
+#endif
+
 #if LUA_OPTIMIZE_MEMORY == 2 && defined(LUA_USE_POPEN)
 #error "Pipes not supported in aggresive optimization mode (LUA_OPTIMIZE_MEMORY=2)"
 #endif
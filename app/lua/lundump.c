@@ -280,7 +280,10 @@ static Proto* LoadFunction(LoadState* S, TString* p)
  Proto* f;
  if (++S->L->nCcalls > LUAI_MAXCCALLS) error(S,"code too deep");
  f=luaF_newproto(S->L);
- if (luaZ_direct_mode(S->Z)) proto_readonly(f);
+ if (luaZ_direct_mode(S->Z)) {
+  proto_readonly(f);
+  G(S->L)->roprotos++;
+ }
  setptvalue2s(S->L,S->L->top,f); incr_top(S->L);
  f->source=LoadString(S); if (f->source==NULL) f->source=p;
  f->linedefined=LoadInt(S);
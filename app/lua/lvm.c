@@ -154,6 +154,103 @@ void luaV_gettable (lua_State *L, const TValue *t, TValue *key, StkId val) {
 }
 
 
+#if LUA_USE_ICACHE
+
+extern int luaB_index (lua_State *L);
+
+#define icacheline(L,pc) \
+  (&G(L)->icache[((size_t)(pc) >> 2) & (LUAI_ICACHESIZE - 1)])
+
+static void icache_put (lua_State *L, const Instruction *pc, const void *t,
+                        const TValue *v) {
+  ICacheLine *c;
+  if (iscollectable(v) || ttisnil(v))
+    return;  /* only values that cannot be freed behind our back */
+  c = icacheline(L, pc);
+  c->pc = pc;
+  c->t = t;
+  c->gen = G(L)->icache_gen;
+  setobj(L, &c->v, v);
+}
+
+
+/*
+** `luaV_gettable' for a constant string key, going through the lookup
+** cache. Cached are lookups that cannot change while `icache_gen' stays
+** the same: a rotable, the rotable `__index' of a userdata metatable,
+** and globals resolved by the base library `__index' of the env table.
+*/
+static void icache_gettable (lua_State *L, const Instruction *pc,
+                             const TValue *t, TValue *key, StkId val) {
+  ICacheLine *c = icacheline(L, pc);
+  const void *ct = NULL;
+  const TValue *res;
+  if (ttisrotable(t))
+    ct = rvalue(t);
+  else if (ttistable(t))
+    ct = hvalue(t);
+  else if (ttisuserdata(t) && uvalue(t)->metatable &&
+           luaR_isrotable(uvalue(t)->metatable))
+    ct = uvalue(t)->metatable;
+  if (ct == NULL || !ttisstring(key)) {
+    luaV_gettable(L, t, key, val);
+    return;
+  }
+  if (c->pc == pc && c->t == ct && c->gen == G(L)->icache_gen) {
+    setobj2s(L, val, &c->v);
+    return;
+  }
+  if (ttisrotable(t)) {
+    res = luaH_getstr_ro(rvalue(t), rawtsvalue(key));
+    if (!ttisnil(res) || luaR_getmeta(rvalue(t)) == NULL) {
+      setobj2s(L, val, res);
+      icache_put(L, pc, ct, res);
+      return;
+    }
+  }
+  else if (ttisuserdata(t)) {
+    const TValue *tm = luaH_getstr_ro((void *)ct, G(L)->tmname[TM_INDEX]);
+    if (ttisrotable(tm)) {
+      res = luaH_getstr_ro(rvalue(tm), rawtsvalue(key));
+      if (!ttisnil(res)) {
+        setobj2s(L, val, res);
+        icache_put(L, pc, ct, res);
+        return;
+      }
+    }
+  }
+  else {
+    Table *h = hvalue(t);
+    const TValue *tm;
+    res = luaH_getstr(h, rawtsvalue(key));
+    if (!ttisnil(res)) {  /* plain hit, cheap enough without the cache */
+      setobj2s(L, val, res);
+      return;
+    }
+    if ((tm = fasttm(L, h->metatable, TM_INDEX)) != NULL &&
+        ttislightfunction(tm) && fvalue(tm) == (void *)luaB_index) {
+      ptrdiff_t result = savestack(L, val);
+      luaV_gettable(L, t, key, val);
+      val = restorestack(L, result);
+      h->icached = 1;
+      icache_put(L, pc, ct, val);
+      return;
+    }
+  }
+  luaV_gettable(L, t, key, val);
+}
+
+#define cachedgettable(L,pc,t,k,v) \
+  { if (ISK(GETARG_C(i))) icache_gettable(L, pc, t, k, v); \
+    else luaV_gettable(L, t, k, v); }
+
+#else
+
+#define cachedgettable(L,pc,t,k,v)	luaV_gettable(L, t, k, v)
+
+#endif
+
+
 void luaV_settable (lua_State *L, const TValue *t, TValue *key, StkId val) {
   int loop;
   TValue temp;
@@ -487,11 +584,15 @@ void luaV_execute (lua_State *L, int nexeccalls) {
         TValue *rb = KBx(i);
         sethvalue(L, &g, cl->env);
         lua_assert(ttisstring(rb));
+#if LUA_USE_ICACHE
+        Protect(icache_gettable(L, pc, &g, rb, ra));
+#else
         Protect(luaV_gettable(L, &g, rb, ra));
+#endif
         continue;
       }
       case OP_GETTABLE: {
-        Protect(luaV_gettable(L, RB(i), RKC(i), ra));
+        Protect(cachedgettable(L, pc, RB(i), RKC(i), ra));
         continue;
       }
       case OP_SETGLOBAL: {
@@ -523,7 +624,7 @@ void luaV_execute (lua_State *L, int nexeccalls) {
       case OP_SELF: {
         StkId rb = RB(i);
         setobjs2s(L, ra+1, rb);
-        Protect(luaV_gettable(L, rb, RKC(i), ra));
+        Protect(cachedgettable(L, pc, rb, RKC(i), ra));
         continue;
       }
       case OP_ADD: {
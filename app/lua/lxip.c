@@ -0,0 +1,222 @@
+// Execute-in-place bytecode images
+//
+// Chunks loaded from an image are undumped in lundump's direct mode: code
+// arrays, line info and constant strings are referenced where they lie
+// instead of being copied to the heap. Only the Proto headers and the
+// constant tables are allocated.
+
+#define LUAC_CROSS_FILE
+
+#include "lua.h"
+#include C_HEADER_STRING
+#include "lxip.h"
+
+#if !defined(LUA_CROSS_COMPILER)
+#include "lmem.h"
+#include "lstate.h"
+#include "platform.h"
+#endif
+
+const lxip_entry *lxip_next(const char *image, size_t size, const lxip_entry *e) {
+  const char *p = e ? lxip_chunk(e) + lxip_align(e->size) : image;
+  const lxip_entry *next = (const lxip_entry *)p;
+
+  if (p + sizeof(lxip_entry) > image + size || next->magic != LXIP_MAGIC)
+    return NULL;
+  if (next->size > (size_t)(image + size - lxip_chunk(next)))
+    return NULL;
+  return next;
+}
+
+// the last entry of that name, so a chunk added again replaces the old one
+const lxip_entry *lxip_find(const char *image, size_t size, const char *name) {
+  const lxip_entry *e = NULL, *found = NULL;
+
+  while ((e = lxip_next(image, size, e)) != NULL) {
+    if (c_strncmp(e->name, name, LXIP_NAME_MAX) == 0)
+      found = e;
+  }
+  return found;
+}
+
+size_t lxip_used(const char *image, size_t size) {
+  const lxip_entry *e = NULL, *last = NULL;
+
+  while ((e = lxip_next(image, size, e)) != NULL)
+    last = e;
+  return last ? lxip_chunk(last) + lxip_align(last->size) - image : 0;
+}
+
+typedef struct {
+  const char *base;
+  size_t size;
+} LoadXIP;
+
+static const char *getXIP(lua_State *L, void *ud, size_t *size) {
+  LoadXIP *lx = (LoadXIP *)ud;
+
+  if (L == NULL && size == NULL)  // direct mode check
+    return lx->base;
+  if (lx->size == 0)
+    return NULL;
+  *size = lx->size;
+  lx->size = 0;
+  return lx->base;
+}
+
+// Lua: same results as luaL_loadbuffer
+int lxip_load(lua_State *L, const lxip_entry *e) {
+  LoadXIP lx;
+  char name[LXIP_NAME_MAX + 2];
+
+  name[0] = '=';
+  c_memcpy(name + 1, e->name, LXIP_NAME_MAX);
+  name[LXIP_NAME_MAX + 1] = '\0';
+  lx.base = lxip_chunk(e);
+  lx.size = e->size;
+  return lua_load(L, getXIP, &lx, name);
+}
+
+#if defined(LUA_XIP_SIZE) && !defined(LUA_CROSS_COMPILER)
+
+#define XIP_STAGE_SIZE 256
+
+// The region starts where the file system would without it, see
+// myspiffs_mount(). A file system at a fixed location stays there, and the
+// region takes the bytes just below it instead.
+static uint32_t region_start(void) {
+#ifdef SPIFFS_FIXED_LOCATION
+  return ((SPIFFS_FIXED_LOCATION + 0x3FFF) & 0xFFFFC000) - LUA_XIP_SIZE;
+#else
+  return (platform_flash_get_first_free_block_address(NULL) + 0x3FFF) & 0xFFFFC000;
+#endif
+}
+
+// The mapped address of the region, or NULL if it lies outside the flash
+// window the cache maps or would overlap the firmware.
+const char *lxip_region(uint32_t *phys, size_t *size) {
+  uint32_t start = region_start();
+  uint32_t mapped = platform_flash_phys2mapped(start);
+
+  if (phys)
+    *phys = start;
+  if (size)
+    *size = LUA_XIP_SIZE;
+  if (mapped == (uint32_t)-1 || platform_flash_phys2mapped(start + LUA_XIP_SIZE - 1) == (uint32_t)-1)
+    return NULL;
+#ifdef SPIFFS_FIXED_LOCATION
+  if (SPIFFS_FIXED_LOCATION < LUA_XIP_SIZE ||
+      start < platform_flash_get_first_free_block_address(NULL))
+    return NULL;
+#endif
+  return (const char *)mapped;
+}
+
+// Chunks are written through a small RAM stage, so adding one needs no
+// more heap than compiling it did.
+typedef struct {
+  uint32_t addr;                    // next flash address to write
+  uint32_t end;
+  uint32_t used;
+  int status;
+  char stage[XIP_STAGE_SIZE] __attribute__((aligned(4)));
+} XIPWriter;
+
+static int stage_flush(XIPWriter *w) {
+  if (w->used > 0 && w->status == 0) {
+    if (platform_flash_write(w->stage, w->addr, w->used) != w->used)
+      w->status = LXIP_ERR_WRITE;
+    w->addr += w->used;
+  }
+  w->used = 0;
+  return w->status;
+}
+
+static int writer(lua_State *L, const void *p, size_t size, void *ud) {
+  XIPWriter *w = (XIPWriter *)ud;
+  size_t n;
+  (void)L;
+
+  if (w->addr + w->used + size > w->end)
+    w->status = LXIP_ERR_FULL;
+  while (size > 0 && w->status == 0) {
+    n = XIP_STAGE_SIZE - w->used;
+    if (n > size)
+      n = size;
+    c_memcpy(w->stage + w->used, p, n);
+    w->used += n;
+    p = (const char *)p + n;
+    size -= n;
+    if (w->used == XIP_STAGE_SIZE)
+      stage_flush(w);
+  }
+  return w->status;
+}
+
+// Appends f to the region as name. Returns 0, a LXIP_ERR_* code, or the
+// LUA_ERR_CC_* code of the dump. The header goes in last, so a chunk cut
+// short by a reset is never found.
+int lxip_add(lua_State *L, const char *name, const Proto *f) {
+  size_t size, used;
+  uint32_t phys;
+  const char *image = lxip_region(&phys, &size);
+  const uint32_t *p, *end;
+  XIPWriter *w;
+  lxip_entry e;
+  int status;
+
+  if (image == NULL)
+    return LXIP_ERR_WRITE;
+  used = lxip_used(image, size);
+  if (used + sizeof(lxip_entry) >= size)
+    return LXIP_ERR_FULL;
+
+  // flash bits only go from 1 to 0: what follows the last entry must still be erased
+  end = (const uint32_t *)(image + size);
+  for (p = (const uint32_t *)(image + used); p < end; p++) {
+    if (*p != 0xFFFFFFFF)
+      return LXIP_ERR_DIRTY;
+  }
+
+  w = (XIPWriter *)luaM_malloc(L, sizeof(XIPWriter));
+  w->addr = phys + used + sizeof(lxip_entry);
+  w->end = phys + size;
+  w->used = 0;
+  w->status = 0;
+  // stripped: line info would stay in flash, but the names of locals and
+  // upvalues would be copied to the heap on every load
+  lua_lock(L);
+  status = luaU_dump(L, f, writer, w, 1);
+  lua_unlock(L);
+  if (status == 0)
+    status = stage_flush(w);
+
+  if (status == 0) {
+    c_memset(&e, 0, sizeof(e));
+    e.magic = LXIP_MAGIC;
+    e.size = w->addr - (phys + used + sizeof(lxip_entry));
+    c_strncpy(e.name, name, LXIP_NAME_MAX);
+    if (platform_flash_write(&e, phys + used, sizeof(e)) != sizeof(e))
+      status = LXIP_ERR_WRITE;
+  }
+  luaM_free(L, w);
+  return status;
+}
+
+// Functions loaded from the region would run erased flash, so the region
+// is only erased once the collector has freed every one of them.
+int lxip_erase(lua_State *L) {
+  uint32_t sect = platform_flash_get_sector_of_address(region_start());
+  uint32_t last = platform_flash_get_sector_of_address(region_start() + LUA_XIP_SIZE - 1);
+
+  lua_gc(L, LUA_GCCOLLECT, 0);
+  if (G(L)->roprotos > 0)
+    return LXIP_ERR_LOADED;
+  while (sect <= last) {
+    if (platform_flash_erase_sector(sect++) == PLATFORM_ERR)
+      return LXIP_ERR_WRITE;
+  }
+  return 0;
+}
+
+#endif
@@ -0,0 +1,42 @@
+// Execute-in-place bytecode images
+
+#ifndef __LXIP_H__
+#define __LXIP_H__
+
+#include "lua.h"
+#include "lundump.h"
+
+// An image is a run of entries, each a header followed by a precompiled
+// chunk. Entries start on a 4 byte boundary, so the code arrays the chunk
+// aligns stay word aligned and lundump can point at them in place. The run
+// ends at the first header without LXIP_MAGIC, which erased flash never has.
+#define LXIP_MAGIC      0x5049584c  // "LXIP" read as a little endian word
+#define LXIP_NAME_MAX   32
+
+typedef struct {
+  uint32_t magic;
+  uint32_t size;                    // chunk bytes after the header
+  char name[LXIP_NAME_MAX];         // NUL padded
+} lxip_entry;
+
+#define lxip_chunk(e)   ((const char *)((e) + 1))
+#define lxip_align(n)   (((n) + 3) & ~3)
+
+const lxip_entry *lxip_next(const char *image, size_t size, const lxip_entry *e);
+const lxip_entry *lxip_find(const char *image, size_t size, const char *name);
+size_t lxip_used(const char *image, size_t size);
+int lxip_load(lua_State *L, const lxip_entry *e);
+
+#if defined(LUA_XIP_SIZE) && !defined(LUA_CROSS_COMPILER)
+// the flash region, between the firmware and the file system
+const char *lxip_region(uint32_t *phys, size_t *size);
+int lxip_add(lua_State *L, const char *name, const Proto *f);
+int lxip_erase(lua_State *L);
+
+#define LXIP_ERR_FULL   1
+#define LXIP_ERR_DIRTY  2
+#define LXIP_ERR_WRITE  3
+#define LXIP_ERR_LOADED 4   // functions loaded from the region still live
+#endif
+
+#endif
@@ -62,6 +62,7 @@ espconn_copy_partial(struct espconn *pesp_dest, struct espconn *pesp_source)
 		os_memcpy(pesp_dest->proto.udp->local_ip, pesp_source->proto.udp->local_ip, 4);
 	}
 	pesp_dest->recv_callback = pesp_source->recv_callback;
+	pesp_dest->recv_pbuf_callback = pesp_source->recv_pbuf_callback;
 	pesp_dest->sent_callback = pesp_source->sent_callback;
 	pesp_dest->link_cnt = pesp_source->link_cnt;
 	pesp_dest->reverse = pesp_source->reverse;
@@ -777,6 +778,25 @@ espconn_regist_recvcb(struct espconn *espconn, espconn_recv_callback recv_cb)
     return ESPCONN_OK;
 }
 
+/******************************************************************************
+ * FunctionName : espconn_regist_recvpbufcb
+ * Description  : used to specify the function that should be called with the
+ *                received pbuf chain, bypassing the copy into a heap buffer.
+ * Parameters   : espconn -- espconn to set the recv callback
+ *                recv_cb -- recv callback function to call when recv data
+ * Returns      : none
+*******************************************************************************/
+sint8 ICACHE_FLASH_ATTR
+espconn_regist_recvpbufcb(struct espconn *espconn, espconn_recv_pbuf_callback recv_cb)
+{
+    if (espconn == NULL) {
+    	return ESPCONN_ARG;
+    }
+
+    espconn ->recv_pbuf_callback = recv_cb;
+    return ESPCONN_OK;
+}
+
 /******************************************************************************
  * FunctionName : espconn_regist_reconcb
  * Description  : used to specify the function that should be called when connection
@@ -540,6 +540,32 @@ espconn_client_close(void *arg, struct tcp_pcb *pcb)
 	}
 }
 
+/******************************************************************************
+ * FunctionName : espconn_recved
+ * Description  : acknowledge len bytes handed to the recv pbuf callback, once
+ * 				  the application has released them, so the window reopens
+ * Parameters   : pespconn -- the espconn the data was received on
+ * 				  len -- the number of bytes released
+ * Returns      : none
+*******************************************************************************/
+void ICACHE_FLASH_ATTR
+espconn_recved(struct espconn *pespconn, uint16 len)
+{
+	espconn_msg *pnode = NULL;
+	if (len == 0)
+		return;
+	/*the connection may have been closed while the data was held, look it
+	 *up before touching the espconn*/
+	if (espconn_find_connection(pespconn, &pnode) != true || pnode->pcommon.pcb == NULL)
+		return;
+	if (pespconn->type != ESPCONN_TCP)
+		return;
+	if (pnode->recv_hold_flag == 0)
+		tcp_recved(pnode->pcommon.pcb, len);
+	else
+		pnode->recv_holded_buf_Len += len;
+}
+
 //***********Code for WIFI_BLOCK from upper**************
 sint8 ICACHE_FLASH_ATTR
 espconn_recv_hold(struct espconn *pespconn)
@@ -612,15 +638,24 @@ espconn_client_recv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
 
 	tcp_arg(pcb, arg);
 
-    if (p != NULL) {
-    	/*To update and advertise a larger window*/
+    if (p != NULL && precv_cb->pespconn->recv_pbuf_callback == NULL) {
+    	/*To update and advertise a larger window, the pbuf callback
+    	 *does it through espconn_recved once the pbuf is released*/
 		if(precv_cb->recv_hold_flag == 0)
         	tcp_recved(pcb, p->tot_len);
 		else
 			precv_cb->recv_holded_buf_Len += p->tot_len;
     }
 
-    if (err == ERR_OK && p != NULL) {
+    if (err == ERR_OK && p != NULL && precv_cb->pespconn->recv_pbuf_callback != NULL) {
+    	/*Hand the packet buffer chain over without copying it,
+    	 *the application is responsible for freeing it*/
+    	precv_cb->pespconn ->state = ESPCONN_READ;
+    	precv_cb->pcommon.pcb = pcb;
+    	precv_cb->pespconn->recv_pbuf_callback(precv_cb->pespconn, p);
+    	if (pcb->state == ESTABLISHED)
+    		precv_cb->pespconn ->state = ESPCONN_CONNECT;
+    } else if (err == ERR_OK && p != NULL) {
     	char *pdata = NULL;
     	u16_t length = 0;
     	/*Copy the contents of a packet buffer to an application buffer.
@@ -983,15 +1018,26 @@ espconn_server_recv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
 
     tcp_arg(pcb, arg);
     espconn_printf("server has application data received: %d\n", system_get_free_heap_size());
-    if (p != NULL) {
-    	/*To update and advertise a larger window*/
+    if (p != NULL && precv_cb->pespconn->recv_pbuf_callback == NULL) {
+    	/*To update and advertise a larger window, the pbuf callback
+    	 *does it through espconn_recved once the pbuf is released*/
 		if(precv_cb->recv_hold_flag == 0)
         	tcp_recved(pcb, p->tot_len);
 		else
 			precv_cb->recv_holded_buf_Len += p->tot_len;
     }
 
-    if (err == ERR_OK && p != NULL) {
+    if (err == ERR_OK && p != NULL && precv_cb->pespconn->recv_pbuf_callback != NULL) {
+    	/*clear the count for connection timeout*/
+    	precv_cb->pcommon.recv_check = 0;
+    	/*Hand the packet buffer chain over without copying it,
+    	 *the application is responsible for freeing it*/
+    	precv_cb->pespconn ->state = ESPCONN_READ;
+    	precv_cb->pcommon.pcb = pcb;
+    	precv_cb->pespconn->recv_pbuf_callback(precv_cb->pespconn, p);
+    	if (pcb->state == ESTABLISHED)
+    		precv_cb->pespconn ->state = ESPCONN_CONNECT;
+    } else if (err == ERR_OK && p != NULL) {
     	u8_t *data_ptr = NULL;
     	u32_t data_cntr = 0;
     	/*clear the count for connection timeout*/
@@ -864,6 +864,8 @@ static void json_append_data(lua_State *l, json_config_t *cfg,
     }
 }
 
+static int json_encode_chunked(lua_State *l);
+
 static int json_encode(lua_State *l)
 {
     json_config_t *cfg = json_fetch_config(l);
@@ -872,6 +874,8 @@ static int json_encode(lua_State *l)
     char *json;
     int len;
 
+    if (lua_gettop(l) > 1)
+        return json_encode_chunked(l);
     luaL_argcheck(l, lua_gettop(l) == 1, 1, "expected 1 argument");
 
     if (!cfg->encode_keep_buffer) {
@@ -1266,6 +1270,25 @@ static void json_next_token(json_parse_t *json, json_token_t *token)
     json_set_token_error(token, json, "invalid token");
 }
 
+/* Name of the token for error messages, copied out of flash to temp
+ * unless it is an error string */
+static const char *json_token_name(json_token_t *token, char *temp)
+{
+    const char *found;
+    int i;
+
+    if (token->type == T_ERROR)
+        return token->value.string;
+
+    found = json_token_type_name[token->type];
+    for (i=0; i < 16; ++i)
+    {
+        temp[i] = byte_of_aligned_array(found, i);
+        if(temp[i]==0) break;
+    }
+    return temp;
+}
+
 /* This function does not return.
  * DO NOT CALL WITH DYNAMIC MEMORY ALLOCATED.
  * The only supported exception is the temporary parser string
@@ -1280,19 +1303,7 @@ static void json_throw_parse_error(lua_State *l, json_parse_t *json,
 
     strbuf_free(json->tmp);
 
-    if (token->type == T_ERROR)
-        found = token->value.string;
-    else
-    {
-        found = json_token_type_name[token->type];
-        int i;
-        for (i=0; i < 16; ++i)
-        {
-            temp[i] = byte_of_aligned_array(found, i);
-            if(temp[i]==0) break;
-        }
-        found = temp;
-    }
+    found = json_token_name(token, temp);
 
     /* Note: token->index is 0 based, display starting from 1 */
     luaL_error(l, "Expected %s but found %s at character %d",
@@ -1479,6 +1490,578 @@ static int json_decode(lua_State *l)
     return 1;
 }
 
+/* ===== STREAMING ===== */
+
+/* The streaming encoder and decoder keep the tables they are in the
+ * middle of in the environment table of their userdata, instead of on
+ * the C stack. Their memory is bounded by the nesting depth and by the
+ * longest single string, not by the size of the document. */
+
+#define JSON_CHUNK_DEFAULT 256
+
+typedef struct {
+    strbuf_t buf;       /* encoded bytes not yet read */
+    int chunk;          /* bytes per chunk */
+    int depth;
+    int started;
+} json_encoder_t;
+
+/* Encoder environment:
+ *   [0]        the value being encoded
+ *   [3d - 2]   table open at depth d
+ *   [3d - 1]   its array length, nil for an object
+ *   [3d]       array index or object key last encoded */
+
+/* Starts encoding the value on top of the stack (popped).
+ * Tables are opened, everything else is encoded at once. */
+static void json_encoder_value(lua_State *l, json_encoder_t *enc, int env)
+{
+    json_config_t *cfg = json_fetch_config(l);
+    int len, base;
+
+    if (lua_type(l, -1) != LUA_TTABLE) {
+        json_append_data(l, cfg, enc->depth, &enc->buf);
+        lua_pop(l, 1);
+        return;
+    }
+
+    enc->depth++;
+    json_check_encode_depth(l, cfg, enc->depth, &enc->buf);
+    len = lua_array_length(l, cfg, &enc->buf);
+    base = 3 * enc->depth;
+    lua_rawseti(l, env, base - 2);
+    if (len > 0) {
+        lua_pushinteger(l, len);
+        lua_rawseti(l, env, base - 1);
+        lua_pushinteger(l, 0);
+        lua_rawseti(l, env, base);
+        strbuf_append_char(&enc->buf, '[');
+    } else {
+        strbuf_append_char(&enc->buf, '{');
+    }
+}
+
+static void json_encoder_close(lua_State *l, json_encoder_t *enc, int env,
+                               char end)
+{
+    int base = 3 * enc->depth;
+    int i;
+
+    strbuf_append_char(&enc->buf, end);
+    for (i = base - 2; i <= base; i++) {
+        lua_pushnil(l);
+        lua_rawseti(l, env, i);
+    }
+    enc->depth--;
+}
+
+/* Encodes the next element of the innermost open table */
+static void json_encoder_step(lua_State *l, json_encoder_t *enc, int env)
+{
+    json_config_t *cfg = json_fetch_config(l);
+    strbuf_t *json = &enc->buf;
+    int base = 3 * enc->depth;
+    int comma, keytype, len, i;
+
+    if (!enc->started) {
+        enc->started = 1;
+        lua_rawgeti(l, env, 0);
+        json_encoder_value(l, enc, env);
+        return;
+    }
+
+    lua_rawgeti(l, env, base - 2);
+    lua_rawgeti(l, env, base - 1);
+    if (!lua_isnil(l, -1)) {
+        /* table, length */
+        len = lua_tointeger(l, -1);
+        lua_rawgeti(l, env, base);
+        i = lua_tointeger(l, -1);
+        lua_pop(l, 2);
+        if (i == len) {
+            lua_pop(l, 1);
+            json_encoder_close(l, enc, env, ']');
+            return;
+        }
+        if (i > 0)
+            strbuf_append_char(json, ',');
+        lua_pushinteger(l, ++i);
+        lua_rawseti(l, env, base);
+        lua_rawgeti(l, -1, i);
+        lua_remove(l, -2);
+        json_encoder_value(l, enc, env);
+        return;
+    }
+    lua_pop(l, 1);
+
+    /* table, last key */
+    lua_rawgeti(l, env, base);
+    comma = !lua_isnil(l, -1);
+    if (lua_next(l, -2) == 0) {
+        lua_pop(l, 1);
+        json_encoder_close(l, enc, env, '}');
+        return;
+    }
+
+    /* table, key, value */
+    if (comma)
+        strbuf_append_char(json, ',');
+    lua_pushvalue(l, -2);
+    lua_rawseti(l, env, base);
+    keytype = lua_type(l, -2);
+    if (keytype == LUA_TNUMBER) {
+        strbuf_append_char(json, '"');
+        json_append_number(l, cfg, json, -2);
+        strbuf_append_mem(json, "\":", 2);
+    } else if (keytype == LUA_TSTRING) {
+        json_append_string(l, json, -2);
+        strbuf_append_char(json, ':');
+    } else {
+        json_encode_exception(l, cfg, json, -2,
+                              "table key must be a number or string");
+        /* never returns */
+    }
+    lua_replace(l, -3);
+    lua_pop(l, 1);
+    json_encoder_value(l, enc, env);
+}
+
+/* Encodes until a chunk is ready or the value is done. Returns the
+ * number of bytes to hand out, 0 at the end. */
+static int json_encoder_fill(lua_State *l, json_encoder_t *enc, int env)
+{
+    int len;
+
+    if (!strbuf_allocated(&enc->buf))
+        luaL_error(l, "encoder failed");
+
+    while (strbuf_length(&enc->buf) < enc->chunk &&
+           !(enc->started && enc->depth == 0))
+        json_encoder_step(l, enc, env);
+
+    len = strbuf_length(&enc->buf);
+    return len < enc->chunk ? len : enc->chunk;
+}
+
+/* Pushes the first len bytes as a string and drops them from the buffer */
+static void json_encoder_push(lua_State *l, json_encoder_t *enc, int len)
+{
+    strbuf_t *s = &enc->buf;
+
+    lua_pushlstring(l, s->buf, len);
+    c_memmove(s->buf, s->buf + len, s->length - len);
+    s->length -= len;
+}
+
+/* Pushes an encoder for the value at index */
+static json_encoder_t *json_encoder_new(lua_State *l, int index, int chunk)
+{
+    json_encoder_t *enc;
+
+    enc = (json_encoder_t *)lua_newuserdata(l, sizeof(json_encoder_t));
+    c_memset(enc, 0, sizeof(json_encoder_t));
+    enc->chunk = chunk;
+    luaL_getmetatable(l, "cjson.encoder");
+    lua_setmetatable(l, -2);
+
+    lua_newtable(l);
+    lua_pushvalue(l, index);
+    lua_rawseti(l, -2, 0);
+    lua_setfenv(l, -2);
+
+    if (-1 == strbuf_init(&enc->buf, chunk))
+        luaL_error(l, "not enough memory");
+    return enc;
+}
+
+/* Lua: cjson.encode(value, function(chunk) [, size])
+ * Hands the JSON text to the function in chunks of size bytes */
+static int json_encode_chunked(lua_State *l)
+{
+    json_encoder_t *enc;
+    int chunk = luaL_optinteger(l, 3, JSON_CHUNK_DEFAULT);
+    int len;
+
+    luaL_checktype(l, 2, LUA_TFUNCTION);
+    luaL_argcheck(l, chunk > 0, 3, "chunk size must be positive");
+
+    enc = json_encoder_new(l, 1, chunk);
+    lua_getfenv(l, -1);
+    /* value, function, [size,] encoder, env */
+    while ((len = json_encoder_fill(l, enc, lua_gettop(l))) > 0) {
+        lua_pushvalue(l, 2);
+        json_encoder_push(l, enc, len);
+        lua_call(l, 1, 0);
+    }
+    return 0;
+}
+
+/* Lua: encoder = cjson.encoder(value [, size]) */
+static int json_encoder(lua_State *l)
+{
+    int chunk = luaL_optinteger(l, 2, JSON_CHUNK_DEFAULT);
+
+    luaL_checkany(l, 1);
+    luaL_argcheck(l, chunk > 0, 2, "chunk size must be positive");
+    json_encoder_new(l, 1, chunk);
+    return 1;
+}
+
+/* Lua: chunk = encoder:read()
+ * Returns the next size bytes of JSON text, fewer for the last chunk and
+ * nil at the end. The value must not change while it is being read. */
+static int json_encoder_read(lua_State *l)
+{
+    json_encoder_t *enc = (json_encoder_t *)luaL_checkudata(l, 1, "cjson.encoder");
+    int len;
+
+    lua_getfenv(l, 1);
+    len = json_encoder_fill(l, enc, lua_gettop(l));
+    if (len == 0)
+        return 0;
+    json_encoder_push(l, enc, len);
+    return 1;
+}
+
+static int json_encoder_gc(lua_State *l)
+{
+    json_encoder_t *enc = (json_encoder_t *)luaL_checkudata(l, 1, "cjson.encoder");
+
+    strbuf_free(&enc->buf);
+    return 0;
+}
+
+typedef enum {
+    LEX_NONE,           /* between tokens */
+    LEX_STRING,
+    LEX_STRING_ESCAPE,  /* after a backslash in a string */
+    LEX_BARE            /* number, literal */
+} json_lex_t;
+
+typedef enum {
+    EXPECT_VALUE,
+    EXPECT_VALUE_OR_END,    /* just after [ */
+    EXPECT_KEY,
+    EXPECT_KEY_OR_END,      /* just after { */
+    EXPECT_COLON,
+    EXPECT_COMMA_OR_END,
+    EXPECT_NOTHING          /* document complete */
+} json_expect_t;
+
+typedef struct {
+    strbuf_t tok;       /* undecoded bytes of the current token */
+    strbuf_t str;       /* decoded string token */
+    int offset;         /* bytes written before the current chunk */
+    int tok_index;      /* where the current token started */
+    int depth;
+    json_lex_t lex;
+    json_expect_t expect;
+} json_decoder_t;
+
+/* Decoder environment:
+ *   [0]        the document, once complete
+ *   [2d - 1]   table open at depth d
+ *   [2d]       count of an array, pending key of an object */
+
+static void json_decoder_reset(lua_State *l, json_decoder_t *dec, int ud)
+{
+    dec->offset = 0;
+    dec->depth = 0;
+    dec->lex = LEX_NONE;
+    dec->expect = EXPECT_VALUE;
+    lua_newtable(l);
+    lua_setfenv(l, ud);
+}
+
+/* Resets the decoder, so the next write starts a new document, and
+ * throws. Does not return. */
+static void json_decoder_error(lua_State *l, json_decoder_t *dec,
+                               const char *exp, json_token_t *token)
+{
+    char temp[16];
+    const char *found = json_token_name(token, temp);
+
+    json_decoder_reset(l, dec, 1);
+    luaL_error(l, "Expected %s but found %s at character %d",
+               exp, found, token->index + 1);
+}
+
+/* Stores the value on top of the stack (popped) in the open table */
+static void json_decoder_value(lua_State *l, json_decoder_t *dec, int env)
+{
+    int base = 2 * dec->depth;
+    int i;
+
+    if (dec->depth == 0) {
+        lua_rawseti(l, env, 0);
+        dec->expect = EXPECT_NOTHING;
+        return;
+    }
+
+    lua_rawgeti(l, env, base);
+    lua_rawgeti(l, env, base - 1);
+    /* value, count or key, table */
+    if (lua_type(l, -2) == LUA_TNUMBER) {
+        i = lua_tointeger(l, -2) + 1;
+        lua_pushinteger(l, i);
+        lua_rawseti(l, env, base);
+        lua_insert(l, -3);
+        lua_pop(l, 1);
+        lua_rawseti(l, -2, i);
+    } else {
+        lua_insert(l, -3);
+        lua_insert(l, -2);
+        lua_rawset(l, -3);
+    }
+    lua_pop(l, 1);
+    dec->expect = EXPECT_COMMA_OR_END;
+}
+
+static void json_decoder_open(lua_State *l, json_decoder_t *dec, int env,
+                              json_token_t *token)
+{
+    json_config_t *cfg = json_fetch_config(l);
+    int base;
+
+    if (++dec->depth > cfg->decode_max_depth) {
+        json_decoder_reset(l, dec, 1);
+        luaL_error(l, "Found too many nested data structures (%d) at character %d",
+            cfg->decode_max_depth + 1, token->index + 1);
+    }
+
+    base = 2 * dec->depth;
+    lua_newtable(l);
+    lua_rawseti(l, env, base - 1);
+    if (token->type == T_ARR_BEGIN) {
+        lua_pushinteger(l, 0);
+        lua_rawseti(l, env, base);
+        dec->expect = EXPECT_VALUE_OR_END;
+    } else {
+        dec->expect = EXPECT_KEY_OR_END;
+    }
+}
+
+static void json_decoder_close(lua_State *l, json_decoder_t *dec, int env)
+{
+    int base = 2 * dec->depth;
+
+    lua_rawgeti(l, env, base - 1);
+    lua_pushnil(l);
+    lua_rawseti(l, env, base - 1);
+    lua_pushnil(l);
+    lua_rawseti(l, env, base);
+    dec->depth--;
+    json_decoder_value(l, dec, env);
+}
+
+/* Feeds one token to the parser. T_END accepts a complete document. */
+static void json_decoder_token(lua_State *l, json_decoder_t *dec, int env,
+                               json_token_t *token)
+{
+    int array;
+
+    switch (dec->expect) {
+    case EXPECT_VALUE_OR_END:
+        if (token->type == T_ARR_END) {
+            json_decoder_close(l, dec, env);
+            return;
+        }
+        /* fall through */
+    case EXPECT_VALUE:
+        switch (token->type) {
+        case T_STRING:
+            lua_pushlstring(l, token->value.string, token->string_len);
+            break;
+        case T_NUMBER:
+            lua_pushnumber(l, token->value.number);
+            break;
+        case T_BOOLEAN:
+            lua_pushboolean(l, token->value.boolean);
+            break;
+        case T_NULL:
+            lua_pushlightuserdata(l, NULL);
+            break;
+        case T_OBJ_BEGIN:
+        case T_ARR_BEGIN:
+            json_decoder_open(l, dec, env, token);
+            return;
+        default:
+            json_decoder_error(l, dec, "value", token);
+        }
+        json_decoder_value(l, dec, env);
+        return;
+    case EXPECT_KEY_OR_END:
+        if (token->type == T_OBJ_END) {
+            json_decoder_close(l, dec, env);
+            return;
+        }
+        /* fall through */
+    case EXPECT_KEY:
+        if (token->type != T_STRING)
+            json_decoder_error(l, dec, "object key string", token);
+        lua_pushlstring(l, token->value.string, token->string_len);
+        lua_rawseti(l, env, 2 * dec->depth);
+        dec->expect = EXPECT_COLON;
+        return;
+    case EXPECT_COLON:
+        if (token->type != T_COLON)
+            json_decoder_error(l, dec, "colon", token);
+        dec->expect = EXPECT_VALUE;
+        return;
+    case EXPECT_COMMA_OR_END:
+        lua_rawgeti(l, env, 2 * dec->depth);
+        array = lua_type(l, -1) == LUA_TNUMBER;
+        lua_pop(l, 1);
+        if (token->type == T_COMMA)
+            dec->expect = array ? EXPECT_VALUE : EXPECT_KEY;
+        else if (token->type == (array ? T_ARR_END : T_OBJ_END))
+            json_decoder_close(l, dec, env);
+        else
+            json_decoder_error(l, dec, array ? "comma or array end" :
+                               "comma or object end", token);
+        return;
+    case EXPECT_NOTHING:
+        if (token->type != T_END)
+            json_decoder_error(l, dec, "the end", token);
+        return;
+    }
+}
+
+/* Decodes the string, number or literal collected in tok and feeds it
+ * to the parser */
+static void json_decoder_flush(lua_State *l, json_decoder_t *dec, int env)
+{
+    json_parse_t json;
+    json_token_t token;
+
+    strbuf_ensure_null(&dec->tok);
+    strbuf_reset(&dec->str);
+    strbuf_ensure_empty_length(&dec->str, strbuf_length(&dec->tok));
+
+    json.cfg = json_fetch_config(l);
+    json.data = json.ptr = dec->tok.buf;
+    json.tmp = &dec->str;
+    json.current_depth = 0;
+    json_next_token(&json, &token);
+    if (token.type != T_ERROR && json.ptr != dec->tok.buf + dec->tok.length)
+        json_set_token_error(&token, &json, "invalid token");
+    token.index += dec->tok_index;
+    dec->lex = LEX_NONE;
+    json_decoder_token(l, dec, env, &token);
+}
+
+/* Lua: complete = decoder:write(chunk)
+ * Returns true once a complete document has been written */
+static int json_decoder_write(lua_State *l)
+{
+    json_decoder_t *dec = (json_decoder_t *)luaL_checkudata(l, 1, "cjson.decoder");
+    size_t len, i;
+    const char *data = luaL_checklstring(l, 2, &len);
+    json_token_t token;
+    int env;
+    unsigned char ch;
+
+    lua_getfenv(l, 1);
+    env = lua_gettop(l);
+
+    for (i = 0; i < len; i++) {
+        ch = data[i];
+        switch (dec->lex) {
+        case LEX_STRING_ESCAPE:
+            dec->lex = LEX_STRING;
+            strbuf_append_char(&dec->tok, ch);
+            continue;
+        case LEX_STRING:
+            strbuf_append_char(&dec->tok, ch);
+            if (ch == '\\')
+                dec->lex = LEX_STRING_ESCAPE;
+            else if (ch == '"')
+                json_decoder_flush(l, dec, env);
+            continue;
+        case LEX_BARE:
+            token.type = ch2token(ch);
+            if (ch != '"' && (token.type == T_UNKNOWN || token.type == T_ERROR)) {
+                strbuf_append_char(&dec->tok, ch);
+                continue;
+            }
+            json_decoder_flush(l, dec, env);
+            /* ch ends the token and starts the next one */
+            break;
+        case LEX_NONE:
+            break;
+        }
+
+        token.type = ch2token(ch);
+        token.index = dec->offset + i;
+        if (token.type == T_WHITESPACE)
+            continue;
+        if (token.type == T_UNKNOWN || token.type == T_ERROR) {
+            strbuf_reset(&dec->tok);
+            strbuf_append_char(&dec->tok, ch);
+            dec->tok_index = token.index;
+            dec->lex = ch == '"' ? LEX_STRING : LEX_BARE;
+            continue;
+        }
+        json_decoder_token(l, dec, env, &token);
+    }
+    dec->offset += len;
+
+    lua_pushboolean(l, dec->expect == EXPECT_NOTHING && dec->lex == LEX_NONE);
+    return 1;
+}
+
+/* Lua: value = decoder:result()
+ * Ends the document and returns it. The decoder is ready for the next. */
+static int json_decoder_result(lua_State *l)
+{
+    json_decoder_t *dec = (json_decoder_t *)luaL_checkudata(l, 1, "cjson.decoder");
+    json_token_t token;
+    int env;
+
+    lua_getfenv(l, 1);
+    env = lua_gettop(l);
+
+    if (dec->lex == LEX_BARE)
+        json_decoder_flush(l, dec, env);
+    token.type = T_END;
+    token.index = dec->offset;
+    if (dec->lex != LEX_NONE) {
+        token.type = T_ERROR;
+        token.index = dec->tok_index;
+        token.value.string = "unexpected end of string";
+    }
+    json_decoder_token(l, dec, env, &token);
+
+    lua_rawgeti(l, env, 0);
+    json_decoder_reset(l, dec, 1);
+    return 1;
+}
+
+static int json_decoder_gc(lua_State *l)
+{
+    json_decoder_t *dec = (json_decoder_t *)luaL_checkudata(l, 1, "cjson.decoder");
+
+    strbuf_free(&dec->tok);
+    strbuf_free(&dec->str);
+    return 0;
+}
+
+/* Lua: decoder = cjson.decoder() */
+static int json_decoder(lua_State *l)
+{
+    json_decoder_t *dec;
+
+    dec = (json_decoder_t *)lua_newuserdata(l, sizeof(json_decoder_t));
+    c_memset(dec, 0, sizeof(json_decoder_t));
+    luaL_getmetatable(l, "cjson.decoder");
+    lua_setmetatable(l, -2);
+    json_decoder_reset(l, dec, lua_gettop(l));
+
+    if (-1 == strbuf_init(&dec->tok, 32) || -1 == strbuf_init(&dec->str, 32))
+        return luaL_error(l, "not enough memory");
+    return 1;
+}
+
 /* ===== INITIALISATION ===== */
 #if 0
 #if !defined(LUA_VERSION_NUM) || LUA_VERSION_NUM < 502
@@ -1599,10 +2182,27 @@ int luaopen_cjson_safe(lua_State *l)
 }
 #endif
 
+static const LUA_REG_TYPE cjson_encoder_map[] = {
+  { LSTRKEY( "read" ),                    LFUNCVAL( json_encoder_read ) },
+  { LSTRKEY( "__gc" ),                    LFUNCVAL( json_encoder_gc ) },
+  { LSTRKEY( "__index" ),                 LROVAL( cjson_encoder_map ) },
+  { LNILKEY, LNILVAL }
+};
+
+static const LUA_REG_TYPE cjson_decoder_map[] = {
+  { LSTRKEY( "write" ),                   LFUNCVAL( json_decoder_write ) },
+  { LSTRKEY( "result" ),                  LFUNCVAL( json_decoder_result ) },
+  { LSTRKEY( "__gc" ),                    LFUNCVAL( json_decoder_gc ) },
+  { LSTRKEY( "__index" ),                 LROVAL( cjson_decoder_map ) },
+  { LNILKEY, LNILVAL }
+};
+
 // Module function map
 static const LUA_REG_TYPE cjson_map[] = {
   { LSTRKEY( "encode" ),                  LFUNCVAL( json_encode ) },
   { LSTRKEY( "decode" ),                  LFUNCVAL( json_decode ) },
+  { LSTRKEY( "encoder" ),                 LFUNCVAL( json_encoder ) },
+  { LSTRKEY( "decoder" ),                 LFUNCVAL( json_decoder ) },
 //{ LSTRKEY( "encode_sparse_array" ),     LFUNCVAL( json_cfg_encode_sparse_array ) },
 //{ LSTRKEY( "encode_max_depth" ),        LFUNCVAL( json_cfg_encode_max_depth ) },
 //{ LSTRKEY( "decode_max_depth" ),        LFUNCVAL( json_cfg_decode_max_depth ) },
@@ -1618,6 +2218,9 @@ int luaopen_cjson( lua_State *L )
 {
   cjson_mem_setlua (L);
 
+  luaL_rometatable(L, "cjson.encoder", (void *)cjson_encoder_map);
+  luaL_rometatable(L, "cjson.decoder", (void *)cjson_decoder_map);
+
   /* Initialise number conversions */
   // fpconv_init();         // not needed for a specific cpu.
   if(-1==cfg_init(&_cfg)){
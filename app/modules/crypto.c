@@ -5,6 +5,7 @@
 #include "platform.h"
 #include "c_types.h"
 #include "c_stdlib.h"
+#include "flash_fs.h"
 #include "../crypto/digests.h"
 
 #include "user_interface.h"
@@ -149,6 +150,153 @@ static int crypto_lhmac (lua_State *L)
 }
 
 
+/* The state of a streaming hash or HMAC lives in the userdata itself: the
+ * mech context, then for a HMAC the inner and outer pads.
+ */
+typedef struct
+{
+  const digest_mech_info_t *mi;
+  uint8_t hmac;
+  uint64_t ctx[0];
+} digest_user_datum_t;
+
+#define digest_pads(dudat) ((uint8_t *)(dudat)->ctx + (dudat)->mi->ctx_size)
+
+static int crypto_new_digest (lua_State *L, int hmac)
+{
+  const digest_mech_info_t *mi = crypto_digest_mech (luaL_checkstring (L, 1));
+  if (!mi)
+    return bad_mech (L);
+  size_t klen = 0;
+  const char *key = hmac ? luaL_checklstring (L, 2, &klen) : NULL;
+
+  size_t size = sizeof (digest_user_datum_t) + mi->ctx_size + (hmac ? 2 * mi->block_size : 0);
+  digest_user_datum_t *dudat = (digest_user_datum_t *)lua_newuserdata (L, size);
+  luaL_getmetatable (L, "crypto.hash");
+  lua_setmetatable (L, -2);
+
+  dudat->mi = mi;
+  dudat->hmac = hmac;
+  if (hmac)
+  {
+    uint8_t *k_ipad = digest_pads (dudat);
+    crypto_hmac_pads (mi, dudat->ctx, key, klen, k_ipad, k_ipad + mi->block_size);
+    crypto_hmac_begin (mi, dudat->ctx, k_ipad);
+  }
+  else
+    mi->create (dudat->ctx);
+  return 1;
+}
+
+/* hashobj = crypto.new_hash("SHA256")
+ */
+static int crypto_new_hash (lua_State *L)
+{
+  return crypto_new_digest (L, 0);
+}
+
+/* hmacobj = crypto.new_hmac("SHA256", key)
+ */
+static int crypto_new_hmac (lua_State *L)
+{
+  return crypto_new_digest (L, 1);
+}
+
+/* hashobj:update(str)
+ */
+static int crypto_digest_update (lua_State *L)
+{
+  digest_user_datum_t *dudat = (digest_user_datum_t *)luaL_checkudata (L, 1, "crypto.hash");
+  size_t len = 0;
+  const char *data = luaL_checklstring (L, 2, &len);
+
+  dudat->mi->update (dudat->ctx, data, len);
+  return 0;
+}
+
+/* rawdigest = hashobj:finalize()
+ * The object starts over afterwards, with the same key for a HMAC.
+ */
+static int crypto_digest_finalize (lua_State *L)
+{
+  digest_user_datum_t *dudat = (digest_user_datum_t *)luaL_checkudata (L, 1, "crypto.hash");
+  const digest_mech_info_t *mi = dudat->mi;
+  uint8_t digest[mi->digest_size];
+
+  if (dudat->hmac)
+  {
+    uint8_t *k_ipad = digest_pads (dudat);
+    crypto_hmac_finalize (mi, dudat->ctx, k_ipad + mi->block_size, digest);
+    crypto_hmac_begin (mi, dudat->ctx, k_ipad);
+  }
+  else
+  {
+    mi->finalize (digest, dudat->ctx);
+    mi->create (dudat->ctx);
+  }
+
+  lua_pushlstring (L, digest, sizeof (digest));
+  return 1;
+}
+
+
+/* rawdigest = crypto.fhash("SHA256", "init.lua")
+ * The file goes through the digest a flash page at a time. A read error
+ * ends the file early, so the bytes hashed are checked against its size.
+ */
+static int crypto_flhash (lua_State *L)
+{
+  const digest_mech_info_t *mi = crypto_digest_mech (luaL_checkstring (L, 1));
+  if (!mi)
+    return bad_mech (L);
+  const char *filename = luaL_checkstring (L, 2);
+
+  void *ctx = c_malloc (mi->ctx_size);
+  if (!ctx)
+    return bad_mem (L);
+  int fd = fs_open (filename, FS_RDONLY);
+  if (fd < FS_OPEN_OK)
+  {
+    c_free (ctx);
+    return luaL_error (L, "cannot open %s", filename);
+  }
+
+  fs_buf fb;
+  const char *data;
+  size_t len, total = 0;
+  int size = fs_seek (fd, 0, FS_SEEK_END);
+  fs_seek (fd, 0, FS_SEEK_SET);
+  fs_buf_init (&fb, fd);
+  mi->create (ctx);
+  while ((data = fs_buf_next (&fb, &len)) != NULL)
+  {
+    mi->update (ctx, data, len);
+    total += len;
+  }
+  fs_close (fd);
+  if (size < 0 || total != (size_t)size)
+  {
+    c_free (ctx);
+    return luaL_error (L, "read error on %s", filename);
+  }
+
+  uint8_t digest[mi->digest_size];
+  mi->finalize (digest, ctx);
+  c_free (ctx);
+
+  lua_pushlstring (L, digest, sizeof (digest));
+  return 1;
+}
+
+
+// Hash and HMAC object method map
+static const LUA_REG_TYPE crypto_hash_map[] = {
+  { LSTRKEY( "update" ),   LFUNCVAL( crypto_digest_update ) },
+  { LSTRKEY( "finalize" ), LFUNCVAL( crypto_digest_finalize ) },
+  { LSTRKEY( "__index" ),  LROVAL( crypto_hash_map ) },
+  { LNILKEY, LNILVAL }
+};
+
 // Module function map
 static const LUA_REG_TYPE crypto_map[] = {
   { LSTRKEY( "sha1" ),     LFUNCVAL( crypto_sha1 ) },
@@ -157,7 +305,16 @@ static const LUA_REG_TYPE crypto_map[] = {
   { LSTRKEY( "mask" ),     LFUNCVAL( crypto_mask ) },
   { LSTRKEY( "hash"   ),   LFUNCVAL( crypto_lhash ) },
   { LSTRKEY( "hmac"   ),   LFUNCVAL( crypto_lhmac ) },
+  { LSTRKEY( "new_hash" ), LFUNCVAL( crypto_new_hash ) },
+  { LSTRKEY( "new_hmac" ), LFUNCVAL( crypto_new_hmac ) },
+  { LSTRKEY( "fhash" ),    LFUNCVAL( crypto_flhash ) },
   { LNILKEY, LNILVAL }
 };
 
-NODEMCU_MODULE(CRYPTO, "crypto", crypto_map, NULL);
+int luaopen_crypto (lua_State *L)
+{
+  luaL_rometatable (L, "crypto.hash", (void *)crypto_hash_map);  // create metatable for hash objects
+  return 0;
+}
+
+NODEMCU_MODULE(CRYPTO, "crypto", crypto_map, luaopen_crypto);
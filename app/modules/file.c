@@ -7,49 +7,144 @@
 #include "c_types.h"
 #include "flash_fs.h"
 #include "c_string.h"
+#include "c_stdlib.h"
 
-static volatile int file_fd = FS_OPEN_OK - 1;
+typedef struct lfile_userdata
+{
+  int fd;
+  fs_buf *fb;     // read-ahead for read()/readline(), allocated on first use
+  uint16_t gen;   // file_gen when opened
+} lfile_userdata;
 
-// Lua: open(filename, mode)
-static int file_open( lua_State* L )
+// the file used by the module level functions, the last one opened
+static int file_cur_ref = LUA_NOREF;
+
+// bumped by format(): the descriptors of older file objects are gone, and
+// their numbers may be handed out again to other files
+static uint16_t file_gen;
+
+// give the fd back its logical position before raw seeks and writes
+static void file_sync_fb( lfile_userdata *ud )
 {
-  size_t len;
-  if((FS_OPEN_OK - 1)!=file_fd){
-    fs_close(file_fd);
-    file_fd = FS_OPEN_OK - 1;
+  if(ud->fb)
+    fs_buf_sync(ud->fb);
+}
+
+static void file_release( lfile_userdata *ud )
+{
+  if((FS_OPEN_OK - 1)!=ud->fd){
+    if(ud->gen == file_gen)
+      fs_close(ud->fd);
+    ud->fd = FS_OPEN_OK - 1;
+  }
+  if(ud->fb){
+    c_free(ud->fb);
+    ud->fb = NULL;
+  }
+}
+
+// The file a call works on: self when called as a method, otherwise the
+// last opened file. *arg is set to the index of the first real argument.
+static lfile_userdata *file_self( lua_State* L, int *arg )
+{
+  lfile_userdata *ud = NULL;
+
+  *arg = 1;
+  if(lua_type(L, 1) == LUA_TUSERDATA && lua_getmetatable(L, 1)){
+    luaL_getmetatable(L, "file.obj");
+    if(lua_rawequal(L, -1, -2)){
+      ud = (lfile_userdata *)lua_touserdata(L, 1);
+      *arg = 2;
+    }
+    lua_pop(L, 2);
+  }
+  if(ud == NULL && file_cur_ref != LUA_NOREF){
+    lua_rawgeti(L, LUA_REGISTRYINDEX, file_cur_ref);
+    ud = (lfile_userdata *)lua_touserdata(L, -1);
+    lua_pop(L, 1);  // still referenced from the registry
   }
+  if(ud == NULL || (FS_OPEN_OK - 1)==ud->fd)
+    luaL_error(L, "open a file first");
+  if(ud->gen != file_gen){
+    file_release(ud);
+    luaL_error(L, "file closed by format");
+  }
+  return ud;
+}
+
+// close the last opened file, as open() used to do implicitly
+static void file_close_cur( lua_State* L )
+{
+  if(file_cur_ref == LUA_NOREF)
+    return;
+  lua_rawgeti(L, LUA_REGISTRYINDEX, file_cur_ref);
+  file_release((lfile_userdata *)lua_touserdata(L, -1));
+  lua_pop(L, 1);
+  luaL_unref(L, LUA_REGISTRYINDEX, file_cur_ref);
+  file_cur_ref = LUA_NOREF;
+}
 
+// Lua: f = open(filename, mode)
+static int file_open( lua_State* L )
+{
+  size_t len;
   const char *fname = luaL_checklstring( L, 1, &len );
   if( len > FS_NAME_MAX_LENGTH )
     return luaL_error(L, "filename too long");
   const char *mode = luaL_optstring(L, 2, "r");
 
-  file_fd = fs_open(fname, fs_mode2flag(mode));
-
-  if(file_fd < FS_OPEN_OK){
-    file_fd = FS_OPEN_OK - 1;
+  int fd = fs_open(fname, fs_mode2flag(mode));
+  if(fd == FS_ERR_NO_FD){
+    // unreachable file objects may still hold descriptors
+    lua_gc(L, LUA_GCCOLLECT, 0);
+    fd = fs_open(fname, fs_mode2flag(mode));
+  }
+  if(fd < FS_OPEN_OK){
     lua_pushnil(L);
-  } else {
-    lua_pushboolean(L, 1);
+    return 1;
   }
+
+  lfile_userdata *ud = (lfile_userdata *)lua_newuserdata(L, sizeof(lfile_userdata));
+  ud->fd = fd;
+  ud->fb = NULL;
+  ud->gen = file_gen;
+  luaL_getmetatable(L, "file.obj");
+  lua_setmetatable(L, -2);
+
+  // earlier objects stay open, only the module level default moves on
+  if(file_cur_ref != LUA_NOREF)
+    luaL_unref(L, LUA_REGISTRYINDEX, file_cur_ref);
+  lua_pushvalue(L, -1);
+  file_cur_ref = luaL_ref(L, LUA_REGISTRYINDEX);
   return 1; 
 }
 
-// Lua: close()
+// Lua: close(), f:close()
 static int file_close( lua_State* L )
 {
-  if((FS_OPEN_OK - 1)!=file_fd){
-    fs_close(file_fd);
-    file_fd = FS_OPEN_OK - 1;
+  if(lua_type(L, 1) == LUA_TUSERDATA){
+    lfile_userdata *ud = (lfile_userdata *)luaL_checkudata(L, 1, "file.obj");
+    file_release(ud);
+    return 0;
   }
+  file_close_cur(L);
   return 0;  
 }
 
+// f.__gc
+static int file_obj_gc( lua_State* L )
+{
+  lfile_userdata *ud = (lfile_userdata *)luaL_checkudata(L, 1, "file.obj");
+  file_release(ud);
+  return 0;
+}
+
 // Lua: format()
 static int file_format( lua_State* L )
 {
   size_t len;
-  file_close(L);
+  file_close_cur(L);
+  file_gen++;   // every other file object is closed as well
   if( !fs_format() )
   {
     NODE_ERR( "\ni*** ERROR ***: unable to format. FS might be compromised.\n" );
@@ -98,19 +193,21 @@ static int file_list( lua_State* L )
   return 1;
 }
 
+// Lua: seek(whence, offset), f:seek(whence, offset)
 static int file_seek (lua_State *L) 
 {
   static const int mode[] = {FS_SEEK_SET, FS_SEEK_CUR, FS_SEEK_END};
   static const char *const modenames[] = {"set", "cur", "end", NULL};
-  if((FS_OPEN_OK - 1)==file_fd)
-    return luaL_error(L, "open a file first");
-  int op = luaL_checkoption(L, 1, "cur", modenames);
-  long offset = luaL_optlong(L, 2, 0);
-  op = fs_seek(file_fd, offset, mode[op]);
+  int arg;
+  lfile_userdata *ud = file_self(L, &arg);
+  int op = luaL_checkoption(L, arg, "cur", modenames);
+  long offset = luaL_optlong(L, arg + 1, 0);
+  file_sync_fb(ud);
+  op = fs_seek(ud->fd, offset, mode[op]);
   if (op < 0)
     lua_pushnil(L);  /* error */
   else
-    lua_pushinteger(L, fs_tell(file_fd));
+    lua_pushinteger(L, fs_tell(ud->fd));
   return 1;
 }
 
@@ -121,17 +218,20 @@ static int file_remove( lua_State* L )
   const char *fname = luaL_checklstring( L, 1, &len );
   if( len > FS_NAME_MAX_LENGTH )
     return luaL_error(L, "filename too long");
-  file_close(L);
+  file_close_cur(L);
+  if(myspiffs_is_open(fname))
+    return luaL_error(L, "file is open");
   SPIFFS_remove(&fs, (char *)fname);
   return 0;  
 }
 
-// Lua: flush()
+// Lua: flush(), f:flush()
 static int file_flush( lua_State* L )
 {
-  if((FS_OPEN_OK - 1)==file_fd)
-    return luaL_error(L, "open a file first");
-  if(fs_flush(file_fd) == 0)
+  int arg;
+  lfile_userdata *ud = file_self(L, &arg);
+  file_sync_fb(ud);
+  if(fs_flush(ud->fd) == 0)
     lua_pushboolean(L, 1);
   else
     lua_pushnil(L);
@@ -151,10 +251,7 @@ static int file_check( lua_State* L )
 static int file_rename( lua_State* L )
 {
   size_t len;
-  if((FS_OPEN_OK - 1)!=file_fd){
-    fs_close(file_fd);
-    file_fd = FS_OPEN_OK - 1;
-  }
+  file_close_cur(L);
 
   const char *oldname = luaL_checklstring( L, 1, &len );
   if( len > FS_NAME_MAX_LENGTH )
@@ -164,6 +261,8 @@ static int file_rename( lua_State* L )
   if( len > FS_NAME_MAX_LENGTH )
     return luaL_error(L, "filename too long");
 
+  if(myspiffs_is_open(oldname))
+    return luaL_error(L, "file is open");
   if(SPIFFS_OK==myspiffs_rename( oldname, newname )){
     lua_pushboolean(L, 1);
   } else {
@@ -188,10 +287,47 @@ static int file_fsinfo( lua_State* L )
   return 3;
 }
 
+// Lua: t = fscachestats([reset])
+static int file_fscachestats( lua_State* L )
+{
+  myspiffs_wb_stats wb;
+  int reset = lua_toboolean(L, 1);
+
+  myspiffs_writeback_stats(&wb, reset);
+  lua_createtable(L, 0, 7);
+#if SPIFFS_CACHE_STATS
+  lua_pushinteger(L, fs.cache_hits);
+  lua_setfield(L, -2, "hits");
+  lua_pushinteger(L, fs.cache_misses);
+  lua_setfield(L, -2, "misses");
+  lua_pushinteger(L, fs.cache_evictions);
+  lua_setfield(L, -2, "evictions");
+  if(reset)
+    fs.cache_hits = fs.cache_misses = fs.cache_evictions = 0;
+#endif
+  lua_pushinteger(L, myspiffs_cache_pages());
+  lua_setfield(L, -2, "pages");
+  lua_pushinteger(L, wb.writes);
+  lua_setfield(L, -2, "wb_writes");
+  lua_pushinteger(L, wb.merged);
+  lua_setfield(L, -2, "wb_merged");
+  lua_pushinteger(L, wb.programs);
+  lua_setfield(L, -2, "wb_programs");
+  return 1;
+}
+
+// Lua: fswriteback(enable)
+static int file_fswriteback( lua_State* L )
+{
+  if(!myspiffs_writeback(lua_toboolean(L, 1)))
+    return luaL_error(L, "not enough memory");
+  return 0;
+}
+
 #endif
 
 // g_read()
-static int file_g_read( lua_State* L, int n, int16_t end_char )
+static int file_g_read( lua_State* L, lfile_userdata *ud, int n, int16_t end_char )
 {
   if(n <= 0 || n > LUAL_BUFFERSIZE)
     n = LUAL_BUFFERSIZE;
@@ -199,27 +335,29 @@ static int file_g_read( lua_State* L, int n, int16_t end_char )
     end_char = EOF;
   
   luaL_Buffer b;
-  if((FS_OPEN_OK - 1)==file_fd)
-    return luaL_error(L, "open a file first");
+  if(ud->fb == NULL){
+    ud->fb = (fs_buf *)c_malloc(sizeof(fs_buf));
+    if(ud->fb == NULL)
+      return luaL_error(L, "not enough memory");
+    fs_buf_init(ud->fb, ud->fd);
+  }
 
   luaL_buffinit(L, &b);
   char *p = luaL_prepbuffer(&b);
-  int i;
+  int i = 0, c;
 
-  n = fs_read(file_fd, p, n);
-  for (i = 0; i < n; ++i)
-    if (p[i] == end_char)
-    {
-      ++i;
+  // served from the page buffer, nothing to seek back over afterwards
+  while(i < n && (c = fs_buf_getc(ud->fb)) != EOF){
+    p[i++] = (char)c;
+    if(c == end_char)
       break;
-    }
+  }
 
   if(i==0){
     luaL_pushresult(&b);  /* close buffer */
     return (lua_objlen(L, -1) > 0);  /* check whether read something */
   }
 
-  fs_seek(file_fd, -(n - i), SEEK_CUR);
   luaL_addsize(&b, i);
   luaL_pushresult(&b);  /* close buffer */
   return 1;  /* read at least an `eol' */ 
@@ -229,44 +367,50 @@ static int file_g_read( lua_State* L, int n, int16_t end_char )
 // file.read() will read all byte in file
 // file.read(10) will read 10 byte from file, or EOF is reached.
 // file.read('q') will read until 'q' or EOF is reached. 
+// f:read() etc. work the same on a file object
 static int file_read( lua_State* L )
 {
   unsigned need_len = LUAL_BUFFERSIZE;
   int16_t end_char = EOF;
   size_t el;
-  if( lua_type( L, 1 ) == LUA_TNUMBER )
+  int arg;
+  lfile_userdata *ud = file_self(L, &arg);
+  if( lua_type( L, arg ) == LUA_TNUMBER )
   {
-    need_len = ( unsigned )luaL_checkinteger( L, 1 );
+    need_len = ( unsigned )luaL_checkinteger( L, arg );
     if( need_len > LUAL_BUFFERSIZE ){
       need_len = LUAL_BUFFERSIZE;
     }
   }
-  else if(lua_isstring(L, 1))
+  else if(lua_isstring(L, arg))
   {
-    const char *end = luaL_checklstring( L, 1, &el );
+    const char *end = luaL_checklstring( L, arg, &el );
     if(el!=1){
       return luaL_error( L, "wrong arg range" );
     }
     end_char = (int16_t)end[0];
   }
 
-  return file_g_read(L, need_len, end_char);
+  return file_g_read(L, ud, need_len, end_char);
 }
 
-// Lua: readline()
+// Lua: readline(), f:readline()
 static int file_readline( lua_State* L )
 {
-  return file_g_read(L, LUAL_BUFFERSIZE, '\n');
+  int arg;
+  lfile_userdata *ud = file_self(L, &arg);
+  return file_g_read(L, ud, LUAL_BUFFERSIZE, '\n');
 }
 
-// Lua: write("string")
+// Lua: write("string"), f:write("string")
 static int file_write( lua_State* L )
 {
-  if((FS_OPEN_OK - 1)==file_fd)
-    return luaL_error(L, "open a file first");
+  int arg;
+  lfile_userdata *ud = file_self(L, &arg);
   size_t l, rl;
-  const char *s = luaL_checklstring(L, 1, &l);
-  rl = fs_write(file_fd, s, l);
+  const char *s = luaL_checklstring(L, arg, &l);
+  file_sync_fb(ud);
+  rl = fs_write(ud->fd, s, l);
   if(rl==l)
     lua_pushboolean(L, 1);
   else
@@ -274,16 +418,17 @@ static int file_write( lua_State* L )
   return 1;
 }
 
-// Lua: writeline("string")
+// Lua: writeline("string"), f:writeline("string")
 static int file_writeline( lua_State* L )
 {
-  if((FS_OPEN_OK - 1)==file_fd)
-    return luaL_error(L, "open a file first");
+  int arg;
+  lfile_userdata *ud = file_self(L, &arg);
   size_t l, rl;
-  const char *s = luaL_checklstring(L, 1, &l);
-  rl = fs_write(file_fd, s, l);
+  const char *s = luaL_checklstring(L, arg, &l);
+  file_sync_fb(ud);
+  rl = fs_write(ud->fd, s, l);
   if(rl==l){
-    rl = fs_write(file_fd, "\n", 1);
+    rl = fs_write(ud->fd, "\n", 1);
     if(rl==1)
       lua_pushboolean(L, 1);
     else
@@ -295,6 +440,22 @@ static int file_writeline( lua_State* L )
   return 1;
 }
 
+// File object method map
+static const LUA_REG_TYPE file_obj_map[] = {
+  { LSTRKEY( "close" ),     LFUNCVAL( file_close ) },
+  { LSTRKEY( "write" ),     LFUNCVAL( file_write ) },
+  { LSTRKEY( "writeline" ), LFUNCVAL( file_writeline ) },
+  { LSTRKEY( "read" ),      LFUNCVAL( file_read ) },
+  { LSTRKEY( "readline" ),  LFUNCVAL( file_readline ) },
+#if defined(BUILD_SPIFFS) && !defined(BUILD_WOFS)
+  { LSTRKEY( "seek" ),      LFUNCVAL( file_seek ) },
+  { LSTRKEY( "flush" ),     LFUNCVAL( file_flush ) },
+#endif
+  { LSTRKEY( "__gc" ),      LFUNCVAL( file_obj_gc ) },
+  { LSTRKEY( "__index" ),   LROVAL( file_obj_map ) },
+  { LNILKEY, LNILVAL }
+};
+
 // Module function map
 static const LUA_REG_TYPE file_map[] = {
   { LSTRKEY( "list" ),      LFUNCVAL( file_list ) },
@@ -312,8 +473,16 @@ static const LUA_REG_TYPE file_map[] = {
 //{ LSTRKEY( "check" ),     LFUNCVAL( file_check ) },
   { LSTRKEY( "rename" ),    LFUNCVAL( file_rename ) },
   { LSTRKEY( "fsinfo" ),    LFUNCVAL( file_fsinfo ) },
+  { LSTRKEY( "fscachestats" ), LFUNCVAL( file_fscachestats ) },
+  { LSTRKEY( "fswriteback" ), LFUNCVAL( file_fswriteback ) },
 #endif
   { LNILKEY, LNILVAL }
 };
 
-NODEMCU_MODULE(FILE, "file", file_map, NULL);
+int luaopen_file( lua_State *L )
+{
+  luaL_rometatable(L, "file.obj", (void *)file_obj_map);  // create metatable for file objects
+  return 0;
+}
+
+NODEMCU_MODULE(FILE, "file", file_map, luaopen_file);
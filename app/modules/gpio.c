@@ -18,6 +18,7 @@
 
 #ifdef GPIO_INTERRUPT_ENABLE
 static int gpio_cb_ref[GPIO_PIN_NUM];
+static uint8_t gpio_cb_batch[GPIO_PIN_NUM];
 static lua_State* gL = NULL;
 
 void lua_gpio_unref(unsigned pin){
@@ -26,21 +27,61 @@ void lua_gpio_unref(unsigned pin){
       luaL_unref(gL, LUA_REGISTRYINDEX, gpio_cb_ref[pin]);
   }
   gpio_cb_ref[pin] = LUA_NOREF;
+  gpio_cb_batch[pin] = 0;
 }
 
-void gpio_intr_callback( unsigned pin, unsigned level )
+// Runs in the Lua task, never in the interrupt. Takes at most one queue
+// worth of edges per run so a bouncing input cannot starve other tasks.
+static void gpio_event_handler( void )
 {
-  NODE_DBG("pin:%d, level:%d \n", pin, level);
-  if(gpio_cb_ref[pin] == LUA_NOREF)
-    return;
-  if(!gL)
+  platform_gpio_event_t ev;
+  int batch[GPIO_PIN_NUM];   // stack index of each pin's edge table
+  int count[GPIO_PIN_NUM];
+  int n, pin, top;
+
+  if(!gL){
+    while(platform_gpio_event_get(&ev));
     return;
-  lua_rawgeti(gL, LUA_REGISTRYINDEX, gpio_cb_ref[pin]);
-  lua_pushinteger(gL, level);
-  lua_call(gL, 1, 0);
+  }
+  top = lua_gettop(gL);
+  c_memset(batch, 0, sizeof(batch));
+  for(n = 0; n < PLATFORM_GPIO_EVENTS && platform_gpio_event_get(&ev); n++)
+  {
+    NODE_DBG("pin:%d, level:%d \n", ev.pin, ev.level);
+    pin = ev.pin;
+    if(gpio_cb_ref[pin] == LUA_NOREF)
+      continue;
+    if(gpio_cb_batch[pin]){
+      if(!batch[pin]){
+        lua_checkstack(gL, 2);
+        lua_createtable(gL, 2 * PLATFORM_GPIO_EVENTS, 0);
+        batch[pin] = lua_gettop(gL);
+        count[pin] = 0;
+      }
+      lua_pushinteger(gL, ev.level);
+      lua_rawseti(gL, batch[pin], ++count[pin]);
+      lua_pushnumber(gL, ev.ccount);
+      lua_rawseti(gL, batch[pin], ++count[pin]);
+      continue;
+    }
+    lua_rawgeti(gL, LUA_REGISTRYINDEX, gpio_cb_ref[pin]);
+    lua_pushinteger(gL, ev.level);
+    lua_pushnumber(gL, ev.ccount);
+    lua_call(gL, 2, 0);
+  }
+  // batch callbacks get { level, ccount, level, ccount, ... }
+  for(pin = 0; pin < GPIO_PIN_NUM; pin++)
+  {
+    if(!batch[pin] || gpio_cb_ref[pin] == LUA_NOREF)
+      continue;
+    lua_rawgeti(gL, LUA_REGISTRYINDEX, gpio_cb_ref[pin]);
+    lua_pushvalue(gL, batch[pin]);
+    lua_call(gL, 1, 0);
+  }
+  lua_settop(gL, top);
 }
 
-// Lua: trig( pin, type, function )
+// Lua: trig( pin, type, function, batch )
 static int lgpio_trig( lua_State* L )
 {
   unsigned type;
@@ -76,11 +117,19 @@ static int lgpio_trig( lua_State* L )
     if(gpio_cb_ref[pin] != LUA_NOREF)
       luaL_unref(L, LUA_REGISTRYINDEX, gpio_cb_ref[pin]);
     gpio_cb_ref[pin] = luaL_ref(L, LUA_REGISTRYINDEX);
+    gpio_cb_batch[pin] = lua_toboolean(L, 4);
   }
 
   platform_gpio_intr_init(pin, type);
   return 0;  
 }
+
+// Lua: n = overflow( reset )
+static int lgpio_overflow( lua_State* L )
+{
+  lua_pushnumber( L, platform_gpio_event_overflow( lua_toboolean( L, 1 ) ) );
+  return 1;
+}
 #endif
 
 // Lua: mode( pin, mode, pullup )
@@ -107,6 +156,7 @@ static int lgpio_mode( lua_State* L )
       luaL_unref(L, LUA_REGISTRYINDEX, gpio_cb_ref[pin]);
     }
     gpio_cb_ref[pin] = LUA_NOREF;
+    gpio_cb_batch[pin] = 0;
   }
 #endif
   int r = platform_gpio_mode( pin, mode, pullup );
@@ -227,6 +277,7 @@ static const LUA_REG_TYPE gpio_map[] = {
   { LSTRKEY( "serout" ), LFUNCVAL( lgpio_serout ) },
 #ifdef GPIO_INTERRUPT_ENABLE
   { LSTRKEY( "trig" ),   LFUNCVAL( lgpio_trig ) },
+  { LSTRKEY( "overflow" ), LFUNCVAL( lgpio_overflow ) },
   { LSTRKEY( "INT" ),    LNUMVAL( INTERRUPT ) },
 #endif
   { LSTRKEY( "OUTPUT" ), LNUMVAL( OUTPUT ) },
@@ -244,7 +295,7 @@ int luaopen_gpio( lua_State *L ) {
   for(i=0;i<GPIO_PIN_NUM;i++){
     gpio_cb_ref[i] = LUA_NOREF;
   }
-  platform_gpio_init(gpio_intr_callback);
+  platform_gpio_init(gpio_event_handler);
 #endif
   return 0;
 }
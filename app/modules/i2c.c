@@ -3,6 +3,7 @@
 #include "module.h"
 #include "lauxlib.h"
 #include "platform.h"
+#include "c_stdlib.h"
 
 // Lua: speed = i2c.setup( id, sda, scl, speed )
 static int i2c_setup( lua_State *L )
@@ -139,6 +140,84 @@ static int i2c_read( lua_State *L )
   return 1;
 }
 
+// Lua: data, wrote = i2c.transfer( id, address, { write = data, read = size, repeated_start = true } )
+// write can be a string, a table or an 8-bit number. The whole transaction
+// runs in C; data is the string read, or nil if the slave did not ack.
+static int i2c_transfer( lua_State *L )
+{
+  unsigned id = luaL_checkinteger( L, 1 );
+  int address = luaL_checkinteger( L, 2 );
+  const char *wdata = NULL;
+  size_t wlen = 0, i;
+  u32 wrote = 0, rlen = 0;
+  int repeated_start = 1, numdata, ok;
+  char *rdata = NULL;
+  luaL_Buffer b;
+
+  MOD_CHECK_ID( i2c, id );
+  if ( address < 0 || address > 127 )
+    return luaL_error( L, "wrong arg range" );
+  luaL_checktype( L, 3, LUA_TTABLE );
+  lua_settop( L, 3 );
+
+  lua_getfield( L, 3, "read" );
+  if( !lua_isnil( L, -1 ) )
+    rlen = ( u32 )luaL_checkinteger( L, -1 );
+  lua_getfield( L, 3, "repeated_start" );
+  if( !lua_isnil( L, -1 ) )
+    repeated_start = lua_toboolean( L, -1 );
+  lua_pop( L, 2 );
+
+  lua_getfield( L, 3, "write" );
+  if( lua_type( L, 4 ) == LUA_TNUMBER || lua_istable( L, 4 ) )
+  {
+    // gather the bytes into a string first
+    luaL_buffinit( L, &b );
+    if( lua_type( L, 4 ) == LUA_TNUMBER )
+    {
+      numdata = ( int )luaL_checkinteger( L, 4 );
+      if( numdata < 0 || numdata > 255 )
+        return luaL_error( L, "wrong arg range" );
+      luaL_addchar( &b, ( char )numdata );
+    }
+    else
+    {
+      wlen = lua_objlen( L, 4 );
+      for( i = 0; i < wlen; i ++ )
+      {
+        lua_rawgeti( L, 4, i + 1 );
+        numdata = ( int )luaL_checkinteger( L, -1 );
+        lua_pop( L, 1 );
+        if( numdata < 0 || numdata > 255 )
+          return luaL_error( L, "wrong arg range" );
+        luaL_addchar( &b, ( char )numdata );
+      }
+    }
+    luaL_pushresult( &b );
+    lua_replace( L, 4 );
+  }
+  if( !lua_isnil( L, 4 ) )
+    wdata = luaL_checklstring( L, 4, &wlen );
+
+  if( rlen > 0 )
+  {
+    rdata = ( char * )c_malloc( rlen );
+    if( !rdata )
+      return luaL_error( L, "not enough memory" );
+  }
+  wrote = wlen;
+  ok = platform_i2c_transfer( id, ( u16 )address, ( const u8 * )wdata, &wrote,
+                              ( u8 * )rdata, rlen, repeated_start );
+  if( ok )
+    lua_pushlstring( L, rdata ? rdata : "", rlen );
+  else
+    lua_pushnil( L );
+  if( rdata )
+    c_free( rdata );
+  lua_pushinteger( L, wrote );
+  return 2;
+}
+
 // Module function map
 static const LUA_REG_TYPE i2c_map[] = {
   { LSTRKEY( "setup" ),       LFUNCVAL( i2c_setup ) },
@@ -147,7 +226,8 @@ static const LUA_REG_TYPE i2c_map[] = {
   { LSTRKEY( "address" ),     LFUNCVAL( i2c_address ) },
   { LSTRKEY( "write" ),       LFUNCVAL( i2c_write ) },
   { LSTRKEY( "read" ),        LFUNCVAL( i2c_read ) },
- //{ LSTRKEY( "FAST" ),       LNUMVAL( PLATFORM_I2C_SPEED_FAST ) },
+  { LSTRKEY( "transfer" ),    LFUNCVAL( i2c_transfer ) },
+  { LSTRKEY( "FAST" ),        LNUMVAL( PLATFORM_I2C_SPEED_FAST ) },
   { LSTRKEY( "SLOW" ),        LNUMVAL( PLATFORM_I2C_SPEED_SLOW ) },
   { LSTRKEY( "TRANSMITTER" ), LNUMVAL( PLATFORM_I2C_DIRECTION_TRANSMITTER ) },
   { LSTRKEY( "RECEIVER" ),    LNUMVAL( PLATFORM_I2C_DIRECTION_RECEIVER ) },
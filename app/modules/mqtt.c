@@ -10,12 +10,16 @@
 #include "c_types.h"
 #include "mem.h"
 #include "lwip/ip_addr.h"
+#include "lwip/pbuf.h"
 #include "espconn.h"
 
 #include "mqtt_msg.h"
+#include "mqtt_parser.h"
 #include "msg_queue.h"
 
 #define MQTT_BUF_SIZE 1024
+#define MQTT_ACK_BUF_SIZE 8
+#define MQTT_DEFAULT_QUEUE_BYTES (2*MQTT_BUF_SIZE)
 #define MQTT_DEFAULT_KEEPALIVE 60
 #define MQTT_MAX_CLIENT_LEN   64
 #define MQTT_MAX_USER_LEN     64
@@ -45,10 +49,9 @@ typedef struct mqtt_state_t
   uint16_t port;
   int auto_reconnect;
   mqtt_connect_info_t* connect_info;
-  uint16_t message_length;
-  uint16_t message_length_read;
+  mqtt_parser_t parser;
   mqtt_connection_t mqtt_connection;
-  msg_queue_t* pending_msg_q;
+  msg_ring_t pending_msg_q;
 } mqtt_state_t;
 
 typedef struct lmqtt_userdata
@@ -59,8 +62,10 @@ typedef struct lmqtt_userdata
   int cb_connect_ref;
   int cb_disconnect_ref;
   int cb_message_ref;
+  int cb_chunk_ref;
   int cb_suback_ref;
   int cb_puback_ref;
+  int cb_drain_ref;
   mqtt_state_t  mqtt_state;
   mqtt_connect_info_t connect_info;
   uint16_t keep_alive_tick;
@@ -69,6 +74,8 @@ typedef struct lmqtt_userdata
   uint8_t secure;
 #endif
   bool connected;     // indicate socket connected, not mqtt prot connected.
+  bool queue_full;    // an enqueue was refused, call drain when the queue empties
+  uint8_t rx_gen;     // bumped when the connection or the parser goes, see mqtt_socket_received_pbuf()
   ETSTimer mqttTimer;
   tConnState connState;
 }lmqtt_userdata;
@@ -77,6 +84,29 @@ static void socket_connect(struct espconn *pesp_conn);
 static void mqtt_socket_reconnected(void *arg, sint8_t err);
 static void mqtt_socket_connected(void *arg);
 
+static void mqtt_queue_pop(lmqtt_userdata *mud)
+{
+  msg_dequeue(&(mud->mqtt_state.pending_msg_q));
+}
+
+// called once a handler has done its protocol work, so that lua only sees
+// the queue in a consistent state (e.g. PUBREL already queued after PUBREC)
+static void mqtt_queue_drained(lmqtt_userdata *mud)
+{
+  if(!mud->queue_full || msg_size(&(mud->mqtt_state.pending_msg_q)) > 0)
+    return;
+  mud->queue_full = false;
+  if(mud->cb_drain_ref == LUA_NOREF)
+    return;
+  if(mud->self_ref == LUA_NOREF)
+    return;
+  if(mud->L == NULL)
+    return;
+  lua_rawgeti(mud->L, LUA_REGISTRYINDEX, mud->cb_drain_ref);
+  lua_rawgeti(mud->L, LUA_REGISTRYINDEX, mud->self_ref);  // pass the userdata(client) to callback func in lua
+  lua_call(mud->L, 1, 0);
+}
+
 static void mqtt_socket_disconnected(void *arg)    // tcp only
 {
   NODE_DBG("enter mqtt_socket_disconnected.\n");
@@ -89,6 +119,8 @@ static void mqtt_socket_disconnected(void *arg)    // tcp only
     return;
 
   os_timer_disarm(&mud->mqttTimer);
+  mqtt_parser_reset(&mud->mqtt_state.parser);
+  mud->rx_gen++;
 
   if(mud->connected){     // call back only called when socket is from connection to disconnection.
     mud->connected = false;
@@ -195,32 +227,89 @@ static void deliver_publish(lmqtt_userdata * mud, uint8_t* message, int length)
   NODE_DBG("leave deliver_publish.\n");
 }
 
-static void mqtt_socket_received(void *arg, char *pdata, unsigned short len)
+static void mqtt_socket_send_head(lmqtt_userdata *mud, msg_queue_t *node)
 {
-  NODE_DBG("enter mqtt_socket_received.\n");
+  if(node && (1==msg_size(&(mud->mqtt_state.pending_msg_q))) && mud->event_timeout == 0){
+    mud->event_timeout = MQTT_SEND_TIMEOUT;
+    NODE_DBG("Sent: %d\n", node->msg.length);
+#ifdef CLIENT_SSL_ENABLE
+    if( mud->secure )
+    {
+      espconn_secure_sent( mud->pesp_conn, node->msg.data, node->msg.length );
+    }
+    else
+#endif
+    {
+      espconn_sent( mud->pesp_conn, node->msg.data, node->msg.length );
+    }
+  }
+}
+
+static msg_queue_t *mqtt_publish_response(lmqtt_userdata *mud, uint8_t msg_qos, uint16_t msg_id)
+{
+  uint8_t temp_buffer[MQTT_ACK_BUF_SIZE];
+  mqtt_message_t *temp_msg = NULL;
+  msg_queue_t *node = NULL;
+
+  mqtt_msg_init(&mud->mqtt_state.mqtt_connection, temp_buffer, MQTT_ACK_BUF_SIZE);
+  if(msg_qos == 1){
+    temp_msg = mqtt_msg_puback(&mud->mqtt_state.mqtt_connection, msg_id);
+    node = msg_enqueue(&(mud->mqtt_state.pending_msg_q), temp_msg,
+              msg_id, MQTT_MSG_TYPE_PUBACK, (int)mqtt_get_qos(temp_msg->data) );
+  }
+  else if(msg_qos == 2){
+    temp_msg = mqtt_msg_pubrec(&mud->mqtt_state.mqtt_connection, msg_id);
+    node = msg_enqueue(&(mud->mqtt_state.pending_msg_q), temp_msg,
+              msg_id, MQTT_MSG_TYPE_PUBREC, (int)mqtt_get_qos(temp_msg->data) );
+  }
+  if(msg_qos == 1 || msg_qos == 2){
+    NODE_DBG("MQTT: Queue response QoS: %d\r\n", msg_qos);
+  }
+  return node;
+}
+
+// publish too large for MQTT_BUF_SIZE, handed to lua piece by piece
+static void deliver_publish_chunk(void *arg, mqtt_publish_chunk_t *chunk)
+{
+  lmqtt_userdata *mud = (lmqtt_userdata *)arg;
+  if(mud == NULL)
+    return;
+
+  if(chunk->offset == 0 && mud->connState == MQTT_DATA)
+    mqtt_socket_send_head(mud, mqtt_publish_response(mud, mqtt_get_qos(chunk->header), chunk->msg_id));
+
+  if(mud->cb_chunk_ref == LUA_NOREF)
+    return;
+  if(mud->self_ref == LUA_NOREF)
+    return;
+  if(mud->L == NULL)
+    return;
+  lua_rawgeti(mud->L, LUA_REGISTRYINDEX, mud->cb_chunk_ref);
+  lua_rawgeti(mud->L, LUA_REGISTRYINDEX, mud->self_ref);  // pass the userdata to callback func in lua
+  lua_pushlstring(mud->L, chunk->topic, chunk->topic_length);
+  lua_pushlstring(mud->L, (const char *)chunk->data, chunk->data_length);
+  lua_pushinteger(mud->L, chunk->offset);
+  lua_pushinteger(mud->L, chunk->total);
+  lua_call(mud->L, 5, 0);
+}
+
+// called by the parser once per complete packet
+static void mqtt_socket_packet(void *arg, uint8_t *in_buffer, uint16_t length)
+{
+  NODE_DBG("enter mqtt_socket_packet.\n");
 
   uint8_t msg_type;
   uint8_t msg_qos;
   uint16_t msg_id;
   msg_queue_t *node = NULL;
-  int length = (int)len;
-  // uint8_t in_buffer[MQTT_BUF_SIZE];
-  uint8_t *in_buffer = (uint8_t *)pdata;
 
-  struct espconn *pesp_conn = arg;
-  if(pesp_conn == NULL)
-    return;
-  lmqtt_userdata *mud = (lmqtt_userdata *)pesp_conn->reverse;
-  if(mud == NULL)
+  lmqtt_userdata *mud = (lmqtt_userdata *)arg;
+  if(mud == NULL || mud->pesp_conn == NULL)
     return;
+  struct espconn *pesp_conn = mud->pesp_conn;
 
-READPACKET:
-  if(length > MQTT_BUF_SIZE || length <= 0)
-	  return;
-
-  // c_memcpy(in_buffer, pdata, length);
-  uint8_t temp_buffer[MQTT_BUF_SIZE];
-  mqtt_msg_init(&mud->mqtt_state.mqtt_connection, temp_buffer, MQTT_BUF_SIZE);
+  uint8_t temp_buffer[MQTT_ACK_BUF_SIZE];
+  mqtt_msg_init(&mud->mqtt_state.mqtt_connection, temp_buffer, MQTT_ACK_BUF_SIZE);
   mqtt_message_t *temp_msg = NULL;
   switch(mud->connState){
     case MQTT_CONNECT_SENDING:
@@ -228,6 +317,7 @@ READPACKET:
       if(mqtt_get_type(in_buffer) != MQTT_MSG_TYPE_CONNACK){
         NODE_DBG("MQTT: Invalid packet\r\n");
         mud->connState = MQTT_INIT;
+        mud->rx_gen++;
 #ifdef CLIENT_SSL_ENABLE
         if(mud->secure)
         {
@@ -255,11 +345,9 @@ READPACKET:
       break;
 
     case MQTT_DATA:
-      mud->mqtt_state.message_length_read = length;
-      mud->mqtt_state.message_length = mqtt_get_total_length(in_buffer, mud->mqtt_state.message_length_read);
       msg_type = mqtt_get_type(in_buffer);
       msg_qos = mqtt_get_qos(in_buffer);
-      msg_id = mqtt_get_id(in_buffer, mud->mqtt_state.message_length);
+      msg_id = mqtt_get_id(in_buffer, length);
 
       msg_queue_t *pending_msg = msg_peek(&(mud->mqtt_state.pending_msg_q));
 
@@ -273,7 +361,7 @@ READPACKET:
         case MQTT_MSG_TYPE_SUBACK:
           if(pending_msg && pending_msg->msg_type == MQTT_MSG_TYPE_SUBSCRIBE && pending_msg->msg_id == msg_id){
             NODE_DBG("MQTT: Subscribe successful\r\n");
-            msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
+            mqtt_queue_pop(mud);
             if (mud->cb_suback_ref == LUA_NOREF)
               break;
             if (mud->self_ref == LUA_NOREF)
@@ -288,29 +376,17 @@ READPACKET:
         case MQTT_MSG_TYPE_UNSUBACK:
           if(pending_msg && pending_msg->msg_type == MQTT_MSG_TYPE_UNSUBSCRIBE && pending_msg->msg_id == msg_id){
             NODE_DBG("MQTT: UnSubscribe successful\r\n");
-            msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
+            mqtt_queue_pop(mud);
           }
           break;
         case MQTT_MSG_TYPE_PUBLISH:
-          if(msg_qos == 1){
-            temp_msg = mqtt_msg_puback(&mud->mqtt_state.mqtt_connection, msg_id);
-            node = msg_enqueue(&(mud->mqtt_state.pending_msg_q), temp_msg,
-                      msg_id, MQTT_MSG_TYPE_PUBACK, (int)mqtt_get_qos(temp_msg->data) );
-          }
-          else if(msg_qos == 2){
-            temp_msg = mqtt_msg_pubrec(&mud->mqtt_state.mqtt_connection, msg_id);
-            node = msg_enqueue(&(mud->mqtt_state.pending_msg_q), temp_msg,
-                      msg_id, MQTT_MSG_TYPE_PUBREC, (int)mqtt_get_qos(temp_msg->data) );
-          }
-          if(msg_qos == 1 || msg_qos == 2){
-            NODE_DBG("MQTT: Queue response QoS: %d\r\n", msg_qos);
-          }
-          deliver_publish(mud, in_buffer, mud->mqtt_state.message_length);
+          node = mqtt_publish_response(mud, msg_qos, msg_id);
+          deliver_publish(mud, in_buffer, length);
           break;
         case MQTT_MSG_TYPE_PUBACK:
           if(pending_msg && pending_msg->msg_type == MQTT_MSG_TYPE_PUBLISH && pending_msg->msg_id == msg_id){
             NODE_DBG("MQTT: Publish with QoS = 1 successful\r\n");
-            msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
+            mqtt_queue_pop(mud);
             if(mud->cb_puback_ref == LUA_NOREF)
               break;
             if(mud->self_ref == LUA_NOREF)
@@ -327,7 +403,7 @@ READPACKET:
           if(pending_msg && pending_msg->msg_type == MQTT_MSG_TYPE_PUBLISH && pending_msg->msg_id == msg_id){
             NODE_DBG("MQTT: Publish  with QoS = 2 Received PUBREC\r\n");
             // Note: actrually, should not destroy the msg until PUBCOMP is received.
-            msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
+            mqtt_queue_pop(mud);
             temp_msg = mqtt_msg_pubrel(&mud->mqtt_state.mqtt_connection, msg_id);
             node = msg_enqueue(&(mud->mqtt_state.pending_msg_q), temp_msg,
                       msg_id, MQTT_MSG_TYPE_PUBREL, (int)mqtt_get_qos(temp_msg->data) );
@@ -336,7 +412,7 @@ READPACKET:
           break;
         case MQTT_MSG_TYPE_PUBREL:
           if(pending_msg && pending_msg->msg_type == MQTT_MSG_TYPE_PUBREC && pending_msg->msg_id == msg_id){
-            msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
+            mqtt_queue_pop(mud);
             temp_msg = mqtt_msg_pubcomp(&mud->mqtt_state.mqtt_connection, msg_id);
             node = msg_enqueue(&(mud->mqtt_state.pending_msg_q), temp_msg,
                       msg_id, MQTT_MSG_TYPE_PUBCOMP, (int)mqtt_get_qos(temp_msg->data) );
@@ -346,7 +422,7 @@ READPACKET:
         case MQTT_MSG_TYPE_PUBCOMP:
           if(pending_msg && pending_msg->msg_type == MQTT_MSG_TYPE_PUBREL && pending_msg->msg_id == msg_id){
             NODE_DBG("MQTT: Publish  with QoS = 2 successful\r\n");
-            msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
+            mqtt_queue_pop(mud);
             if(mud->cb_puback_ref == LUA_NOREF)
               break;
             if(mud->self_ref == LUA_NOREF)
@@ -369,43 +445,65 @@ READPACKET:
           NODE_DBG("MQTT: PINGRESP received\r\n");
           break;
       }
-      // NOTE: this is done down here and not in the switch case above
-      // because the PSOCK_READBUF_LEN() won't work inside a switch
-      // statement due to the way protothreads resume.
-      if(msg_type == MQTT_MSG_TYPE_PUBLISH)
-      {
+      break;
+  }
 
-        length = mud->mqtt_state.message_length_read;
+  mqtt_socket_send_head(mud, node);
+  mqtt_queue_drained(mud);
+  NODE_DBG("receive, queue size: %d\n", msg_size(&(mud->mqtt_state.pending_msg_q)));
+  NODE_DBG("leave mqtt_socket_packet.\n");
+}
 
-        if(mud->mqtt_state.message_length < mud->mqtt_state.message_length_read)
-				{
-					length -= mud->mqtt_state.message_length;
-					in_buffer += mud->mqtt_state.message_length;
+static void mqtt_socket_received(void *arg, char *pdata, unsigned short len)
+{
+  NODE_DBG("enter mqtt_socket_received.\n");
 
-					NODE_DBG("Get another published message\r\n");
-					goto READPACKET;
-				}
-      }
-      break;
-  }
+  struct espconn *pesp_conn = arg;
+  if(pesp_conn == NULL)
+    return;
+  lmqtt_userdata *mud = (lmqtt_userdata *)pesp_conn->reverse;
+  if(mud == NULL)
+    return;
 
-  if(node && (1==msg_size(&(mud->mqtt_state.pending_msg_q))) && mud->event_timeout == 0){
-    mud->event_timeout = MQTT_SEND_TIMEOUT;
-    NODE_DBG("Sent: %d\n", node->msg.length);
+  if(mqtt_parser_feed(&mud->mqtt_state.parser, (uint8_t *)pdata, len) < 0){
+    NODE_DBG("MQTT: Invalid packet\r\n");
+    mud->connState = MQTT_INIT;
+    mud->rx_gen++;    // nothing more from this connection
 #ifdef CLIENT_SSL_ENABLE
-    if( mud->secure )
+    if(mud->secure)
     {
-      espconn_secure_sent( pesp_conn, node->msg.data, node->msg.length );
+      espconn_secure_disconnect(pesp_conn);
     }
     else
 #endif
     {
-      espconn_sent( pesp_conn, node->msg.data, node->msg.length );
+      espconn_disconnect(pesp_conn);
     }
   }
-  NODE_DBG("receive, queue size: %d\n", msg_size(&(mud->mqtt_state.pending_msg_q)));
   NODE_DBG("leave mqtt_socket_received.\n");
-  return;
+}
+
+static void mqtt_socket_received_pbuf(void *arg, struct pbuf *p)
+{
+  struct espconn *pesp_conn = arg;
+  lmqtt_userdata *mud = pesp_conn ? (lmqtt_userdata *)pesp_conn->reverse : NULL;
+  u16_t len = p->tot_len;
+  uint8_t gen;
+  struct pbuf *q;
+
+  if(mud == NULL){
+    pbuf_free(p);
+    return;
+  }
+  // the parser copes with packets split anywhere, so feed the chain as is,
+  // until a bad packet or a callback (close, delete, a new connect) ends
+  // the connection or the parser it was for; pesp_conn may be gone then
+  gen = mud->rx_gen;
+  for(q = p; q != NULL && mud->rx_gen == gen; q = q->next)
+    mqtt_socket_received(arg, (char *)q->payload, q->len);
+  pbuf_free(p);
+  if(mud->rx_gen == gen)
+    espconn_recved(pesp_conn, len);
 }
 
 static void mqtt_socket_sent(void *arg)
@@ -432,23 +530,20 @@ static void mqtt_socket_sent(void *arg)
   // qos = 0, publish and forgot.
   msg_queue_t *node = msg_peek(&(mud->mqtt_state.pending_msg_q));
   if(node && node->msg_type == MQTT_MSG_TYPE_PUBLISH && node->publish_qos == 0) {
-    msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
-  	if(mud->cb_puback_ref == LUA_NOREF)
-			return;
-		if(mud->self_ref == LUA_NOREF)
-			return;
-    if(mud->L == NULL)
-      return;
-		lua_rawgeti(mud->L, LUA_REGISTRYINDEX, mud->cb_puback_ref);
-		lua_rawgeti(mud->L, LUA_REGISTRYINDEX, mud->self_ref);  // pass the userdata to callback func in lua
-		lua_call(mud->L, 1, 0);
+    mqtt_queue_pop(mud);
+    if(mud->cb_puback_ref != LUA_NOREF && mud->self_ref != LUA_NOREF && mud->L != NULL){
+      lua_rawgeti(mud->L, LUA_REGISTRYINDEX, mud->cb_puback_ref);
+      lua_rawgeti(mud->L, LUA_REGISTRYINDEX, mud->self_ref);  // pass the userdata to callback func in lua
+      lua_call(mud->L, 1, 0);
+    }
   } else if(node && node->msg_type == MQTT_MSG_TYPE_PUBACK) {
-    msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
+    mqtt_queue_pop(mud);
   } else if(node && node->msg_type == MQTT_MSG_TYPE_PUBCOMP) {
-    msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
+    mqtt_queue_pop(mud);
   } else if(node && node->msg_type == MQTT_MSG_TYPE_PINGREQ) {
-    msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
+    mqtt_queue_pop(mud);
   }
+  mqtt_queue_drained(mud);
   NODE_DBG("sent2, queue size: %d\n", msg_size(&(mud->mqtt_state.pending_msg_q)));
   NODE_DBG("leave mqtt_socket_sent.\n");
 }
@@ -463,7 +558,10 @@ static void mqtt_socket_connected(void *arg)
   if(mud == NULL)
     return;
   mud->connected = true;
+  mqtt_parser_reset(&mud->mqtt_state.parser);
+  mud->rx_gen++;
   espconn_regist_recvcb(pesp_conn, mqtt_socket_received);
+  espconn_regist_recvpbufcb(pesp_conn, mqtt_socket_received_pbuf);
   espconn_regist_sentcb(pesp_conn, mqtt_socket_sent);
   espconn_regist_disconcb(pesp_conn, mqtt_socket_disconnected);
 
@@ -512,8 +610,10 @@ void mqtt_socket_timer(void *arg)
       return;
     } else {
       NODE_DBG("event timeout. \n");
-      if(mud->connState == MQTT_DATA)
-        msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
+      if(mud->connState == MQTT_DATA){
+        mqtt_queue_pop(mud);
+        mqtt_queue_drained(mud);
+      }
       // should remove the head of the queue and re-send with DUP = 1
       // Not implemented yet.
     }
@@ -584,7 +684,7 @@ void mqtt_socket_timer(void *arg)
   NODE_DBG("leave mqtt_socket_timer.\n");
 }
 
-// Lua: mqtt.Client(clientid, keepalive, user, pass, clean_session)
+// Lua: mqtt.Client(clientid, keepalive, user, pass, clean_session, {queue_bytes=n})
 static int mqtt_socket_client( lua_State* L )
 {
   NODE_DBG("enter mqtt_socket_client.\n");
@@ -601,6 +701,7 @@ static int mqtt_socket_client( lua_State* L )
   int keepalive = 0;
   int stack = 1;
   int clean_session = 1;
+  int queue_bytes = MQTT_DEFAULT_QUEUE_BYTES;
   int top = lua_gettop(L);
 
   // create a object
@@ -612,8 +713,10 @@ static int mqtt_socket_client( lua_State* L )
   mud->cb_disconnect_ref = LUA_NOREF;
 
   mud->cb_message_ref = LUA_NOREF;
+  mud->cb_chunk_ref = LUA_NOREF;
   mud->cb_suback_ref = LUA_NOREF;
   mud->cb_puback_ref = LUA_NOREF;
+  mud->cb_drain_ref = LUA_NOREF;
   mud->pesp_conn = NULL;
 #ifdef CLIENT_SSL_ENABLE
   mud->secure = 0;
@@ -623,6 +726,7 @@ static int mqtt_socket_client( lua_State* L )
   mud->event_timeout = 0;
   mud->connState = MQTT_INIT;
   mud->connected = false;
+  mud->queue_full = false;
   c_memset(&mud->mqttTimer, 0, sizeof(ETSTimer));
   c_memset(&mud->mqtt_state, 0, sizeof(mqtt_state_t));
   c_memset(&mud->connect_info, 0, sizeof(mqtt_connect_info_t));
@@ -675,6 +779,16 @@ static int mqtt_socket_client( lua_State* L )
     clean_session = 1;
   }
 
+  if(lua_istable( L, stack ))
+  {
+    lua_getfield( L, stack, "queue_bytes" );
+    if(lua_isnumber( L, -1 ))
+      queue_bytes = lua_tointeger( L, -1 );
+    lua_pop( L, 1 );
+    luaL_argcheck( L, queue_bytes >= 64 && queue_bytes <= 0xffff, stack, "queue_bytes out of range" );
+    stack++;
+  }
+
   // TODO: check the zalloc result.
   mud->connect_info.client_id = (uint8_t *)c_zalloc(idl+1);
   mud->connect_info.username = (uint8_t *)c_zalloc(unl + 1);
@@ -709,10 +823,13 @@ static int mqtt_socket_client( lua_State* L )
   mud->connect_info.will_retain = 0;
   mud->connect_info.keepalive = keepalive;
 
-  mud->mqtt_state.pending_msg_q = NULL;
+  if(!msg_ring_init(&mud->mqtt_state.pending_msg_q, queue_bytes))
+    return luaL_error(L, "not enough memory");
   mud->mqtt_state.auto_reconnect = 0;
   mud->mqtt_state.port = 1883;
   mud->mqtt_state.connect_info = &mud->connect_info;
+  mqtt_parser_init(&mud->mqtt_state.parser, MQTT_BUF_SIZE, mqtt_socket_packet, deliver_publish_chunk, mud);
+  mud->rx_gen = 0;
 
   NODE_DBG("leave mqtt_socket_client.\n");
   return 1;
@@ -745,6 +862,10 @@ static int mqtt_delete( lua_State* L )
     mud->pesp_conn = NULL;    // for socket, it will free this when disconnected
   }
 
+  mqtt_parser_reset(&mud->mqtt_state.parser);
+  mud->rx_gen++;
+  msg_ring_free(&mud->mqtt_state.pending_msg_q);
+
   // ---- alloc-ed in mqtt_socket_lwt()
   if(mud->connect_info.will_topic){
   	c_free(mud->connect_info.will_topic);
@@ -785,6 +906,10 @@ static int mqtt_delete( lua_State* L )
     luaL_unref(L, LUA_REGISTRYINDEX, mud->cb_message_ref);
     mud->cb_message_ref = LUA_NOREF;
   }
+  if(LUA_NOREF!=mud->cb_chunk_ref){
+    luaL_unref(L, LUA_REGISTRYINDEX, mud->cb_chunk_ref);
+    mud->cb_chunk_ref = LUA_NOREF;
+  }
   if(LUA_NOREF!=mud->cb_suback_ref){
     luaL_unref(L, LUA_REGISTRYINDEX, mud->cb_suback_ref);
     mud->cb_suback_ref = LUA_NOREF;
@@ -793,6 +918,10 @@ static int mqtt_delete( lua_State* L )
     luaL_unref(L, LUA_REGISTRYINDEX, mud->cb_puback_ref);
     mud->cb_puback_ref = LUA_NOREF;
   }
+  if(LUA_NOREF!=mud->cb_drain_ref){
+    luaL_unref(L, LUA_REGISTRYINDEX, mud->cb_drain_ref);
+    mud->cb_drain_ref = LUA_NOREF;
+  }
   lua_gc(L, LUA_GCSTOP, 0);
   if(LUA_NOREF!=mud->self_ref){
     luaL_unref(L, LUA_REGISTRYINDEX, mud->self_ref);
@@ -900,6 +1029,7 @@ static int mqtt_socket_connect( lua_State* L )
     mud->pesp_conn->proto.tcp = NULL;
     c_free(mud->pesp_conn);
     mud->pesp_conn = NULL;
+    mud->rx_gen++;
   }
 
   struct espconn *pesp_conn = NULL;
@@ -1042,6 +1172,7 @@ static int mqtt_socket_close( lua_State* L )
     espconn_sent(mud->pesp_conn, temp_msg->data, temp_msg->length);
 
   mud->mqtt_state.auto_reconnect = 0;   // stop auto reconnect.
+  mud->rx_gen++;
 
 #ifdef CLIENT_SSL_ENABLE
   if(mud->secure){
@@ -1091,6 +1222,14 @@ static int mqtt_socket_on( lua_State* L )
     if(mud->cb_message_ref != LUA_NOREF)
       luaL_unref(L, LUA_REGISTRYINDEX, mud->cb_message_ref);
     mud->cb_message_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  }else if( sl == 5 && c_strcmp(method, "drain") == 0){
+    if(mud->cb_drain_ref != LUA_NOREF)
+      luaL_unref(L, LUA_REGISTRYINDEX, mud->cb_drain_ref);
+    mud->cb_drain_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  }else if( sl == 10 && c_strcmp(method, "data_chunk") == 0){
+    if(mud->cb_chunk_ref != LUA_NOREF)
+      luaL_unref(L, LUA_REGISTRYINDEX, mud->cb_chunk_ref);
+    mud->cb_chunk_ref = luaL_ref(L, LUA_REGISTRYINDEX);
   }else{
     lua_pop(L, 1);
     return luaL_error( L, "method not supported" );
@@ -1193,8 +1332,6 @@ static int mqtt_socket_subscribe( lua_State* L ) {
   msg_queue_t *node = msg_enqueue( &(mud->mqtt_state.pending_msg_q), temp_msg,
                             msg_id, MQTT_MSG_TYPE_SUBSCRIBE, (int)mqtt_get_qos(temp_msg->data) );
 
-  NODE_DBG("topic: %s - id: %d - qos: %d, length: %d\n", topic, node->msg_id, node->publish_qos, node->msg.length);
-
   if(node && (1==msg_size(&(mud->mqtt_state.pending_msg_q))) && mud->event_timeout == 0){
   	mud->event_timeout = MQTT_SEND_TIMEOUT;
   	NODE_DBG("Sent: %d\n", node->msg.length);
@@ -1212,6 +1349,8 @@ static int mqtt_socket_subscribe( lua_State* L ) {
   }
 
   if(!node){
+    // queue full: tell lua once it has drained, unless the message can never fit
+    mud->queue_full = msg_size(&(mud->mqtt_state.pending_msg_q)) > 0;
     lua_pushboolean(L, 0);
   } else {
     lua_pushboolean(L, 1);  // enqueued succeed.
@@ -1300,6 +1439,8 @@ static int mqtt_socket_publish( lua_State* L )
   }
 
   if(!node){
+    // queue full: tell lua once it has drained, unless the message can never fit
+    mud->queue_full = msg_size(&(mud->mqtt_state.pending_msg_q)) > 0;
     lua_pushboolean(L, 0);
   } else {
     lua_pushboolean(L, 1);  // enqueued succeed.
@@ -10,6 +10,7 @@
 #include "c_types.h"
 #include "mem.h"
 #include "lwip/ip_addr.h"
+#include "lwip/pbuf.h"
 #include "espconn.h"
 #include "lwip/dns.h" 
 
@@ -39,21 +40,241 @@ static uint16_t tcp_server_timeover = 30;
 static struct espconn *pTcpServer = NULL;
 static struct espconn *pUdpServer = NULL;
 
+// Pending tcp sends. The strings are kept in a Lua table until espconn has
+// had them acknowledged, so large payloads are passed on without a copy;
+// runs of small pieces are gathered into one segment sized buffer instead.
+#define NET_SEND_GATHER 1460
+#define NET_SEND_MAX 0xffff       // espconn_sent takes a 16 bit length
+#define NET_SEND_HIGHWATER 4096
+#define NET_SEND_RETRY_MS 10      // after espconn ran out of memory for a unit
+
+typedef struct lnet_sendq
+{
+  int ref;              // table of queued strings, LUA_NOREF when empty
+  int head, tail;       // next string to send, next free slot
+  uint32_t off;         // bytes of the head string already handed out
+  uint32_t queued;      // bytes not acknowledged yet
+  uint32_t highwater;
+  const uint8_t *unit;  // what espconn is sending (or was refused)
+  uint16_t unit_len;
+  bool unit_direct;     // unit points into the head string
+  bool busy;            // espconn accepted unit, waiting for sent
+  bool full;            // queued went above highwater
+  uint8_t *gather;
+  os_timer_t retry;     // offers a refused unit again
+}lnet_sendq;
+
 typedef struct lnet_userdata
 {
   struct espconn *pesp_conn;
+  struct lnet_buffer *buffers;  // net.buffers still holding data received on it
   int self_ref;
   int cb_connect_ref;
   int cb_reconnect_ref;
   int cb_disconnect_ref;
   int cb_receive_ref;
+  int cb_receivebuf_ref;
   int cb_send_ref;
   int cb_dns_found_ref;
+  int cb_drain_ref;
 #ifdef CLIENT_SSL_ENABLE
   uint8_t secure;
 #endif
+  lnet_sendq sendq;
 }lnet_userdata;
 
+static void net_sendq_init(lnet_sendq *q)
+{
+  c_memset(q, 0, sizeof(lnet_sendq));
+  q->ref = LUA_NOREF;
+  q->highwater = NET_SEND_HIGHWATER;
+}
+
+static void net_sendq_free(lua_State *L, lnet_sendq *q)
+{
+  uint32_t highwater = q->highwater;
+  os_timer_disarm(&q->retry);
+  if(q->ref != LUA_NOREF)
+    luaL_unref(L, LUA_REGISTRYINDEX, q->ref);
+  if(q->gather)
+    c_free(q->gather);
+  net_sendq_init(q);
+  q->highwater = highwater;
+}
+
+// Picks the next unit to hand to espconn. Expects the queue table on top.
+static void net_sendq_next(lua_State *L, lnet_sendq *q, bool secure)
+{
+  size_t l;
+  const char *s;
+  uint32_t max = secure ? NET_SEND_GATHER : NET_SEND_MAX;
+
+  q->unit_len = 0;
+  while(q->head != q->tail)
+  {
+    lua_rawgeti(L, -1, q->head);
+    s = lua_tolstring(L, -1, &l);
+    lua_pop(L, 1);    // still referenced from the table
+    if(q->off >= l){
+      lua_pushnil(L);
+      lua_rawseti(L, -2, q->head++);
+      q->off = 0;
+      continue;
+    }
+    if(q->unit_len == 0 && (l - q->off >= NET_SEND_GATHER || q->head + 1 == q->tail)){
+      q->unit = (const uint8_t *)s + q->off;
+      q->unit_len = l - q->off > max ? max : l - q->off;
+      q->unit_direct = true;
+      return;
+    }
+    if(!q->gather && !(q->gather = (uint8_t *)c_malloc(NET_SEND_GATHER))){
+      NODE_DBG("not enough memory\n");
+      return;
+    }
+    uint32_t n = NET_SEND_GATHER - q->unit_len;
+    if(n > l - q->off)
+      n = l - q->off;
+    c_memcpy(q->gather + q->unit_len, s + q->off, n);
+    q->unit = q->gather;
+    q->unit_len += n;
+    q->unit_direct = false;
+    q->off += n;
+    if(q->unit_len == NET_SEND_GATHER)
+      return;
+  }
+}
+
+static void net_sendq_retry(void *arg);
+
+// Hands the next unit to espconn unless one is outstanding.
+static void net_sendq_pump(lua_State *L, lnet_userdata *nud)
+{
+  lnet_sendq *q = &nud->sendq;
+  bool secure = false;
+  sint8 r;
+
+  if(q->busy || q->ref == LUA_NOREF || nud->pesp_conn == NULL)
+    return;
+#ifdef CLIENT_SSL_ENABLE
+  secure = nud->secure;
+#endif
+  if(q->unit_len == 0){
+    lua_rawgeti(L, LUA_REGISTRYINDEX, q->ref);
+    net_sendq_next(L, q, secure);
+    lua_pop(L, 1);
+    if(q->unit_len == 0)
+      return;
+  }
+#ifdef CLIENT_SSL_ENABLE
+  if(secure)
+    r = espconn_secure_sent(nud->pesp_conn, (unsigned char *)q->unit, q->unit_len);
+  else
+#endif
+    r = espconn_sent(nud->pesp_conn, (unsigned char *)q->unit, q->unit_len);
+  // only an accepted unit is followed by a sent callback; otherwise it is
+  // kept and offered again on the next sent or send. With nothing of ours
+  // in flight no sent comes, so one refused for lack of memory is offered
+  // again on a timer as well
+  q->busy = (r == ESPCONN_OK);
+  if(r == ESPCONN_MEM || r == ESPCONN_MAXNUM){
+    os_timer_disarm(&q->retry);
+    os_timer_setfn(&q->retry, net_sendq_retry, nud);
+    os_timer_arm(&q->retry, NET_SEND_RETRY_MS, 0);
+  }
+}
+
+static void net_sendq_retry(void *arg)
+{
+  net_sendq_pump(gL, (lnet_userdata *)arg);
+}
+
+// Queues a string, or a table of strings, at the top of the stack. All of
+// it or nothing: a table is checked before anything is queued.
+static void net_sendq_push(lua_State *L, lnet_sendq *q, int index)
+{
+  size_t l;
+  int i, n = 1;
+
+  if(lua_istable(L, index)){
+    n = lua_objlen(L, index);
+    for(i = 1; i <= n; i++)
+    {
+      lua_rawgeti(L, index, i);
+      if(!lua_isstring(L, -1))
+        luaL_error(L, "strings expected");
+      lua_pop(L, 1);
+    }
+  }
+  if(q->ref == LUA_NOREF){
+    lua_newtable(L);
+    q->ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    q->head = q->tail = 1;
+  }
+  lua_rawgeti(L, LUA_REGISTRYINDEX, q->ref);
+  for(i = 1; i <= n; i++)
+  {
+    if(lua_istable(L, index))
+      lua_rawgeti(L, index, i);
+    else
+      lua_pushvalue(L, index);
+    lua_tolstring(L, -1, &l);   // numbers become strings in place
+    q->queued += l;
+    lua_rawseti(L, -2, q->tail++);
+  }
+  lua_pop(L, 1);
+  if(q->queued > q->highwater)
+    q->full = true;
+}
+
+// a received pbuf chain handed to lua without copying, freed on release;
+// the tcp window is only reopened for its bytes once it has been released.
+// A buffer may outlive its connection: the socket detaches its buffers when
+// the espconn goes, and a detached buffer only frees the pbuf.
+typedef struct lnet_buffer
+{
+  struct pbuf *p;
+  struct espconn *conn;         // NULL once the connection has gone
+  struct lnet_buffer *next;     // the other buffers of the socket
+  struct lnet_buffer **pprev;   // NULL when detached
+}lnet_buffer;
+
+static void net_pbuf_release(struct espconn *pesp_conn, struct pbuf *p)
+{
+  u16_t len = p->tot_len;
+  pbuf_free(p);
+  if(pesp_conn)
+    espconn_recved(pesp_conn, len);
+}
+
+static void net_buffer_attach(lnet_userdata *nud, lnet_buffer *buf)
+{
+  buf->conn = nud->pesp_conn;
+  buf->next = nud->buffers;
+  if(buf->next)
+    buf->next->pprev = &buf->next;
+  buf->pprev = &nud->buffers;
+  nud->buffers = buf;
+}
+
+static void net_buffer_detach(lnet_buffer *buf)
+{
+  if(buf->pprev == NULL)
+    return;
+  *buf->pprev = buf->next;
+  if(buf->next)
+    buf->next->pprev = buf->pprev;
+  buf->next = NULL;
+  buf->pprev = NULL;
+  buf->conn = NULL;
+}
+
+// the espconn of the socket is going away
+static void net_buffers_detach(lnet_userdata *nud)
+{
+  while(nud->buffers)
+    net_buffer_detach(nud->buffers);
+}
+
 static void net_server_disconnected(void *arg)    // for tcp server only
 {
   NODE_DBG("net_server_disconnected is called.\n");
@@ -80,6 +301,8 @@ static void net_server_disconnected(void *arg)    // for tcp server only
     lua_rawgeti(gL, LUA_REGISTRYINDEX, nud->self_ref);  // pass the userdata(client) to callback func in lua
     lua_call(gL, 1, 0);
   }
+  net_sendq_free(gL, &nud->sendq);
+  net_buffers_detach(nud);    // the sdk frees the espconn
   int i;
   lua_gc(gL, LUA_GCSTOP, 0);
   for(i=0;i<MAX_SOCKET;i++){
@@ -112,6 +335,8 @@ static void net_socket_disconnected(void *arg)    // tcp only
     lua_rawgeti(gL, LUA_REGISTRYINDEX, nud->self_ref);  // pass the userdata(client) to callback func in lua
     lua_call(gL, 1, 0);
   }
+  net_sendq_free(gL, &nud->sendq);
+  net_buffers_detach(nud);
 
   if(pesp_conn->proto.tcp)
     c_free(pesp_conn->proto.tcp);
@@ -163,6 +388,62 @@ static void net_socket_received(void *arg, char *pdata, unsigned short len)
   lua_call(gL, 2, 0);
 }
 
+// push len bytes of the pbuf chain starting at offset as one lua string
+static void net_push_pbuf( lua_State* L, struct pbuf *p, u16_t offset, u16_t len )
+{
+  while(p && offset >= p->len){
+    offset -= p->len;
+    p = p->next;
+  }
+  if(p && offset + len <= p->len){   // fits in one segment, no intermediate copy
+    lua_pushlstring(L, (const char *)p->payload + offset, len);
+    return;
+  }
+  luaL_Buffer b;
+  luaL_buffinit(L, &b);
+  while(p && len > 0){
+    u16_t n = p->len - offset;
+    if(n > len)
+      n = len;
+    luaL_addlstring(&b, (const char *)p->payload + offset, n);
+    len -= n;
+    offset = 0;
+    p = p->next;
+  }
+  luaL_pushresult(&b);
+}
+
+static void net_socket_received_pbuf(void *arg, struct pbuf *p)
+{
+  NODE_DBG("net_socket_received_pbuf is called.\n");
+  struct espconn *pesp_conn = arg;
+  lnet_userdata *nud = NULL;
+  if(pesp_conn)
+    nud = (lnet_userdata *)pesp_conn->reverse;
+  if(nud == NULL || nud->self_ref == LUA_NOREF || gL == NULL){
+    net_pbuf_release(pesp_conn, p);
+    return;
+  }
+  if(nud->cb_receivebuf_ref != LUA_NOREF){
+    lua_rawgeti(gL, LUA_REGISTRYINDEX, nud->cb_receivebuf_ref);
+    lua_rawgeti(gL, LUA_REGISTRYINDEX, nud->self_ref);  // pass the userdata(socket) to callback func in lua
+    lnet_buffer *buf = (lnet_buffer *)lua_newuserdata(gL, sizeof(lnet_buffer));
+    buf->p = p;   // owned by the userdata from now on
+    net_buffer_attach(nud, buf);
+    luaL_getmetatable(gL, "net.buffer");
+    lua_setmetatable(gL, -2);
+    lua_call(gL, 2, 0);
+  }else if(nud->cb_receive_ref != LUA_NOREF){
+    lua_rawgeti(gL, LUA_REGISTRYINDEX, nud->cb_receive_ref);
+    lua_rawgeti(gL, LUA_REGISTRYINDEX, nud->self_ref);  // pass the userdata(socket) to callback func in lua
+    net_push_pbuf(gL, p, 0, p->tot_len);
+    net_pbuf_release(pesp_conn, p);
+    lua_call(gL, 2, 0);
+  }else{
+    net_pbuf_release(pesp_conn, p);
+  }
+}
+
 static void net_socket_sent(void *arg)
 {
   // NODE_DBG("net_socket_sent is called.\n");
@@ -172,6 +453,28 @@ static void net_socket_sent(void *arg)
   lnet_userdata *nud = (lnet_userdata *)pesp_conn->reverse;
   if(nud == NULL)
     return;
+  lnet_sendq *q = &nud->sendq;
+  if(q->busy){
+    q->busy = false;
+    q->queued -= q->unit_len;
+    if(q->unit_direct)
+      q->off += q->unit_len;
+    q->unit_len = 0;
+  }
+  if(q->ref != LUA_NOREF){   // also retries a unit espconn refused before
+    net_sendq_pump(gL, nud);
+    if(q->full && q->queued <= q->highwater / 2){
+      q->full = false;
+      if(nud->cb_drain_ref != LUA_NOREF && nud->self_ref != LUA_NOREF){
+        lua_rawgeti(gL, LUA_REGISTRYINDEX, nud->cb_drain_ref);
+        lua_rawgeti(gL, LUA_REGISTRYINDEX, nud->self_ref);
+        lua_call(gL, 1, 0);
+      }
+    }
+    if(q->queued > 0)   // "sent" once everything queued is out
+      return;
+    net_sendq_free(gL, q);
+  }
   if(nud->cb_send_ref == LUA_NOREF)
     return;
   if(nud->self_ref == LUA_NOREF)
@@ -319,8 +622,12 @@ static void net_server_connected(void *arg) // for tcp only
   skt->cb_disconnect_ref = LUA_NOREF;
 
   skt->cb_receive_ref = LUA_NOREF;
+  skt->cb_receivebuf_ref = LUA_NOREF;
   skt->cb_send_ref = LUA_NOREF;
   skt->cb_dns_found_ref = LUA_NOREF;
+  skt->cb_drain_ref = LUA_NOREF;
+  skt->buffers = NULL;
+  net_sendq_init(&skt->sendq);
 
 #ifdef CLIENT_SSL_ENABLE
   skt->secure = 0;    // as a server SSL is not supported.
@@ -330,6 +637,7 @@ static void net_server_connected(void *arg) // for tcp only
   pesp_conn->reverse = skt;   // let espcon carray the info of this userdata(net.socket)
 
   espconn_regist_recvcb(pesp_conn, net_socket_received);
+  espconn_regist_recvpbufcb(pesp_conn, net_socket_received_pbuf);
   espconn_regist_sentcb(pesp_conn, net_socket_sent);
   espconn_regist_disconcb(pesp_conn, net_server_disconnected);
   espconn_regist_reconcb(pesp_conn, net_server_reconnected);
@@ -349,8 +657,10 @@ static void net_socket_connected(void *arg)
     return;
   // can receive and send data, even if there is no connected callback in lua.
   espconn_regist_recvcb(pesp_conn, net_socket_received);
+  espconn_regist_recvpbufcb(pesp_conn, net_socket_received_pbuf);
   espconn_regist_sentcb(pesp_conn, net_socket_sent);
   espconn_regist_disconcb(pesp_conn, net_socket_disconnected);
+  net_sendq_pump(gL, nud);    // data queued before the connection was up
 
   if(nud->cb_connect_ref == LUA_NOREF)
     return;
@@ -425,9 +735,13 @@ static int net_create( lua_State* L, const char* mt )
   nud->cb_reconnect_ref = LUA_NOREF;
   nud->cb_disconnect_ref = LUA_NOREF;
   nud->cb_receive_ref = LUA_NOREF;
+  nud->cb_receivebuf_ref = LUA_NOREF;
   nud->cb_send_ref = LUA_NOREF;
   nud->cb_dns_found_ref = LUA_NOREF;
+  nud->cb_drain_ref = LUA_NOREF;
   nud->pesp_conn = NULL;
+  nud->buffers = NULL;
+  net_sendq_init(&nud->sendq);
 #ifdef CLIENT_SSL_ENABLE
   nud->secure = secure;
 #endif
@@ -530,6 +844,7 @@ static int net_delete( lua_State* L, const char* mt )
   	NODE_DBG("userdata is nil.\n");
   	return 0;
   }
+  net_buffers_detach(nud);
   if(nud->pesp_conn){     // for client connected to tcp server, this should set NULL in disconnect cb
   	nud->pesp_conn->reverse = NULL;
     if(!isserver)   // socket is freed here
@@ -565,6 +880,10 @@ static int net_delete( lua_State* L, const char* mt )
     luaL_unref(L, LUA_REGISTRYINDEX, nud->cb_receive_ref);
     nud->cb_receive_ref = LUA_NOREF;
   }
+  if(LUA_NOREF!=nud->cb_receivebuf_ref){
+    luaL_unref(L, LUA_REGISTRYINDEX, nud->cb_receivebuf_ref);
+    nud->cb_receivebuf_ref = LUA_NOREF;
+  }
   if(LUA_NOREF!=nud->cb_send_ref){
     luaL_unref(L, LUA_REGISTRYINDEX, nud->cb_send_ref);
     nud->cb_send_ref = LUA_NOREF;
@@ -573,6 +892,11 @@ static int net_delete( lua_State* L, const char* mt )
     luaL_unref(L, LUA_REGISTRYINDEX, nud->cb_dns_found_ref);
     nud->cb_dns_found_ref = LUA_NOREF;
   }
+  if(LUA_NOREF!=nud->cb_drain_ref){
+    luaL_unref(L, LUA_REGISTRYINDEX, nud->cb_drain_ref);
+    nud->cb_drain_ref = LUA_NOREF;
+  }
+  net_sendq_free(L, &nud->sendq);
   lua_gc(gL, LUA_GCSTOP, 0);
   if(LUA_NOREF!=nud->self_ref){
     luaL_unref(L, LUA_REGISTRYINDEX, nud->self_ref);
@@ -1002,10 +1326,18 @@ static int net_on( lua_State* L, const char* mt )
     if(nud->cb_receive_ref != LUA_NOREF)
       luaL_unref(L, LUA_REGISTRYINDEX, nud->cb_receive_ref);
     nud->cb_receive_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  }else if(!isserver && nud->pesp_conn->type == ESPCONN_TCP && sl == 10 && c_strcmp(method, "receivebuf") == 0){
+    if(nud->cb_receivebuf_ref != LUA_NOREF)
+      luaL_unref(L, LUA_REGISTRYINDEX, nud->cb_receivebuf_ref);
+    nud->cb_receivebuf_ref = luaL_ref(L, LUA_REGISTRYINDEX);
   }else if((!isserver || nud->pesp_conn->type == ESPCONN_UDP) && sl == 4 && c_strcmp(method, "sent") == 0){
     if(nud->cb_send_ref != LUA_NOREF)
       luaL_unref(L, LUA_REGISTRYINDEX, nud->cb_send_ref);
     nud->cb_send_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  }else if(!isserver && nud->pesp_conn->type == ESPCONN_TCP && sl == 5 && c_strcmp(method, "drain") == 0){
+    if(nud->cb_drain_ref != LUA_NOREF)
+      luaL_unref(L, LUA_REGISTRYINDEX, nud->cb_drain_ref);
+    nud->cb_drain_ref = luaL_ref(L, LUA_REGISTRYINDEX);
   }else if(!isserver && nud->pesp_conn->type == ESPCONN_TCP && sl == 3 && c_strcmp(method, "dns") == 0){
     if(nud->cb_dns_found_ref != LUA_NOREF)
       luaL_unref(L, LUA_REGISTRYINDEX, nud->cb_dns_found_ref);
@@ -1018,7 +1350,9 @@ static int net_on( lua_State* L, const char* mt )
   return 0;  
 }
 
-// Lua: server/socket:send( string, function(sent) )
+// Lua: server/socket:send( string or {strings}, function(sent) )
+// tcp sockets queue any amount of data and return false above the high
+// water mark, "drain" fires once half of it has gone out
 static int net_send( lua_State* L, const char* mt )
 {
   // NODE_DBG("net_send is called.\n");
@@ -1064,16 +1398,27 @@ static int net_send( lua_State* L, const char* mt )
   NODE_DBG(" sending data.\n");
 #endif
 
-  const char *payload = luaL_checklstring( L, 2, &l );
-  if (l>1460 || payload == NULL)
-    return luaL_error( L, "need <1460 payload" );
-
   if (lua_type(L, 3) == LUA_TFUNCTION || lua_type(L, 3) == LUA_TLIGHTFUNCTION){
     lua_pushvalue(L, 3);  // copy argument (func) to the top of stack
     if(nud->cb_send_ref != LUA_NOREF)
       luaL_unref(L, LUA_REGISTRYINDEX, nud->cb_send_ref);
     nud->cb_send_ref = luaL_ref(L, LUA_REGISTRYINDEX);
   }
+
+  if(!isserver && pesp_conn->type == ESPCONN_TCP){
+    if(!lua_istable(L, 2))
+      luaL_checkstring( L, 2 );
+    net_sendq_push(L, &nud->sendq, 2);
+    net_sendq_pump(L, nud);
+    if(!nud->sendq.busy && nud->sendq.queued == 0)
+      net_sendq_free(L, &nud->sendq);   // only empty strings
+    lua_pushboolean(L, !nud->sendq.full);
+    return 1;
+  }
+
+  const char *payload = luaL_checklstring( L, 2, &l );
+  if (l>1460 || payload == NULL)
+    return luaL_error( L, "need <1460 payload" );
   // SDK 1.4.0 changed behaviour, for UDP server need to look up remote ip/port
   if (isserver && pesp_conn->type == ESPCONN_UDP)
   {
@@ -1296,13 +1641,27 @@ static int net_socket_on( lua_State* L )
   return net_on(L, mt);
 }
 
-// Lua: socket:send( string, function() )
+// Lua: socket:send( string or {strings}, function() )
 static int net_socket_send( lua_State* L )
 {
   const char *mt = "net.socket";
   return net_send(L, mt);
 }
 
+// Lua: bytes = socket:highwater( [bytes] )
+static int net_socket_highwater( lua_State* L )
+{
+  lnet_userdata *nud = (lnet_userdata *)luaL_checkudata(L, 1, "net.socket");
+  luaL_argcheck(L, nud, 1, "Server/Socket expected");
+  if(lua_isnumber(L, 2)){
+    int n = lua_tointeger(L, 2);
+    luaL_argcheck(L, n > 0, 2, "wrong arg range");
+    nud->sendq.highwater = n;
+  }
+  lua_pushinteger(L, nud->sendq.highwater);
+  return 1;
+}
+
 static int net_socket_hold( lua_State* L )
 {
   const char *mt = "net.socket";
@@ -1476,6 +1835,55 @@ static int net_getdnsserver( lua_State* L )
   return 1;
 }
 
+// Lua: buf:len() / #buf
+static int net_buffer_len( lua_State* L )
+{
+  lnet_buffer *buf = (lnet_buffer *)luaL_checkudata(L, 1, "net.buffer");
+  lua_pushinteger(L, buf->p ? buf->p->tot_len : 0);
+  return 1;
+}
+
+// Lua: buf:tostring([i [, j]]), same index rules as string.sub
+static int net_buffer_tostring( lua_State* L )
+{
+  lnet_buffer *buf = (lnet_buffer *)luaL_checkudata(L, 1, "net.buffer");
+  ptrdiff_t l = buf->p ? buf->p->tot_len : 0;
+  ptrdiff_t start = luaL_optinteger(L, 2, 1);
+  ptrdiff_t end = luaL_optinteger(L, 3, -1);
+  if(start < 0) start += l + 1;
+  if(end < 0) end += l + 1;
+  if(start < 1) start = 1;
+  if(end > l) end = l;
+  if(start <= end)
+    net_push_pbuf(L, buf->p, start - 1, end - start + 1);
+  else
+    lua_pushliteral(L, "");
+  return 1;
+}
+
+// Lua: buf:byte(i)
+static int net_buffer_byte( lua_State* L )
+{
+  lnet_buffer *buf = (lnet_buffer *)luaL_checkudata(L, 1, "net.buffer");
+  int i = luaL_checkinteger(L, 2);
+  if(!buf->p || i < 1 || i > buf->p->tot_len)
+    return 0;
+  lua_pushinteger(L, pbuf_get_at(buf->p, i - 1));
+  return 1;
+}
+
+// Lua: buf:free(), releases the pbuf without waiting for the gc
+static int net_buffer_free( lua_State* L )
+{
+  lnet_buffer *buf = (lnet_buffer *)luaL_checkudata(L, 1, "net.buffer");
+  if(buf->p){
+    net_pbuf_release(buf->conn, buf->p);
+    buf->p = NULL;
+  }
+  net_buffer_detach(buf);
+  return 0;
+}
+
 #if 0
 static int net_array_index( lua_State* L )
 {
@@ -1521,6 +1929,7 @@ static const LUA_REG_TYPE net_socket_map[] = {
   { LSTRKEY( "close" ),   LFUNCVAL( net_socket_close ) },
   { LSTRKEY( "on" ),      LFUNCVAL( net_socket_on ) },
   { LSTRKEY( "send" ),    LFUNCVAL( net_socket_send ) },
+  { LSTRKEY( "highwater" ), LFUNCVAL( net_socket_highwater ) },
   { LSTRKEY( "hold" ),    LFUNCVAL( net_socket_hold ) },
   { LSTRKEY( "unhold" ),  LFUNCVAL( net_socket_unhold ) },
   { LSTRKEY( "dns" ),     LFUNCVAL( net_socket_dns ) },
@@ -1530,6 +1939,17 @@ static const LUA_REG_TYPE net_socket_map[] = {
   { LSTRKEY( "__index" ), LROVAL( net_socket_map ) },
   { LNILKEY, LNILVAL }
 };
+static const LUA_REG_TYPE net_buffer_map[] = {
+  { LSTRKEY( "len" ),        LFUNCVAL( net_buffer_len ) },
+  { LSTRKEY( "tostring" ),   LFUNCVAL( net_buffer_tostring ) },
+  { LSTRKEY( "byte" ),       LFUNCVAL( net_buffer_byte ) },
+  { LSTRKEY( "free" ),       LFUNCVAL( net_buffer_free ) },
+  { LSTRKEY( "__len" ),      LFUNCVAL( net_buffer_len ) },
+  { LSTRKEY( "__tostring" ), LFUNCVAL( net_buffer_tostring ) },
+  { LSTRKEY( "__gc" ),       LFUNCVAL( net_buffer_free ) },
+  { LSTRKEY( "__index" ),    LROVAL( net_buffer_map ) },
+  { LNILKEY, LNILVAL }
+};
 #if 0
 static const LUA_REG_TYPE net_array_map[] = {
   { LSTRKEY( "__index" ),    LFUNCVAL( net_array_index ) },
@@ -1566,6 +1986,7 @@ int luaopen_net( lua_State *L ) {
 
   luaL_rometatable(L, "net.server", (void *)net_server_map);  // create metatable for net.server
   luaL_rometatable(L, "net.socket", (void *)net_socket_map);  // create metatable for net.socket
+  luaL_rometatable(L, "net.buffer", (void *)net_buffer_map);  // create metatable for net.buffer
   #if 0
   luaL_rometatable(L, "net.array", (void *)net_array_map);    // create metatable for net.array
   #endif
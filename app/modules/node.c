@@ -9,6 +9,8 @@
 #include "lmem.h"
 #include "lobject.h"
 #include "lstate.h"
+#include "legc.h"
+#include "lxip.h"
 
 #include "lopcodes.h"
 #include "lstring.h"
@@ -25,6 +27,9 @@
 #include "flash_api.h"
 #include "flash_fs.h"
 #include "user_version.h"
+#ifdef HEAP_STATS
+#include "c_heapstats.h"
+#endif
 
 #define CPU80MHZ 80
 #define CPU160MHZ 160
@@ -143,6 +148,80 @@ static int node_heap( lua_State* L )
   return 1;
 }
 
+#ifdef HEAP_STATS
+// Lua: t = heapstats()
+static int node_heapstats( lua_State* L )
+{
+  uint32_t free_heap = system_get_free_heap_size();
+  uint32_t largest = heap_stats_largest();
+  char key[64];
+  int i;
+
+  lua_createtable(L, 0, 12);
+  lua_pushinteger(L, free_heap);
+  lua_setfield(L, -2, "free");
+  lua_pushinteger(L, heap_stats_data.min_free);
+  lua_setfield(L, -2, "min_free");
+  lua_pushinteger(L, largest);
+  lua_setfield(L, -2, "largest");
+  lua_pushinteger(L, heap_stats_frag(free_heap, largest));
+  lua_setfield(L, -2, "frag");
+  lua_pushinteger(L, heap_stats_data.allocs);
+  lua_setfield(L, -2, "allocs");
+  lua_pushinteger(L, heap_stats_data.reallocs);
+  lua_setfield(L, -2, "reallocs");
+  lua_pushinteger(L, heap_stats_data.frees);
+  lua_setfield(L, -2, "frees");
+  lua_pushinteger(L, heap_stats_data.failed);
+  lua_setfield(L, -2, "failed");
+  lua_pushinteger(L, heap_stats_data.bytes);
+  lua_setfield(L, -2, "bytes");
+  lua_pushinteger(L, heap_stats_data.lua_peak);
+  lua_setfield(L, -2, "lua_peak");
+  lua_pushinteger(L, heap_stats_data.overflow);
+  lua_setfield(L, -2, "overflow");
+
+  // sites["file:line"] = { count, bytes, failed }
+  lua_newtable(L);
+  for (i = 0; i < HEAP_STATS_SITES; i++) {
+    heap_site *s = &heap_stats_data.sites[i];
+    if (s->file == NULL)
+      continue;
+    c_sprintf(key, "%.50s:%d", s->file, s->line);
+    lua_createtable(L, 3, 0);
+    lua_pushinteger(L, s->count);
+    lua_rawseti(L, -2, 1);
+    lua_pushinteger(L, s->bytes);
+    lua_rawseti(L, -2, 2);
+    lua_pushinteger(L, s->failed);
+    lua_rawseti(L, -2, 3);
+    lua_setfield(L, -2, key);
+  }
+  lua_setfield(L, -2, "sites");
+  return 1;
+}
+
+// Lua: heapdump(), print the statistics without allocating from the heap
+static int node_heapdump( lua_State* L )
+{
+  uint32_t free_heap = system_get_free_heap_size();
+  uint32_t largest = heap_stats_largest();
+  int i;
+
+  c_printf("free %d min_free %d largest %d frag %d%%\n",
+    free_heap, heap_stats_data.min_free, largest, heap_stats_frag(free_heap, largest));
+  c_printf("allocs %d reallocs %d frees %d failed %d bytes %d lua_peak %d overflow %d\n",
+    heap_stats_data.allocs, heap_stats_data.reallocs, heap_stats_data.frees, heap_stats_data.failed,
+    heap_stats_data.bytes, heap_stats_data.lua_peak, heap_stats_data.overflow);
+  for (i = 0; i < HEAP_STATS_SITES; i++) {
+    heap_site *s = &heap_stats_data.sites[i];
+    if (s->file != NULL)
+      c_printf("%s:%d count %d bytes %d failed %d\n", s->file, s->line, s->count, s->bytes, s->failed);
+  }
+  return 0;
+}
+#endif
+
 static lua_State *gL = NULL;
 
 #ifdef DEVKIT_VERSION_0_9
@@ -547,6 +626,179 @@ static int node_stripdebug (lua_State *L) {
 }
 #endif
 
+// Lua: node.egc.setmode( mode, [limit], [step] ), limit is the memory limit
+// for ON_MEM_LIMIT, step the time budget in us of one STEP slice
+static int node_egc_setmode(lua_State* L)
+{
+  unsigned mode  = luaL_checkinteger( L, 1 );
+  unsigned limit = luaL_optinteger( L, 2, 0 );
+  unsigned step  = luaL_optinteger( L, 3, 0 );
+
+  luaL_argcheck( L, mode <= (EGC_ON_ALLOC_FAILURE | EGC_ON_MEM_LIMIT | EGC_ALWAYS | EGC_STEP), 1, "invalid mode" );
+  legc_set_mode( L, mode, limit, step );
+  return 0;
+}
+
+// Lua: count, max_us, avg_us, full, hist = node.egc.stats( [reset] ), hist
+// counts the pauses under 128, 256, ... us, the last entry the longer ones
+static int node_egc_stats(lua_State* L)
+{
+  legc_stats_t stats;
+  int i;
+
+  legc_get_stats( &stats, lua_toboolean( L, 1 ) );
+  lua_pushinteger( L, stats.count );
+  lua_pushinteger( L, stats.max_us );
+  lua_pushinteger( L, stats.count ? stats.total_us / stats.count : 0 );
+  lua_pushinteger( L, stats.full );
+  lua_createtable( L, LEGC_HIST_BUCKETS, 0 );
+  for( i = 0; i < LEGC_HIST_BUCKETS; i++ ){
+    lua_pushinteger( L, stats.hist[i] );
+    lua_rawseti( L, -2, i + 1 );
+  }
+  return 5;
+}
+
+static const LUA_REG_TYPE node_egc_map[] =
+{
+  { LSTRKEY( "setmode" ), LFUNCVAL( node_egc_setmode ) },
+  { LSTRKEY( "stats" ), LFUNCVAL( node_egc_stats ) },
+  { LSTRKEY( "NOT_ACTIVE" ), LNUMVAL( EGC_NOT_ACTIVE ) },
+  { LSTRKEY( "ON_ALLOC_FAILURE" ), LNUMVAL( EGC_ON_ALLOC_FAILURE ) },
+  { LSTRKEY( "ON_MEM_LIMIT" ), LNUMVAL( EGC_ON_MEM_LIMIT ) },
+  { LSTRKEY( "ALWAYS" ), LNUMVAL( EGC_ALWAYS ) },
+  { LSTRKEY( "STEP" ), LNUMVAL( EGC_STEP ) },
+  { LNILKEY, LNILVAL }
+};
+
+#ifdef LUA_XIP_SIZE
+static const char *node_xip_image( lua_State* L, size_t *size )
+{
+  const char *image = lxip_region( NULL, size );
+  if ( image == NULL )
+    luaL_error( L, "xip region not mapped" );
+  return image;
+}
+
+// Lua: used = node.xip.compile( "name.lua" )
+// Adds the stripped bytecode of name.lua to the region as "name"; require
+// and node.xip.load() then run it from flash.
+static int node_xip_compile( lua_State* L )
+{
+  size_t len;
+  const char *fname = luaL_checklstring( L, 1, &len );
+  char name[LXIP_NAME_MAX];
+  size_t size;
+  const char *image = node_xip_image( L, &size );
+
+  if ( len < 4 || c_strcmp( fname + len - 4, ".lua" ) != 0 )
+    return luaL_error( L, "not a .lua file" );
+  if ( len - 4 >= LXIP_NAME_MAX )
+    return luaL_error( L, "filename too long" );
+  c_memcpy( name, fname, len - 4 );
+  name[len - 4] = '\0';
+
+  if ( luaL_loadfsfile( L, fname ) != 0 )
+    return luaL_error( L, lua_tostring( L, -1 ) );
+
+  switch ( lxip_add( L, name, toproto( L, -1 ) ) )
+  {
+    case 0:
+      break;
+    case LXIP_ERR_FULL:
+      return luaL_error( L, "xip region full" );
+    case LXIP_ERR_DIRTY:
+      return luaL_error( L, "xip region needs node.xip.erase()" );
+    case LUA_ERR_CC_INTOVERFLOW:
+      return luaL_error( L, "value too big or small for target integer type" );
+    case LUA_ERR_CC_NOTINTEGER:
+      return luaL_error( L, "target lua_Number is integral but fractional value found" );
+    default:
+      return luaL_error( L, "writing to flash failed" );
+  }
+  lua_pushinteger( L, lxip_used( image, size ) );
+  return 1;
+}
+
+// Lua: f = node.xip.load( "name" ), or nil and a message
+static int node_xip_load( lua_State* L )
+{
+  const char *name = luaL_checkstring( L, 1 );
+  size_t size;
+  const char *image = node_xip_image( L, &size );
+  const lxip_entry *e = lxip_find( image, size, name );
+
+  if ( e == NULL ) {
+    lua_pushnil( L );
+    lua_pushfstring( L, "no xip image " LUA_QS, name );
+    return 2;
+  }
+  if ( lxip_load( L, e ) != 0 ) {
+    lua_pushnil( L );
+    lua_insert( L, -2 );
+    return 2;
+  }
+  return 1;
+}
+
+// Lua: t = node.xip.list(), name -> bytes
+static int node_xip_list( lua_State* L )
+{
+  size_t size;
+  const char *image = node_xip_image( L, &size );
+  const lxip_entry *e = NULL;
+  char name[LXIP_NAME_MAX + 1];
+
+  lua_newtable( L );
+  while ( ( e = lxip_next( image, size, e ) ) != NULL ) {
+    c_memcpy( name, e->name, LXIP_NAME_MAX );
+    name[LXIP_NAME_MAX] = '\0';
+    lua_pushinteger( L, e->size );
+    lua_setfield( L, -2, name );
+  }
+  return 1;
+}
+
+// Lua: used, size, address = node.xip.info()
+static int node_xip_info( lua_State* L )
+{
+  size_t size;
+  uint32_t phys;
+  const char *image = lxip_region( &phys, &size );
+
+  lua_pushinteger( L, image ? lxip_used( image, size ) : 0 );
+  lua_pushinteger( L, size );
+  lua_pushinteger( L, phys );
+  return 3;
+}
+
+// Lua: node.xip.erase()
+// Refused while functions loaded from the region are still reachable, from
+// package.loaded for one; node.restart() drops them all.
+static int node_xip_erase( lua_State* L )
+{
+  switch ( lxip_erase( L ) )
+  {
+    case 0:
+      return 0;
+    case LXIP_ERR_LOADED:
+      return luaL_error( L, "xip functions still loaded" );
+    default:
+      return luaL_error( L, "erasing flash failed" );
+  }
+}
+
+static const LUA_REG_TYPE node_xip_map[] =
+{
+  { LSTRKEY( "compile" ), LFUNCVAL( node_xip_compile ) },
+  { LSTRKEY( "load" ), LFUNCVAL( node_xip_load ) },
+  { LSTRKEY( "list" ), LFUNCVAL( node_xip_list ) },
+  { LSTRKEY( "info" ), LFUNCVAL( node_xip_info ) },
+  { LSTRKEY( "erase" ), LFUNCVAL( node_xip_erase ) },
+  { LNILKEY, LNILVAL }
+};
+#endif
+
 // Module function map
 static const LUA_REG_TYPE node_map[] =
 {
@@ -557,6 +809,10 @@ static const LUA_REG_TYPE node_map[] =
   { LSTRKEY( "flashid" ), LFUNCVAL( node_flashid ) },
   { LSTRKEY( "flashsize" ), LFUNCVAL( node_flashsize) },
   { LSTRKEY( "heap" ), LFUNCVAL( node_heap ) },
+#ifdef HEAP_STATS
+  { LSTRKEY( "heapstats" ), LFUNCVAL( node_heapstats ) },
+  { LSTRKEY( "heapdump" ), LFUNCVAL( node_heapdump ) },
+#endif
 #ifdef DEVKIT_VERSION_0_9
   { LSTRKEY( "key" ), LFUNCVAL( node_key ) },
   { LSTRKEY( "led" ), LFUNCVAL( node_led ) },
@@ -574,6 +830,10 @@ static const LUA_REG_TYPE node_map[] =
 #ifdef LUA_OPTIMIZE_DEBUG
   { LSTRKEY( "stripdebug" ), LFUNCVAL( node_stripdebug ) },
 #endif
+  { LSTRKEY( "egc" ), LROVAL( node_egc_map ) },
+#ifdef LUA_XIP_SIZE
+  { LSTRKEY( "xip" ), LROVAL( node_xip_map ) },
+#endif
 
 // Combined to dsleep(us, option)
 // { LSTRKEY( "dsleepsetoption" ), LFUNCVAL( node_deepsleep_setoption) },
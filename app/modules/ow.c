@@ -4,6 +4,9 @@
 #include "lauxlib.h"
 #include "platform.h"
 #include "driver/onewire.h"
+#include "c_stdlib.h"
+#include "c_string.h"
+#include "osapi.h"
 
 // Lua: ow.setup( id )
 static int ow_setup( lua_State *L )
@@ -279,6 +282,170 @@ static int ow_crc16( lua_State *L )
 #endif
 #endif
 
+#if ONEWIRE_SEARCH && ONEWIRE_CRC
+// Non-blocking conversion of all devices on a bus, run from a timer. Each
+// step does a bounded piece of bus work (one search pass or one scratchpad
+// read, a few ms) and rearms the timer, the conversion time is a timer
+// wait, so the Lua task keeps running in between.
+#define OW_JOB_MAX_DEVICES 32
+#define OW_JOB_MAX_READ    16
+
+enum { OW_JOB_SEARCH, OW_JOB_READ };
+
+typedef struct
+{
+  os_timer_t timer;
+  lua_State *L;
+  int cb_ref;
+  int result_ref;
+  uint16_t wait;
+  uint8_t pin, state, family, command, nread, crc;
+  uint8_t count, next;
+  uint8_t rom[OW_JOB_MAX_DEVICES][8];
+} ow_job_t;
+
+static ow_job_t *ow_jobs[NUM_OW];
+
+static void ow_job_finish( ow_job_t *job )
+{
+  lua_State *L = job->L;
+
+  ow_jobs[job->pin] = NULL;
+  lua_rawgeti( L, LUA_REGISTRYINDEX, job->cb_ref );
+  lua_rawgeti( L, LUA_REGISTRYINDEX, job->result_ref );
+  luaL_unref( L, LUA_REGISTRYINDEX, job->cb_ref );
+  luaL_unref( L, LUA_REGISTRYINDEX, job->result_ref );
+  c_free( job );
+  lua_call( L, 1, 0 );
+}
+
+static void ow_job_step( void *arg )
+{
+  ow_job_t *job = ( ow_job_t * )arg;
+  lua_State *L = job->L;
+  uint8_t data[OW_JOB_MAX_READ];
+  uint8_t *rom;
+  uint32_t delay = 1;
+
+  switch( job->state )
+  {
+    case OW_JOB_SEARCH:
+      // one device per step
+      if( job->count < OW_JOB_MAX_DEVICES && onewire_search( job->pin, job->rom[job->count] ) )
+      {
+        rom = job->rom[job->count];
+        if( onewire_crc8( rom, 7 ) == rom[7] && ( !job->family || rom[0] == job->family ) )
+          job->count ++;
+        break;
+      }
+      onewire_reset_search( job->pin );
+      if( job->count == 0 || !onewire_reset( job->pin ) )
+      {
+        ow_job_finish( job );
+        return;
+      }
+      // one broadcast starts all conversions, parasite powered devices
+      // are kept supplied until the first read
+      onewire_skip( job->pin );
+      onewire_write( job->pin, job->command, 1 );
+      job->state = OW_JOB_READ;
+      delay = job->wait;
+      break;
+
+    case OW_JOB_READ:
+      rom = job->rom[job->next ++];
+      onewire_reset( job->pin );
+      onewire_select( job->pin, rom );
+      onewire_write( job->pin, 0xBE, 1 );
+      onewire_read_bytes( job->pin, data, job->nread );
+      lua_rawgeti( L, LUA_REGISTRYINDEX, job->result_ref );
+      lua_pushlstring( L, ( const char * )rom, 8 );
+      if( job->crc && onewire_crc8( data, job->nread - 1 ) != data[job->nread - 1] )
+        lua_pushboolean( L, 0 );
+      else
+        lua_pushlstring( L, ( const char * )data, job->nread );
+      lua_rawset( L, -3 );
+      lua_pop( L, 1 );
+      if( job->next == job->count )
+      {
+        onewire_depower( job->pin );
+        ow_job_finish( job );
+        return;
+      }
+      break;
+  }
+  os_timer_arm( &job->timer, delay, 0 );
+}
+
+static int ow_job_option( lua_State *L, int table, const char *key, int def, int max )
+{
+  int v;
+
+  lua_getfield( L, table, key );
+  v = luaL_optinteger( L, -1, def );
+  lua_pop( L, 1 );
+  if( v < 0 || v > max )
+    return luaL_error( L, "wrong arg range" );
+  return v;
+}
+
+// Lua: ow.convert( id, function(results), [{ family = 0, command = 0x44, wait = 750, read = 9, crc = true }] )
+// Searches the bus, starts a conversion on all devices at once, waits and
+// reads the scratchpad of each. results maps each 8 byte ROM string to the
+// data read, or to false when its crc was wrong.
+static int ow_convert( lua_State *L )
+{
+  unsigned id = luaL_checkinteger( L, 1 );
+  int family, command, wait, nread, crc;
+  ow_job_t *job;
+
+  MOD_CHECK_ID( ow, id );
+  luaL_checkanyfunction( L, 2 );
+  if( lua_isnoneornil( L, 3 ) )
+  {
+    lua_settop( L, 2 );
+    lua_newtable( L );
+  }
+  luaL_checktype( L, 3, LUA_TTABLE );
+  if( ow_jobs[id] )
+    return luaL_error( L, "busy" );
+
+  family = ow_job_option( L, 3, "family", 0, 255 );
+  command = ow_job_option( L, 3, "command", 0x44, 255 );
+  wait = ow_job_option( L, 3, "wait", 750, 65535 );
+  nread = ow_job_option( L, 3, "read", 9, OW_JOB_MAX_READ );
+  if( nread == 0 )
+    return luaL_error( L, "wrong arg range" );
+  lua_getfield( L, 3, "crc" );
+  crc = nread > 1 && ( lua_isnil( L, -1 ) || lua_toboolean( L, -1 ) );
+  lua_pop( L, 1 );
+
+  job = ( ow_job_t * )c_malloc( sizeof( ow_job_t ) );
+  if( !job )
+    return luaL_error( L, "not enough memory" );
+  c_memset( job, 0, sizeof( ow_job_t ) );
+  job->pin = id;
+  job->family = family;
+  job->command = command;
+  job->wait = wait;
+  job->nread = nread;
+  job->crc = crc;
+  job->L = L;
+  lua_pushvalue( L, 2 );
+  job->cb_ref = luaL_ref( L, LUA_REGISTRYINDEX );
+  lua_newtable( L );
+  job->result_ref = luaL_ref( L, LUA_REGISTRYINDEX );
+  job->state = OW_JOB_SEARCH;
+  ow_jobs[id] = job;
+
+  onewire_reset_search( id );
+  os_timer_disarm( &job->timer );
+  os_timer_setfn( &job->timer, ( os_timer_func_t * )ow_job_step, job );
+  os_timer_arm( &job->timer, 1, 0 );
+  return 0;
+}
+#endif
+
 // Module function map
 static const LUA_REG_TYPE ow_map[] = {
   { LSTRKEY( "setup" ),         LFUNCVAL( ow_setup ) },
@@ -295,6 +462,9 @@ static const LUA_REG_TYPE ow_map[] = {
   { LSTRKEY( "target_search" ), LFUNCVAL( ow_target_search ) },
   { LSTRKEY( "search" ),        LFUNCVAL( ow_search ) },
 #endif
+#if ONEWIRE_SEARCH && ONEWIRE_CRC
+  { LSTRKEY( "convert" ),       LFUNCVAL( ow_convert ) },
+#endif
 #if ONEWIRE_CRC
   { LSTRKEY( "crc8" ),          LFUNCVAL( ow_crc8 ) },
 #if ONEWIRE_CRC16
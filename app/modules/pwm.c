@@ -107,6 +107,38 @@ static int lpwm_setduty( lua_State* L )
   return 1;
 }
 
+// Lua: count = setduties( { [id] = duty, ... } )
+// All duties change at the same period boundary
+static int lpwm_setduties( lua_State* L )
+{
+  unsigned ids[NUM_PWM];
+  u32 duties[NUM_PWM];
+  unsigned n = 0;
+  lua_Integer id, duty;
+
+  luaL_checktype( L, 1, LUA_TTABLE );
+  lua_pushnil( L );
+  while( lua_next( L, 1 ) )
+  {
+    // keys like 1.5 or "01" would name a pin twice
+    id = lua_tointeger( L, -2 );
+    if( lua_type( L, -2 ) != LUA_TNUMBER || ( lua_Number )id != lua_tonumber( L, -2 ) )
+      return luaL_error( L, "pin ids expected" );
+    duty = luaL_checkinteger( L, -1 );
+    lua_pop( L, 1 );
+    MOD_CHECK_ID( pwm, id );
+    if ( duty < 0 || duty > NORMAL_PWM_DEPTH )
+      return luaL_error( L, "wrong arg range" );
+    if( n == NUM_PWM )
+      return luaL_error( L, "too many pins" );
+    ids[n] = id;
+    duties[n] = duty;
+    n++;
+  }
+  lua_pushinteger( L, platform_pwm_set_duties( ids, duties, n ) );
+  return 1;
+}
+
 // Lua: duty = getduty( id )
 static int lpwm_getduty( lua_State* L )
 {
@@ -129,6 +161,7 @@ static const LUA_REG_TYPE pwm_map[] = {
   { LSTRKEY( "setclock" ), LFUNCVAL( lpwm_setclock ) },
   { LSTRKEY( "getclock" ), LFUNCVAL( lpwm_getclock ) },
   { LSTRKEY( "setduty" ),  LFUNCVAL( lpwm_setduty ) },
+  { LSTRKEY( "setduties" ), LFUNCVAL( lpwm_setduties ) },
   { LSTRKEY( "getduty" ),  LFUNCVAL( lpwm_getduty ) },
   { LNILKEY, LNILVAL }
 };
@@ -3,6 +3,7 @@
 #include "module.h"
 #include "lauxlib.h"
 #include "platform.h"
+#include "c_stdlib.h"
 
 #define SPI_HALFDUPLEX 0
 #define SPI_FULLDUPLEX 1
@@ -10,6 +11,11 @@
 static u8 spi_databits[NUM_SPI] = {0, 0};
 static u8 spi_duplex[NUM_SPI] = {SPI_HALFDUPLEX, SPI_HALFDUPLEX};
 
+// data and callback of an asynchronous spi.blkwrite
+static lua_State *gL = NULL;
+static int spi_blk_data_ref[NUM_SPI] = {LUA_NOREF, LUA_NOREF};
+static int spi_blk_cb_ref[NUM_SPI] = {LUA_NOREF, LUA_NOREF};
+
 // Lua: = spi.setup( id, mode, cpol, cpha, databits, clock_div, [duplex_mode] )
 static int spi_setup( lua_State *L )
 {
@@ -308,6 +314,112 @@ static int spi_transaction( lua_State *L )
   return 0;
 }
 
+#ifdef LUA_USE_MODULES_WS2812
+extern const uint8_t *ws2812_buffer_payload( lua_State *L, int index, size_t *len );
+#endif
+
+// Block data is a string, or the payload of a buffer object another module
+// hands out. Other userdata are refused: what of their bytes is data and
+// what is header is only known to their module.
+static const u8 *spi_blk_data( lua_State *L, int index, size_t *len )
+{
+  const u8 *data = NULL;
+
+  if( lua_type( L, index ) != LUA_TUSERDATA )
+    return ( const u8 * )luaL_checklstring( L, index, len );
+#ifdef LUA_USE_MODULES_WS2812
+  data = ws2812_buffer_payload( L, index, len );
+#endif
+  if( data == NULL )
+    luaL_typerror( L, index, "string or buffer" );
+  return data;
+}
+
+static void spi_blk_done( uint8_t id )
+{
+  int cb = spi_blk_cb_ref[id];
+
+  luaL_unref( gL, LUA_REGISTRYINDEX, spi_blk_data_ref[id] );
+  spi_blk_data_ref[id] = LUA_NOREF;
+  spi_blk_cb_ref[id] = LUA_NOREF;
+  lua_rawgeti( gL, LUA_REGISTRYINDEX, cb );
+  luaL_unref( gL, LUA_REGISTRYINDEX, cb );
+  lua_call( gL, 0, 0 );
+}
+
+// Lua: wrote = spi.blkwrite( id, data, [callback] )
+// Sends data in transactions of up to 64 bytes. With a callback it returns
+// at once and calls it when all data is out (HSPI only).
+static int spi_blkwrite( lua_State *L )
+{
+  int id = luaL_checkinteger( L, 1 );
+  const u8 *data;
+  size_t len;
+
+  MOD_CHECK_ID( spi, id );
+  data = spi_blk_data( L, 2, &len );
+  if( lua_isnoneornil( L, 3 ) )
+  {
+    platform_spi_blkwrite( id, data, len );
+  }
+  else
+  {
+    luaL_checkanyfunction( L, 3 );
+    if( spi_blk_cb_ref[id] != LUA_NOREF )
+      return luaL_error( L, "busy" );
+    if( len == 0 )
+      return luaL_error( L, "no data" );
+    gL = L;
+    lua_pushvalue( L, 3 );
+    spi_blk_cb_ref[id] = luaL_ref( L, LUA_REGISTRYINDEX );
+    // keep the data alive while the interrupt sends it
+    lua_pushvalue( L, 2 );
+    spi_blk_data_ref[id] = luaL_ref( L, LUA_REGISTRYINDEX );
+    if( PLATFORM_OK != platform_spi_blkwrite_async( id, data, len, spi_blk_done ) )
+    {
+      luaL_unref( L, LUA_REGISTRYINDEX, spi_blk_data_ref[id] );
+      luaL_unref( L, LUA_REGISTRYINDEX, spi_blk_cb_ref[id] );
+      spi_blk_data_ref[id] = LUA_NOREF;
+      spi_blk_cb_ref[id] = LUA_NOREF;
+      return luaL_error( L, "async needs HSPI" );
+    }
+  }
+  lua_pushinteger( L, len );
+  return 1;
+}
+
+// Lua: data = spi.blkread( id, size, [fill] )
+// Receives size bytes in transactions of up to 64 bytes, sending fill (0xff)
+static int spi_blkread( lua_State *L )
+{
+  int id   = luaL_checkinteger( L, 1 );
+  int size = luaL_checkinteger( L, 2 );
+  int fill = luaL_optinteger( L, 3, 0xff );
+  u8 *data;
+
+  MOD_CHECK_ID( spi, id );
+  if (size < 0) {
+    return luaL_error( L, "out of range" );
+  }
+  data = ( u8 * )c_malloc( size ? size : 1 );
+  if( !data )
+    return luaL_error( L, "not enough memory" );
+  platform_spi_blkread( id, data, size, fill );
+  lua_pushlstring( L, ( const char * )data, size );
+  c_free( data );
+  return 1;
+}
+
+// Lua: busy = spi.busy( id )
+static int spi_busy( lua_State *L )
+{
+  int id = luaL_checkinteger( L, 1 );
+
+  MOD_CHECK_ID( spi, id );
+  lua_pushboolean( L, platform_spi_busy( id ) || spi_blk_cb_ref[id] != LUA_NOREF );
+  return 1;
+}
+
 
 // Module function map
 static const LUA_REG_TYPE spi_map[] = {
@@ -317,6 +429,9 @@ static const LUA_REG_TYPE spi_map[] = {
   { LSTRKEY( "set_mosi" ),    LFUNCVAL( spi_set_mosi ) },
   { LSTRKEY( "get_miso" ),    LFUNCVAL( spi_get_miso ) },
   { LSTRKEY( "transaction" ), LFUNCVAL( spi_transaction ) },
+  { LSTRKEY( "blkwrite" ),    LFUNCVAL( spi_blkwrite ) },
+  { LSTRKEY( "blkread" ),     LFUNCVAL( spi_blkread ) },
+  { LSTRKEY( "busy" ),        LFUNCVAL( spi_busy ) },
   { LSTRKEY( "MASTER" ),      LNUMVAL( PLATFORM_SPI_MASTER ) },
   { LSTRKEY( "SLAVE" ),       LNUMVAL( PLATFORM_SPI_SLAVE) },
   { LSTRKEY( "CPHA_LOW" ),    LNUMVAL( PLATFORM_SPI_CPHA_LOW) },
@@ -46,6 +46,22 @@ tmr.softwd(int)
 	any other value starts the timer, when the
 	countdown reaches zero, the device restarts
 	the timer units are seconds
+tmr.create()
+	ret: timer object
+	a timer without an id, as many as memory allows
+	it has the methods register, alarm, start, stop,
+	unregister, interval and state, taking the same
+	arguments as the functions above minus the id
+	its callback gets the timer object as argument
+	a started timer is not garbage collected
+tmr.stats([reset])
+	ret: table
+	callbacks run, callbacks per second, max and
+	average lateness in us, wakes of the timer wheel
+	and timers in it; true resets the counters
+
+All alarms, numbered and created, share one timer wheel
+driven by a single SDK timer, see below.
 */
 
 #include "module.h"
@@ -73,12 +89,12 @@ extern uint32_t system_get_rtc_time();
 extern void system_restart();
 extern void system_soft_wdt_feed();
 
-//in fact lua_State is constant, it's pointless to pass it around
-//but hey, whatever, I'll just pass it, still we waste 28B here
-typedef struct{
-	os_timer_t os;
-	lua_State* L;
+typedef struct timer_struct{
+	struct timer_struct* next;   //wheel slot list
+	struct timer_struct** pprev; //NULL when not in the wheel
+	uint32_t expires;            //wheel tick (ms) it is due at
 	sint32_t lua_ref;
+	sint32_t self_ref;           //keeps a started timer object alive
 	uint32_t interval;
 	uint8_t mode;
 }timer_struct_t;
@@ -93,20 +109,239 @@ static sint32_t soft_watchdog  = -1;
 static timer_struct_t alarm_timers[NUM_TMR];
 static os_timer_t rtc_timer;
 
-static void alarm_timer_common(void* arg){
-	timer_t tmr = &alarm_timers[(uint32_t)arg];
-	if(tmr->lua_ref == LUA_NOREF || tmr->L == NULL)
+/*-------------------------------------
+TIMER WHEEL
+---------------------------------------
+One tick is one ms. Level 0 has a slot per tick for
+the next 64 ticks, each level above a slot per 64
+ticks of the one below, so four levels reach 4.6 hours
+(later alarms wait in the last slot and are placed
+again). Adding and removing an alarm is a list
+operation; when level 0 wraps the due slot of level 1
+is spread over level 0, and so on upwards.
+
+The SDK timer is only armed while alarms exist, and
+only for the next tick that has work: alarms that are
+due on the same tick run from one wake. Its delay is
+at most a level 1 turn, so a late wake never has
+more than 4096 ticks to catch up on.
+*/
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1<<WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SIZE-1)
+#define WHEEL_LEVELS 4
+#define WHEEL_SPAN (1UL<<(WHEEL_BITS*WHEEL_LEVELS))
+#define WHEEL_MAX_DELAY (WHEEL_SIZE*WHEEL_SIZE)
+
+static struct{
+	timer_t slot[WHEEL_LEVELS][WHEEL_SIZE];
+	uint32_t now;       //next tick to process
+	uint32_t clock_ms;  //system time in ms, extended past the
+	uint32_t clock_us;  //wrap of system_get_time at clock_us
+	uint32_t wake;      //tick the SDK timer is armed for
+	uint32_t count;     //alarms in the wheel
+	bool armed;
+	os_timer_t os;
+	//statistics
+	uint32_t calls;
+	uint32_t wakes;
+	uint32_t late_max;
+	uint64_t late_sum;
+	uint32_t since;     //clock_ms of the last reset
+}wheel;
+
+static uint32_t wheel_clock(void){
+	uint32_t ms = (system_get_time() - wheel.clock_us)/1000;
+	wheel.clock_us += ms*1000;
+	wheel.clock_ms += ms;
+	return wheel.clock_ms;
+}
+
+static void wheel_link(timer_t tmr){
+	uint32_t idx = tmr->expires - wheel.now;
+	uint32_t e = tmr->expires;
+	timer_t* head;
+	int level;
+
+	if((sint32_t)idx < 0){
+		idx = 0;
+		e = wheel.now;
+	}else if(idx >= WHEEL_SPAN){
+		idx = WHEEL_SPAN - 1;
+		e = wheel.now + idx;
+	}
+	for(level = 0; level < WHEEL_LEVELS-1 && idx >= (1UL<<(WHEEL_BITS*(level+1))); level++);
+	head = &wheel.slot[level][(e>>(WHEEL_BITS*level))&WHEEL_MASK];
+	tmr->next = *head;
+	if(tmr->next)
+		tmr->next->pprev = &tmr->next;
+	tmr->pprev = head;
+	*head = tmr;
+}
+
+static void wheel_del(timer_t tmr){
+	if(tmr->pprev == NULL)
 		return;
-	lua_rawgeti(tmr->L, LUA_REGISTRYINDEX, tmr->lua_ref);
-	//if the timer was set to single run we clean up after it
-	if(tmr->mode == TIMER_MODE_SINGLE){
-		luaL_unref(tmr->L, LUA_REGISTRYINDEX, tmr->lua_ref);
-		tmr->lua_ref = LUA_NOREF;
-		tmr->mode = TIMER_MODE_OFF;
-	}else if(tmr->mode == TIMER_MODE_SEMI){
-		tmr->mode |= TIMER_IDLE_FLAG;
+	*tmr->pprev = tmr->next;
+	if(tmr->next)
+		tmr->next->pprev = tmr->pprev;
+	tmr->pprev = NULL;
+	wheel.count--;
+}
+
+static void wheel_arm(uint32_t tick){
+	sint32_t delay = tick - wheel_clock();
+	if(delay < 1)
+		delay = 1;
+	else if(delay > WHEEL_MAX_DELAY)
+		delay = WHEEL_MAX_DELAY;
+	ets_timer_disarm(&wheel.os);
+	ets_timer_arm_new(&wheel.os, delay, 0, 1);
+	wheel.wake = tick;
+	wheel.armed = true;
+}
+
+static void wheel_add(timer_t tmr, uint32_t expires){
+	//an empty wheel may be far behind, nothing is lost by skipping ahead
+	if(wheel.count == 0)
+		wheel.now = wheel_clock();
+	tmr->expires = expires;
+	wheel_link(tmr);
+	wheel.count++;
+	if(!wheel.armed || (sint32_t)(expires - wheel.wake) < 0)
+		wheel_arm(expires);
+}
+
+//ticks from now to the next one with alarms to run or to spread
+static uint32_t wheel_next(void){
+	uint32_t i0 = wheel.now & WHEEL_MASK, i, i1, d;
+
+	//level 0 wrapped, the slot of level 1 due now is spread first
+	if(i0 == 0)
+		return 0;
+	for(i = i0; i < WHEEL_SIZE; i++)
+		if(wheel.slot[0][i])
+			return i - i0;
+	//the slots before i0 are due in the next turn of level 0
+	for(i = 0; i < i0 && !wheel.slot[0][i]; i++);
+	d = WHEEL_SIZE - i0;
+	for(i1 = ((wheel.now>>WHEEL_BITS) + 1) & WHEEL_MASK; ; i1 = (i1 + 1) & WHEEL_MASK){
+		if(i1 == 0 || wheel.slot[1][i1])
+			return d;
+		if(i < i0)
+			return d + i;
+		d += WHEEL_SIZE;
+	}
+}
+
+//spread slot idx of level over the levels below, returns idx
+static uint32_t wheel_cascade(int level, uint32_t idx){
+	timer_t tmr = wheel.slot[level][idx], next;
+	wheel.slot[level][idx] = NULL;
+	for(; tmr; tmr = next){
+		next = tmr->next;
+		wheel_link(tmr);
+	}
+	return idx;
+}
+
+static void alarm_timer_common(timer_t tmr){
+	lua_State* L = lua_getstate();
+	uint32_t late = (system_get_time() - wheel.clock_us) + (wheel.clock_ms - tmr->expires)*1000;
+	int nargs = 0;
+
+	if((sint32_t)late < 0)
+		late = 0;
+	wheel.calls++;
+	wheel.late_sum += late;
+	if(late > wheel.late_max)
+		wheel.late_max = late;
+
+	if(tmr->lua_ref == LUA_NOREF)
+		return;
+	lua_rawgeti(L, LUA_REGISTRYINDEX, tmr->lua_ref);
+	if(tmr->self_ref != LUA_NOREF){
+		lua_rawgeti(L, LUA_REGISTRYINDEX, tmr->self_ref);
+		nargs = 1;
+	}
+	if(tmr->mode == TIMER_MODE_AUTO){
+		//keep the phase, skipping the periods that were missed
+		uint32_t next = tmr->expires + tmr->interval;
+		if((sint32_t)(next - wheel.now) < 0)
+			next += ((wheel.now - next)/tmr->interval + 1)*tmr->interval;
+		wheel_add(tmr, next);
+	}else{
+		//if the timer was set to single run we clean up after it
+		if(tmr->mode == TIMER_MODE_SINGLE){
+			luaL_unref(L, LUA_REGISTRYINDEX, tmr->lua_ref);
+			tmr->lua_ref = LUA_NOREF;
+			tmr->mode = TIMER_MODE_OFF;
+		}else if(tmr->mode == TIMER_MODE_SEMI){
+			tmr->mode |= TIMER_IDLE_FLAG;
+		}
+		//the object stays alive on the stack for the call
+		if(tmr->self_ref != LUA_NOREF){
+			luaL_unref(L, LUA_REGISTRYINDEX, tmr->self_ref);
+			tmr->self_ref = LUA_NOREF;
+		}
 	}
-	lua_call(tmr->L, 0, 0);
+	lua_call(L, nargs, 0);
+}
+
+static void wheel_run(void* arg){
+	uint32_t target = wheel_clock();
+	timer_t pending, tmr;
+	uint32_t i0;
+	int level;
+
+	wheel.armed = false;
+	wheel.wakes++;
+	while((sint32_t)(target - wheel.now) >= 0){
+		i0 = wheel.now & WHEEL_MASK;
+		if(i0 == 0){
+			for(level = 1; level < WHEEL_LEVELS; level++)
+				if(wheel_cascade(level, (wheel.now>>(WHEEL_BITS*level)) & WHEEL_MASK) != 0)
+					break;
+		}
+		pending = wheel.slot[0][i0];
+		wheel.slot[0][i0] = NULL;
+		wheel.now++;
+		//callbacks may add and remove alarms, this one included
+		if(pending)
+			pending->pprev = &pending;
+		while((tmr = pending) != NULL){
+			wheel_del(tmr);
+			alarm_timer_common(tmr);
+		}
+	}
+	if(wheel.count > 0){
+		wheel_arm(wheel.now + wheel_next());
+	}else if(wheel.armed){
+		ets_timer_disarm(&wheel.os);
+		wheel.armed = false;
+	}
+}
+
+static void tmr_arm(timer_t tmr){
+	wheel_del(tmr);
+	wheel_add(tmr, wheel_clock() + tmr->interval);
+}
+
+static void tmr_release(lua_State* L, timer_t tmr){
+	if(tmr->self_ref != LUA_NOREF){
+		luaL_unref(L, LUA_REGISTRYINDEX, tmr->self_ref);
+		tmr->self_ref = LUA_NOREF;
+	}
+}
+
+//the timer of a call: a timer object or a timer id at index 1
+static timer_t tmr_get(lua_State* L){
+	if(lua_type(L, 1) == LUA_TUSERDATA)
+		return (timer_t)luaL_checkudata(L, 1, "tmr.timer");
+	uint32_t id = luaL_checkinteger(L, 1);
+	if(!platform_tmr_exists(id))
+		luaL_error(L, "tmr %d does not exist", (unsigned)id);
+	return &alarm_timers[id];
 }
 
 // Lua: tmr.delay( us )
@@ -133,10 +368,9 @@ static int tmr_now(lua_State* L){
 	return 1; 
 }
 
-// Lua: tmr.register( id, interval, mode, function )
+// Lua: tmr.register( id / ref, interval, mode, function )
 static int tmr_register(lua_State* L){
-	uint32_t id = luaL_checkinteger(L, 1);
-	MOD_CHECK_ID(tmr, id);
+	timer_t tmr = tmr_get(L);
 	sint32_t interval = luaL_checkinteger(L, 2);
 	uint8_t mode = luaL_checkinteger(L, 3);
 	//validate arguments
@@ -148,51 +382,49 @@ static int tmr_register(lua_State* L){
 	//get the lua function reference
 	lua_pushvalue(L, 4);
 	sint32_t ref = luaL_ref(L, LUA_REGISTRYINDEX);
-	timer_t tmr = &alarm_timers[id];
-	if(!(tmr->mode & TIMER_IDLE_FLAG) && tmr->mode != TIMER_MODE_OFF)
-		ets_timer_disarm(&tmr->os);
+	wheel_del(tmr);
+	tmr_release(L, tmr);
 	//there was a bug in this part, the second part of the following condition was missing
 	if(tmr->lua_ref != LUA_NOREF && tmr->lua_ref != ref)
 		luaL_unref(L, LUA_REGISTRYINDEX, tmr->lua_ref);
 	tmr->lua_ref = ref;
 	tmr->mode = mode|TIMER_IDLE_FLAG;
 	tmr->interval = interval;
-	tmr->L = L; 
-	ets_timer_setfn(&tmr->os, alarm_timer_common, (void*)id);
 	return 0;  
 }
 
-// Lua: tmr.start( id )
+// Lua: tmr.start( id / ref )
 static int tmr_start(lua_State* L){
-	uint8_t id = luaL_checkinteger(L, 1);
-	MOD_CHECK_ID(tmr,id);
-	timer_t tmr = &alarm_timers[id];
+	timer_t tmr = tmr_get(L);
 	//we return false if the timer is not idle
 	if(!(tmr->mode&TIMER_IDLE_FLAG)){
 		lua_pushboolean(L, 0);
 	}else{
 		tmr->mode &= ~TIMER_IDLE_FLAG;
-		ets_timer_arm_new(&tmr->os, tmr->interval, tmr->mode==TIMER_MODE_AUTO, 1);
+		if(lua_type(L, 1) == LUA_TUSERDATA && tmr->self_ref == LUA_NOREF){
+			lua_pushvalue(L, 1);
+			tmr->self_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+		}
+		tmr_arm(tmr);
 		lua_pushboolean(L, 1);
 	}
 	return 1;
 }
 
-// Lua: tmr.alarm( id, interval, repeat, function )
+// Lua: tmr.alarm( id / ref, interval, repeat, function )
 static int tmr_alarm(lua_State* L){
 	tmr_register(L);
 	return tmr_start(L);
 }
 
-// Lua: tmr.stop( id )
+// Lua: tmr.stop( id / ref )
 static int tmr_stop(lua_State* L){
-	uint8_t id = luaL_checkinteger(L, 1);
-	MOD_CHECK_ID(tmr,id);
-	timer_t tmr = &alarm_timers[id];
+	timer_t tmr = tmr_get(L);
 	//we return false if the timer is idle (of not registered)
 	if(!(tmr->mode & TIMER_IDLE_FLAG) && tmr->mode != TIMER_MODE_OFF){
 		tmr->mode |= TIMER_IDLE_FLAG;
-		ets_timer_disarm(&tmr->os);
+		wheel_del(tmr);
+		tmr_release(L, tmr);
 		lua_pushboolean(L, 1);
 	}else{
 		lua_pushboolean(L, 0);
@@ -200,13 +432,11 @@ static int tmr_stop(lua_State* L){
 	return 1;  
 }
 
-// Lua: tmr.unregister( id )
+// Lua: tmr.unregister( id / ref )
 static int tmr_unregister(lua_State* L){
-	uint8_t id = luaL_checkinteger(L, 1);
-	MOD_CHECK_ID(tmr,id);
-	timer_t tmr = &alarm_timers[id];
-	if(!(tmr->mode & TIMER_IDLE_FLAG) && tmr->mode != TIMER_MODE_OFF)
-		ets_timer_disarm(&tmr->os);
+	timer_t tmr = tmr_get(L);
+	wheel_del(tmr);
+	tmr_release(L, tmr);
 	if(tmr->lua_ref != LUA_NOREF)
 		luaL_unref(L, LUA_REGISTRYINDEX, tmr->lua_ref);
 	tmr->lua_ref = LUA_NOREF;
@@ -214,29 +444,23 @@ static int tmr_unregister(lua_State* L){
 	return 0;
 }
 
-// Lua: tmr.interval( id, interval )
+// Lua: tmr.interval( id / ref, interval )
 static int tmr_interval(lua_State* L){
-	uint8_t id = luaL_checkinteger(L, 1);
-	MOD_CHECK_ID(tmr,id);
-	timer_t tmr = &alarm_timers[id];
+	timer_t tmr = tmr_get(L);
 	sint32_t interval = luaL_checkinteger(L, 2);
 	if(interval <= 0)
 		return luaL_error(L, "wrong arg range");
 	if(tmr->mode != TIMER_MODE_OFF){	
 		tmr->interval = interval;
-		if(!(tmr->mode&TIMER_IDLE_FLAG)){
-			ets_timer_disarm(&tmr->os);
-			ets_timer_arm_new(&tmr->os, tmr->interval, tmr->mode==TIMER_MODE_AUTO, 1);
-		}
+		if(!(tmr->mode&TIMER_IDLE_FLAG))
+			tmr_arm(tmr);
 	}
 	return 0;
 }
 
-// Lua: tmr.state( id )
+// Lua: tmr.state( id / ref )
 static int tmr_state(lua_State* L){
-	uint8_t id = luaL_checkinteger(L, 1);
-	MOD_CHECK_ID(tmr,id);
-	timer_t tmr = &alarm_timers[id];
+	timer_t tmr = tmr_get(L);
 	if(tmr->mode == TIMER_MODE_OFF){
 		lua_pushnil(L);
 		return 1;
@@ -246,6 +470,58 @@ static int tmr_state(lua_State* L){
 	return 2;
 }
 
+// Lua: ref = tmr.create()
+static int tmr_create(lua_State* L){
+	timer_t tmr = (timer_t)lua_newuserdata(L, sizeof(timer_struct_t));
+	tmr->next = NULL;
+	tmr->pprev = NULL;
+	tmr->lua_ref = LUA_NOREF;
+	tmr->self_ref = LUA_NOREF;
+	tmr->interval = 0;
+	tmr->mode = TIMER_MODE_OFF;
+	luaL_getmetatable(L, "tmr.timer");
+	lua_setmetatable(L, -2);
+	return 1;
+}
+
+// Lua: ref.__gc
+static int tmr_gc(lua_State* L){
+	timer_t tmr = (timer_t)luaL_checkudata(L, 1, "tmr.timer");
+	//only an idle timer can be collected, but be safe
+	wheel_del(tmr);
+	if(tmr->lua_ref != LUA_NOREF)
+		luaL_unref(L, LUA_REGISTRYINDEX, tmr->lua_ref);
+	tmr->lua_ref = LUA_NOREF;
+	return 0;
+}
+
+// Lua: tmr.stats( [reset] )
+static int tmr_stats(lua_State* L){
+	bool reset = lua_toboolean(L, 1);
+	uint32_t ms = wheel_clock() - wheel.since;
+	lua_createtable(L, 0, 6);
+	lua_pushinteger(L, wheel.calls);
+	lua_setfield(L, -2, "callbacks");
+	lua_pushnumber(L, ms ? (lua_Number)wheel.calls*1000/ms : 0);
+	lua_setfield(L, -2, "rate");
+	lua_pushinteger(L, wheel.late_max);
+	lua_setfield(L, -2, "late_max");
+	lua_pushinteger(L, wheel.calls ? (uint32_t)(wheel.late_sum/wheel.calls) : 0);
+	lua_setfield(L, -2, "late_avg");
+	lua_pushinteger(L, wheel.wakes);
+	lua_setfield(L, -2, "wakes");
+	lua_pushinteger(L, wheel.count);
+	lua_setfield(L, -2, "timers");
+	if(reset){
+		wheel.calls = 0;
+		wheel.wakes = 0;
+		wheel.late_max = 0;
+		wheel.late_sum = 0;
+		wheel.since = wheel.clock_ms;
+	}
+	return 1;
+}
+
 /*I left the led comments 'couse I don't know
 why they are here*/
 
@@ -284,6 +560,7 @@ inline static void rtc_timer_update(){
 
 void rtc_callback(void *arg){
 	rtc_timer_update();
+	wheel_clock(); //often enough to see every wrap of system_get_time
 	if(soft_watchdog > 0){
 		soft_watchdog--;
 		if(soft_watchdog == 0)
@@ -306,6 +583,19 @@ static int tmr_softwd( lua_State* L ){
 
 // Module function map
 
+static const LUA_REG_TYPE tmr_dyn_map[] = {
+	{ LSTRKEY( "register" ),    LFUNCVAL( tmr_register ) },
+	{ LSTRKEY( "alarm" ),       LFUNCVAL( tmr_alarm ) },
+	{ LSTRKEY( "start" ),       LFUNCVAL( tmr_start ) },
+	{ LSTRKEY( "stop" ),        LFUNCVAL( tmr_stop ) },
+	{ LSTRKEY( "unregister" ),  LFUNCVAL( tmr_unregister ) },
+	{ LSTRKEY( "state" ),       LFUNCVAL( tmr_state ) },
+	{ LSTRKEY( "interval" ),    LFUNCVAL( tmr_interval) },
+	{ LSTRKEY( "__gc" ),        LFUNCVAL( tmr_gc ) },
+	{ LSTRKEY( "__index" ),     LROVAL( tmr_dyn_map ) },
+	{ LNILKEY, LNILVAL }
+};
+
 static const LUA_REG_TYPE tmr_map[] = {
 	{ LSTRKEY( "delay" ),        LFUNCVAL( tmr_delay ) },
 	{ LSTRKEY( "now" ),          LFUNCVAL( tmr_now ) },
@@ -319,6 +609,8 @@ static const LUA_REG_TYPE tmr_map[] = {
 	{ LSTRKEY( "unregister" ),   LFUNCVAL( tmr_unregister ) },
 	{ LSTRKEY( "state" ),        LFUNCVAL( tmr_state ) },
 	{ LSTRKEY( "interval" ),     LFUNCVAL( tmr_interval) }, 
+	{ LSTRKEY( "create" ),       LFUNCVAL( tmr_create ) },
+	{ LSTRKEY( "stats" ),        LFUNCVAL( tmr_stats ) },
 	{ LSTRKEY( "ALARM_SINGLE" ), LNUMVAL( TIMER_MODE_SINGLE ) },
 	{ LSTRKEY( "ALARM_SEMI" ),   LNUMVAL( TIMER_MODE_SEMI ) },
 	{ LSTRKEY( "ALARM_AUTO" ),   LNUMVAL( TIMER_MODE_AUTO ) },
@@ -327,11 +619,17 @@ static const LUA_REG_TYPE tmr_map[] = {
 
 int luaopen_tmr( lua_State *L ){
 	int i;	
+
+	luaL_rometatable(L, "tmr.timer", (void *)tmr_dyn_map);
 	for(i=0; i<NUM_TMR; i++){
+		alarm_timers[i].pprev = NULL;
 		alarm_timers[i].lua_ref = LUA_NOREF;
+		alarm_timers[i].self_ref = LUA_NOREF;
 		alarm_timers[i].mode = TIMER_MODE_OFF;
-		ets_timer_disarm(&alarm_timers[i].os);
 	}
+	wheel.clock_us = system_get_time();
+	ets_timer_disarm(&wheel.os);
+	ets_timer_setfn(&wheel.os, wheel_run, NULL);
 	rtc_time.block = 0;
 	ets_timer_disarm(&rtc_timer);
 	ets_timer_setfn(&rtc_timer, rtc_callback, NULL);
@@ -5,14 +5,36 @@
 #include "platform.h"
 
 #include "c_stdlib.h"
+#include "c_string.h"
 
 #include "u8g.h"
 
 #include "u8g_config.h"
 
+// Full framebuffer: every page of the display in RAM, in the display's
+// own page buffer format
+struct _lu8g_fb_t
+{
+    u8g_dev_t dev;              // stands in for the display device
+    u8g_dev_t *display;
+    size_t page_bytes;
+    uint8_t pages;
+    uint8_t *dirty;             // per page: LU8G_FB_*
+    uint32_t *sum;              // per page: contents when last sent
+    uint8_t *buf;
+};
+
+typedef struct _lu8g_fb_t lu8g_fb_t;
+
+#define LU8G_FB_CLEAN   0
+#define LU8G_FB_DRAWN   1       // drawn on since the last update
+#define LU8G_FB_UNSENT  2       // the display may show something else
+
 struct _lu8g_userdata_t
 {
     u8g_t u8g;
+    u8g_dev_t *dev;             // the display device, below any rotation or scaling
+    lu8g_fb_t *fb;              // NULL in page mode
 };
 
 typedef struct _lu8g_userdata_t lu8g_userdata_t;
@@ -39,6 +61,240 @@ static void lu8g_get_int_args( lua_State *L, uint8_t stack, uint8_t num, u8g_uin
 }
 
 
+
+// ------------------------------------------------------------
+// full framebuffer
+//
+// In framebuffer mode a stand-in device sits on top of the display device.
+// Lua draws a frame once instead of once per page: drawing goes through
+// the display's own page buffer code, pointed at the frame's copy of each
+// page in turn, and an update sends only the pages whose contents changed.
+
+// point the display's page buffer at page
+static void lu8g_fb_select( u8g_pb_t *pb, uint8_t page )
+{
+    pb->p.page = page;
+    pb->p.page_y0 = page * pb->p.page_height;
+    pb->p.page_y1 = pb->p.page_y0 + pb->p.page_height - 1;
+    if (pb->p.page_y1 >= pb->p.total_height)
+        pb->p.page_y1 = pb->p.total_height - 1;
+}
+
+static void lu8g_fb_clear( lu8g_fb_t *fb )
+{
+    c_memset( fb->buf, 0, fb->pages * fb->page_bytes );
+    c_memset( fb->dirty, LU8G_FB_DRAWN, fb->pages );
+}
+
+// hands a pixel message to every page it touches
+static void lu8g_fb_draw( u8g_t *u8g, lu8g_fb_t *fb, uint8_t msg, u8g_dev_arg_pixel_t *arg )
+{
+    u8g_dev_t *dev = fb->display;
+    u8g_pb_t *pb = (u8g_pb_t *)(dev->dev_mem);
+    void *page_buf = pb->buf;
+    u8g_dev_arg_pixel_t a;
+    int y0 = arg->y, y1 = arg->y, n = 1, page;
+
+    if (msg == U8G_DEV_MSG_SET_8PIXEL)
+        n = 8;
+    else if (msg == U8G_DEV_MSG_SET_4TPIXEL)
+        n = 4;
+    if (n > 1 && arg->dir == 1)
+        y1 += n - 1;
+    else if (n > 1 && arg->dir == 3)
+        y0 -= n - 1;
+    if (y0 < 0)
+        y0 = 0;
+    if (y1 >= pb->p.total_height)
+        y1 = pb->p.total_height - 1;
+
+    for (page = y0 / pb->p.page_height; y0 <= y1 && page <= y1 / pb->p.page_height; page++)
+    {
+        a = *arg;               // the 8 pixel functions move it along
+        pb->buf = fb->buf + page * fb->page_bytes;
+        lu8g_fb_select( pb, page );
+        u8g_call_dev_fn( u8g, dev, msg, &a );
+        fb->dirty[page] = LU8G_FB_DRAWN;
+    }
+    pb->buf = page_buf;
+}
+
+static uint32_t lu8g_fb_sum( const uint8_t *p, size_t n )
+{
+    uint32_t sum = 2166136261u;     // FNV-1a
+
+    while (n-- > 0)
+        sum = (sum ^ *p++) * 16777619u;
+    return sum;
+}
+
+// Sends the pages drawn on since the last update that now look different.
+// Returns the number of pages sent.
+static int lu8g_fb_update( u8g_t *u8g, lu8g_fb_t *fb )
+{
+    u8g_dev_t *dev = fb->display;
+    u8g_pb_t *pb = (u8g_pb_t *)(dev->dev_mem);
+    const uint8_t *page_buf;
+    uint32_t sum;
+    uint8_t page;
+    int sent = 0;
+
+    for (page = 0; page < fb->pages; page++)
+    {
+        if (fb->dirty[page] == LU8G_FB_CLEAN)
+            continue;
+        page_buf = fb->buf + page * fb->page_bytes;
+        sum = lu8g_fb_sum( page_buf, fb->page_bytes );
+        if (fb->dirty[page] == LU8G_FB_DRAWN && sum == fb->sum[page])
+        {
+            fb->dirty[page] = LU8G_FB_CLEAN;
+            continue;
+        }
+
+        // the display sends its own page buffer, then clears it
+        c_memcpy( pb->buf, page_buf, fb->page_bytes );
+        lu8g_fb_select( pb, page );
+        u8g_call_dev_fn( u8g, dev, U8G_DEV_MSG_PAGE_NEXT, NULL );
+        fb->sum[page] = sum;
+        fb->dirty[page] = LU8G_FB_CLEAN;
+        sent++;
+    }
+    return sent;
+}
+
+static uint8_t lu8g_fb_fn( u8g_t *u8g, u8g_dev_t *dev, uint8_t msg, void *arg )
+{
+    lu8g_fb_t *fb = (lu8g_fb_t *)(dev->dev_mem);
+    u8g_pb_t *pb = (u8g_pb_t *)(fb->display->dev_mem);
+
+    switch (msg)
+    {
+    case U8G_DEV_MSG_SET_PIXEL:
+    case U8G_DEV_MSG_SET_8PIXEL:
+    case U8G_DEV_MSG_SET_TPIXEL:
+    case U8G_DEV_MSG_SET_4TPIXEL:
+        lu8g_fb_draw( u8g, fb, msg, (u8g_dev_arg_pixel_t *)arg );
+        return 1;
+
+    // a picture loop runs once, on a clear frame
+    case U8G_DEV_MSG_PAGE_FIRST:
+        lu8g_fb_clear( fb );
+        return 1;
+
+    case U8G_DEV_MSG_PAGE_NEXT:
+        lu8g_fb_update( u8g, fb );
+        return 0;
+
+    case U8G_DEV_MSG_GET_PAGE_BOX:
+        {
+            u8g_box_t *box = (u8g_box_t *)arg;
+            box->x0 = 0;
+            box->y0 = 0;
+            box->x1 = pb->width - 1;
+            box->y1 = pb->p.total_height - 1;
+        }
+        return 1;
+    }
+    return u8g_call_dev_fn( u8g, fb->display, msg, arg );
+}
+
+// where the device chain refers to dev; rotation and scaling devices keep
+// the device below them in dev_mem
+static u8g_dev_t **lu8g_dev_link( lu8g_userdata_t *lud, u8g_dev_t *dev )
+{
+    u8g_dev_t **link = &(LU8G->dev);
+
+    while (*link != dev)
+        link = (u8g_dev_t **)&((*link)->dev_mem);
+    return link;
+}
+
+// The bytes of the display's page buffer that a page really takes: how far
+// setting every pixel of a page reaches into a scratch buffer twice the
+// size it should take. 0 if there is not enough memory.
+static size_t lu8g_fb_page_extent( lu8g_userdata_t *lud, size_t page_bytes )
+{
+    u8g_pb_t *pb = (u8g_pb_t *)(lud->dev->dev_mem);
+    void *page_buf = pb->buf;
+    u8g_page_t p = pb->p;
+    uint8_t *probe = (uint8_t *)c_zalloc( 2 * page_bytes );
+    u8g_dev_arg_pixel_t a;
+    u8g_uint_t x, y;
+    size_t n;
+
+    if (probe == NULL)
+        return 0;
+    pb->buf = probe;
+    pb->p.page = 0;
+    pb->p.page_y0 = 0;
+    pb->p.page_y1 = pb->p.page_height - 1;
+    c_memset( &a, 0, sizeof( a ) );
+    a.color = 3;
+    for (y = 0; y < pb->p.page_height; y++)
+        for (x = 0; x < pb->width; x++)
+        {
+            a.x = x;
+            a.y = y;
+            u8g_call_dev_fn( LU8G, lud->dev, U8G_DEV_MSG_SET_PIXEL, &a );
+        }
+    pb->buf = page_buf;
+    pb->p = p;
+
+    for (n = 2 * page_bytes; n > 0 && probe[n - 1] == 0; n--)
+        ;
+    c_free( probe );
+    return n;
+}
+
+// Switches to framebuffer mode. Returns 0 if the display mode has no page
+// buffer format to copy or there is not enough memory.
+static int lu8g_fb_open( lu8g_userdata_t *lud )
+{
+    u8g_pb_t *pb = (u8g_pb_t *)(lud->dev->dev_mem);
+    uint8_t bits = U8G_MODE_GET_BITS_PER_PIXEL( u8g_call_dev_fn( LU8G, lud->dev, U8G_DEV_MSG_GET_MODE, NULL ) );
+    uint8_t pages = (pb->p.total_height + pb->p.page_height - 1) / pb->p.page_height;
+    size_t page_bytes = (size_t)pb->width * pb->p.page_height * bits / 8;
+    lu8g_fb_t *fb;
+
+    if (bits != 1 && bits != 2)
+        return 0;
+    // formats that pad their pages, like the 14 row one, cannot be copied
+    // page by page
+    if (lu8g_fb_page_extent( lud, page_bytes ) != page_bytes)
+        return 0;
+    fb = (lu8g_fb_t *)c_malloc( sizeof( lu8g_fb_t ) + pages * (sizeof( uint32_t ) + 1 + page_bytes) );
+    if (fb == NULL)
+        return 0;
+
+    fb->dev.dev_fn = lu8g_fb_fn;
+    fb->dev.dev_mem = fb;
+    fb->dev.com_fn = lud->dev->com_fn;
+    fb->display = lud->dev;
+    fb->page_bytes = page_bytes;
+    fb->pages = pages;
+    fb->sum = (uint32_t *)(fb + 1);
+    fb->dirty = (uint8_t *)(fb->sum + pages);
+    fb->buf = fb->dirty + pages;
+    lu8g_fb_clear( fb );
+    c_memset( fb->dirty, LU8G_FB_UNSENT, pages );
+
+    *lu8g_dev_link( lud, lud->dev ) = &(fb->dev);
+    lud->fb = fb;
+    u8g_UpdateDimension( LU8G );
+    return 1;
+}
+
+// back to page mode
+static void lu8g_fb_close( lu8g_userdata_t *lud )
+{
+    if (lud->fb == NULL)
+        return;
+    *lu8g_dev_link( lud, &(lud->fb->dev) ) = lud->dev;
+    c_free( lud->fb );
+    lud->fb = NULL;
+    u8g_UpdateDimension( LU8G );
+}
+
 // Lua: u8g.begin( self )
 static int lu8g_begin( lua_State *L )
 {
@@ -630,6 +886,55 @@ static int lu8g_nextPage( lua_State *L )
     return 1;
 }
 
+// Lua: u8g.setFramebuffer( self, on )
+static int lu8g_setFramebuffer( lua_State *L )
+{
+    lu8g_userdata_t *lud;
+
+    if ((lud = get_lud( L )) == NULL)
+        return 0;
+
+    if (lua_toboolean( L, 2 ))
+    {
+        if (lud->fb == NULL && lu8g_fb_open( lud ) == 0)
+            return luaL_error( L, "framebuffer not available" );
+    }
+    else
+        lu8g_fb_close( lud );
+
+    return 0;
+}
+
+// Lua: u8g.clearBuffer( self )
+static int lu8g_clearBuffer( lua_State *L )
+{
+    lu8g_userdata_t *lud;
+
+    if ((lud = get_lud( L )) == NULL)
+        return 0;
+
+    if (lud->fb == NULL)
+        return luaL_error( L, "framebuffer mode required" );
+    lu8g_fb_clear( lud->fb );
+
+    return 0;
+}
+
+// Lua: int = u8g.updateDisplay( self )
+static int lu8g_updateDisplay( lua_State *L )
+{
+    lu8g_userdata_t *lud;
+
+    if ((lud = get_lud( L )) == NULL)
+        return 0;
+
+    if (lud->fb == NULL)
+        return luaL_error( L, "framebuffer mode required" );
+    lua_pushinteger( L, lu8g_fb_update( LU8G, lud->fb ) );
+
+    return 1;
+}
+
 // Lua: u8g.sleepOn( self )
 static int lu8g_sleepOn( lua_State *L )
 {
@@ -958,6 +1263,10 @@ static int lu8g_close_display( lua_State *L )
     if ((lud = get_lud( L )) == NULL)
         return 0;
 
+    if (lud->fb)
+        c_free( lud->fb );
+    lud->fb = NULL;
+
     return 0;
 }
 
@@ -979,6 +1288,8 @@ static int lu8g_close_display( lua_State *L )
         lu8g_userdata_t *lud = (lu8g_userdata_t *) lua_newuserdata( L, sizeof( lu8g_userdata_t ) ); \
                                                                         \
         lud->u8g.i2c_addr = (uint8_t)addr;                              \
+        lud->dev = &u8g_dev_ ## device;                                 \
+        lud->fb = NULL;                                                 \
                                                                         \
         u8g_InitI2C( LU8G, &u8g_dev_ ## device, U8G_I2C_OPT_NONE);      \
                                                                         \
@@ -1008,6 +1319,8 @@ U8G_DISPLAY_TABLE_I2C
         unsigned res = luaL_optinteger( L, 3, U8G_PIN_NONE );           \
                                                                         \
         lu8g_userdata_t *lud = (lu8g_userdata_t *) lua_newuserdata( L, sizeof( lu8g_userdata_t ) ); \
+        lud->dev = &u8g_dev_ ## device;                                 \
+        lud->fb = NULL;                                                 \
                                                                         \
         u8g_InitHWSPI( LU8G, &u8g_dev_ ## device, cs, dc, res );        \
                                                                         \
@@ -1027,6 +1340,7 @@ U8G_DISPLAY_TABLE_SPI
 // Module function map
 static const LUA_REG_TYPE lu8g_display_map[] = {
   { LSTRKEY( "begin" ),                        LFUNCVAL( lu8g_begin ) },
+  { LSTRKEY( "clearBuffer" ),                  LFUNCVAL( lu8g_clearBuffer ) },
   { LSTRKEY( "drawBitmap" ),                   LFUNCVAL( lu8g_drawBitmap ) },
   { LSTRKEY( "drawBox" ),                      LFUNCVAL( lu8g_drawBox ) },
   { LSTRKEY( "drawCircle" ),                   LFUNCVAL( lu8g_drawCircle ) },
@@ -1059,6 +1373,7 @@ static const LUA_REG_TYPE lu8g_display_map[] = {
   { LSTRKEY( "setColorIndex" ),                LFUNCVAL( lu8g_setColorIndex ) },
   { LSTRKEY( "setDefaultBackgroundColor" ),    LFUNCVAL( lu8g_setDefaultBackgroundColor ) },
   { LSTRKEY( "setDefaultForegroundColor" ),    LFUNCVAL( lu8g_setDefaultForegroundColor ) },
+  { LSTRKEY( "setFramebuffer" ),               LFUNCVAL( lu8g_setFramebuffer ) },
   { LSTRKEY( "setFont" ),                      LFUNCVAL( lu8g_setFont ) },
   { LSTRKEY( "setFontLineSpacingFactor" ),     LFUNCVAL( lu8g_setFontLineSpacingFactor ) },
   { LSTRKEY( "setFontPosBaseline" ),           LFUNCVAL( lu8g_setFontPosBaseline ) },
@@ -1076,6 +1391,7 @@ static const LUA_REG_TYPE lu8g_display_map[] = {
   { LSTRKEY( "sleepOn" ),                      LFUNCVAL( lu8g_sleepOn ) },
   { LSTRKEY( "undoRotation" ),                 LFUNCVAL( lu8g_undoRotation ) },
   { LSTRKEY( "undoScale" ),                    LFUNCVAL( lu8g_undoScale ) },
+  { LSTRKEY( "updateDisplay" ),                LFUNCVAL( lu8g_updateDisplay ) },
   { LSTRKEY( "__gc" ),                         LFUNCVAL( lu8g_close_display ) },
   { LSTRKEY( "__index" ),                      LROVAL( lu8g_display_map ) },
   { LNILKEY, LNILVAL }
@@ -7,8 +7,27 @@
 #include "c_types.h"
 #include "c_string.h"
 
+// the receive ring in driver/uart.c
+extern uint16_t uart_rx_size(void);
+extern uint16_t uart_rx_count(void);
+extern uint16_t uart_rx_find(uint8_t c);
+extern uint16_t uart_rx_read(char *buf, uint16_t len);
+extern void uart_rx_trigger(uint16_t threshold, int16_t terminator);
+extern uint32_t uart_rx_overflow(bool reset);
+// and the transmit ring
+extern uint16_t uart_tx_size(void);
+extern uint16_t uart_tx_free(void);
+extern uint16_t uart_tx_write(const char *buf, uint16_t len, bool block);
+
+// what uart.write does when the transmit ring is full
+#define TX_BLOCK  0
+#define TX_DROP   1
+#define TX_ERROR  2
+
 static lua_State *gL = NULL;
 static int uart_receive_rf = LUA_NOREF;
+static int uart_sent_rf = LUA_NOREF;
+static int tx_policy = TX_BLOCK;
 bool run_input = true;
 bool uart_on_data_cb(const char *buf, size_t len){
   if(!buf || len==0)
@@ -23,8 +42,59 @@ bool uart_on_data_cb(const char *buf, size_t len){
   return !run_input;
 }
 
-uint16_t need_len = 0;
-int16_t end_char = -1;
+static uint16_t need_len = 0;
+static int16_t end_char = -1;
+
+// Tells the receive interrupt when the task has something to do
+static void uart_set_trigger(void)
+{
+  if (run_input)
+    uart_rx_trigger(1, -1);
+  else if (end_char >= 0)
+    uart_rx_trigger(0, end_char);    // the terminator, or a full ring
+  else if (need_len > 0)
+    uart_rx_trigger(need_len, -1);
+  else
+    uart_rx_trigger(1, -1);          // whatever the fifo or an idle line brings
+}
+
+// Hands raw input from the receive ring to the data callback, in the
+// chunks uart.on() asked for. Runs in the Lua task while run_input is off.
+void uart_on_data_rx(void)
+{
+  uint16_t avail, n, k;
+  luaL_Buffer b;
+
+  while (!run_input && (avail = uart_rx_count()) > 0) {
+    if (end_char >= 0)
+      n = uart_rx_find((uint8_t)end_char);
+    else if (need_len > 0)
+      n = avail >= need_len ? need_len : 0;
+    else
+      n = avail;
+    // a full ring is passed on whole rather than left to overflow
+    if (n == 0 && avail >= uart_rx_size())
+      n = avail;
+    if (n == 0)
+      return;
+
+    if (uart_receive_rf == LUA_NOREF || !gL) {
+      char skip[32];
+      while (n > 0)
+        n -= uart_rx_read(skip, n < sizeof(skip) ? n : sizeof(skip));
+      continue;
+    }
+    lua_rawgeti(gL, LUA_REGISTRYINDEX, uart_receive_rf);
+    luaL_buffinit(gL, &b);
+    while (n > 0) {
+      k = n < LUAL_BUFFERSIZE ? n : LUAL_BUFFERSIZE;
+      luaL_addsize(&b, uart_rx_read(luaL_prepbuffer(&b), k));
+      n -= k;
+    }
+    luaL_pushresult(&b);
+    lua_call(gL, 1, 0);
+  }
+}
 // Lua: uart.on("method", [number/char], function, [run_input])
 static int uart_on( lua_State* L )
 {
@@ -38,13 +108,13 @@ static int uart_on( lua_State* L )
 
   if( lua_type( L, stack ) == LUA_TNUMBER )
   {
-    need_len = ( uint16_t )luaL_checkinteger( L, stack );
+    int len = luaL_checkinteger( L, stack );
     stack++;
-    end_char = -1;
-    if( need_len > 255 ){
-      need_len = 255;
+    if( len < 0 || len > uart_rx_size() ){
       return luaL_error( L, "wrong arg range" );
     }
+    need_len = ( uint16_t )len;
+    end_char = -1;
   }
   else if(lua_isstring(L, stack))
   {
@@ -80,6 +150,18 @@ static int uart_on( lua_State* L )
     } else {
       lua_pop(L, 1);
     }
+    uart_set_trigger();
+  }else if(sl == 4 && c_strcmp(method, "sent") == 0){
+    if(uart_sent_rf != LUA_NOREF){
+      luaL_unref(L, LUA_REGISTRYINDEX, uart_sent_rf);
+      uart_sent_rf = LUA_NOREF;
+    }
+    if(!lua_isnil(L, -1)){
+      uart_sent_rf = luaL_ref(L, LUA_REGISTRYINDEX);
+      gL = L;
+    } else {
+      lua_pop(L, 1);
+    }
   }else{
     lua_pop(L, 1);
     return luaL_error( L, "method not supported" );
@@ -88,11 +170,12 @@ static int uart_on( lua_State* L )
 }
 
 bool uart0_echo = true;
-// Lua: actualbaud = setup( id, baud, databits, parity, stopbits, echo )
+// Lua: actualbaud = setup( id, baud, databits, parity, stopbits, echo, [rxbuffer], [txbuffer] )
 static int uart_setup( lua_State* L )
 {
   unsigned id, databits, parity, stopbits, echo = 1;
   u32 baud, res;
+  int rxbuffer, txbuffer;
 
   id = luaL_checkinteger( L, 1 );
   MOD_CHECK_ID( uart, id );
@@ -108,11 +191,57 @@ static int uart_setup( lua_State* L )
       uart0_echo = false;
   }
 
+  rxbuffer = luaL_optinteger( L, 7, 0 );
+  if( rxbuffer != 0 )
+  {
+    if( rxbuffer < need_len || rxbuffer > 0xFFFE )
+      return luaL_error( L, "wrong arg range" );
+    if( platform_uart_set_buffer( id, rxbuffer ) != 0 )
+      return luaL_error( L, "not enough memory" );
+    uart_set_trigger();
+  }
+
+  txbuffer = luaL_optinteger( L, 8, -1 );
+  if( txbuffer >= 0 )
+  {
+    if( txbuffer > 0xFFFE )
+      return luaL_error( L, "wrong arg range" );
+    if( platform_uart_set_tx_buffer( id, txbuffer ) != 0 )
+      return luaL_error( L, "not enough memory" );
+  }
+
   res = platform_uart_setup( id, baud, databits, parity, stopbits );
   lua_pushinteger( L, res );
   return 1;
 }
 
+// Lua: n = overflow( reset )
+static int uart_overflow( lua_State* L )
+{
+  lua_pushnumber( L, uart_rx_overflow( lua_toboolean( L, 1 ) ) );
+  return 1;
+}
+
+// Lua: txpolicy( policy )
+static int uart_txpolicy( lua_State* L )
+{
+  int policy = luaL_checkinteger( L, 1 );
+
+  if( policy != TX_BLOCK && policy != TX_DROP && policy != TX_ERROR )
+    return luaL_error( L, "wrong arg range" );
+  tx_policy = policy;
+  return 0;
+}
+
+// Runs in the Lua task once uart.write output has gone out
+static void uart_sent( unsigned id )
+{
+  if( uart_sent_rf == LUA_NOREF || !gL )
+    return;
+  lua_rawgeti( gL, LUA_REGISTRYINDEX, uart_sent_rf );
+  lua_call( gL, 0, 0 );
+}
+
 // Lua: alt( set )
 static int uart_alt( lua_State* L )
 {
@@ -124,34 +253,75 @@ static int uart_alt( lua_State* L )
   return 0;
 }
 
-// Lua: write( id, string1, [string2], ..., [stringn] )
+// Lua: queued = write( id, string1, [string2], ..., [stringn] )
 static int uart_write( lua_State* L )
 {
   int id;
   const char* buf;
-  size_t len, i;
-  int total = lua_gettop( L ), s;
+  char c;
+  size_t len, i, total = 0, queued = 0;
+  int n = lua_gettop( L ), s;
+  bool ring, full = false;
 
   id = luaL_checkinteger( L, 1 );
   MOD_CHECK_ID( uart, id );
-  for( s = 2; s <= total; s ++ )
+  for( s = 2; s <= n; s ++ )
   {
     if( lua_type( L, s ) == LUA_TNUMBER )
     {
-      len = lua_tointeger( L, s );
-      if( len > 255 )
+      if( lua_tointeger( L, s ) < 0 || lua_tointeger( L, s ) > 255 )
         return luaL_error( L, "invalid number" );
-      platform_uart_send( id, ( u8 )len );
+      total ++;
     }
     else
     {
       luaL_checktype( L, s, LUA_TSTRING );
+      total += lua_objlen( L, s );
+    }
+  }
+
+  // UART0 output goes through the transmit ring unless it has none
+  ring = id == 0 && uart_tx_size() > 0;
+  if( ring && tx_policy == TX_ERROR && total > uart_tx_free() )
+    return luaL_error( L, "buffer full" );
+
+  for( s = 2; s <= n && !full; s ++ )
+  {
+    if( lua_type( L, s ) == LUA_TNUMBER )
+    {
+      c = ( char )lua_tointeger( L, s );
+      buf = &c;
+      len = 1;
+    }
+    else
       buf = lua_tolstring( L, s, &len );
+    if( !ring )
+    {
       for( i = 0; i < len; i ++ )
         platform_uart_send( id, buf[ i ] );
+      queued += len;
+      continue;
+    }
+    // the ring takes at most 0xFFFF bytes a call
+    for( i = 0; i < len; )
+    {
+      uint16_t k = len - i > 0xFFFF ? 0xFFFF : len - i;
+      uint16_t done = uart_tx_write( buf + i, k, tx_policy == TX_BLOCK );
+      i += done;
+      if( done < k )
+      {
+        // dropped: what follows would arrive out of context
+        full = true;
+        break;
+      }
     }
+    queued += i;
   }
-  return 0;
+
+  if( id == 0 && uart_sent_rf != LUA_NOREF && queued > 0 )
+    platform_uart_notify_sent( id, uart_sent );
+  lua_pushinteger( L, queued );
+  return 1;
 }
 
 // Module function map
@@ -160,6 +330,11 @@ static const LUA_REG_TYPE uart_map[] =  {
   { LSTRKEY( "write" ), LFUNCVAL( uart_write ) },
   { LSTRKEY( "on" ),    LFUNCVAL( uart_on ) },
   { LSTRKEY( "alt" ),   LFUNCVAL( uart_alt ) },
+  { LSTRKEY( "overflow" ), LFUNCVAL( uart_overflow ) },
+  { LSTRKEY( "txpolicy" ), LFUNCVAL( uart_txpolicy ) },
+  { LSTRKEY( "TX_BLOCK" ),     LNUMVAL( TX_BLOCK ) },
+  { LSTRKEY( "TX_DROP" ),      LNUMVAL( TX_DROP ) },
+  { LSTRKEY( "TX_ERROR" ),     LNUMVAL( TX_ERROR ) },
   { LSTRKEY( "STOPBITS_1" ),   LNUMVAL( PLATFORM_UART_STOPBITS_1 ) },
   { LSTRKEY( "STOPBITS_1_5" ), LNUMVAL( PLATFORM_UART_STOPBITS_1_5 ) },
   { LSTRKEY( "STOPBITS_2" ),   LNUMVAL( PLATFORM_UART_STOPBITS_2 ) },
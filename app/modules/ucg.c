@@ -5,11 +5,34 @@
 #include "platform.h"
 
 #include "c_stdlib.h"
+#include "c_string.h"
 
 #include "ucg.h"
 
 #include "ucg_config.h"
 
+// Batches record boxes, lines and pixels as runs in the color they were
+// drawn with. A run is a box, so adjacent pixels become lines and adjacent
+// lines become boxes.
+typedef struct
+{
+    ucg_int_t x, y, w, h;
+    uint8_t rgb[3];
+} lucg_run_t;
+
+typedef struct
+{
+    uint16_t size, used;
+    uint32_t calls, runs;   // recorded and drawn since beginBatch
+    lucg_run_t run[1];
+} lucg_batch_t;
+
+#define LUCG_BATCH_RUNS 64
+
+// bytes staged per block transfer, a multiple of 1, 2 and 3 byte pixels
+// and of the 64 byte SPI buffer
+#define LUCG_SPI_CHUNK 192
+
 struct _lucg_userdata_t
 {
     ucg_t ucg;
@@ -20,6 +43,8 @@ struct _lucg_userdata_t
     // For Print() function
     ucg_int_t tx, ty;
     uint8_t tdir;
+
+    lucg_batch_t *batch;
 };
 
 typedef struct _lucg_userdata_t lucg_userdata_t;
@@ -36,14 +61,26 @@ static int16_t ucg_com_esp8266_hw_spi(ucg_t *ucg, int16_t msg, uint16_t arg, uin
 #define LUCG (&(lud->ucg))
 
 
+static void lucg_batch_flush( lucg_userdata_t *lud );
+
 // helper function: retrieve and check userdata argument
-static lucg_userdata_t *get_lud( lua_State *L )
+static lucg_userdata_t *check_lud( lua_State *L )
 {
     lucg_userdata_t *lud = (lucg_userdata_t *)luaL_checkudata(L, 1, "ucg.display");
     luaL_argcheck(L, lud, 1, "ucg.display expected");
     return lud;
 }
 
+// as check_lud, but draws the runs of an open batch first so that calls
+// which are not recorded keep their order
+static lucg_userdata_t *get_lud( lua_State *L )
+{
+    lucg_userdata_t *lud = check_lud( L );
+    if (lud && lud->batch)
+        lucg_batch_flush( lud );
+    return lud;
+}
+
 // helper function: retrieve given number of integer arguments
 static void lucg_get_int_args( lua_State *L, uint8_t stack, uint8_t num, ucg_int_t *args)
 {
@@ -53,6 +90,139 @@ static void lucg_get_int_args( lua_State *L, uint8_t stack, uint8_t num, ucg_int
     }
 }
 
+// ***************************************************************************
+// Batches
+//
+// Between beginBatch and endBatch boxes, lines and pixels are recorded
+// instead of drawn. Each one is joined to the run before it where the two
+// share a color and an edge, and the runs are drawn when the list fills,
+// on endBatch or before any call that is not recorded.
+
+// join box x, y, w, h to run r if they line up
+static int lucg_run_join( lucg_run_t *r, ucg_int_t x, ucg_int_t y, ucg_int_t w, ucg_int_t h, const uint8_t *rgb )
+{
+    if (c_memcmp( r->rgb, rgb, 3 ) != 0)
+        return 0;
+
+    if (r->y == y && r->h == h && (r->x + r->w == x || x + w == r->x))
+    {
+        if (x < r->x)
+            r->x = x;
+        r->w += w;
+        return 1;
+    }
+    if (r->x == x && r->w == w && (r->y + r->h == y || y + h == r->y))
+    {
+        if (y < r->y)
+            r->y = y;
+        r->h += h;
+        return 1;
+    }
+    return 0;
+}
+
+static void lucg_batch_add( lucg_userdata_t *lud, ucg_int_t x, ucg_int_t y, ucg_int_t w, ucg_int_t h )
+{
+    lucg_batch_t *b = lud->batch;
+    const uint8_t *rgb = lud->ucg.arg.rgb[0].color;
+    lucg_run_t *r;
+
+    b->calls++;
+    if (w <= 0 || h <= 0)
+        return;
+
+    if (b->used > 0 && lucg_run_join( &b->run[b->used-1], x, y, w, h, rgb ))
+    {
+        // a longer run may now line up with the one before it
+        while (b->used > 1)
+        {
+            r = &b->run[b->used-1];
+            if (!lucg_run_join( r - 1, r->x, r->y, r->w, r->h, r->rgb ))
+                break;
+            b->used--;
+        }
+        return;
+    }
+
+    if (b->used == b->size)
+        lucg_batch_flush( lud );
+    r = &b->run[b->used++];
+    r->x = x;
+    r->y = y;
+    r->w = w;
+    r->h = h;
+    c_memcpy( r->rgb, rgb, 3 );
+}
+
+// draw the recorded runs, each as few lines as possible
+static void lucg_batch_flush( lucg_userdata_t *lud )
+{
+    lucg_batch_t *b = lud->batch;
+    ucg_color_t color = lud->ucg.arg.rgb[0];
+    lucg_run_t *r;
+    ucg_int_t i;
+
+    for (r = b->run; r < b->run + b->used; r++)
+    {
+        ucg_SetColor( LUCG, 0, r->rgb[0], r->rgb[1], r->rgb[2] );
+        if (r->w == 1 && r->h == 1)
+            ucg_DrawPixel( LUCG, r->x, r->y );
+        else if (r->w >= r->h)
+            for (i = 0; i < r->h; i++)
+                ucg_DrawHLine( LUCG, r->x, r->y + i, r->w );
+        else
+            for (i = 0; i < r->w; i++)
+                ucg_DrawVLine( LUCG, r->x + i, r->y, r->h );
+    }
+    b->runs += b->used;
+    b->used = 0;
+    lud->ucg.arg.rgb[0] = color;
+}
+
+// Lua: ucg.beginBatch( self, [runs] )
+static int lucg_beginBatch( lua_State *L )
+{
+    lucg_userdata_t *lud;
+
+    if ((lud = get_lud( L )) == NULL)
+        return 0;
+
+    int size = luaL_optinteger( L, 2, LUCG_BATCH_RUNS );
+    if (size < 1 || size > 0xffff)
+        return luaL_error( L, "wrong arg range" );
+
+    if (lud->batch)
+        c_free( lud->batch );
+    lud->batch = (lucg_batch_t *)c_malloc( sizeof( lucg_batch_t ) + (size - 1) * sizeof( lucg_run_t ) );
+    if (lud->batch == NULL)
+        return luaL_error( L, "out of memory" );
+    lud->batch->size  = size;
+    lud->batch->used  = 0;
+    lud->batch->calls = 0;
+    lud->batch->runs  = 0;
+
+    return 0;
+}
+
+// Lua: calls, runs = ucg.endBatch( self )
+static int lucg_endBatch( lua_State *L )
+{
+    lucg_userdata_t *lud;
+
+    if ((lud = get_lud( L )) == NULL)
+        return 0;
+
+    if (lud->batch == NULL)
+        return 0;
+
+    lua_pushinteger( L, lud->batch->calls );
+    lua_pushinteger( L, lud->batch->runs );
+    c_free( lud->batch );
+    lud->batch = NULL;
+
+    return 2;
+}
+
 // Lua: ucg.begin( self, fontmode )
 static int lucg_begin( lua_State *L )
 {
@@ -104,13 +274,16 @@ static int lucg_drawBox( lua_State *L )
 {
     lucg_userdata_t *lud;
 
-    if ((lud = get_lud( L )) == NULL)
+    if ((lud = check_lud( L )) == NULL)
         return 0;
 
     ucg_int_t args[4];
     lucg_get_int_args( L, 2, 4, args );
 
-    ucg_DrawBox( LUCG, args[0], args[1], args[2], args[3] );
+    if (lud->batch)
+        lucg_batch_add( lud, args[0], args[1], args[2], args[3] );
+    else
+        ucg_DrawBox( LUCG, args[0], args[1], args[2], args[3] );
 
     return 0;
 }
@@ -220,13 +393,16 @@ static int lucg_drawHLine( lua_State *L )
 {
     lucg_userdata_t *lud;
 
-    if ((lud = get_lud( L )) == NULL)
+    if ((lud = check_lud( L )) == NULL)
         return 0;
 
     ucg_int_t args[3];
     lucg_get_int_args( L, 2, 3, args );
 
-    ucg_DrawHLine( LUCG, args[0], args[1], args[2] );
+    if (lud->batch)
+        lucg_batch_add( lud, args[0], args[1], args[2], 1 );
+    else
+        ucg_DrawHLine( LUCG, args[0], args[1], args[2] );
 
     return 0;
 }
@@ -252,13 +428,16 @@ static int lucg_drawPixel( lua_State *L )
 {
     lucg_userdata_t *lud;
 
-    if ((lud = get_lud( L )) == NULL)
+    if ((lud = check_lud( L )) == NULL)
         return 0;
 
     ucg_int_t args[2];
     lucg_get_int_args( L, 2, 2, args );
 
-    ucg_DrawPixel( LUCG, args[0], args[1] );
+    if (lud->batch)
+        lucg_batch_add( lud, args[0], args[1], 1, 1 );
+    else
+        ucg_DrawPixel( LUCG, args[0], args[1] );
 
     return 0;
 }
@@ -352,13 +531,16 @@ static int lucg_drawVLine( lua_State *L )
 {
     lucg_userdata_t *lud;
 
-    if ((lud = get_lud( L )) == NULL)
+    if ((lud = check_lud( L )) == NULL)
         return 0;
 
     ucg_int_t args[3];
     lucg_get_int_args( L, 2, 3, args );
 
-    ucg_DrawVLine( LUCG, args[0], args[1], args[2] );
+    if (lud->batch)
+        lucg_batch_add( lud, args[0], args[1], 1, args[2] );
+    else
+        ucg_DrawVLine( LUCG, args[0], args[1], args[2] );
 
     return 0;
 }
@@ -453,7 +635,7 @@ static int lucg_setColor( lua_State *L )
 {
     lucg_userdata_t *lud;
 
-    if ((lud = get_lud( L )) == NULL)
+    if ((lud = check_lud( L )) == NULL)
         return 0;
 
     ucg_int_t args[3];
@@ -704,6 +886,27 @@ static int lucg_undoScale( lua_State *L )
 
 
 
+// send count copies of an n byte pattern, as many per block transfer as
+// fit the staging buffer
+static void lucg_spi_repeat( const uint8_t *pattern, uint8_t n, uint16_t count )
+{
+    uint8_t buf[LUCG_SPI_CHUNK];
+    uint16_t fill = LUCG_SPI_CHUNK / n;
+    uint16_t i, k;
+
+    if (fill > count)
+        fill = count;
+    for (i = 0; i < fill * n; i++)
+        buf[i] = pattern[i % n];
+
+    while (count > 0)
+    {
+        k = count < fill ? count : fill;
+        platform_spi_blkwrite( 1, buf, k * n );
+        count -= k;
+    }
+}
+
 static int16_t ucg_com_esp8266_hw_spi(ucg_t *ucg, int16_t msg, uint16_t arg, uint8_t *data)
 {
   switch(msg)
@@ -754,55 +957,50 @@ static int16_t ucg_com_esp8266_hw_spi(ucg_t *ucg, int16_t msg, uint16_t arg, uin
         break;
 
     case UCG_COM_MSG_REPEAT_1_BYTE:
-        while( arg > 0 ) {
-            platform_spi_send( 1, 8, data[0] );
-            arg--;
-        }
+        lucg_spi_repeat( data, 1, arg );
         break;
 
     case UCG_COM_MSG_REPEAT_2_BYTES:
-        while( arg > 0 ) {
-            platform_spi_send( 1, 8, data[0] );
-            platform_spi_send( 1, 8, data[1] );
-            arg--;
-        }
+        lucg_spi_repeat( data, 2, arg );
         break;
 
     case UCG_COM_MSG_REPEAT_3_BYTES:
-        while( arg > 0 ) {
-            platform_spi_send( 1, 8, data[0] );
-            platform_spi_send( 1, 8, data[1] );
-            platform_spi_send( 1, 8, data[2] );
-            arg--;
-        }
+        lucg_spi_repeat( data, 3, arg );
         break;
 
     case UCG_COM_MSG_SEND_STR:
-        while( arg > 0 ) {
-            platform_spi_send( 1, 8, *data++ );
-            arg--;
-        }
+        platform_spi_blkwrite( 1, data, arg );
         break;
 
     case UCG_COM_MSG_SEND_CD_DATA_SEQUENCE:
-        while(arg > 0)
         {
-            if ( *data != 0 )
+            uint8_t buf[LUCG_SPI_CHUNK];
+            uint16_t n = 0;
+            int cd = -1;
+
+            while(arg > 0)
             {
                 /* set the data line directly, ignore the setting from UCG_CFG_CD */
-                if ( *data == 1 )
+                if ( *data != 0 && (*data == 1 ? 0 : 1) != cd )
                 {
-                    platform_gpio_write( ucg->pin_list[UCG_PIN_CD], 0 );
+                    /* the bytes so far go out at the old level */
+                    if ( n > 0 )
+                        platform_spi_blkwrite( 1, buf, n );
+                    n = 0;
+                    cd = *data == 1 ? 0 : 1;
+                    platform_gpio_write( ucg->pin_list[UCG_PIN_CD], cd );
                 }
-                else
+                data++;
+                buf[n++] = *data++;
+                if ( n == LUCG_SPI_CHUNK )
                 {
-                    platform_gpio_write( ucg->pin_list[UCG_PIN_CD], 1 );
+                    platform_spi_blkwrite( 1, buf, n );
+                    n = 0;
                 }
+                arg--;
             }
-            data++;
-            platform_spi_send( 1, 8, *data );
-            data++;
-            arg--;
+            if ( n > 0 )
+                platform_spi_blkwrite( 1, buf, n );
         }
         break;
   }
@@ -816,9 +1014,15 @@ static int lucg_close_display( lua_State *L )
 {
     lucg_userdata_t *lud;
 
-    if ((lud = get_lud( L )) == NULL)
+    if ((lud = check_lud( L )) == NULL)
         return 0;
 
+    if (lud->batch)
+    {
+        c_free( lud->batch );
+        lud->batch = NULL;
+    }
+
     return 0;
 }
 
@@ -849,6 +1053,8 @@ static int lucg_close_display( lua_State *L )
         lud->ty   = 0;                                                  \
         lud->tdir = 0;  /* default direction */                         \
                                                                         \
+        lud->batch = NULL;                                              \
+                                                                        \
         uint8_t i;                                                      \
         for( i = 0; i < UCG_PIN_COUNT; i++ )                            \
             lud->ucg.pin_list[i] = UCG_PIN_VAL_NONE;                    \
@@ -877,6 +1083,7 @@ UCG_DISPLAY_TABLE
 static const LUA_REG_TYPE lucg_display_map[] =
 {
     { LSTRKEY( "begin" ),              LFUNCVAL( lucg_begin ) },
+    { LSTRKEY( "beginBatch" ),         LFUNCVAL( lucg_beginBatch ) },
     { LSTRKEY( "clearScreen" ),        LFUNCVAL( lucg_clearScreen ) },
     { LSTRKEY( "draw90Line" ),         LFUNCVAL( lucg_draw90Line ) },
     { LSTRKEY( "drawBox" ),            LFUNCVAL( lucg_drawBox ) },
@@ -895,6 +1102,7 @@ static const LUA_REG_TYPE lucg_display_map[] =
     { LSTRKEY( "drawTetragon" ),       LFUNCVAL( lucg_drawTetragon ) },
     { LSTRKEY( "drawTriangle" ),       LFUNCVAL( lucg_drawTriangle ) },
     { LSTRKEY( "drawVLine" ),          LFUNCVAL( lucg_drawVLine ) },
+    { LSTRKEY( "endBatch" ),           LFUNCVAL( lucg_endBatch ) },
     { LSTRKEY( "getFontAscent" ),      LFUNCVAL( lucg_getFontAscent ) },
     { LSTRKEY( "getFontDescent" ),     LFUNCVAL( lucg_getFontDescent ) },
     { LSTRKEY( "getHeight" ),          LFUNCVAL( lucg_getHeight ) },
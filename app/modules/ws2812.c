@@ -3,7 +3,25 @@
 #include "platform.h"
 #include "c_stdlib.h"
 #include "c_string.h"
+#include "c_limits.h"
 #include "user_interface.h"
+#include "driver/uart.h"
+
+#define WS2812_UART 1              // UART1 TXD is GPIO2, pin 4
+#define WS2812_UART_BAUD 3200000   // 4 UART bits per LED bit
+#define WS2812_FIFO_SIZE 128
+#define WS2812_MIX_MAX 8           // source buffers for buffer:mix()
+
+typedef struct {
+  int size;
+  uint8_t colorsPerLed;
+  uint8_t values[0];
+} ws2812_buffer;
+
+enum { SHIFT_LOGICAL = 0, SHIFT_CIRCULAR };
+enum { FADE_OUT = 0, FADE_IN };
+
+static uint8_t ws2812_uart_ready = 0;
 
 static inline uint32_t _getCycleCount(void) {
   uint32_t cycles;
@@ -54,6 +72,24 @@ static void ICACHE_RAM_ATTR ws2812_write(uint8_t pin, uint8_t *pixels, uint32_t
   }
 }
 
+// Bit-bangs the bytes on pin with interrupts off for the whole frame.
+// Taking GPIO2 back from UART1 means the next buffer:write() sets it up again.
+static void ws2812_bitbang(uint8_t pin, uint8_t *pixels, uint32_t length) {
+  // Initialize the output pin
+  platform_gpio_mode(pin, PLATFORM_GPIO_OUTPUT, PLATFORM_GPIO_FLOAT);
+  platform_gpio_write(pin, 0);
+  if (pin_num[pin] == 2) {
+    ws2812_uart_ready = 0;
+  }
+
+  if (length == 0) {
+    return;
+  }
+  ets_intr_lock();
+  ws2812_write(pin_num[pin], pixels, length);
+  ets_intr_unlock();
+}
+
 // Lua: ws2812.writergb(pin, "string")
 // Byte triples in the string are interpreted as R G B values and sent to the hardware as G R B.
 // WARNING: this function scrambles the input buffer :
@@ -87,14 +123,8 @@ static int ICACHE_FLASH_ATTR ws2812_writergb(lua_State* L)
     buffer[i + 1] = r;
   }
 
-  // Initialize the output pin and wait a bit
-  platform_gpio_mode(pin, PLATFORM_GPIO_OUTPUT, PLATFORM_GPIO_FLOAT);
-  platform_gpio_write(pin, 0);
-
   // Send the buffer
-  ets_intr_lock();
-  ws2812_write(pin_num[pin], (uint8_t*) buffer, length);
-  ets_intr_unlock();
+  ws2812_bitbang(pin, (uint8_t*) buffer, length);
 
   c_free(buffer);
 
@@ -103,7 +133,7 @@ static int ICACHE_FLASH_ATTR ws2812_writergb(lua_State* L)
 
 // Lua: ws2812.write(pin, "string")
 // Byte triples in the string are interpreted as G R B values.
-// This function does not corrupt your buffer.
+// This function does not corrupt your buffer. A buffer object is sent as is.
 //
 // ws2812.write(4, string.char(0, 255, 0)) uses GPIO2 and sets the first LED red.
 // ws2812.write(3, string.char(0, 0, 255):rep(10)) uses GPIO0 and sets ten LEDs blue.
@@ -111,29 +141,351 @@ static int ICACHE_FLASH_ATTR ws2812_writergb(lua_State* L)
 static int ICACHE_FLASH_ATTR ws2812_writegrb(lua_State* L) {
   const uint8_t pin = luaL_checkinteger(L, 1);
   size_t length;
-  const char *buffer = luaL_checklstring(L, 2, &length);
+  const char *buffer;
 
-  // Initialize the output pin
-  platform_gpio_mode(pin, PLATFORM_GPIO_OUTPUT, PLATFORM_GPIO_FLOAT);
-  platform_gpio_write(pin, 0);
+  if (lua_type(L, 2) == LUA_TUSERDATA) {
+    ws2812_buffer *b = (ws2812_buffer *)luaL_checkudata(L, 2, "ws2812.buffer");
+    buffer = (const char *)b->values;
+    length = b->size * b->colorsPerLed;
+  } else {
+    buffer = luaL_checklstring(L, 2, &length);
+  }
 
   // Send the buffer
-  ets_intr_lock();
-  ws2812_write(pin_num[pin], (uint8_t*) buffer, length);
-  ets_intr_unlock();
+  ws2812_bitbang(pin, (uint8_t*) buffer, length);
+
+  return 0;
+}
+
+// The UART sends a 6N1 frame, start bit first and LSB first, as 8 bits of
+// 312.5ns. With the line inverted the start bit is high and the stop bit
+// low, so each frame carries two LED bits of 4 UART bits each:
+// 0 is high for one bit (312.5ns), 1 is high for three (937.5ns).
+static const uint8_t ws2812_uart_bits[4] = { 0x37, 0x07, 0x34, 0x04 };
+
+static void ws2812_uart_init(void) {
+  // Let the last frame leave the FIFO before switching speed
+  while ((READ_PERI_REG(UART_STATUS(WS2812_UART)) >> UART_TXFIFO_CNT_S) & UART_TXFIFO_CNT);
+
+  WRITE_PERI_REG(UART_CLKDIV(WS2812_UART), UART_CLK_FREQ / WS2812_UART_BAUD);
+  WRITE_PERI_REG(UART_CONF0(WS2812_UART), UART_TXD_INV
+                 | (ONE_STOP_BIT << UART_STOP_BIT_NUM_S)
+                 | (SIX_BITS << UART_BIT_NUM_S));
+
+  // Hand GPIO2 over to U1TXD; the inverted idle level keeps the line low
+  GPIO_REG_WRITE(GPIO_ENABLE_W1TC_ADDRESS, BIT2);
+  PIN_FUNC_SELECT(PERIPHS_IO_MUX_GPIO2_U, FUNC_U1TXD_BK);
+  ws2812_uart_ready = 1;
+}
+
+// Feeds the TX FIFO 4 UART frames per byte. Interrupts stay enabled: the
+// 128 frame FIFO holds 320us of output, so WiFi and timer interrupts do
+// not stretch a bit or latch the strip half way.
+static void ws2812_uart_write(const uint8_t *pixels, uint32_t length) {
+  const uint8_t *end = pixels + length;
+  uint8_t value;
+
+  if (!ws2812_uart_ready) {
+    ws2812_uart_init();
+  }
+  while (pixels < end) {
+    while (((READ_PERI_REG(UART_STATUS(WS2812_UART)) >> UART_TXFIFO_CNT_S) & UART_TXFIFO_CNT) > WS2812_FIFO_SIZE - 4);
+    value = *pixels++;
+    WRITE_PERI_REG(UART_FIFO(WS2812_UART), ws2812_uart_bits[(value >> 6) & 3]);
+    WRITE_PERI_REG(UART_FIFO(WS2812_UART), ws2812_uart_bits[(value >> 4) & 3]);
+    WRITE_PERI_REG(UART_FIFO(WS2812_UART), ws2812_uart_bits[(value >> 2) & 3]);
+    WRITE_PERI_REG(UART_FIFO(WS2812_UART), ws2812_uart_bits[value & 3]);
+  }
+}
+
+// Lua: ws2812.init()
+// Switches GPIO2 (pin 4) to UART1 for buffer:write(). UART1 is the debug
+// console, so nothing else should print there afterwards.
+static int ICACHE_FLASH_ATTR ws2812_init(lua_State* L) {
+  ws2812_uart_init();
+  return 0;
+}
+
+static ws2812_buffer *ws2812_check_buffer(lua_State *L, int index) {
+  return (ws2812_buffer *)luaL_checkudata(L, index, "ws2812.buffer");
+}
+
+// The LED data of the ws2812.buffer at index, without its header, for
+// other modules that send it out (spi.blkwrite); NULL for anything else.
+const uint8_t *ws2812_buffer_payload(lua_State *L, int index, size_t *len) {
+  ws2812_buffer *buffer = NULL;
+
+  if (lua_type(L, index) == LUA_TUSERDATA && lua_getmetatable(L, index)) {
+    luaL_getmetatable(L, "ws2812.buffer");
+    if (lua_rawequal(L, -1, -2))
+      buffer = (ws2812_buffer *)lua_touserdata(L, index);
+    lua_pop(L, 2);
+  }
+  if (buffer == NULL)
+    return NULL;
+  *len = buffer->size * buffer->colorsPerLed;
+  return buffer->values;
+}
+
+static uint8_t *ws2812_check_led(lua_State *L, ws2812_buffer *buffer, int index) {
+  int led = luaL_checkinteger(L, index);
+
+  if (led < 1 || led > buffer->size) {
+    luaL_error(L, "wrong arg range");
+  }
+  return &buffer->values[(led - 1) * buffer->colorsPerLed];
+}
+
+static void ws2812_check_colors(lua_State *L, ws2812_buffer *buffer, int index, uint8_t *colors) {
+  int i, c;
+
+  for (i = 0; i < buffer->colorsPerLed; i++) {
+    c = luaL_checkinteger(L, index + i);
+    if (c < 0 || c > 255) {
+      luaL_error(L, "wrong arg range");
+    }
+    colors[i] = c;
+  }
+}
+
+// Lua: buffer = ws2812.newBuffer(leds, colorsPerLed)
+// The buffer holds the bytes in the order the strip expects them, G R B for
+// WS2812, and starts out all zero.
+static int ICACHE_FLASH_ATTR ws2812_new_buffer(lua_State *L) {
+  const int leds = luaL_checkint(L, 1);
+  const int colorsPerLed = luaL_checkint(L, 2);
+  ws2812_buffer *buffer;
+
+  if (leds < 1 || colorsPerLed < 1 || colorsPerLed > 4) {
+    return luaL_error(L, "wrong arg range");
+  }
+  // the byte count must not wrap, the allocation then fails cleanly
+  luaL_argcheck(L, leds <= (INT_MAX - (int)sizeof(ws2812_buffer)) / colorsPerLed, 1, "too many leds");
+
+  buffer = (ws2812_buffer *)lua_newuserdata(L, sizeof(ws2812_buffer) + leds * colorsPerLed);
+  luaL_getmetatable(L, "ws2812.buffer");
+  lua_setmetatable(L, -2);
+
+  buffer->size = leds;
+  buffer->colorsPerLed = colorsPerLed;
+  c_memset(buffer->values, 0, leds * colorsPerLed);
+
+  return 1;
+}
+
+// Lua: buffer:fill(c1, c2, c3[, c4])
+static int ICACHE_FLASH_ATTR ws2812_buffer_fill(lua_State *L) {
+  ws2812_buffer *buffer = ws2812_check_buffer(L, 1);
+  uint8_t colors[4];
+  uint8_t *p, *end;
+
+  ws2812_check_colors(L, buffer, 2, colors);
+
+  end = buffer->values + buffer->size * buffer->colorsPerLed;
+  for (p = buffer->values; p < end; p += buffer->colorsPerLed) {
+    c_memcpy(p, colors, buffer->colorsPerLed);
+  }
+  return 0;
+}
+
+// Lua: buffer:set(led, c1, c2, c3[, c4]) or buffer:set(led, "string")
+// A string sets its bytes from led onwards.
+static int ICACHE_FLASH_ATTR ws2812_buffer_set(lua_State *L) {
+  ws2812_buffer *buffer = ws2812_check_buffer(L, 1);
+  uint8_t *p = ws2812_check_led(L, buffer, 2);
+
+  if (lua_type(L, 3) == LUA_TSTRING) {
+    size_t length;
+    const char *data = lua_tolstring(L, 3, &length);
+
+    if (p + length > buffer->values + buffer->size * buffer->colorsPerLed) {
+      return luaL_error(L, "string too long");
+    }
+    c_memcpy(p, data, length);
+  } else {
+    ws2812_check_colors(L, buffer, 3, p);
+  }
+  return 0;
+}
+
+// Lua: c1, c2, c3[, c4] = buffer:get(led)
+static int ICACHE_FLASH_ATTR ws2812_buffer_get(lua_State *L) {
+  ws2812_buffer *buffer = ws2812_check_buffer(L, 1);
+  uint8_t *p = ws2812_check_led(L, buffer, 2);
+  int i;
+
+  for (i = 0; i < buffer->colorsPerLed; i++) {
+    lua_pushinteger(L, p[i]);
+  }
+  return buffer->colorsPerLed;
+}
+
+static void ws2812_reverse(uint8_t *p, uint8_t *q) {
+  uint8_t t;
+
+  while (p < --q) {
+    t = *p;
+    *p++ = *q;
+    *q = t;
+  }
+}
+
+// Lua: buffer:shift(n[, mode])
+// Moves the LEDs n places towards the end of the strip, or towards the
+// start if n is negative. ws2812.SHIFT_LOGICAL (the default) clears the
+// LEDs moved in, ws2812.SHIFT_CIRCULAR rotates them round from the other end.
+static int ICACHE_FLASH_ATTR ws2812_buffer_shift(lua_State *L) {
+  ws2812_buffer *buffer = ws2812_check_buffer(L, 1);
+  const int shift = luaL_checkinteger(L, 2);
+  const int mode = luaL_optinteger(L, 3, SHIFT_LOGICAL);
+  const size_t total = buffer->size * buffer->colorsPerLed;
+  size_t bytes;
+
+  if (shift <= -buffer->size || shift >= buffer->size) {
+    if (mode == SHIFT_LOGICAL) {
+      c_memset(buffer->values, 0, total);
+    }
+    return 0;
+  }
+
+  bytes = (shift < 0 ? -shift : shift) * buffer->colorsPerLed;
+  if (mode == SHIFT_CIRCULAR) {
+    // rotate in place by reversing both parts and then the whole
+    size_t split = shift < 0 ? bytes : total - bytes;
+    ws2812_reverse(buffer->values, buffer->values + split);
+    ws2812_reverse(buffer->values + split, buffer->values + total);
+    ws2812_reverse(buffer->values, buffer->values + total);
+  } else if (shift > 0) {
+    c_memmove(buffer->values + bytes, buffer->values, total - bytes);
+    c_memset(buffer->values, 0, bytes);
+  } else if (shift < 0) {
+    c_memmove(buffer->values, buffer->values + bytes, total - bytes);
+    c_memset(buffer->values + total - bytes, 0, bytes);
+  }
+  return 0;
+}
+
+// Lua: buffer:fade(value[, direction])
+// ws2812.FADE_OUT (the default) divides every color by value,
+// ws2812.FADE_IN multiplies it, saturating at 255.
+static int ICACHE_FLASH_ATTR ws2812_buffer_fade(lua_State *L) {
+  ws2812_buffer *buffer = ws2812_check_buffer(L, 1);
+  const int value = luaL_checkinteger(L, 2);
+  const int direction = luaL_optinteger(L, 3, FADE_OUT);
+  uint8_t *p = buffer->values;
+  uint8_t *end = p + buffer->size * buffer->colorsPerLed;
+  int c;
 
+  if (value < 1) {
+    return luaL_error(L, "wrong arg range");
+  }
+
+  for (; p < end; p++) {
+    if (direction == FADE_IN) {
+      c = *p * value;
+      *p = c > 255 ? 255 : c;
+    } else {
+      *p /= value;
+    }
+  }
   return 0;
 }
 
+// Lua: buffer:mix(factor1, buffer1, factor2, buffer2, ...)
+// Sets each color to the sum of factor * color over the given buffers,
+// with a factor of 256 being 1.0; the result is clamped to 0..255.
+// buffer itself may be one of the sources.
+static int ICACHE_FLASH_ATTR ws2812_buffer_mix(lua_State *L) {
+  ws2812_buffer *buffer = ws2812_check_buffer(L, 1);
+  const int args = lua_gettop(L) - 1;
+  const int total = buffer->size * buffer->colorsPerLed;
+  const int sources = args / 2;
+  int factors[WS2812_MIX_MAX];
+  uint8_t *values[WS2812_MIX_MAX];
+  int i, j, sum;
+
+  if (sources < 1 || sources > WS2812_MIX_MAX || args % 2) {
+    return luaL_error(L, "wrong arg range");
+  }
+
+  for (j = 0; j < sources; j++) {
+    ws2812_buffer *source;
+
+    factors[j] = luaL_checkinteger(L, 2 + 2 * j);
+    source = ws2812_check_buffer(L, 3 + 2 * j);
+    if (source->size != buffer->size || source->colorsPerLed != buffer->colorsPerLed) {
+      return luaL_error(L, "buffers not same size");
+    }
+    values[j] = source->values;
+  }
+
+  for (i = 0; i < total; i++) {
+    sum = 128;
+    for (j = 0; j < sources; j++) {
+      sum += factors[j] * values[j][i];
+    }
+    sum >>= 8;
+    buffer->values[i] = sum < 0 ? 0 : sum > 255 ? 255 : sum;
+  }
+  return 0;
+}
+
+// Lua: leds = buffer:size()
+static int ICACHE_FLASH_ATTR ws2812_buffer_size(lua_State *L) {
+  ws2812_buffer *buffer = ws2812_check_buffer(L, 1);
+
+  lua_pushinteger(L, buffer->size);
+  return 1;
+}
+
+// Lua: s = buffer:dump()
+static int ICACHE_FLASH_ATTR ws2812_buffer_dump(lua_State *L) {
+  ws2812_buffer *buffer = ws2812_check_buffer(L, 1);
+
+  lua_pushlstring(L, (const char *)buffer->values, buffer->size * buffer->colorsPerLed);
+  return 1;
+}
+
+// Lua: buffer:write()
+// Sends the buffer through UART1 on GPIO2 (pin 4), see ws2812.init().
+static int ICACHE_FLASH_ATTR ws2812_buffer_write(lua_State *L) {
+  ws2812_buffer *buffer = ws2812_check_buffer(L, 1);
+
+  ws2812_uart_write(buffer->values, buffer->size * buffer->colorsPerLed);
+  return 0;
+}
+
+static const LUA_REG_TYPE ws2812_buffer_map[] =
+{
+  { LSTRKEY( "fill" ), LFUNCVAL( ws2812_buffer_fill )},
+  { LSTRKEY( "set" ), LFUNCVAL( ws2812_buffer_set )},
+  { LSTRKEY( "get" ), LFUNCVAL( ws2812_buffer_get )},
+  { LSTRKEY( "shift" ), LFUNCVAL( ws2812_buffer_shift )},
+  { LSTRKEY( "fade" ), LFUNCVAL( ws2812_buffer_fade )},
+  { LSTRKEY( "mix" ), LFUNCVAL( ws2812_buffer_mix )},
+  { LSTRKEY( "size" ), LFUNCVAL( ws2812_buffer_size )},
+  { LSTRKEY( "dump" ), LFUNCVAL( ws2812_buffer_dump )},
+  { LSTRKEY( "write" ), LFUNCVAL( ws2812_buffer_write )},
+  { LSTRKEY( "__index" ), LROVAL( ws2812_buffer_map )},
+  { LNILKEY, LNILVAL}
+};
+
 static const LUA_REG_TYPE ws2812_map[] =
 {
   { LSTRKEY( "writergb" ), LFUNCVAL( ws2812_writergb )},
   { LSTRKEY( "write" ), LFUNCVAL( ws2812_writegrb )},
+  { LSTRKEY( "init" ), LFUNCVAL( ws2812_init )},
+  { LSTRKEY( "newBuffer" ), LFUNCVAL( ws2812_new_buffer )},
+  { LSTRKEY( "SHIFT_LOGICAL" ), LNUMVAL( SHIFT_LOGICAL )},
+  { LSTRKEY( "SHIFT_CIRCULAR" ), LNUMVAL( SHIFT_CIRCULAR )},
+  { LSTRKEY( "FADE_IN" ), LNUMVAL( FADE_IN )},
+  { LSTRKEY( "FADE_OUT" ), LNUMVAL( FADE_OUT )},
   { LNILKEY, LNILVAL}
 };
 
 int luaopen_ws2812(lua_State *L) {
   // TODO: Make sure that the GPIO system is initialized
+  luaL_rometatable(L, "ws2812.buffer", (void *)ws2812_buffer_map);  // create metatable for buffer objects
   return 0;
 }
 
@@ -0,0 +1,231 @@
+#include "c_string.h"
+#include "c_stdlib.h"
+#include "c_stdio.h"
+#include "mqtt_parser.h"
+
+void mqtt_parser_init(mqtt_parser_t* parser, uint16_t max_length, mqtt_packet_cb_t on_packet, mqtt_chunk_cb_t on_chunk, void* arg)
+{
+  c_memset(parser, 0, sizeof(mqtt_parser_t));
+  parser->state = MQTT_PARSER_FIXED_HEADER;
+  parser->max_length = max_length;
+  parser->on_packet = on_packet;
+  parser->on_chunk = on_chunk;
+  parser->arg = arg;
+}
+
+void mqtt_parser_reset(mqtt_parser_t* parser)
+{
+  if(parser->buffer)
+    c_free(parser->buffer);
+  parser->buffer = NULL;
+  parser->buffer_length = 0;
+  parser->buffer_used = 0;
+  parser->state = MQTT_PARSER_FIXED_HEADER;
+}
+
+// length of the packet at data if it is complete within length, else 0
+static uint32_t whole_packet(const uint8_t* data, uint16_t length)
+{
+  uint32_t body = 0;
+  int i;
+
+  for(i = 1; i < length && i < MQTT_PARSER_FIXED_HEADER_SIZE; ++i)
+  {
+    body |= (uint32_t)(data[i] & 0x7f) << (7 * (i - 1));
+    if((data[i] & 0x80) == 0)
+      return (i + 1 + body <= length) ? i + 1 + body : 0;
+  }
+  return 0;
+}
+
+static int buffer_alloc(mqtt_parser_t* parser, uint16_t length)
+{
+  parser->buffer = (uint8_t *)c_malloc(length);
+  if(!parser->buffer){
+    NODE_DBG("not enough memory\n");
+    return 0;
+  }
+  parser->buffer_length = length;
+  c_memcpy(parser->buffer, parser->fixed, parser->fixed_length);
+  parser->buffer_used = parser->fixed_length;
+  return 1;
+}
+
+static void start_body(mqtt_parser_t* parser)
+{
+  uint32_t total = parser->fixed_length + parser->body_length;
+
+  parser->remaining = parser->body_length;
+  parser->offset = 0;
+  if(parser->body_length == 0){
+    parser->state = MQTT_PARSER_FIXED_HEADER;
+    parser->on_packet(parser->arg, parser->fixed, parser->fixed_length);
+  } else if(total <= parser->max_length){
+    parser->state = buffer_alloc(parser, total) ? MQTT_PARSER_BODY : MQTT_PARSER_SKIP;
+  } else if(parser->on_chunk && mqtt_get_type(parser->fixed) == MQTT_MSG_TYPE_PUBLISH && parser->body_length >= 2){
+    parser->buffer_used = 0;
+    parser->state = MQTT_PARSER_TOPIC_LENGTH;
+  } else {
+    NODE_DBG("MQTT: drop %d bytes packet\r\n", total);
+    parser->state = MQTT_PARSER_SKIP;
+  }
+}
+
+static void send_chunk(mqtt_parser_t* parser, const uint8_t* data, uint16_t length)
+{
+  mqtt_publish_chunk_t chunk;
+  uint16_t header_length = parser->buffer_length - parser->fixed_length;
+
+  chunk.header = parser->buffer;
+  chunk.topic = (const char *)parser->buffer + parser->fixed_length + 2;
+  chunk.topic_length = (parser->buffer[parser->fixed_length] << 8) | parser->buffer[parser->fixed_length + 1];
+  chunk.msg_id = 0;
+  if(mqtt_get_qos(parser->buffer) > 0)
+    chunk.msg_id = (parser->buffer[parser->buffer_length - 2] << 8) | parser->buffer[parser->buffer_length - 1];
+  chunk.data = data;
+  chunk.data_length = length;
+  chunk.offset = parser->offset;
+  chunk.total = parser->body_length - header_length;
+  parser->offset += length;
+  parser->on_chunk(parser->arg, &chunk);
+}
+
+// switch to passing the payload through once topic and id are buffered
+static void start_stream(mqtt_parser_t* parser)
+{
+  if(parser->buffer_used < parser->buffer_length)
+    return;
+  parser->state = MQTT_PARSER_STREAM;
+  if(parser->remaining == 0){
+    send_chunk(parser, NULL, 0);
+    mqtt_parser_reset(parser);
+  }
+}
+
+static void finish(mqtt_parser_t* parser)
+{
+  // detach the buffer first, callbacks may feed or reset the parser
+  uint8_t* buffer = parser->buffer;
+  uint16_t length = parser->buffer_used;
+
+  parser->buffer = NULL;
+  parser->buffer_length = 0;
+  parser->buffer_used = 0;
+  parser->state = MQTT_PARSER_FIXED_HEADER;
+  if(buffer){
+    parser->on_packet(parser->arg, buffer, length);
+    c_free(buffer);
+  }
+}
+
+// Feed one received segment. Packets may be split across segments at any
+// byte and a segment may hold several packets; complete packets that lie
+// within the segment are handed out without copying.
+// Returns 0, or -1 if the stream is malformed (the parser is reset).
+int mqtt_parser_feed(mqtt_parser_t* parser, uint8_t* data, uint16_t length)
+{
+  uint32_t n;
+
+  while(length > 0)
+  {
+    switch(parser->state)
+    {
+      case MQTT_PARSER_FIXED_HEADER:
+        n = whole_packet(data, length);
+        if(n > 0 && n <= parser->max_length){
+          parser->on_packet(parser->arg, data, n);
+          data += n;
+          length -= n;
+          break;
+        }
+        parser->fixed[0] = *data++;
+        length--;
+        parser->fixed_length = 1;
+        parser->body_length = 0;
+        parser->state = MQTT_PARSER_LENGTH;
+        break;
+
+      case MQTT_PARSER_LENGTH:
+        n = *data++;
+        length--;
+        parser->body_length |= (n & 0x7f) << (7 * (parser->fixed_length - 1));
+        parser->fixed[parser->fixed_length++] = n;
+        if((n & 0x80) == 0){
+          start_body(parser);
+        } else if(parser->fixed_length == MQTT_PARSER_FIXED_HEADER_SIZE){
+          NODE_DBG("MQTT: bad remaining length\r\n");
+          mqtt_parser_reset(parser);
+          return -1;
+        }
+        break;
+
+      case MQTT_PARSER_BODY:
+        n = parser->remaining < length ? parser->remaining : length;
+        c_memcpy(parser->buffer + parser->buffer_used, data, n);
+        parser->buffer_used += n;
+        parser->remaining -= n;
+        data += n;
+        length -= n;
+        if(parser->remaining == 0)
+          finish(parser);
+        break;
+
+      case MQTT_PARSER_TOPIC_LENGTH:
+        parser->fixed[parser->fixed_length + parser->buffer_used++] = *data++;
+        length--;
+        parser->remaining--;
+        if(parser->buffer_used == 2){
+          uint8_t* topic_length = parser->fixed + parser->fixed_length;
+          n = 2 + ((topic_length[0] << 8) | topic_length[1]);
+          if(mqtt_get_qos(parser->fixed) > 0)
+            n += 2;
+          if(n > parser->body_length || parser->fixed_length + n > parser->max_length){
+            NODE_DBG("MQTT: drop publish, topic too long\r\n");
+            parser->state = MQTT_PARSER_SKIP;
+          } else if(!buffer_alloc(parser, parser->fixed_length + n)){
+            parser->state = MQTT_PARSER_SKIP;
+          } else {
+            c_memcpy(parser->buffer + parser->buffer_used, topic_length, 2);
+            parser->buffer_used += 2;
+            parser->state = MQTT_PARSER_TOPIC;
+            start_stream(parser);
+          }
+        }
+        if(parser->state == MQTT_PARSER_SKIP && parser->remaining == 0)
+          parser->state = MQTT_PARSER_FIXED_HEADER;
+        break;
+
+      case MQTT_PARSER_TOPIC:
+        n = parser->buffer_length - parser->buffer_used;
+        if(n > length)
+          n = length;
+        c_memcpy(parser->buffer + parser->buffer_used, data, n);
+        parser->buffer_used += n;
+        parser->remaining -= n;
+        data += n;
+        length -= n;
+        start_stream(parser);
+        break;
+
+      case MQTT_PARSER_STREAM:
+        n = parser->remaining < length ? parser->remaining : length;
+        parser->remaining -= n;
+        send_chunk(parser, data, n);
+        data += n;
+        length -= n;
+        if(parser->remaining == 0)
+          mqtt_parser_reset(parser);
+        break;
+
+      case MQTT_PARSER_SKIP:
+        n = parser->remaining < length ? parser->remaining : length;
+        parser->remaining -= n;
+        data += n;
+        length -= n;
+        if(parser->remaining == 0)
+          mqtt_parser_reset(parser);
+        break;
+    }
+  }
+  return 0;
+}
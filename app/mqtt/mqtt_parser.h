@@ -0,0 +1,64 @@
+#ifndef _MQTT_PARSER_H
+#define _MQTT_PARSER_H 1
+#include "mqtt_msg.h"
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// fixed header: type byte + up to 4 remaining length bytes
+#define MQTT_PARSER_FIXED_HEADER_SIZE 5
+
+enum mqtt_parser_state
+{
+  MQTT_PARSER_FIXED_HEADER = 0,
+  MQTT_PARSER_LENGTH,
+  MQTT_PARSER_BODY,          // reassembling a packet split across segments
+  MQTT_PARSER_TOPIC_LENGTH,  // oversized publish: waiting for topic length
+  MQTT_PARSER_TOPIC,         // oversized publish: collecting topic and id
+  MQTT_PARSER_STREAM,        // oversized publish: passing payload through
+  MQTT_PARSER_SKIP
+};
+
+typedef struct mqtt_publish_chunk_t
+{
+  uint8_t* header;           // fixed header, for the qos/dup/retain flags
+  const char* topic;
+  uint16_t topic_length;
+  uint16_t msg_id;
+  const uint8_t* data;
+  uint16_t data_length;
+  uint32_t offset;           // of data within the payload
+  uint32_t total;            // payload length
+} mqtt_publish_chunk_t;
+
+// called with a complete packet, fixed header included
+typedef void (*mqtt_packet_cb_t)(void* arg, uint8_t* packet, uint16_t length);
+// called for each piece of the payload of a publish larger than max_length
+typedef void (*mqtt_chunk_cb_t)(void* arg, mqtt_publish_chunk_t* chunk);
+
+typedef struct mqtt_parser_t
+{
+  uint8_t state;
+  uint8_t fixed[MQTT_PARSER_FIXED_HEADER_SIZE + 2];
+  uint8_t fixed_length;
+  uint32_t remaining;        // bytes of the current packet not consumed yet
+  uint32_t body_length;
+  uint8_t* buffer;           // only held while a packet is incomplete
+  uint16_t buffer_length;
+  uint16_t buffer_used;
+  uint32_t offset;
+  uint16_t max_length;       // largest packet handed out in one piece
+  mqtt_packet_cb_t on_packet;
+  mqtt_chunk_cb_t on_chunk;
+  void* arg;
+} mqtt_parser_t;
+
+void mqtt_parser_init(mqtt_parser_t* parser, uint16_t max_length, mqtt_packet_cb_t on_packet, mqtt_chunk_cb_t on_chunk, void* arg);
+void mqtt_parser_reset(mqtt_parser_t* parser);
+int mqtt_parser_feed(mqtt_parser_t* parser, uint8_t* data, uint16_t length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -3,26 +3,66 @@
 #include "c_stdio.h"
 #include "msg_queue.h"
 
-msg_queue_t *msg_enqueue(msg_queue_t **head, mqtt_message_t *msg, uint16_t msg_id, int msg_type, int publish_qos){
-  if(!head){
+#define MSG_NODE_SIZE(len) ((sizeof(msg_queue_t) + (len) + 3) & ~3)
+
+int msg_ring_init(msg_ring_t *q, uint16_t size){
+  c_memset(q, 0, sizeof(msg_ring_t));
+  q->buf = (uint8_t *)c_malloc(size);
+  if(!q->buf){
+    NODE_DBG("not enough memory\n");
+    return 0;
+  }
+  q->size = size;
+  return 1;
+}
+
+void msg_ring_free(msg_ring_t *q){
+  if(q->buf)
+    c_free(q->buf);
+  c_memset(q, 0, sizeof(msg_ring_t));
+}
+
+static uint8_t *ring_alloc(msg_ring_t *q, uint16_t n){
+  uint8_t *p;
+  if(q->count == 0){
+    q->rd = q->wr = q->end = 0;
+  }
+  if(q->end == 0){
+    // used: [rd, wr)
+    if(q->size - q->wr < n){
+      if(q->rd < n)
+        return NULL;
+      q->end = q->wr;
+      q->wr = 0;
+    }
+  } else if(q->rd - q->wr < n){
+    // used: [rd, end) and [0, wr)
+    return NULL;
+  }
+  p = q->buf + q->wr;
+  q->wr += n;
+  return p;
+}
+
+msg_queue_t *msg_enqueue(msg_ring_t *q, mqtt_message_t *msg, uint16_t msg_id, int msg_type, int publish_qos){
+  if(!q || !q->buf){
     return NULL;
   }
   if (!msg || !msg->data || msg->length == 0){
     NODE_DBG("empty message\n");
     return NULL;
   }
-  msg_queue_t *node = (msg_queue_t *)c_zalloc(sizeof(msg_queue_t));
-  if(!node){
-    NODE_DBG("not enough memory\n");
+  if(MSG_NODE_SIZE(msg->length) > q->size){
+    NODE_DBG("message too long\n");
     return NULL;
   }
-  
-  node->msg.data = (uint8_t *)c_zalloc(msg->length);
-  if(!node->msg.data){
-    NODE_DBG("not enough memory\n");
-    c_free(node);
+  msg_queue_t *node = (msg_queue_t *)ring_alloc(q, MSG_NODE_SIZE(msg->length));
+  if(!node){
+    NODE_DBG("queue full\n");
     return NULL;
   }
+
+  node->msg.data = (uint8_t *)(node + 1);
   c_memcpy(node->msg.data, msg->data, msg->length);
   node->msg.length = msg->length;
   node->next = NULL;
@@ -30,53 +70,43 @@ msg_queue_t *msg_enqueue(msg_queue_t **head, mqtt_message_t *msg, uint16_t msg_i
   node->msg_type = msg_type;
   node->publish_qos = publish_qos;
 
-  msg_queue_t *tail = *head;
-  if(tail){
-    while(tail->next!=NULL) tail = tail->next;
-    tail->next = node;
+  if(q->tail){
+    q->tail->next = node;
   } else {
-    *head = node;
+    q->head = node;
   }
+  q->tail = node;
+  q->count++;
   return node;
 }
 
-void msg_destroy(msg_queue_t *node){
-  if(!node) return;
-  if(node->msg.data){
-    c_free(node->msg.data);
-    node->msg.data = NULL;
+// remove the head and give its space back to the ring
+void msg_dequeue(msg_ring_t *q){
+  if(!q || !q->head){
+    return;
   }
-  c_free(node);
-}
-
-msg_queue_t * msg_dequeue(msg_queue_t **head){
-  if(!head || !*head){
-    return NULL;
+  msg_queue_t *node = q->head;  // fetch head.
+  q->head = node->next; // update head.
+  if(!q->head)
+    q->tail = NULL;
+  q->rd += MSG_NODE_SIZE(node->msg.length);
+  if(q->end && q->rd == q->end){
+    q->rd = 0;
+    q->end = 0;
   }
-  msg_queue_t *node = *head;  // fetch head.
-  *head = node->next; // update head.
-  node->next = NULL;
-  return node;
+  q->count--;
 }
 
-msg_queue_t * msg_peek(msg_queue_t **head){
-  if(!head || !*head){
+msg_queue_t * msg_peek(msg_ring_t *q){
+  if(!q){
     return NULL;
   }
-  return *head;  // fetch head.
+  return q->head;  // fetch head.
 }
 
-int msg_size(msg_queue_t **head){
-  if(!head || !*head){
+int msg_size(msg_ring_t *q){
+  if(!q){
     return 0;
   }
-  int i = 1;
-  msg_queue_t *tail = *head;
-  if(tail){
-    while(tail->next!=NULL){
-      tail = tail->next;
-      i++;
-    }
-  }
-  return i;
+  return q->count;
 }
@@ -15,11 +15,26 @@ typedef struct msg_queue_t {
   int publish_qos;
 } msg_queue_t;
 
-msg_queue_t * msg_enqueue(msg_queue_t **head, mqtt_message_t *msg, uint16_t msg_id, int msg_type, int publish_qos);
-void msg_destroy(msg_queue_t *node);
-msg_queue_t * msg_dequeue(msg_queue_t **head);
-msg_queue_t * msg_peek(msg_queue_t **head);
-int msg_size(msg_queue_t **head);
+// Nodes and their message data are carved out of one buffer sized when the
+// client is created. Messages leave the queue in the order they entered,
+// so the buffer is used as a ring and never fragments.
+typedef struct msg_ring_t {
+  msg_queue_t *head;
+  msg_queue_t *tail;
+  uint8_t *buf;
+  uint16_t size;
+  uint16_t rd;      // oldest node
+  uint16_t wr;      // next free byte
+  uint16_t end;     // end of the older part once wr has wrapped, else 0
+  int count;
+} msg_ring_t;
+
+int msg_ring_init(msg_ring_t *q, uint16_t size);
+void msg_ring_free(msg_ring_t *q);
+msg_queue_t * msg_enqueue(msg_ring_t *q, mqtt_message_t *msg, uint16_t msg_id, int msg_type, int publish_qos);
+void msg_dequeue(msg_ring_t *q);
+msg_queue_t * msg_peek(msg_ring_t *q);
+int msg_size(msg_ring_t *q);
 
 #ifdef __cplusplus
 }
@@ -1,5 +1,6 @@
 #include "flash_fs.h"
 #include "c_string.h"
+#include "c_stdio.h"
 
 #if defined( BUILD_WOFS )
 #include "romfs.h"
@@ -30,3 +31,75 @@ int fs_mode2flag(const char *mode){
   	return FS_RDONLY;
   }
 }
+
+static int fs_buf_fill(fs_buf *fb){
+  fb->pos = 0;
+  fb->len = fs_read(fb->fd, fb->buf, FS_BUF_SIZE);
+  return fb->len;
+}
+
+void fs_buf_init(fs_buf *fb, int fd){
+  fb->fd = fd;
+  fb->pos = 0;
+  fb->len = 0;
+}
+
+int fs_buf_getc(fs_buf *fb){
+  if(fb->pos >= fb->len && fs_buf_fill(fb) == 0)
+    return EOF;
+  return (unsigned char)fb->buf[fb->pos++];
+}
+
+// only the byte just read by fs_buf_getc can be pushed back
+int fs_buf_ungetc(int c, fs_buf *fb){
+  if(c == EOF || fb->pos == 0)
+    return EOF;
+  fb->buf[--fb->pos] = (char)c;
+  return c;
+}
+
+size_t fs_buf_read(fs_buf *fb, void *ptr, size_t len){
+  size_t n = 0;
+  char *p = (char *)ptr;
+  while(n < len){
+    if(fb->pos >= fb->len){
+      // large reads bypass the buffer once it is drained
+      if(len - n >= FS_BUF_SIZE){
+        size_t r = fs_read(fb->fd, p + n, len - n);
+        n += r;
+        break;
+      }
+      if(fs_buf_fill(fb) == 0)
+        break;
+    }
+    size_t avail = fb->len - fb->pos;
+    if(avail > len - n)
+      avail = len - n;
+    c_memcpy(p + n, fb->buf + fb->pos, avail);
+    fb->pos += avail;
+    n += avail;
+  }
+  return n;
+}
+
+// hand out whatever is buffered (refilling if empty) without copying
+const char *fs_buf_next(fs_buf *fb, size_t *size){
+  if(fb->pos >= fb->len && fs_buf_fill(fb) == 0){
+    *size = 0;
+    return NULL;
+  }
+  *size = fb->len - fb->pos;
+  fb->pos = fb->len;
+  return fb->buf + (fb->len - *size);
+}
+
+// drop read-ahead data and move the fd back to the logical position,
+// must be called before seeking or writing through the raw fd
+int fs_buf_sync(fs_buf *fb){
+  int res = 0;
+  if(fb->pos < fb->len)
+    res = fs_seek(fb->fd, -(int)(fb->len - fb->pos), FS_SEEK_CUR);
+  fb->pos = 0;
+  fb->len = 0;
+  return res;
+}
@@ -8,6 +8,7 @@
 #include "romfs.h"
 
 #define FS_OPEN_OK	0
+#define FS_ERR_NO_FD	-1    // romfs returns -1 for every failure
 
 #define FS_RDONLY O_RDONLY
 #define FS_WRONLY O_WRONLY
@@ -40,6 +41,7 @@
 #include "spiffs.h"
 
 #define FS_OPEN_OK	1
+#define FS_ERR_NO_FD	SPIFFS_ERR_OUT_OF_FILE_DESCS
 
 #define FS_RDONLY SPIFFS_RDONLY
 #define FS_WRONLY SPIFFS_WRONLY
@@ -80,4 +82,22 @@
 
 int fs_mode2flag(const char *mode);
 
+// Buffered reader, serves getc/ungetc/read from RAM and refills one
+// logical flash page at a time instead of hitting the fs per byte.
+#define FS_BUF_SIZE 256
+
+typedef struct fs_buf {
+  int fd;
+  unsigned short pos;   // next unread byte in buf
+  unsigned short len;   // valid bytes in buf
+  char buf[FS_BUF_SIZE];
+} fs_buf;
+
+void fs_buf_init(fs_buf *fb, int fd);
+int fs_buf_getc(fs_buf *fb);
+int fs_buf_ungetc(int c, fs_buf *fb);
+size_t fs_buf_read(fs_buf *fb, void *ptr, size_t len);
+const char *fs_buf_next(fs_buf *fb, size_t *size);
+int fs_buf_sync(fs_buf *fb);
+
 #endif // #ifndef __FLASH_FS_H__
@@ -7,6 +7,7 @@
 #include "gpio.h"
 #include "user_interface.h"
 #include "driver/uart.h"
+#include "driver/i2c_master.h"
 // Platform specific includes
 
 static void pwms_init();
@@ -131,8 +132,24 @@ int platform_gpio_read( unsigned pin )
 }
 
 #ifdef GPIO_INTERRUPT_ENABLE
-static void platform_gpio_intr_dispatcher( platform_gpio_intr_handler_fn_t cb){
+static platform_gpio_intr_handler_fn_t gpio_event_cb;
+
+// Single producer ring: only the interrupt moves head, only the Lua task
+// moves tail. Both run free and are masked on access.
+static platform_gpio_event_t gpio_events[PLATFORM_GPIO_EVENTS];
+static volatile uint32_t gpio_event_head, gpio_event_tail;
+static volatile uint32_t gpio_event_overflow;
+static volatile uint8_t gpio_event_posted;
+
+static inline bool is_level_intr( GPIO_INT_TYPE type )
+{
+  return type == GPIO_PIN_INTR_LOLEVEL || type == GPIO_PIN_INTR_HILEVEL;
+}
+
+static void ICACHE_RAM_ATTR platform_gpio_intr_dispatcher( void *arg ){
   uint8 i, level;
+  bool queued;
+  uint32 ccount = xthal_get_ccount();
   uint32 gpio_status = GPIO_REG_READ(GPIO_STATUS_ADDRESS);
   for (i = 0; i < GPIO_PIN_NUM; i++) {
     if (pin_int_type[i] && (gpio_status & BIT(pin_num[i])) ) {
@@ -141,17 +158,30 @@ static void platform_gpio_intr_dispatcher( platform_gpio_intr_handler_fn_t cb){
       //clear interrupt status
       GPIO_REG_WRITE(GPIO_STATUS_W1TC_ADDRESS, gpio_status & BIT(pin_num[i]));
       level = 0x1 & GPIO_INPUT_GET(GPIO_ID_PIN(pin_num[i]));
-      if(cb){
-        cb(i, level);
+      queued = gpio_event_head - gpio_event_tail < PLATFORM_GPIO_EVENTS;
+      if (queued) {
+        platform_gpio_event_t *ev = &gpio_events[gpio_event_head & (PLATFORM_GPIO_EVENTS - 1)];
+        ev->ccount = ccount;
+        ev->pin = i;
+        ev->level = level;
+        gpio_event_head++;
+      } else {
+        gpio_event_overflow++;
       }
-      gpio_pin_intr_state_set(GPIO_ID_PIN(pin_num[i]), pin_int_type[i]);
+      // a level interrupt would fire again at once, it is rearmed
+      // when its event has been taken
+      if (!queued || !is_level_intr(pin_int_type[i]))
+        gpio_pin_intr_state_set(GPIO_ID_PIN(pin_num[i]), pin_int_type[i]);
     }
   }
+  if (gpio_event_head != gpio_event_tail && !gpio_event_posted)
+    gpio_event_posted = system_os_post(LUA_TASK_PRIO, LUA_GPIO_SIG, 0);
 }
 
 void platform_gpio_init( platform_gpio_intr_handler_fn_t cb )
 {
-  ETS_GPIO_INTR_ATTACH(platform_gpio_intr_dispatcher, cb);
+  gpio_event_cb = cb;
+  ETS_GPIO_INTR_ATTACH(platform_gpio_intr_dispatcher, NULL);
 }
 
 int platform_gpio_intr_init( unsigned pin, GPIO_INT_TYPE type )
@@ -166,6 +196,50 @@ int platform_gpio_intr_init( unsigned pin, GPIO_INT_TYPE type )
   gpio_pin_intr_state_set(GPIO_ID_PIN(pin_num[pin]), type);
   ETS_GPIO_INTR_ENABLE();
 }
+
+// Takes the oldest queued edge. Returns 0 if there is none
+int platform_gpio_event_get( platform_gpio_event_t *ev )
+{
+  if (gpio_event_tail == gpio_event_head)
+    return 0;
+  // keep the copy between the two index accesses
+  __asm__ __volatile__ ("" ::: "memory");
+  *ev = gpio_events[gpio_event_tail & (PLATFORM_GPIO_EVENTS - 1)];
+  __asm__ __volatile__ ("" ::: "memory");
+  gpio_event_tail++;
+  if (is_level_intr(pin_int_type[ev->pin])) {
+    ETS_GPIO_INTR_DISABLE();
+    gpio_pin_intr_state_set(GPIO_ID_PIN(pin_num[ev->pin]), pin_int_type[ev->pin]);
+    ETS_GPIO_INTR_ENABLE();
+  }
+  return 1;
+}
+
+// Edges lost because the queue was full
+uint32_t platform_gpio_event_overflow( int reset )
+{
+  uint32_t n = gpio_event_overflow;
+  if (reset) {
+    ETS_GPIO_INTR_DISABLE();
+    gpio_event_overflow -= n;
+    ETS_GPIO_INTR_ENABLE();
+  }
+  return n;
+}
+
+// Runs in the Lua task on LUA_GPIO_SIG
+void platform_gpio_process_events( void )
+{
+  // clear first, edges arriving while the handler runs post again
+  gpio_event_posted = 0;
+  if (gpio_event_cb)
+    gpio_event_cb();
+  else
+    gpio_event_tail = gpio_event_head;
+  // the handler may leave edges for the next run to let other tasks in
+  if (gpio_event_head != gpio_event_tail && !gpio_event_posted)
+    gpio_event_posted = system_os_post(LUA_TASK_PRIO, LUA_GPIO_SIG, 0);
+}
 #endif
 
 // ****************************************************************************
@@ -254,6 +328,51 @@ uint32_t platform_uart_setup( unsigned id, uint32_t baud, int databits, int pari
   return baud;
 }
 
+// Only UART0 receives. Returns 0, or -1 if there is not enough memory
+int platform_uart_set_buffer( unsigned id, unsigned size )
+{
+  if( id != 0 )
+    return 0;
+  return uart_rx_setup( size ) ? 0 : -1;
+}
+
+// Only UART0 queues its output; 0 writes the FIFO directly
+int platform_uart_set_tx_buffer( unsigned id, unsigned size )
+{
+  if( id != 0 )
+    return 0;
+  return uart_tx_setup( size ) ? 0 : -1;
+}
+
+static platform_uart_sent_fn_t uart_sent_cb;
+
+// sent is called once from the Lua task, when the UART has run empty
+// after the last call
+void platform_uart_notify_sent( unsigned id, platform_uart_sent_fn_t sent )
+{
+  if( id != 0 )
+    return;
+  uart_sent_cb = sent;
+  uart_tx_notify();
+}
+
+// Runs in the Lua task on LUA_UART_SENT_SIG. The post may stem from an
+// earlier notify, output queued since then is waited for as well.
+void platform_uart_process_sent( unsigned id )
+{
+  platform_uart_sent_fn_t sent = uart_sent_cb;
+
+  if( !sent )
+    return;
+  if( !uart_tx_idle() )
+  {
+    uart_tx_notify();
+    return;
+  }
+  uart_sent_cb = NULL;
+  sent( id );
+}
+
 // if set=1, then alternate serial output pins are used. (15=rx, 13=tx)
 void platform_uart_alt( int set )
 {
@@ -341,6 +460,25 @@ uint32_t platform_pwm_set_duty( unsigned pin, uint32_t duty )
   return pwms_duty[pin];
 }
 
+// Set the duty of several pins, they all change at the same period boundary.
+// Returns the number of pins that are set up for PWM
+unsigned platform_pwm_set_duties( const unsigned *pins, const uint32_t *duties, unsigned n )
+{
+  unsigned i, done = 0;
+
+  for (i = 0; i < n; i++)
+  {
+    if (pins[i] >= NUM_PWM || !pwm_exist(pins[i]))
+      continue;
+    pwm_set_duty(DUTY(duties[i]), pins[i]);
+    pwms_duty[pins[i]] = NORMAL_DUTY(pwm_get_duty(pins[i]));
+    done++;
+  }
+  if (done)
+    pwm_start();
+  return done;
+}
+
 uint32_t platform_pwm_setup( unsigned pin, uint32_t frequency, unsigned duty )
 {
   uint32_t clock;
@@ -398,6 +536,8 @@ void platform_pwm_stop( unsigned pin )
 // *****************************************************************************
 // I2C platform interface
 
+static uint8_t i2c_fast;
+
 uint32_t platform_i2c_setup( unsigned id, uint8_t sda, uint8_t scl, uint32_t speed ){
   if (sda >= NUM_GPIO || scl >= NUM_GPIO)
     return 0;
@@ -410,15 +550,25 @@ uint32_t platform_i2c_setup( unsigned id, uint8_t sda, uint8_t scl, uint32_t spe
   platform_gpio_mode(scl, PLATFORM_GPIO_INPUT, PLATFORM_GPIO_PULLUP);    // disable gpio interrupt first
 
   i2c_master_gpio_init(sda, scl);
+  // Anything above the standard mode runs on the cycle timed engine
+  i2c_fast = speed > PLATFORM_I2C_SPEED_SLOW;
+  if (i2c_fast)
+    return i2c_master_fast_setup(speed);
   return PLATFORM_I2C_SPEED_SLOW;
 }
 
 void platform_i2c_send_start( unsigned id ){
-  i2c_master_start();
+  if (i2c_fast)
+    i2c_master_fast_start();
+  else
+    i2c_master_start();
 }
 
 void platform_i2c_send_stop( unsigned id ){
-  i2c_master_stop();
+  if (i2c_fast)
+    i2c_master_fast_stop();
+  else
+    i2c_master_stop();
 }
 
 int platform_i2c_send_address( unsigned id, uint16_t address, int direction ){
@@ -429,23 +579,62 @@ int platform_i2c_send_address( unsigned id, uint16_t address, int direction ){
     direction = ( direction == PLATFORM_I2C_DIRECTION_TRANSMITTER ) ? 0 : 1;
   }
 
-  i2c_master_writeByte( (uint8_t) ((address << 1) | direction ));
-  // Low-level returns nack (0=acked); we return ack (1=acked).
-  return ! i2c_master_getAck();
+  return platform_i2c_send_byte( id, (uint8_t) ((address << 1) | direction ));
 }
 
 int platform_i2c_send_byte( unsigned id, uint8_t data ){
-  i2c_master_writeByte(data);
   // Low-level returns nack (0=acked); we return ack (1=acked).
+  if (i2c_fast)
+    return ! i2c_master_fast_writeByte(data);
+  i2c_master_writeByte(data);
   return ! i2c_master_getAck();
 }
 
 int platform_i2c_recv_byte( unsigned id, int ack ){
-  uint8_t r = i2c_master_readByte();
+  uint8_t r;
+
+  if (i2c_fast)
+    return i2c_master_fast_readByte( !ack );
+  r = i2c_master_readByte();
   i2c_master_setAck( !ack );
   return r;
 }
 
+// Run a whole transaction: write wlen bytes, then read rlen bytes (the last
+// one nacked), joined by a repeated start or by stop and start. Either part
+// may be empty. *wlen returns the number of bytes written.
+// Returns 1, or 0 if the slave did not ack its address or a written byte.
+int platform_i2c_transfer( unsigned id, uint16_t address, const uint8_t *wdata, uint32_t *wlen,
+                           uint8_t *rdata, uint32_t rlen, int repeated_start ){
+  uint32_t i, n = *wlen;
+  int ok = 1;
+
+  *wlen = 0;
+  if (n > 0 || rlen == 0) {
+    platform_i2c_send_start( id );
+    ok = platform_i2c_send_address( id, address, PLATFORM_I2C_DIRECTION_TRANSMITTER );
+    if (ok && i2c_fast)
+      *wlen = i2c_master_fast_write( wdata, n );
+    else if (ok)
+      while (*wlen < n && platform_i2c_send_byte( id, wdata[*wlen] ))
+        (*wlen)++;
+    ok = ok && *wlen == n;
+    if (!ok || rlen == 0 || !repeated_start)
+      platform_i2c_send_stop( id );
+  }
+  if (ok && rlen > 0) {
+    platform_i2c_send_start( id );
+    ok = platform_i2c_send_address( id, address, PLATFORM_I2C_DIRECTION_RECEIVER );
+    if (ok && i2c_fast)
+      i2c_master_fast_read( rdata, rlen );
+    else if (ok)
+      for (i = 0; i < rlen; i++)
+        rdata[i] = platform_i2c_recv_byte( id, i < rlen - 1 );
+    platform_i2c_send_stop( id );
+  }
+  return ok;
+}
+
 // *****************************************************************************
 // SPI platform interface
 uint32_t platform_spi_setup( uint8_t id, int mode, unsigned cpol, unsigned cpha, uint32_t clock_div)
@@ -507,6 +696,69 @@ int platform_spi_transaction( uint8_t id, uint8_t cmd_bitlen, spi_data_type cmd_
   return PLATFORM_OK;
 }
 
+// Block transfers move 64 bytes per transaction through the whole data buffer
+int platform_spi_blkwrite( uint8_t id, const uint8_t *data, uint32_t len )
+{
+  spi_mast_blkwrite( id, data, len );
+  return PLATFORM_OK;
+}
+
+int platform_spi_blkread( uint8_t id, uint8_t *data, uint32_t len, uint8_t fill )
+{
+  spi_mast_blkread( id, data, len, fill );
+  return PLATFORM_OK;
+}
+
+static platform_spi_done_fn_t spi_done_cb[NUM_SPI];
+static volatile uint8_t spi_done_unposted[NUM_SPI];
+
+static void ICACHE_RAM_ATTR platform_spi_blk_done( uint8 spi_no )
+{
+  // the task queue may be full, the next task run posts it again
+  spi_done_unposted[spi_no] = !system_os_post( LUA_TASK_PRIO, LUA_SPI_SIG, spi_no );
+}
+
+// Runs at the start of every Lua task run. A transfer is only started from
+// the task once done has been called, so the flag cannot change under us
+void platform_spi_post_pending( void )
+{
+  uint8_t id;
+
+  for (id = 0; id < NUM_SPI; id++)
+    if (spi_done_unposted[id] && system_os_post( LUA_TASK_PRIO, LUA_SPI_SIG, id ))
+      spi_done_unposted[id] = 0;
+}
+
+// Returns at once, done is called from the Lua task when all data is out.
+// data must stay valid until then.
+int platform_spi_blkwrite_async( uint8_t id, const uint8_t *data, uint32_t len, platform_spi_done_fn_t done )
+{
+  if (id >= NUM_SPI)
+    return PLATFORM_ERR;
+  spi_done_cb[id] = done;
+  if (!spi_mast_blkwrite_async( id, data, len, platform_spi_blk_done ))
+    return PLATFORM_ERR;
+  return PLATFORM_OK;
+}
+
+int platform_spi_busy( uint8_t id )
+{
+  return spi_mast_blkbusy( id );
+}
+
+// Runs in the Lua task on LUA_SPI_SIG
+void platform_spi_process_done( uint8_t id )
+{
+  platform_spi_done_fn_t done;
+
+  if (id >= NUM_SPI || spi_mast_blkbusy( id ))
+    return;
+  done = spi_done_cb[id];
+  spi_done_cb[id] = NULL;
+  if (done)
+    done( id );
+}
+
 // ****************************************************************************
 // Flash access functions
 
@@ -593,3 +845,16 @@ uint32_t platform_flash_mapped2phys (uint32_t mapped_addr)
   uint32_t meg = (b1 << 1) | b0;
   return mapped_addr - INTERNAL_FLASH_MAPPED_ADDRESS + meg * 0x100000;
 }
+
+uint32_t platform_flash_phys2mapped (uint32_t phys_addr)
+{
+  uint32_t cache_ctrl = READ_PERI_REG(CACHE_FLASH_CTRL_REG);
+  if (!(cache_ctrl & CACHE_FLASH_ACTIVE))
+    return -1;
+  bool b0 = (cache_ctrl & CACHE_FLASH_MAPPED0) ? 1 : 0;
+  bool b1 = (cache_ctrl & CACHE_FLASH_MAPPED1) ? 1 : 0;
+  uint32_t meg = (b1 << 1) | b0;
+  if (phys_addr < meg * 0x100000 || phys_addr >= (meg + 1) * 0x100000)
+    return -1;
+  return phys_addr - meg * 0x100000 + INTERNAL_FLASH_MAPPED_ADDRESS;
+}
@@ -35,14 +35,28 @@ uint8_t platform_key_led( uint8_t level);
 #define PLATFORM_GPIO_HIGH 1
 #define PLATFORM_GPIO_LOW 0
 
-/* GPIO interrupt handler */
-typedef void (* platform_gpio_intr_handler_fn_t)( unsigned pin, unsigned level );
+// Edges captured by the GPIO interrupt are queued with a timestamp and
+// handed out from the Lua task; size must be a power of 2
+#define PLATFORM_GPIO_EVENTS 64
+
+typedef struct
+{
+  uint32_t ccount;    // CPU cycle count when the edge was seen
+  uint8_t pin;
+  uint8_t level;
+} platform_gpio_event_t;
+
+/* GPIO event handler, called from the Lua task when edges are queued */
+typedef void (* platform_gpio_intr_handler_fn_t)( void );
 
 int platform_gpio_mode( unsigned pin, unsigned mode, unsigned pull );
 int platform_gpio_write( unsigned pin, unsigned level );
 int platform_gpio_read( unsigned pin );
 void platform_gpio_init( platform_gpio_intr_handler_fn_t cb );
 int platform_gpio_intr_init( unsigned pin, GPIO_INT_TYPE type );
+int platform_gpio_event_get( platform_gpio_event_t *ev );
+uint32_t platform_gpio_event_overflow( int reset );
+void platform_gpio_process_events( void );
 // *****************************************************************************
 // Timer subsection
 
@@ -106,6 +120,13 @@ spi_data_type platform_spi_get_miso( uint8_t id, uint8_t offset, uint8_t bitlen
 int platform_spi_transaction( uint8_t id, uint8_t cmd_bitlen, spi_data_type cmd_data,
                               uint8_t addr_bitlen, spi_data_type addr_data,
                               uint16_t mosi_bitlen, uint8_t dummy_bitlen, int16_t miso_bitlen );
+typedef void (*platform_spi_done_fn_t)( uint8_t id );
+int platform_spi_blkwrite( uint8_t id, const uint8_t *data, uint32_t len );
+int platform_spi_blkread( uint8_t id, uint8_t *data, uint32_t len, uint8_t fill );
+int platform_spi_blkwrite_async( uint8_t id, const uint8_t *data, uint32_t len, platform_spi_done_fn_t done );
+int platform_spi_busy( uint8_t id );
+void platform_spi_process_done( uint8_t id );
+void platform_spi_post_pending( void );
 
 
 // *****************************************************************************
@@ -143,6 +164,10 @@ enum
 int platform_uart_exists( unsigned id );
 uint32_t platform_uart_setup( unsigned id, uint32_t baud, int databits, int parity, int stopbits );
 int platform_uart_set_buffer( unsigned id, unsigned size );
+int platform_uart_set_tx_buffer( unsigned id, unsigned size );
+typedef void (*platform_uart_sent_fn_t)( unsigned id );
+void platform_uart_notify_sent( unsigned id, platform_uart_sent_fn_t sent );
+void platform_uart_process_sent( unsigned id );
 void platform_uart_send( unsigned id, uint8_t data );
 void platform_s_uart_send( unsigned id, uint8_t data );
 int platform_uart_recv( unsigned id, unsigned timer_id, timer_data_type timeout );
@@ -171,6 +196,7 @@ uint32_t platform_pwm_set_clock( unsigned id, uint32_t data );
 uint32_t platform_pwm_get_clock( unsigned id );
 uint32_t platform_pwm_set_duty( unsigned id, uint32_t data );
 uint32_t platform_pwm_get_duty( unsigned id );
+unsigned platform_pwm_set_duties( const unsigned *ids, const uint32_t *duties, unsigned n );
 
 
 // *****************************************************************************
@@ -216,6 +242,8 @@ void platform_i2c_send_stop( unsigned id );
 int platform_i2c_send_address( unsigned id, uint16_t address, int direction );
 int platform_i2c_send_byte( unsigned id, uint8_t data );
 int platform_i2c_recv_byte( unsigned id, int ack );
+int platform_i2c_transfer( unsigned id, uint16_t address, const uint8_t *wdata, uint32_t *wlen,
+                           uint8_t *rdata, uint32_t rlen, int repeated_start );
 
 // *****************************************************************************
 // Ethernet specific functions
@@ -247,6 +275,16 @@ int platform_flash_erase_sector( uint32_t sector_id );
  */
 uint32_t platform_flash_mapped2phys (uint32_t mapped_addr);
 
+/**
+ * Translates a physical flash address to the address it is mapped at, based
+ * on the current flash cache mapping.
+ * @param phys_addr Address to translate
+ * @return the corresponding mapped address, or -1 if flash cache is not
+ *  currently active or the address is outside the mapped megabyte.
+ * @see platform_flash_mapped2phys.
+ */
+uint32_t platform_flash_phys2mapped (uint32_t phys_addr);
+
 // *****************************************************************************
 // Allocator support
 
@@ -1,30 +1,135 @@
 #include "c_stdio.h"
+#include "c_stdlib.h"
 #include "platform.h"
 #include "spiffs.h"
+#include "spiffs_nucleus.h"
   
 spiffs fs;
 
 #define LOG_PAGE_SIZE       256
+
+// default cache size, see myspiffs_mount()
+#ifndef SPIFFS_CACHE_PAGES
+#define SPIFFS_CACHE_PAGES  2
+#endif
+// SPIFFS_mount caps the cache at 32 * LOG_PAGE_SIZE bytes, headers included
+#define SPIFFS_CACHE_PAGES_MAX  29
+#if SPIFFS_CACHE_PAGES < 1 || SPIFFS_CACHE_PAGES > SPIFFS_CACHE_PAGES_MAX
+#error "SPIFFS_CACHE_PAGES must be 1..29"
+#endif
   
 static u8_t spiffs_work_buf[LOG_PAGE_SIZE*2];
 static u8_t spiffs_fds[32*4];
 #if SPIFFS_CACHE
-static u8_t spiffs_cache[(LOG_PAGE_SIZE+32)*2];
+static u8_t *spiffs_cache_buf;
+static u32_t spiffs_cache_pages;
+#define CACHE_BUF_SIZE(pages) \
+  (sizeof(spiffs_cache) + (sizeof(spiffs_cache_page) + LOG_PAGE_SIZE) * (pages))
 #endif
 
+/*******************
+Write-back (off unless file.fswriteback(true)): instead of programming every
+small write spiffs issues (page header, data, lookup entry, flag updates)
+straight away, consecutive writes to the same page are collected in a page
+image and programmed once. A page image starts as the flash content and
+writes are ANDed into it the way NOR flash applies them, so programming the
+image later gives the same result. Reads are served from the pending images.
+
+spiffs relies on the order of its writes to survive a power loss, so the
+pending pages are programmed in the order spiffs first wrote them, and a
+write to any page but the last pending one programs them all first. A power
+loss then loses a tail of the writes, as it could with write-through, only
+a longer one: everything since the last flush. Pending pages are written
+when spiffs goes back to an earlier page, moves to another block or erases,
+when the buffer is full, a file is flushed or closed, or the fs is unmounted.
+********************/
+#define WB_PAGES            4
+
+static struct {
+  u8_t *buf;                  // WB_PAGES page images, NULL when disabled
+  u32_t addr[WB_PAGES];
+  u32_t block;
+  u8_t count;
+  myspiffs_wb_stats stats;
+} wb;
+
+static void wb_flush(void) {
+  int i;
+  for (i = 0; i < wb.count; i++) {
+    platform_flash_write(wb.buf + i * LOG_PAGE_SIZE, wb.addr[i], LOG_PAGE_SIZE);
+    wb.stats.programs++;
+  }
+  wb.count = 0;
+}
+
+static u8_t *wb_page(u32_t addr) {
+  int i;
+  for (i = 0; i < wb.count; i++)
+    if (wb.addr[i] == addr)
+      return wb.buf + i * LOG_PAGE_SIZE;
+  return NULL;
+}
+
+static void wb_write(u32_t addr, u32_t size, const u8_t *src) {
+  while (size > 0) {
+    u32_t page = addr & ~(LOG_PAGE_SIZE - 1);
+    u32_t off = addr - page;
+    u32_t n = LOG_PAGE_SIZE - off;
+    u32_t block = addr & ~(INTERNAL_FLASH_SECTOR_SIZE - 1);
+    u8_t *img;
+    if (n > size)
+      n = size;
+
+    if (wb.count > 0 && wb.block != block)
+      wb_flush();
+    if (wb.count > 0 && wb.addr[wb.count - 1] == page) {
+      img = wb.buf + (wb.count - 1) * LOG_PAGE_SIZE;
+      wb.stats.merged++;
+    } else {
+      // merging into an earlier page would program this write before the
+      // ones in between
+      if (wb.count == WB_PAGES || wb_page(page))
+        wb_flush();
+      img = wb.buf + wb.count * LOG_PAGE_SIZE;
+      platform_flash_read(img, page, LOG_PAGE_SIZE);
+      wb.addr[wb.count++] = page;
+      wb.block = block;
+    }
+    wb.stats.writes++;
+
+    addr += n;
+    size -= n;
+    img += off;
+    while (n--)
+      *img++ &= *src++;
+  }
+}
+
 static s32_t my_spiffs_read(u32_t addr, u32_t size, u8_t *dst) {
+  int i;
   platform_flash_read(dst, addr, size);
+  for (i = 0; i < wb.count; i++) {
+    u32_t from = wb.addr[i] > addr ? wb.addr[i] : addr;
+    u32_t to = wb.addr[i] + LOG_PAGE_SIZE < addr + size ? wb.addr[i] + LOG_PAGE_SIZE : addr + size;
+    if (from < to)
+      c_memcpy(dst + (from - addr), wb.buf + i * LOG_PAGE_SIZE + (from - wb.addr[i]), to - from);
+  }
   return SPIFFS_OK;
 }
 
 static s32_t my_spiffs_write(u32_t addr, u32_t size, u8_t *src) {
-  platform_flash_write(src, addr, size);
+  if (wb.buf)
+    wb_write(addr, size, src);
+  else
+    platform_flash_write(src, addr, size);
   return SPIFFS_OK;
 }
 
 static s32_t my_spiffs_erase(u32_t addr, u32_t size) {
   u32_t sect_first = platform_flash_get_sector_of_address(addr);
   u32_t sect_last = sect_first;
+  // keep the erase after the writes spiffs issued before it
+  wb_flush();
   while( sect_first <= sect_last )
     if( platform_flash_erase_sector( sect_first ++ ) == PLATFORM_ERR )
       return SPIFFS_ERR_INTERNAL;
@@ -44,7 +149,10 @@ The small 4KB sectors allow for greater flexibility in applications th
 
 ********************/
 
-void myspiffs_mount() {
+// Mounts the fs with a cache of cache_pages pages (1..29, 0 for the
+// SPIFFS_CACHE_PAGES default). The cache is allocated here; without the
+// memory for it the fs is mounted uncached.
+void myspiffs_mount( u32_t cache_pages ) {
   spiffs_config cfg;
 #ifdef SPIFFS_FIXED_LOCATION
   cfg.phys_addr = SPIFFS_FIXED_LOCATION;
@@ -53,6 +161,9 @@ void myspiffs_mount() {
 #endif
   cfg.phys_addr += 0x3FFF;
   cfg.phys_addr &= 0xFFFFC000;  // align to 4 sector.
+#if defined(LUA_XIP_SIZE) && !defined(SPIFFS_FIXED_LOCATION)
+  cfg.phys_addr += LUA_XIP_SIZE;  // past the execute-in-place bytecode region
+#endif
   cfg.phys_size = INTERNAL_FLASH_SIZE - ( ( u32_t )cfg.phys_addr );
   cfg.phys_erase_block = INTERNAL_FLASH_SECTOR_SIZE; // according to datasheet
   cfg.log_block_size = INTERNAL_FLASH_SECTOR_SIZE; // let us not complicate things
@@ -62,6 +173,21 @@ void myspiffs_mount() {
   cfg.hal_read_f = my_spiffs_read;
   cfg.hal_write_f = my_spiffs_write;
   cfg.hal_erase_f = my_spiffs_erase;
+
+#if SPIFFS_CACHE
+  if (cache_pages == 0)
+    cache_pages = SPIFFS_CACHE_PAGES;
+  if (cache_pages > SPIFFS_CACHE_PAGES_MAX)
+    cache_pages = SPIFFS_CACHE_PAGES_MAX;
+  // the cache must not go away under a mounted fs
+  SPIFFS_unmount(&fs);
+  if (cache_pages != spiffs_cache_pages) {
+    if (spiffs_cache_buf)
+      c_free(spiffs_cache_buf);
+    spiffs_cache_buf = (u8_t *)c_malloc(CACHE_BUF_SIZE(cache_pages));
+    spiffs_cache_pages = spiffs_cache_buf ? cache_pages : 0;
+  }
+#endif
   
   int res = SPIFFS_mount(&fs,
     &cfg,
@@ -69,8 +195,8 @@ void myspiffs_mount() {
     spiffs_fds,
     sizeof(spiffs_fds),
 #if SPIFFS_CACHE
-    spiffs_cache,
-    sizeof(spiffs_cache),
+    spiffs_cache_buf,
+    CACHE_BUF_SIZE(spiffs_cache_pages),
 #else
     0, 0,
 #endif
@@ -81,6 +207,38 @@ void myspiffs_mount() {
 
 void myspiffs_unmount() {
   SPIFFS_unmount(&fs);
+  wb_flush();
+}
+
+// Enables write-back with a buffer of WB_PAGES pages, or disables it.
+// Returns 1 if OK, 0 if out of memory
+int myspiffs_writeback( int enable ){
+  if (enable && !wb.buf) {
+    wb.buf = (u8_t *)c_malloc(WB_PAGES * LOG_PAGE_SIZE);
+    if (!wb.buf)
+      return 0;
+    wb.count = 0;
+  } else if (!enable && wb.buf) {
+    wb_flush();
+    c_free(wb.buf);
+    wb.buf = NULL;
+  }
+  return 1;
+}
+
+void myspiffs_writeback_stats( myspiffs_wb_stats *stats, int reset ){
+  if (stats)
+    *stats = wb.stats;
+  if (reset)
+    c_memset(&wb.stats, 0, sizeof(wb.stats));
+}
+
+u32_t myspiffs_cache_pages( void ){
+#if SPIFFS_CACHE
+  return spiffs_cache_pages;
+#else
+  return 0;
+#endif
 }
 
 // FS formatting function
@@ -88,6 +246,7 @@ void myspiffs_unmount() {
 int myspiffs_format( void )
 {
   SPIFFS_unmount(&fs);
+  wb.count = 0;
   u32_t sect_first, sect_last;
 #ifdef SPIFFS_FIXED_LOCATION
   sect_first = SPIFFS_FIXED_LOCATION;
@@ -96,6 +255,9 @@ int myspiffs_format( void )
 #endif
   sect_first += 0x3FFF;
   sect_first &= 0xFFFFC000;  // align to 4 sector.
+#if defined(LUA_XIP_SIZE) && !defined(SPIFFS_FIXED_LOCATION)
+  sect_first += LUA_XIP_SIZE;  // past the execute-in-place bytecode region
+#endif
   sect_first = platform_flash_get_sector_of_address(sect_first);
   sect_last = INTERNAL_FLASH_SIZE - SYS_PARAM_SEC_NUM;
   sect_last = platform_flash_get_sector_of_address(sect_last);
@@ -103,7 +265,7 @@ int myspiffs_format( void )
   while( sect_first <= sect_last )
     if( platform_flash_erase_sector( sect_first ++ ) == PLATFORM_ERR )
       return 0;
-  myspiffs_mount();
+  myspiffs_mount(myspiffs_cache_pages());
   return 1;
 }
 
@@ -121,6 +283,7 @@ int myspiffs_open(const char *name, int flags){
 
 int myspiffs_close( int fd ){
   SPIFFS_close(&fs, (spiffs_file)fd);
+  wb_flush();
   return 0;
 }
 size_t myspiffs_write( int fd, const void* ptr, size_t len ){
@@ -172,7 +335,9 @@ int myspiffs_ungetc( int c, int fd ){
   return SPIFFS_lseek(&fs, (spiffs_file)fd, -1, SEEK_CUR);
 }
 int myspiffs_flush( int fd ){
-  return SPIFFS_fflush(&fs, (spiffs_file)fd);
+  int res = SPIFFS_fflush(&fs, (spiffs_file)fd);
+  wb_flush();
+  return res;
 }
 int myspiffs_error( int fd ){
   return SPIFFS_errno(&fs);
@@ -183,6 +348,20 @@ void myspiffs_clearerr( int fd ){
 int myspiffs_rename( const char *old, const char *newname ){
   return SPIFFS_rename(&fs, (char *)old, (char *)newname);
 }
+// whether a descriptor is open on the file, by anyone
+int myspiffs_is_open( const char *name ){
+  spiffs_stat s;
+  spiffs_fd *fds = (spiffs_fd *)fs.fd_space;
+  u32_t i;
+  if(SPIFFS_stat(&fs, (char *)name, &s) != SPIFFS_OK)
+    return 0;
+  for(i = 0; i < fs.fd_count; i++){
+    if(fds[i].file_nbr != 0 &&
+        (fds[i].obj_id & ~SPIFFS_OBJ_ID_IX_FLAG) == (s.obj_id & ~SPIFFS_OBJ_ID_IX_FLAG))
+      return 1;
+  }
+  return 0;
+}
 size_t myspiffs_size( int fd ){
   return SPIFFS_size(&fs, (spiffs_file)fd);
 }
@@ -217,6 +217,7 @@ typedef struct {
 #if SPIFFS_CACHE_STATS
   u32_t cache_hits;
   u32_t cache_misses;
+  u32_t cache_evictions;
 #endif
 #endif
 
@@ -554,8 +555,17 @@ u32_t SPIFFS_buffer_bytes_for_cache(spiffs *fs, u32_t num_pages);
 #if SPIFFS_CACHE
 #endif
 
-void myspiffs_mount();
+typedef struct {
+  u32_t writes;     // writes issued by spiffs while write-back was on
+  u32_t merged;     // of those, writes into an already pending page
+  u32_t programs;   // page programs done when flushing
+} myspiffs_wb_stats;
+
+void myspiffs_mount( u32_t cache_pages );
 void myspiffs_unmount();
+int myspiffs_writeback( int enable );
+void myspiffs_writeback_stats( myspiffs_wb_stats *stats, int reset );
+u32_t myspiffs_cache_pages( void );
 int myspiffs_open(const char *name, int flags);
 int myspiffs_close( int fd );
 size_t myspiffs_write( int fd, const void* ptr, size_t len );
@@ -570,6 +580,7 @@ int myspiffs_error( int fd );
 void myspiffs_clearerr( int fd );
 int myspiffs_check( void );
 int myspiffs_rename( const char *old, const char *newname );
+int myspiffs_is_open( const char *name );
 size_t myspiffs_size( int fd );
 
 s32_t SPIFFS_eof(spiffs *fs, spiffs_file fh);
@@ -71,7 +71,7 @@ static s32_t spiffs_cache_page_remove_oldest(spiffs *fs, u8_t flag_mask, u8_t fl
   u32_t oldest_val = 0;
   for (i = 0; i < cache->cpage_count; i++) {
     spiffs_cache_page *cp = spiffs_get_cache_page_hdr(fs, cache, i);
-    if ((cache->last_access - cp->last_access) > oldest_val &&
+    if ((cache->last_access - cp->last_access) >= oldest_val &&
         (cp->flags & flag_mask) == flags) {
       oldest_val = cache->last_access - cp->last_access;
       cand_ix = i;
@@ -79,6 +79,9 @@ static s32_t spiffs_cache_page_remove_oldest(spiffs *fs, u8_t flag_mask, u8_t fl
   }
 
   if (cand_ix >= 0) {
+#if SPIFFS_CACHE_STATS
+    fs->cache_evictions++;
+#endif
     res = spiffs_cache_page_free(fs, cand_ix, 1);
   }
 
@@ -147,10 +150,12 @@ s32_t spiffs_phys_rd(
 #endif
     res = spiffs_cache_page_remove_oldest(fs, SPIFFS_CACHE_FLAG_TYPE_WR, 0);
     cp = spiffs_cache_page_allocate(fs);
-    if (cp) {
-      cp->flags = SPIFFS_CACHE_FLAG_WRTHRU;
-      cp->pix = SPIFFS_PADDR_TO_PAGE(fs, addr);
+    if (cp == 0) {
+      // all pages hold write caches, read directly
+      return fs->cfg.hal_read_f(addr, len, dst);
     }
+    cp->flags = SPIFFS_CACHE_FLAG_WRTHRU;
+    cp->pix = SPIFFS_PADDR_TO_PAGE(fs, addr);
 
     s32_t res2 = fs->cfg.hal_read_f(
         addr - SPIFFS_PADDR_TO_PAGE_OFFSET(fs, addr),
@@ -2,6 +2,8 @@
 #include <stdlib.h>
 
 int main(int argc, char **args) {
-  run_tests(argc, args);
+  if (run_tests(argc, args)) {
+    exit(EXIT_FAILURE);
+  }
   exit(EXIT_SUCCESS);
 }
@@ -16,6 +16,35 @@
 #include <dirent.h>
 #include <unistd.h>
 
+#if SPIFFS_CACHE_STATS
+// a data logger reopens its log for every line; measure how well the read
+// cache copes with that for different cache sizes
+static int log_append(u32_t pages, u32_t lines, float *hit_rate) {
+  char line[32];
+  u32_t i;
+  u32_t size = 0;
+  spiffs_stat s;
+
+  fs_reset();
+  fs_remount_cache_pages(pages);
+  for (i = 0; i < lines; i++) {
+    spiffs_file fd = SPIFFS_open(FS, "log", SPIFFS_APPEND | SPIFFS_CREAT | SPIFFS_RDWR, 0);
+    CHECK(fd >= 0);
+    int len = sprintf(line, "%06i: sensor %i\n", i, (i * 37) % 1000);
+    CHECK(SPIFFS_write(FS, fd, line, len) == len);
+    SPIFFS_close(FS, fd);
+    size += len;
+  }
+  CHECK(SPIFFS_stat(FS, "log", &s) >= 0);
+  CHECK(s.size == size);
+
+  *hit_rate = (float)(FS)->cache_hits / (float)((FS)->cache_hits + (FS)->cache_misses);
+  printf("  log append, %i cache pages: hits %i misses %i evictions %i rate %f\n",
+      pages, (FS)->cache_hits, (FS)->cache_misses, (FS)->cache_evictions, *hit_rate);
+  return 0;
+}
+#endif
+
 SUITE(hydrogen_tests)
 void setup() {
   _setup();
@@ -1390,5 +1419,18 @@ TEST(long_run)
 }
 TEST_END(long_run)
 
+#if SPIFFS_CACHE_STATS
+TEST(cache_log_append)
+{
+  float small, large;
+  TEST_CHECK(log_append(1, 2000, &small) == 0);
+  TEST_CHECK((FS)->cache_evictions > 0);
+  TEST_CHECK(log_append(8, 2000, &large) == 0);
+  TEST_CHECK(large > small);
+  return TEST_RES_OK;
+}
+TEST_END(cache_log_append)
+#endif
+
 SUITE_END(hydrogen_tests)
 
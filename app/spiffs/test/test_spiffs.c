@@ -343,6 +343,17 @@ void fs_reset() {
   fs_reset_specific(SPIFFS_PHYS_ADDR, SPIFFS_FLASH_SIZE, SECTOR_SIZE, LOG_BLOCK, LOG_PAGE);
 }
 
+void fs_remount_cache_pages(u32_t pages) {
+  spiffs_config c;
+  // slack for the pointer alignment SPIFFS_mount does
+  u32_t size = sizeof(spiffs_cache) + pages * SPIFFS_CACHE_PAGE_SIZE(FS) + sizeof(void *);
+  if (size > sizeof(_cache)) size = sizeof(_cache);
+  memcpy(&c, &__fs.cfg, sizeof(spiffs_config));
+  SPIFFS_unmount(&__fs);
+  memset(_cache,0,sizeof(_cache));
+  SPIFFS_mount(&__fs, &c, _work, _fds, sizeof(_fds), _cache, size, spiffs_check_cb_f);
+}
+
 void set_flash_ops_log(int enable) {
   log_flash_ops = enable;
 }
@@ -360,6 +371,10 @@ u32_t get_flash_ops_log_read_bytes() {
   return bytes_rd;
 }
 
+u32_t get_flash_ops_log_reads() {
+  return reads;
+}
+
 u32_t get_flash_ops_log_write_bytes() {
   return bytes_wr;
 }
@@ -60,6 +60,7 @@ void fs_reset();
 void fs_reset_specific(u32_t phys_addr, u32_t phys_size,
     u32_t phys_sector_size,
     u32_t log_block_size, u32_t log_page_size);
+void fs_remount_cache_pages(u32_t pages);
 int read_and_verify(char *name);
 int read_and_verify_fd(spiffs_file fd, char *name);
 void dump_page(spiffs *fs, spiffs_page_ix p);
@@ -73,6 +74,7 @@ void dump_flash_access_stats();
 void set_flash_ops_log(int enable);
 void clear_flash_ops_log();
 u32_t get_flash_ops_log_read_bytes();
+u32_t get_flash_ops_log_reads();
 u32_t get_flash_ops_log_write_bytes();
 void invoke_error_after_read_bytes(u32_t b, char once_only);
 void invoke_error_after_write_bytes(u32_t b, char once_only);
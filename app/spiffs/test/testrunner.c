@@ -40,14 +40,25 @@ static char check_spec(char *name) {
     char *line = NULL;
     size_t sz;
     ssize_t read;
+    char listed = 0;
+    char selected = 0;
     while ((read = getline(&line, &sz, test_main.spec)) != -1) {
+      // '#' starts a comment, '-name' leaves a test out
+      if (line[0] == '#') continue;
+      if (line[0] == '-') {
+        if (strncmp(line + 1, name, strlen(name)) == 0) {
+          free(line);
+          return 0;
+        }
+        continue;
+      }
+      listed = 1;
       if (strncmp(line, name, strlen(name)) == 0) {
-        free(line);
-        return 1;
+        selected = 1;
       }
     }
     free(line);
-    return 0;
+    return selected || !listed;
   } else {
     return 1;
   }
@@ -94,7 +105,7 @@ static void dump_res(test_res **head) {
   }
 }
 
-void run_tests(int argc, char **args) {
+int run_tests(int argc, char **args) {
   memset(&test_main, 0, sizeof(test_main));
   if (argc > 1) {
     printf("running tests from %s\n", args[1]);
@@ -115,7 +126,7 @@ void run_tests(int argc, char **args) {
 
   if (test_main.test_count == 0) {
     printf("No tests to run\n");
-    return;
+    return 0;
   }
 
   int fd_success = open("_tests_ok", O_APPEND | O_TRUNC | O_CREAT | O_RDWR, S_IRUSR | S_IWUSR);
@@ -172,4 +183,5 @@ void run_tests(int argc, char **args) {
   } else {
     printf("\nALL TESTS OK\n");
   }
+  return test_main.test_count - ok;
 }
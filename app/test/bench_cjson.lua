@@ -0,0 +1,83 @@
+-- bench_cjson.lua
+--
+-- Peak heap of the ways to get a document through cjson: in one piece,
+-- encoded in chunks through a callback or an encoder object, and decoded
+-- from a string or fed in chunks to a decoder. The document is a typical
+-- telemetry upload, about 12 kB of JSON. Chunked work collects garbage
+-- after every chunk, as a socket's sent callback would.
+
+local FILE = "bench_cjson.json"
+local CHUNK = 256
+
+local readings, config = {}, {}
+for i = 1, 150 do
+  readings[i] = { ts = 1445000000 + i, temp = 21.5 + i / 10, hum = 40 + i % 7,
+    ok = (i % 3 == 0), tag = "sensor-" .. i }
+end
+for i = 1, 40 do
+  config["key" .. i] = { enabled = true, interval = i * 100,
+    name = string.rep("n", i % 20) }
+end
+local doc = { device = "esp-01", readings = readings, config = config }
+local text = cjson.encode(doc)
+writefile(FILE, text)
+text = nil
+
+local function gc()
+  collectgarbage()
+  collectgarbage()
+end
+
+local function measure(name, fn)
+  gc()
+  local base = heap()
+  peak_reset()
+  local t = clock()
+  fn()
+  local _, peak = heap()
+  print(string.format("%-24s %7d %8.1f", name, peak - base, (clock() - t) * 1000))
+end
+
+local size = #readfile(FILE)
+print(string.format("document %d bytes, chunks of %d", size, CHUNK))
+print(string.format("%-24s %7s %8s", "", "peak B", "ms"))
+
+measure("encode", function()
+  local s = cjson.encode(doc)
+end)
+measure("encode, callback", function()
+  local n = 0
+  cjson.encode(doc, function(c) n = n + #c gc() end, CHUNK)
+  assert(n == size)
+end)
+measure("encoder:read", function()
+  local e, n = cjson.encoder(doc, CHUNK), 0
+  while true do
+    local c = e:read()
+    if not c then break end
+    n = n + #c
+    gc()
+  end
+  assert(n == size)
+end)
+measure("read file, decode", function()
+  local v = cjson.decode(readfile(FILE))
+end)
+measure("decoder:write", function()
+  local d, h = cjson.decoder(), fopen(FILE)
+  while true do
+    local c = fread(h, CHUNK)
+    if not c then break end
+    d:write(c)
+    gc()
+  end
+  local v = d:result()
+  assert(#v.readings == 150)
+end)
+
+-- what any decode has to keep in the end
+gc()
+local base = heap()
+local kept = cjson.decode(cjson.encode(doc))
+gc()
+print(string.format("%-24s %7d", "decoded tables", heap() - base))
@@ -0,0 +1,75 @@
+-- bench_egc.lua
+--
+-- Garbage collector pauses of each EGC mode, on the EGC of legc.c with the
+-- host playing the Lua task (host_egc.c). Every event churns through short
+-- lived tables and strings the way a busy callback does, with idle slots of
+-- the task in between. Printed per mode are the time the events took and
+-- legc.c's pause histogram, with the buckets of node.egc.stats(): under
+-- 128 us, 256 us, ... and the rest. The host is much faster than the chip,
+-- so the times matter relative to each other.
+--
+-- ON_ALLOC_FAILURE never collects here, as the host heap does not run out;
+-- it shows the plain incremental collector, with which NOT_ACTIVE is the
+-- same. ON_MEM_LIMIT and the collector's own steps are not timed by legc.c,
+-- only by the event times.
+
+local EVENTS = 500
+local IDLE = 4          -- idle slots after each event
+local BUCKETS, BUCKET_US = 8, 128
+
+-- as legc.h has them
+local ON_ALLOC_FAILURE, ON_MEM_LIMIT, ALWAYS, STEP = 1, 2, 4, 8
+
+local keep = {}
+
+local function churn(n)
+  for i = 1, n do
+    keep[i % 64] = { i, tostring(i), string.rep("x", i % 64) }
+  end
+end
+
+local function bucket(us)
+  local i = 1
+  while i < BUCKETS and us >= BUCKET_US * 2 ^ (i - 1) do i = i + 1 end
+  return i
+end
+
+local function row(name, hist)
+  local s = string.format("  %-12s", name)
+  for i = 1, BUCKETS do s = s .. string.format(" %7d", hist[i]) end
+  print(s)
+end
+
+local function run(name, mode, limit, step)
+  collectgarbage()
+  egc_setmode(mode, limit, step)
+  egc_stats(true)
+  local events, worst, total = {}, 0, 0
+  for i = 1, BUCKETS do events[i] = 0 end
+  for e = 1, EVENTS do
+    local t = clock()
+    churn(100)
+    t = (clock() - t) * 1e6
+    events[bucket(t)] = events[bucket(t)] + 1
+    total = total + t
+    if t > worst then worst = t end
+    for i = 1, IDLE do idle() end
+  end
+  local count, max, avg, full, hist = egc_stats()
+  egc_setmode(0)
+  print(string.format("%s: events avg %.0f us max %.0f us, egc runs %d full %d max %d us avg %d us",
+    name, total / EVENTS, worst, count, full, max, avg))
+  row("events", events)
+  row("egc pauses", hist)
+end
+
+local head = string.format("  %-12s", "us <")
+for i = 1, BUCKETS - 1 do head = head .. string.format(" %7d", BUCKET_US * 2 ^ (i - 1)) end
+print(head .. "    more")
+
+churn(100)
+local base = collectgarbage("count") * 1024
+run("ON_ALLOC_FAILURE", ON_ALLOC_FAILURE, 0, 0)
+run("ON_MEM_LIMIT", ON_MEM_LIMIT, base + 4096, 0)
+run("ALWAYS", ALWAYS, 0, 0)
+run("STEP", STEP + ON_ALLOC_FAILURE, 0, 500)
@@ -0,0 +1,77 @@
+-- bench_icache.lua
+--
+-- Table field and global access loops of a typical script, run by
+-- bench_icache_on and bench_icache_off, the host Lua built with and
+-- without LUA_USE_ICACHE. The lookup cache serves module names, fields of
+-- a module's ROM table and methods of a userdata's ROM metatable; plain
+-- table fields and globals kept in _G go the usual way in both builds.
+
+local N = 2000000
+
+local function measure(name, fn)
+  collectgarbage()
+  local t = clock()
+  local check = fn()
+  t = clock() - t
+  print(string.format("%-24s %8.2f M/s  %d", name, N / t / 1e6, check))
+end
+
+print(string.format("%-24s %12s  %s", "loop", "accesses", "check"))
+
+measure("module global", function()
+  local n = 0
+  for i = 1, N do
+    if bit then n = n + 1 end
+  end
+  return n
+end)
+
+measure("module.field", function()
+  local n = 0
+  for i = 1, N do
+    if bit.band then n = n + 1 end
+  end
+  return n
+end)
+
+measure("module.func()", function()
+  local n = 0
+  for i = 1, N do
+    n = n + bit.band(i, 1)
+  end
+  return n
+end)
+
+measure("string.func()", function()
+  local n = 0
+  for i = 1, N do
+    n = n + string.len("abc")
+  end
+  return n
+end)
+
+counter = 1
+measure("_G global", function()
+  local n = 0
+  for i = 1, N do
+    n = n + counter
+  end
+  return n
+end)
+
+local t = { x = 1, y = 2 }
+measure("table.field", function()
+  local n = 0
+  for i = 1, N do
+    n = n + t.x
+  end
+  return n
+end)
+
+measure("unset global", function()
+  local n = 0
+  for i = 1, N do
+    if not undefined_name then n = n + 1 end
+  end
+  return n
+end)
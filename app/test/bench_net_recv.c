@@ -0,0 +1,180 @@
+/*
+ * bench_net_recv.c
+ *
+ * Heap allocations and bytes copied per MB received over tcp, through
+ * espconn_tcp.c and lwIP's pbuf.c as they are in the firmware, for the
+ * three ways net.c takes data in:
+ *
+ *   copy      the recv callback: espconn copies every segment into a
+ *             buffer of its own, net.c copies it again into a Lua string
+ *   pbuf      the recv pbuf callback with a "receive" handler: net.c
+ *             copies the chain into a Lua string and frees it
+ *   buffer    the recv pbuf callback with a "receivebuf" handler: the
+ *             chain goes to Lua in a net.buffer and is freed on release
+ *
+ * What net.c asks of Lua per segment is played here as the allocation and
+ * copy lua_pushlstring() or lua_newuserdata() would do. The segments come
+ * from the stack already in pbufs, which is not counted. Every mode must
+ * reopen the receive window by exactly the bytes received.
+ */
+
+#include "c_types.h"
+#define _SIZE_T     // size_t is c_types.h's, lwIP's stddef.h must not redo it
+#include "mem.h"
+#include "host_sdk.h"
+
+// lwIP copies with MEMCPY, counted here
+static uint32_t allocs, copied, window;   // allocs: those made for Lua
+#define MEMCPY(dst, src, len) (copied += (len), __builtin_memcpy(dst, src, len))
+
+// both keep a name for the SDK heap's leak debugging
+#define mem_debug_file pbuf_mem_debug_file
+#include "../lwip/core/pbuf.c"
+#undef mem_debug_file
+#include "../lwip/app/espconn_tcp.c"
+
+#include <stdio.h>
+#include <time.h>
+
+#define RECEIVE   (1024 * 1024)
+
+espconn_msg *plink_active;
+espconn_msg *pserver_list;
+
+bool espconn_find_connection(struct espconn *pespconn, espconn_msg **pnode)
+{
+  espconn_msg *plist;
+
+  for (plist = plink_active; plist != NULL; plist = plist->pnext) {
+    if (pespconn == plist->pespconn) {
+      *pnode = plist;
+      return true;
+    }
+  }
+  return false;
+}
+
+void tcp_arg(struct tcp_pcb *pcb, void *arg)
+{
+}
+
+void tcp_recved(struct tcp_pcb *pcb, u16_t len)
+{
+  window += len;
+}
+
+// what espconn_tcp.c needs to close a connection, never done here
+struct tcp_pcb *tcp_active_pcbs;
+const u32_t memp_sizes[MEMP_MAX];
+
+void tcp_err(struct tcp_pcb *pcb, tcp_err_fn err) {}
+void tcp_recv(struct tcp_pcb *pcb, tcp_recv_fn recv) {}
+void tcp_sent(struct tcp_pcb *pcb, tcp_sent_fn sent) {}
+err_t tcp_close(struct tcp_pcb *pcb) { return ERR_OK; }
+void tcp_seg_free(struct tcp_seg *seg) {}
+int ets_post(uint32 prio, uint32 sig, uint32 par) { return 0; }
+
+// a Lua string or userdata of n bytes, copy bytes of it filled from data
+static void *lua_side(const void *data, size_t n, size_t copy)
+{
+  void *o = __builtin_malloc(n);
+  allocs++;
+  if (copy) {
+    __builtin_memcpy(o, data, copy);
+    copied += copy;
+  }
+  return o;
+}
+
+// net_socket_received()
+static void recv_copy(void *arg, char *pdata, unsigned short len)
+{
+  __builtin_free(lua_side(pdata, len, len));
+}
+
+// net_socket_received_pbuf() with a "receive" handler: net_push_pbuf()
+// copies the chain into one string, then the pbuf is released
+static void recv_pbuf(void *arg, struct pbuf *p)
+{
+  char *s = lua_side(NULL, p->tot_len, 0);
+  u16_t len = p->tot_len;
+
+  pbuf_copy_partial(p, s, p->tot_len, 0);
+  __builtin_free(s);
+  pbuf_free(p);
+  espconn_recved((struct espconn *)arg, len);
+}
+
+// net_socket_received_pbuf() with a "receivebuf" handler: the chain is
+// kept in a net.buffer, released here as buf:free() would
+static void recv_buffer(void *arg, struct pbuf *p)
+{
+  struct { struct pbuf *p; void *conn, *next, *pprev; } *buf;
+  u16_t len = p->tot_len;
+
+  buf = lua_side(NULL, sizeof(*buf), 0);
+  buf->p = p;
+  pbuf_free(buf->p);
+  espconn_recved((struct espconn *)arg, len);
+  __builtin_free(buf);
+}
+
+static int run(const char *name, espconn_recv_callback copy, espconn_recv_pbuf_callback pbuf)
+{
+  struct espconn conn;
+  struct tcp_pcb pcb;
+  espconn_msg msg;
+  uint32_t got = 0, segs = 0, sdk_allocs;
+  clock_t t;
+
+  memset(&conn, 0, sizeof(conn));
+  memset(&pcb, 0, sizeof(pcb));
+  memset(&msg, 0, sizeof(msg));
+  conn.type = ESPCONN_TCP;
+  conn.recv_callback = copy;
+  conn.recv_pbuf_callback = pbuf;
+  pcb.state = ESTABLISHED;
+  msg.pespconn = &conn;
+  msg.pcommon.pcb = &pcb;
+  plink_active = &msg;
+
+  allocs = copied = window = 0;
+  sdk_allocs = 0;
+  t = clock();
+  while (got < RECEIVE) {
+    // a full segment, now and then two coalesced into a chain
+    struct pbuf *p = pbuf_alloc(PBUF_RAW, TCP_MSS, PBUF_RAM);
+    if (segs % 8 == 7)
+      pbuf_cat(p, pbuf_alloc(PBUF_RAW, TCP_MSS, PBUF_RAM));
+    memset(p->payload, segs, p->len);
+    got += p->tot_len;
+    segs++;
+    host_allocs = 0;      // not the stack's own pbufs
+    espconn_client_recv(&msg, &pcb, p, ERR_OK);
+    sdk_allocs += host_allocs;
+  }
+  allocs += sdk_allocs;
+  t = clock() - t;
+  plink_active = NULL;
+
+  printf("%-8s %6.0f %10.0f %10.0f %8.1f\n", name, segs * (1048576.0 / got),
+    allocs * (1048576.0 / got), copied * (1048576.0 / got),
+    (double)t * 1e6 / CLOCKS_PER_SEC / segs);
+  if (window != got) {
+    printf("%s: window reopened by %u of %u bytes\n", name, window, got);
+    return 1;
+  }
+  return 0;
+}
+
+int main(void)
+{
+  int failed = 0;
+
+  printf("per MB received\n");
+  printf("%-8s %6s %10s %10s %8s\n", "", "recvs", "allocs", "copied B", "us/recv");
+  failed |= run("copy", recv_copy, NULL);
+  failed |= run("pbuf", NULL, recv_pbuf);
+  failed |= run("buffer", NULL, recv_buffer);
+  return failed;
+}
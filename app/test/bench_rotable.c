@@ -0,0 +1,152 @@
+/*
+ * bench_rotable.c
+ *
+ * Lookups per second into the ROM tables, before and after the sorted
+ * global list and the string key cache of lrotable.c:
+ *
+ *   global    luaR_findglobal(), which _G's __index calls for every
+ *             module name a script reads, and for globals that are nil
+ *   entry     the string key lookup luaH_getstr_ro() does for module.func,
+ *             with a key the map has and one it has not
+ *
+ * "before" are the lookups as lrotable.c and ltable.c had them: a linear
+ * scan of lua_rotable with c_strlen per entry, and a copy of the key into
+ * a C string ahead of the linear walk of the map.
+ *
+ * The global list is as long as with the modules of user_modules.h: bit
+ * and the builtin libraries are the real ones, the other names are
+ * stand-ins with a small map. On the chip the keys are read from flash,
+ * so every compare saved there is worth more than here.
+ */
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+#include "lstring.h"
+#include "lrotable.h"
+#include "module.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define LOOKUPS   (4 * 1000 * 1000)
+
+#include "lrodefs.h"
+static const LUA_REG_TYPE standin_map[] = {
+  { LSTRKEY( "setup" ), LNUMVAL( 0 ) },
+  { LSTRKEY( "read" ),  LNUMVAL( 1 ) },
+  { LSTRKEY( "write" ), LNUMVAL( 2 ) },
+  { LSTRKEY( "close" ), LNUMVAL( 3 ) },
+  { LNILKEY, LNILVAL }
+};
+
+BUILTIN_LIB( ADC,     "adc",     standin_map );
+BUILTIN_LIB( CRYPTO,  "crypto",  standin_map );
+BUILTIN_LIB( FILE,    "file",    standin_map );
+BUILTIN_LIB( GPIO,    "gpio",    standin_map );
+BUILTIN_LIB( MQTT,    "mqtt",    standin_map );
+BUILTIN_LIB( NET,     "net",     standin_map );
+BUILTIN_LIB( NODE,    "node",    standin_map );
+BUILTIN_LIB( PWM,     "pwm",     standin_map );
+BUILTIN_LIB( TMR,     "tmr",     standin_map );
+BUILTIN_LIB( UART,    "uart",    standin_map );
+BUILTIN_LIB( WIFI,    "wifi",    standin_map );
+BUILTIN_LIB( DALI,    "dali",    standin_map );
+BUILTIN_LIB( BONJOUR, "bonjour", standin_map );
+
+extern const luaR_table lua_rotable[];
+
+// luaR_findglobal() before
+static void *findglobal_before(const char *name, unsigned len) {
+  unsigned i;
+
+  if (strlen(name) > LUA_MAX_ROTABLE_NAME)
+    return NULL;
+  for (i=0; lua_rotable[i].name; i ++)
+    if (*lua_rotable[i].name != '\0' && strlen(lua_rotable[i].name) == len && !strncmp(lua_rotable[i].name, name, len)) {
+      return (void*)(lua_rotable[i].pentries);
+    }
+  return NULL;
+}
+
+// luaH_getstr_ro() before
+static const TValue *findstrentry_before(void *t, TString *key) {
+  char keyname[LUA_MAX_ROTABLE_NAME + 1];
+  luaR_getcstr(keyname, key, LUA_MAX_ROTABLE_NAME);
+  return luaR_findentry(t, keyname, 0, NULL);
+}
+
+static double rate(clock_t t) {
+  return LOOKUPS / ((double)t / CLOCKS_PER_SEC) / 1e6;
+}
+
+// the names a script reads; for the misses, globals it has not set
+static const char *global_hits[] = { "gpio", "tmr", "string", "wifi", "bit", "node", "uart", "math" };
+static const char *global_misses[] = { "led", "count", "config", "state", "pin", "x", "callback", "ssid" };
+static const char *entry_hits[] = { "band", "bor", "isclear", "lshift" };
+static const char *entry_misses[] = { "nand", "rol", "test", "version" };
+
+static int global_bench(const char **names, int expect, int before, clock_t *t) {
+  int found = 0;
+  long i;
+  *t = clock();
+  for (i = 0; i < LOOKUPS; i++) {
+    const char *name = names[i & 7];
+    void *res = before ? findglobal_before(name, strlen(name)) : luaR_findglobal(name, strlen(name));
+    found += res != NULL;
+  }
+  *t = clock() - *t;
+  return found == (expect ? LOOKUPS : 0);
+}
+
+static int entry_bench(void *map, TString **keys, int expect, int before, clock_t *t) {
+  int found = 0;
+  long i;
+  *t = clock();
+  for (i = 0; i < LOOKUPS; i++) {
+    const TValue *res = before ? findstrentry_before(map, keys[i & 3]) : luaR_findstrentry(map, keys[i & 3]);
+    found += res != NULL;
+  }
+  *t = clock() - *t;
+  return found == (expect ? LOOKUPS : 0);
+}
+
+int main(void) {
+  lua_State *L = lua_open();
+  TString *hits[4], *misses[4];
+  void *bit;
+  int n, i, ok = 1;
+  clock_t t[2];
+
+  luaL_openlibs(L);   // links in the builtin libraries
+  for (n = 0; lua_rotable[n].name; n++)
+    ;
+  bit = luaR_findglobal("bit", 3);
+  if (bit == NULL) {
+    printf("FAIL: no bit rotable\n");
+    return 1;
+  }
+  for (i = 0; i < 4; i++) {
+    hits[i] = luaS_newlstr(L, entry_hits[i], strlen(entry_hits[i]));
+    misses[i] = luaS_newlstr(L, entry_misses[i], strlen(entry_misses[i]));
+  }
+
+  printf("%i globals, %i cache lines, M lookups/s\n", n, LUAR_CACHE_LINES);
+  printf("%-16s %10s %10s\n", "", "before", "after");
+  ok &= global_bench(global_hits, 1, 1, &t[0]) && global_bench(global_hits, 1, 0, &t[1]);
+  printf("%-16s %10.1f %10.1f\n", "global hit", rate(t[0]), rate(t[1]));
+  ok &= global_bench(global_misses, 0, 1, &t[0]) && global_bench(global_misses, 0, 0, &t[1]);
+  printf("%-16s %10.1f %10.1f\n", "global miss", rate(t[0]), rate(t[1]));
+  ok &= entry_bench(bit, hits, 1, 1, &t[0]) && entry_bench(bit, hits, 1, 0, &t[1]);
+  printf("%-16s %10.1f %10.1f\n", "bit.<key> hit", rate(t[0]), rate(t[1]));
+  ok &= entry_bench(bit, misses, 0, 1, &t[0]) && entry_bench(bit, misses, 0, 0, &t[1]);
+  printf("%-16s %10.1f %10.1f\n", "bit.<key> miss", rate(t[0]), rate(t[1]));
+
+  lua_close(L);
+  if (!ok) {
+    printf("FAIL: a lookup found the wrong thing\n");
+    return 1;
+  }
+  return 0;
+}
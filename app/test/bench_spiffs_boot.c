@@ -0,0 +1,264 @@
+/*
+ * bench_spiffs_boot.c
+ *
+ * Startup of a node on the spiffs test harness: mount the fs, load
+ * init.lua and a dozen modules, some of them compiled, and read a config
+ * file line by line. Both ways the firmware has read scripts are played:
+ *
+ *   getc      as before the fs_buf reader: luaL_loadfsfile probes the
+ *             start of a file with fs_getc, one SPIFFS_read per byte and
+ *             an lseek for ungetc, and reopens a compiled file; lua_load
+ *             then reads LUAL_BUFFERSIZE blocks. file.readline reads a
+ *             block and seeks back over what follows the line
+ *   fs_buf    luaL_loadfsfile and file.readline as they are now, on the
+ *             fs_buf reader of flash_fs.c
+ *
+ * The fs has the firmware's geometry and cache size, and the fs glue
+ * below does what spiffs.c does. Counted are the calls into spiffs, the
+ * reads and bytes spiffs asks of the flash, and the host time.
+ */
+
+#include "testrunner.h"
+#include "test_spiffs.h"
+#include "spiffs.h"
+#include "spiffs_nucleus.h"
+#include "../platform/flash_fs.c"
+
+#include <stdio.h>
+#include <time.h>
+
+#define MODULES       12
+#define COMPILED      4       // modules stored as bytecode
+#define MODULE_SIZE   3000
+#define CONFIG_LINES  100
+#define RUNS          20
+#define LUAL_BUFFERSIZE 1024  // BUFSIZ on the chip
+
+static u32_t calls;         // into spiffs
+static u32_t sum;           // of every byte handed to the parser
+
+void add_suites() {
+}
+
+// the fs glue of spiffs.c, on the harness fs
+
+int myspiffs_open(const char *name, int flags) {
+  calls++;
+  return (int)SPIFFS_open(FS, (char *)name, (spiffs_flags)flags, 0);
+}
+
+int myspiffs_close(int fd) {
+  calls++;
+  SPIFFS_close(FS, (spiffs_file)fd);
+  return 0;
+}
+
+size_t myspiffs_read(int fd, void *ptr, size_t len) {
+  calls++;
+  int res = SPIFFS_read(FS, (spiffs_file)fd, ptr, len);
+  return res < 0 ? 0 : res;
+}
+
+int myspiffs_lseek(int fd, int off, int whence) {
+  calls++;
+  return SPIFFS_lseek(FS, (spiffs_file)fd, off, whence);
+}
+
+int myspiffs_eof(int fd) {
+  calls++;
+  return SPIFFS_eof(FS, (spiffs_file)fd);
+}
+
+int myspiffs_getc(int fd) {
+  unsigned char c = 0xFF;
+  if (!myspiffs_eof(fd)) {
+    calls++;
+    if (SPIFFS_read(FS, (spiffs_file)fd, &c, 1) != 1)
+      return EOF;
+    return c;
+  }
+  return EOF;
+}
+
+int myspiffs_ungetc(int c, int fd) {
+  return myspiffs_lseek(fd, -1, SEEK_CUR);
+}
+
+static void parse(const char *p, size_t n) {
+  while (n--)
+    sum += (unsigned char)*p++;
+}
+
+// luaL_loadfsfile and getFSF before the fs_buf reader
+static void load_getc(const char *name) {
+  char buff[LUAL_BUFFERSIZE];
+  size_t n;
+  int c;
+  int f = fs_open(name, FS_RDONLY);
+  c = fs_getc(f);
+  if (c == '#') {
+    parse("\n", 1);
+    while ((c = fs_getc(f)) != EOF && c != '\n') ;
+    if (c == '\n') c = fs_getc(f);
+  }
+  if (c == '\033') {
+    fs_close(f);
+    f = fs_open(name, FS_RDONLY);
+    while ((c = fs_getc(f)) != EOF && c != '\033') ;
+  }
+  fs_ungetc(c, f);
+  while (!fs_eof(f) && (n = fs_read(f, buff, sizeof(buff))) > 0)
+    parse(buff, n);
+  fs_close(f);
+}
+
+// luaL_loadfsfile and getFSF now
+static void load_buf(const char *name) {
+  fs_buf fb;
+  const char *p;
+  size_t n;
+  int c;
+  int f = fs_open(name, FS_RDONLY);
+  fs_buf_init(&fb, f);
+  c = fs_buf_getc(&fb);
+  if (c == '#') {
+    parse("\n", 1);
+    while ((c = fs_buf_getc(&fb)) != EOF && c != '\n') ;
+    if (c == '\n') c = fs_buf_getc(&fb);
+  }
+  if (c == '\033') {
+    fs_seek(f, 0, FS_SEEK_SET);
+    fs_buf_init(&fb, f);
+    while ((c = fs_buf_getc(&fb)) != EOF && c != '\033') ;
+  }
+  fs_buf_ungetc(c, &fb);
+  while ((p = fs_buf_next(&fb, &n)) != NULL)
+    parse(p, n);
+  fs_close(f);
+}
+
+// file.readline before the fs_buf reader
+static void readlines_getc(const char *name) {
+  char p[LUAL_BUFFERSIZE];
+  int f = fs_open(name, FS_RDONLY);
+  for (;;) {
+    int i, n = fs_read(f, p, sizeof(p));
+    for (i = 0; i < n; ++i)
+      if (p[i] == '\n') {
+        ++i;
+        break;
+      }
+    if (i == 0)
+      break;
+    fs_seek(f, -(n - i), SEEK_CUR);
+    parse(p, i);
+  }
+  fs_close(f);
+}
+
+// file.readline now
+static void readlines_buf(const char *name) {
+  char p[LUAL_BUFFERSIZE];
+  fs_buf fb;
+  int f = fs_open(name, FS_RDONLY);
+  fs_buf_init(&fb, f);
+  for (;;) {
+    int i = 0, c;
+    while (i < (int)sizeof(p) && (c = fs_buf_getc(&fb)) != EOF) {
+      p[i++] = (char)c;
+      if (c == '\n')
+        break;
+    }
+    if (i == 0)
+      break;
+    parse(p, i);
+  }
+  fs_close(f);
+}
+
+static void create(const char *name, const char *head, int size) {
+  char line[64];
+  int n = 0;
+  spiffs_file fd = SPIFFS_open(FS, (char *)name, SPIFFS_CREAT | SPIFFS_TRUNC | SPIFFS_RDWR, 0);
+  SPIFFS_write(FS, fd, (char *)head, strlen(head));
+  while (n < size) {
+    int len = sprintf(line, "local v%d = tmr.now() + %d -- %s\n", n, n * 7, name);
+    SPIFFS_write(FS, fd, line, len);
+    n += len;
+  }
+  SPIFFS_close(FS, fd);
+}
+
+static void boot(int buffered) {
+  char name[32];
+  int i;
+  fs_remount_cache_pages(2);
+  if (buffered) {
+    load_buf("init.lua");
+    for (i = 0; i < MODULES; i++) {
+      sprintf(name, i < COMPILED ? "mod%d.lc" : "mod%d.lua", i);
+      load_buf(name);
+    }
+    readlines_buf("config.txt");
+  } else {
+    load_getc("init.lua");
+    for (i = 0; i < MODULES; i++) {
+      sprintf(name, i < COMPILED ? "mod%d.lc" : "mod%d.lua", i);
+      load_getc(name);
+    }
+    readlines_getc("config.txt");
+  }
+}
+
+int main(void) {
+  static const char *modes[] = { "getc", "fs_buf" };
+  char name[32];
+  u32_t sums[2];
+  int i, m;
+
+  // a 1MB fs with the firmware's 4k blocks and 256 byte pages
+  fs_reset_specific(0, 256 * 4096, 4096, 4096, 256);
+  create("init.lua", "#!/usr/bin/lua\n", 2000);
+  for (i = 0; i < MODULES; i++) {
+    sprintf(name, i < COMPILED ? "mod%d.lc" : "mod%d.lua", i);
+    create(name, i < COMPILED ? "\033Lua\x51" : "-- module\n", MODULE_SIZE);
+  }
+  create("config.txt", "ssid=node\n", CONFIG_LINES * 40);
+
+  printf("%i modules (%i compiled) of %i bytes, a %i line config, %i runs\n",
+      MODULES, COMPILED, MODULE_SIZE, CONFIG_LINES, RUNS);
+  printf("%-8s %12s %12s %12s %10s\n", "mode", "fs calls", "flash reads", "flash bytes", "us/boot");
+  {
+    clock_t t;
+    clear_flash_ops_log();
+    t = clock();
+    for (i = 0; i < RUNS; i++)
+      fs_remount_cache_pages(2);
+    t = clock() - t;
+    printf("%-8s %12s %12u %12u %10.0f\n", "mount", "-",
+        get_flash_ops_log_reads() / RUNS, get_flash_ops_log_read_bytes() / RUNS,
+        (double)t * 1e6 / CLOCKS_PER_SEC / RUNS);
+  }
+  for (m = 0; m < 2; m++) {
+    clock_t t;
+    int run;
+    calls = 0;
+    sum = 0;
+    clear_flash_ops_log();
+    t = clock();
+    for (run = 0; run < RUNS; run++)
+      boot(m);
+    t = clock() - t;
+    sums[m] = sum;
+    printf("%-8s %12u %12u %12u %10.0f\n", modes[m], calls / RUNS,
+        get_flash_ops_log_reads() / RUNS, get_flash_ops_log_read_bytes() / RUNS,
+        (double)t * 1e6 / CLOCKS_PER_SEC / RUNS);
+  }
+
+  // the parser must see the same bytes either way
+  if (sums[0] != sums[1]) {
+    printf("FAIL: getc and fs_buf hand the parser different data\n");
+    return 1;
+  }
+  return 0;
+}
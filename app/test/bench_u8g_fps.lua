@@ -0,0 +1,43 @@
+-- bench_u8g_fps.lua
+--
+-- Frame rate of a mostly static screen on an SSD1306 at 400 kHz I2C, with
+-- the picture loop and with the framebuffer. Counted are the bytes that
+-- go over the bus per frame, at 9 bit times a byte, and the host CPU time
+-- per frame, which only compares the two.
+
+local N = 2000
+
+local d = u8g.ssd1306_128x64_i2c(0x3c)
+d:begin()
+
+local calls = 0
+local function scene(d, f)
+  calls = calls + 1
+  d:drawFrame(0, 0, 128, 64)
+  for i = 0, 5 do d:drawHLine(4, 6 + i * 6, 60) end
+  d:drawCircle(100, 20, 10)
+  d:drawBox(4, 50, (f * 3) % 120, 6)            -- only this moves
+end
+
+local function run(name, frame)
+  calls = 0
+  bus()
+  local t = clock()
+  for f = 1, N do frame(f) end
+  t = (clock() - t) / N
+  local bytes = bus()
+  print(string.format("%-13s %5.1f %7d %8.1f %7.1f", name, calls / N, bytes / N,
+    t * 1e6, 400000 / (bytes / N * 9)))
+end
+
+print(string.format("%-13s %5s %7s %8s %7s", "", "draws", "bytes", "cpu us", "fps"))
+run("picture loop", function(f)
+  d:firstPage()
+  repeat scene(d, f) until not d:nextPage()
+end)
+d:setFramebuffer(true)
+run("framebuffer", function(f)
+  d:clearBuffer()
+  scene(d, f)
+  d:updateDisplay()
+end)
@@ -0,0 +1,62 @@
+-- bench_ucg_spi.lua
+--
+-- What each kind of drawing puts on the SPI bus of an ILI9341, drawn
+-- straight and in a batch: bytes, transactions with block writes, and
+-- the transactions the same bytes took when every byte was sent on its
+-- own. Host CPU time only compares the two ways.
+
+local disp = ucg.ili9341_18x240x320_hw_spi(8, 2, 0)
+disp:begin(0)
+
+local function pixels(c)
+  disp:setColor(c, 0, 0)
+  for y = 10, 49 do for x = 20, 59 do disp:drawPixel(x, y) end end
+end
+
+local function hlines(c)
+  disp:setColor(0, 0, c)
+  for y = 0, 59 do disp:drawHLine(30, y, 50) end
+end
+
+local function vlines(c)
+  disp:setColor(0, c, c)
+  for x = 100, 139 do disp:drawVLine(x, 20, 70) end
+end
+
+local function box(c)
+  disp:setColor(c, c, 0)
+  disp:drawBox(10, 200, 100, 100)
+end
+
+local function scene(c)
+  for y = 0, 99 do
+    disp:setColor(y % 3 * 100, 50, c)
+    for x = 0, 59 do disp:drawPixel(x, y) end
+    disp:drawHLine(60, y, 40)
+  end
+  disp:drawLine(0, 0, 200, 150)
+  for x = 0, 30 do disp:drawVLine(120 + x, 20, 80) end
+end
+
+local function run(name, fn, batch)
+  local n = 20
+  bus()
+  local t = clock()
+  for i = 1, n do
+    if batch then disp:beginBatch() end
+    fn(i)
+    if batch then disp:endBatch() end
+  end
+  t = (clock() - t) / n
+  local bytes, trans = bus()
+  print(string.format("%-16s %-6s %8d %8d %8d %8.2f", name, batch and "batch" or "",
+    bytes / n, trans / n, bytes / n, t * 1000))
+end
+
+print(string.format("%-16s %-6s %8s %8s %8s %8s", "", "", "bytes", "trans", "per byte", "cpu ms"))
+run("clearScreen", function() disp:clearScreen() end)
+for _, p in ipairs({ { "drawPixel 40x40", pixels }, { "drawHLine 60", hlines },
+    { "drawVLine 40", vlines }, { "drawBox", box }, { "scene", scene } }) do
+  run(p[1], p[2], false)
+  run(p[1], p[2], true)
+end
@@ -0,0 +1,52 @@
+/*
+ * host_egc.c
+ *
+ * The EGC of legc.c for benchmarks in host_lua.c. The host plays the Lua
+ * task: idle() is one slot between two callbacks, in which the task runs
+ * the EGC step that an allocation posted, if any. Globals for the script:
+ *
+ *   egc_setmode(mode, [limit], [step])   node.egc.setmode()
+ *   egc_stats([reset])                   node.egc.stats()
+ *   idle()                               run a posted EGC step
+ */
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "legc.h"
+
+static int l_egc_setmode(lua_State *L)
+{
+  legc_set_mode(L, luaL_checkinteger(L, 1), luaL_optinteger(L, 2, 0), luaL_optinteger(L, 3, 0));
+  return 0;
+}
+
+static int l_egc_stats(lua_State *L)
+{
+  legc_stats_t stats;
+  int i;
+
+  legc_get_stats(&stats, lua_toboolean(L, 1));
+  lua_pushinteger(L, stats.count);
+  lua_pushinteger(L, stats.max_us);
+  lua_pushinteger(L, stats.count ? stats.total_us / stats.count : 0);
+  lua_pushinteger(L, stats.full);
+  lua_createtable(L, LEGC_HIST_BUCKETS, 0);
+  for (i = 0; i < LEGC_HIST_BUCKETS; i++) {
+    lua_pushinteger(L, stats.hist[i]);
+    lua_rawseti(L, -2, i + 1);
+  }
+  return 5;
+}
+
+static int l_idle(lua_State *L)
+{
+  legc_task_step(L);
+  return 0;
+}
+
+void host_lua_open(lua_State *L)
+{
+  lua_register(L, "egc_setmode", l_egc_setmode);
+  lua_register(L, "egc_stats", l_egc_stats);
+  lua_register(L, "idle", l_idle);
+}
@@ -0,0 +1,209 @@
+/*
+ * host_lua.c
+ *
+ * A host Lua for tests and benchmarks of Lua modules. It is the firmware's
+ * Lua core built as for luac.cross, with the modules linked in through
+ * module.h and host_lua.ld like on the chip. It runs the script named on
+ * the command line, or <program>.lua, and gives it a few globals:
+ *
+ *   print(...)      as on the chip, the cross build's puts() would add a
+ *                   newline to every value
+ *   heap()          bytes allocated now and the peak since peak_reset()
+ *   peak_reset()
+ *   clock()         processor time in seconds
+ *   readfile(name)  the whole file as a string
+ *   writefile(name, s)
+ *   fopen(name), fread(h, n)  read a file n bytes at a time, nil at the end
+ *
+ * A test that plays hardware for its module defines host_lua_open() to
+ * add its own globals.
+ */
+
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+
+// every allocation of the program is counted, whether it comes from Lua
+// or from a module's own buffers
+extern void *__libc_malloc(size_t n);
+extern void *__libc_realloc(void *p, size_t n);
+extern void __libc_free(void *p);
+
+static long heap_cur, heap_peak;
+
+static void heap_add(void *p)
+{
+  heap_cur += malloc_usable_size(p);
+  if (heap_cur > heap_peak)
+    heap_peak = heap_cur;
+}
+
+void *malloc(size_t n)
+{
+  void *p = __libc_malloc(n);
+  if (p)
+    heap_add(p);
+  return p;
+}
+
+void free(void *p)
+{
+  if (p)
+    heap_cur -= malloc_usable_size(p);
+  __libc_free(p);
+}
+
+void *realloc(void *old, size_t n)
+{
+  long was = old ? malloc_usable_size(old) : 0;
+  void *p = __libc_realloc(old, n);
+  if (p || n == 0) {
+    heap_cur -= was;
+    if (p)
+      heap_add(p);
+  }
+  return p;
+}
+
+void *calloc(size_t n, size_t size)
+{
+  void *p = malloc(n * size);
+  if (p)
+    memset(p, 0, n * size);
+  return p;
+}
+
+static int l_print(lua_State *L)
+{
+  int n = lua_gettop(L);
+  int i;
+
+  lua_getglobal(L, "tostring");
+  for (i = 1; i <= n; i++) {
+    lua_pushvalue(L, -1);
+    lua_pushvalue(L, i);
+    lua_call(L, 1, 1);
+    if (i > 1)
+      fputs("\t", stdout);
+    fputs(luaL_checkstring(L, -1), stdout);
+    lua_pop(L, 1);
+  }
+  fputs("\n", stdout);
+  return 0;
+}
+
+static int l_heap(lua_State *L)
+{
+  lua_pushnumber(L, heap_cur);
+  lua_pushnumber(L, heap_peak);
+  return 2;
+}
+
+static int l_peak_reset(lua_State *L)
+{
+  heap_peak = heap_cur;
+  return 0;
+}
+
+static int l_clock(lua_State *L)
+{
+  lua_pushnumber(L, (double)clock() / CLOCKS_PER_SEC);
+  return 1;
+}
+
+static FILE *open_file(lua_State *L, const char *mode)
+{
+  const char *name = luaL_checkstring(L, 1);
+  FILE *f = fopen(name, mode);
+  if (!f)
+    luaL_error(L, "cannot open %s", name);
+  return f;
+}
+
+static int l_readfile(lua_State *L)
+{
+  FILE *f = open_file(L, "rb");
+  luaL_Buffer b;
+  size_t n;
+
+  luaL_buffinit(L, &b);
+  do {
+    n = fread(luaL_prepbuffer(&b), 1, LUAL_BUFFERSIZE, f);
+    luaL_addsize(&b, n);
+  } while (n == LUAL_BUFFERSIZE);
+  fclose(f);
+  luaL_pushresult(&b);
+  return 1;
+}
+
+static int l_writefile(lua_State *L)
+{
+  size_t n;
+  const char *s = luaL_checklstring(L, 2, &n);
+  FILE *f = open_file(L, "wb");
+  fwrite(s, 1, n, f);
+  fclose(f);
+  return 0;
+}
+
+static int l_fopen(lua_State *L)
+{
+  lua_pushlightuserdata(L, open_file(L, "rb"));
+  return 1;
+}
+
+static int l_fread(lua_State *L)
+{
+  FILE *f = (FILE *)lua_touserdata(L, 1);
+  char buf[4096];
+  int n = luaL_checkint(L, 2);
+  size_t got;
+
+  luaL_argcheck(L, f && n > 0 && n <= (int)sizeof(buf), 2, "bad read");
+  got = fread(buf, 1, n, f);
+  if (got == 0) {
+    fclose(f);
+    return 0;
+  }
+  lua_pushlstring(L, buf, got);
+  return 1;
+}
+
+void __attribute__((weak)) host_lua_open(lua_State *L)
+{
+}
+
+int main(int argc, char **argv)
+{
+  char script[256];
+  lua_State *L = lua_open();   // as lua.c does, for lua_getstate()
+
+  if (argc > 1)
+    snprintf(script, sizeof(script), "%s", argv[1]);
+  else
+    snprintf(script, sizeof(script), "%s.lua", argv[0]);
+
+  luaL_openlibs(L);
+  lua_register(L, "print", l_print);
+  lua_register(L, "heap", l_heap);
+  lua_register(L, "peak_reset", l_peak_reset);
+  lua_register(L, "clock", l_clock);
+  lua_register(L, "readfile", l_readfile);
+  lua_register(L, "writefile", l_writefile);
+  lua_register(L, "fopen", l_fopen);
+  lua_register(L, "fread", l_fread);
+  host_lua_open(L);
+
+  if (luaL_loadfile(L, script) || lua_pcall(L, 0, 0, 0)) {
+    printf("%s\n", lua_tostring(L, -1));
+    lua_close(L);
+    return 1;
+  }
+  lua_close(L);
+  return 0;
+}
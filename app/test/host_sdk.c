@@ -0,0 +1,119 @@
+/*
+ * host_sdk.c
+ *
+ * The SDK and ROM functions host_sdk.h tests need, played on the host.
+ */
+
+#include "host_sdk.h"
+
+#define HOST_REGS 4096
+
+host_reg_fn host_reg_hook;
+static uint32_t regs[HOST_REGS];
+
+volatile uint32_t host_posts[8];
+bool host_post_fail;
+uint32_t host_allocs;
+volatile uint32_t host_ccount;
+volatile uint32_t host_gpio_in;
+volatile int host_gpio_armed[17];
+
+static uint32_t irq_mask;
+
+uint32_t host_reg_read(uint32_t addr)
+{
+  uint32_t val = regs[(addr >> 2) % HOST_REGS];
+  if (host_reg_hook)
+    host_reg_hook(addr, &val, false);
+  return val;
+}
+
+void host_reg_write(uint32_t addr, uint32_t val)
+{
+  if (host_reg_hook && host_reg_hook(addr, &val, true))
+    return;
+  regs[(addr >> 2) % HOST_REGS] = val;
+}
+
+bool host_irq_masked(void)
+{
+  return irq_mask != 0;
+}
+
+// a pending interrupt is taken once it is unmasked, as on the chip
+void ets_isr_mask(uint32_t mask)
+{
+  irq_mask |= mask;
+  host_irq_block(true);
+}
+
+void ets_isr_unmask(uint32_t mask)
+{
+  irq_mask &= ~mask;
+  if (irq_mask == 0)
+    host_irq_block(false);
+}
+
+void ets_isr_attach(int inum, void *fn, void *arg)
+{
+  (void)inum; (void)fn; (void)arg;
+}
+
+bool system_os_post(uint8_t prio, uint32_t sig, uint32_t par)
+{
+  (void)prio; (void)par;
+  if (host_post_fail)
+    return false;
+  host_posts[sig & 7]++;
+  return true;
+}
+
+void *pvPortMalloc(size_t size, const char *file, int line)
+{
+  (void)file; (void)line;
+  host_allocs++;
+  return __builtin_malloc(size);
+}
+
+void *pvPortZalloc(size_t size, const char *file, int line)
+{
+  (void)file; (void)line;
+  host_allocs++;
+  return __builtin_calloc(1, size);
+}
+
+void vPortFree(void *p, const char *file, int line)
+{
+  (void)file; (void)line;
+  __builtin_free(p);
+}
+
+// the ROM's memory functions, for the sources built apart from host_sdk.h
+void *ets_memcpy(void *dst, const void *src, size_t n)
+{
+  return __builtin_memcpy(dst, src, n);
+}
+
+size_t ets_strlen(const char *s)
+{
+  return __builtin_strlen(s);
+}
+
+void system_soft_wdt_feed(void)
+{
+}
+
+uint32_t xthal_get_ccount(void)
+{
+  return host_ccount;
+}
+
+uint32_t gpio_input_get(void)
+{
+  return host_gpio_in;
+}
+
+void gpio_pin_intr_state_set(uint32_t gpio, int state)
+{
+  host_gpio_armed[gpio % 17] = state;
+}
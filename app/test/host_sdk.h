@@ -0,0 +1,65 @@
+/*
+ * host_sdk.h
+ *
+ * Lets a firmware source that talks to the SDK and to peripheral registers
+ * be built into a host test. The test includes the SDK headers, then this
+ * file, then the source under test itself; the register macros are
+ * redirected to host_reg_read()/host_reg_write() and the interrupt the
+ * source would get is played by SIGALRM, which ets_isr_mask() blocks.
+ */
+
+#ifndef _HOST_SDK_H_
+#define _HOST_SDK_H_
+
+#include "c_types.h"
+
+#undef READ_PERI_REG
+#undef WRITE_PERI_REG
+#define READ_PERI_REG(addr) host_reg_read((uint32_t)(addr))
+#define WRITE_PERI_REG(addr, val) host_reg_write((uint32_t)(addr), (uint32_t)(val))
+
+// no sections of their own, so that unused functions drop out at link time
+#undef ICACHE_RAM_ATTR
+#define ICACHE_RAM_ATTR
+#undef ICACHE_FLASH_ATTR
+#define ICACHE_FLASH_ATTR
+
+// the ROM's memory functions
+#undef os_memcpy
+#undef os_memmove
+#undef os_memset
+#define os_memcpy __builtin_memcpy
+#define os_memmove __builtin_memmove
+#define os_memset __builtin_memset
+
+// the SDK heap behind os_malloc()/os_free(), which the SDK headers leave
+// undeclared; an implicit int would cut the pointer on the host
+void *pvPortMalloc(size_t size, const char *file, int line);
+void *pvPortZalloc(size_t size, const char *file, int line);
+void vPortFree(void *p, const char *file, int line);
+extern uint32_t host_allocs;   // calls of the two above
+
+// peripheral registers: the test decides what a read returns and what a
+// write does, anything it does not handle reads back what was written
+typedef bool (*host_reg_fn)(uint32_t addr, uint32_t *val, bool write);
+extern host_reg_fn host_reg_hook;
+uint32_t host_reg_read(uint32_t addr);
+void host_reg_write(uint32_t addr, uint32_t val);
+
+// the interrupt: raised by SIGALRM from a periodic timer
+void host_irq_start(void (*isr)(void), unsigned interval_us);
+void host_irq_stop(void);
+void host_irq_block(int block);
+bool host_irq_masked(void);
+
+// task posts, counted per signal; posting fails if host_post_fail is set
+extern volatile uint32_t host_posts[8];
+extern bool host_post_fail;
+
+extern volatile uint32_t host_ccount;   // what xthal_get_ccount() returns
+extern volatile uint32_t host_gpio_in;  // what gpio_input_get() returns
+extern volatile int host_gpio_armed[17];  // last gpio_pin_intr_state_set() per gpio
+
+uint32_t xthal_get_ccount(void);
+
+#endif
@@ -0,0 +1,46 @@
+/*
+ * host_signal.c
+ *
+ * The interrupt of host_sdk.h, played by SIGALRM. Kept apart from
+ * host_sdk.c, since the system headers clash with the SDK's c_types.h.
+ */
+
+#include <signal.h>
+#include <string.h>
+#include <sys/time.h>
+
+static void (*irq_isr)(void);
+
+static void irq_signal(int sig)
+{
+  (void)sig;
+  if (irq_isr)
+    irq_isr();
+}
+
+void host_irq_start(void (*isr)(void), unsigned interval_us)
+{
+  struct itimerval it;
+  irq_isr = isr;
+  signal(SIGALRM, irq_signal);
+  memset(&it, 0, sizeof(it));
+  it.it_interval.tv_usec = interval_us;
+  it.it_value.tv_usec = interval_us;
+  setitimer(ITIMER_REAL, &it, NULL);
+}
+
+void host_irq_stop(void)
+{
+  struct itimerval it;
+  memset(&it, 0, sizeof(it));
+  setitimer(ITIMER_REAL, &it, NULL);
+  irq_isr = NULL;
+}
+
+void host_irq_block(int block)
+{
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGALRM);
+  sigprocmask(block ? SIG_BLOCK : SIG_UNBLOCK, &set, NULL);
+}
@@ -0,0 +1,9 @@
+/*
+ * Host stand-in for app/libc/c_limits.h.
+ */
+#ifndef _TEST_C_LIMITS_H_
+#define _TEST_C_LIMITS_H_
+
+#include <limits.h>
+
+#endif
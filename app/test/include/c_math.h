@@ -0,0 +1,9 @@
+/*
+ * Host stand-in for app/libc/c_math.h.
+ */
+#ifndef _TEST_C_MATH_H_
+#define _TEST_C_MATH_H_
+
+#include <math.h>
+
+#endif
@@ -0,0 +1,9 @@
+/*
+ * Host stand-in for app/libc/c_stdarg.h.
+ */
+#ifndef _TEST_C_STDARG_H_
+#define _TEST_C_STDARG_H_
+
+#include <stdarg.h>
+
+#endif
@@ -0,0 +1,14 @@
+/*
+ * Host stand-in for app/libc/c_stdio.h.
+ */
+#ifndef _TEST_C_STDIO_H_
+#define _TEST_C_STDIO_H_
+
+#include <stdio.h>
+
+#define c_printf printf
+#define c_sprintf sprintf
+#define NODE_DBG(...)
+#define NODE_ERR(...)
+
+#endif
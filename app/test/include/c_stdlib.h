@@ -0,0 +1,14 @@
+/*
+ * Host stand-in for app/libc/c_stdlib.h.
+ */
+#ifndef _TEST_C_STDLIB_H_
+#define _TEST_C_STDLIB_H_
+
+#include <stdlib.h>
+
+#define c_malloc malloc
+#define c_zalloc(n) calloc(1, (n))
+#define c_realloc realloc
+#define c_free free
+
+#endif
@@ -0,0 +1,20 @@
+/*
+ * Host stand-in for app/libc/c_string.h.
+ */
+#ifndef _TEST_C_STRING_H_
+#define _TEST_C_STRING_H_
+
+#include <string.h>
+
+#define c_memset memset
+#define c_memcpy memcpy
+#define c_memmove memmove
+#define c_memcmp memcmp
+#define c_strlen strlen
+#define c_strcmp strcmp
+#define c_strncmp strncmp
+#define c_strncasecmp c_strncmp
+#define c_strcpy strcpy
+#define c_strncpy strncpy
+
+#endif
@@ -0,0 +1,18 @@
+/*
+ * Host stand-in for app/include/c_types.h, for the tests in app/test.
+ */
+#ifndef _TEST_C_TYPES_H_
+#define _TEST_C_TYPES_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef int32_t sint32_t;
+typedef int16_t sint16_t;
+typedef int8_t sint8_t;
+
+#define ICACHE_FLASH_ATTR
+#define ICACHE_RODATA_ATTR
+
+#endif
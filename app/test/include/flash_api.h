@@ -0,0 +1,12 @@
+/*
+ * Host stand-in for app/platform/flash_api.h: constant arrays are plain
+ * memory on the host, no word access needed.
+ */
+#ifndef _TEST_FLASH_API_H_
+#define _TEST_FLASH_API_H_
+
+#include "c_types.h"
+
+#define byte_of_aligned_array(a, i) (((const uint8_t *)(a))[i])
+
+#endif
@@ -0,0 +1,14 @@
+/*
+ * Host stand-in for the SDK's mem.h.
+ */
+#ifndef _TEST_MEM_H_
+#define _TEST_MEM_H_
+
+#include <stdlib.h>
+
+#define os_malloc malloc
+#define os_zalloc(n) calloc(1, (n))
+#define os_realloc realloc
+#define os_free free
+
+#endif
@@ -0,0 +1,13 @@
+/*
+ * Host stand-in for the SDK's osapi.h.
+ */
+#ifndef _TEST_OSAPI_H_
+#define _TEST_OSAPI_H_
+
+#include <string.h>
+
+#define os_memset memset
+#define os_memcpy memcpy
+#define os_memmove memmove
+
+#endif
@@ -0,0 +1,38 @@
+/*
+ * Host stand-in for app/platform/platform.h: the SDK timer type, and the
+ * bus and pin functions modules use, which a host test implements as its
+ * mock.
+ */
+#ifndef _TEST_PLATFORM_H_
+#define _TEST_PLATFORM_H_
+
+#include "c_types.h"
+#include "os_type.h"
+
+#define NUM_TMR 7
+
+#define PLATFORM_GPIO_FLOAT 0
+#define PLATFORM_GPIO_OUTPUT 1
+#define PLATFORM_GPIO_HIGH 1
+#define PLATFORM_GPIO_LOW 0
+
+int platform_gpio_mode( unsigned pin, unsigned mode, unsigned pull );
+int platform_gpio_write( unsigned pin, unsigned level );
+
+typedef uint32_t spi_data_type;
+
+int platform_spi_send( uint8_t id, uint8_t bitlen, spi_data_type data );
+int platform_spi_blkwrite( uint8_t id, const uint8_t *data, uint32_t len );
+
+enum
+{
+  PLATFORM_I2C_DIRECTION_TRANSMITTER,
+  PLATFORM_I2C_DIRECTION_RECEIVER
+};
+
+void platform_i2c_send_start( unsigned id );
+void platform_i2c_send_stop( unsigned id );
+int platform_i2c_send_address( unsigned id, uint16_t address, int direction );
+int platform_i2c_send_byte( unsigned id, uint8_t data );
+
+#endif
@@ -0,0 +1,12 @@
+/*
+ * Host stand-in for the SDK's user_interface.h.
+ */
+#ifndef _TEST_USER_INTERFACE_H_
+#define _TEST_USER_INTERFACE_H_
+
+#include "c_types.h"
+#include "mem.h"
+
+uint32_t system_get_free_heap_size(void);
+
+#endif
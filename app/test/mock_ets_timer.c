@@ -0,0 +1,156 @@
+/*
+ * mock_ets_timer.c
+ *
+ * The SDK timers and system clock for the tmr tests in host_lua.c, on a
+ * virtual clock: system_get_time() is a 32 bit microsecond count that
+ * only moves when the script runs time forward, and every armed timer
+ * fires at its time in order, late by the set jitter. Globals for the
+ * script:
+ *
+ *   run(ms)         let ms of virtual time pass
+ *   vnow()          system_get_time()
+ *   settime(us)     set system_get_time(), to have it wrap soon
+ *   jitter(us)      how late every timer fires from now on
+ */
+
+#include <stdint.h>
+#include "c_types.h"
+#include "platform.h"
+#include "lua.h"
+#include "lauxlib.h"
+
+#define MAX_TIMERS  8
+
+static uint32_t vt, jitter;
+static os_timer_t *timers[MAX_TIMERS];
+static bool armed[MAX_TIMERS];
+static int ntimers;
+
+static int timer_index(os_timer_t *t)
+{
+  int i;
+
+  for (i = 0; i < ntimers; i++)
+    if (timers[i] == t)
+      return i;
+  if (ntimers == MAX_TIMERS)
+    luaL_error(lua_getstate(), "too many SDK timers");
+  timers[ntimers] = t;
+  armed[ntimers] = false;
+  return ntimers++;
+}
+
+void ets_timer_setfn(os_timer_t *t, os_timer_func_t *f, void *arg)
+{
+  armed[timer_index(t)] = false;
+  t->timer_func = f;
+  t->timer_arg = arg;
+}
+
+void ets_timer_disarm(os_timer_t *t)
+{
+  armed[timer_index(t)] = false;
+}
+
+void ets_timer_arm_new(os_timer_t *t, uint32_t time, uint32_t repeat, uint32_t is_ms)
+{
+  uint32_t us = is_ms ? time * 1000 : time;
+
+  armed[timer_index(t)] = true;
+  t->timer_expire = vt + us;
+  t->timer_period = repeat ? us : 0;
+}
+
+uint32_t system_get_time(void)
+{
+  return vt;
+}
+
+uint32_t system_get_rtc_time(void)
+{
+  return vt;
+}
+
+// one rtc tick per us, in 12 bit fixed point
+uint32_t system_rtc_clock_cali_proc(void)
+{
+  return 1 << 12;
+}
+
+void system_restart(void)
+{
+}
+
+void system_soft_wdt_feed(void)
+{
+}
+
+// tmr.delay(), the SDK's macro for ets_delay_us() is not in the stand-ins
+void os_delay_us(uint32_t us)
+{
+}
+
+uint32_t platform_tmr_exists(uint32_t id)
+{
+  return id < NUM_TMR;
+}
+
+static void run(uint32_t ms)
+{
+  uint32_t end = vt + ms * 1000;
+  int i, next;
+
+  for (;;) {
+    next = -1;
+    for (i = 0; i < ntimers; i++)
+      if (armed[i] && (next < 0 || (int32_t)(timers[i]->timer_expire - timers[next]->timer_expire) < 0))
+        next = i;
+    if (next < 0 || (int32_t)(timers[next]->timer_expire - end) > 0)
+      break;
+    vt = timers[next]->timer_expire + jitter;
+    if (timers[next]->timer_period)
+      timers[next]->timer_expire += timers[next]->timer_period;
+    else
+      armed[next] = false;
+    timers[next]->timer_func(timers[next]->timer_arg);
+  }
+  if ((int32_t)(end - vt) > 0)
+    vt = end;
+}
+
+static int l_run(lua_State *L)
+{
+  double ms = luaL_checknumber(L, 1);
+
+  // in steps the 32 bit microsecond count can take
+  for (; ms > 1000000; ms -= 1000000)
+    run(1000000);
+  run((uint32_t)ms);
+  return 0;
+}
+
+static int l_vnow(lua_State *L)
+{
+  lua_pushnumber(L, vt);
+  return 1;
+}
+
+static int l_settime(lua_State *L)
+{
+  vt = (uint32_t)luaL_checknumber(L, 1);
+  return 0;
+}
+
+static int l_jitter(lua_State *L)
+{
+  jitter = luaL_checkint(L, 1);
+  return 0;
+}
+
+void host_lua_open(lua_State *L)
+{
+  lua_register(L, "run", l_run);
+  lua_register(L, "vnow", l_vnow);
+  lua_register(L, "settime", l_settime);
+  lua_register(L, "jitter", l_jitter);
+}
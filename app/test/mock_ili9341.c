@@ -0,0 +1,136 @@
+/*
+ * mock_ili9341.c
+ *
+ * An ILI9341 on the SPI bus for the ucg tests in host_lua.c. It decodes
+ * what the controller would: with the D/C line low a byte is a command,
+ * with it high an argument, the column and page address set commands set
+ * the window and the memory write command fills it with 18 bit pixels,
+ * three bytes each. It also counts what went over the bus, a block write
+ * taking one transaction per 64 bytes as platform_spi_blkwrite() does.
+ * Globals for the script:
+ *
+ *   fb()            the display RAM as a string, row by row, 3 bytes a pixel
+ *   fbclear()
+ *   bus()           bytes, transactions and D/C line changes since the
+ *                   last call
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "lua.h"
+#include "lauxlib.h"
+
+#define WIDTH   240
+#define HEIGHT  320
+#define PIN_CD  2                 // the D/C pin the scripts open the display with
+
+static uint8_t fb[HEIGHT][WIDTH][3];
+static int cd, cmd, argn, x0, x1, y0, y1, px, py, ci;
+static uint8_t color[3];
+static long spi_bytes, spi_trans, cd_changes;
+
+// start and end of a window, high byte first
+static void window_arg(int *start, int *end, int n, uint8_t b)
+{
+  int *v = n < 2 ? start : end;
+
+  if (n < 4)
+    *v = n % 2 ? *v | b : b << 8;
+}
+
+static void spi_byte(uint8_t b)
+{
+  spi_bytes++;
+  if (!cd) {
+    cmd = b;
+    argn = 0;
+    if (b == 0x2c) {
+      px = x0;
+      py = y0;
+      ci = 0;
+    }
+    return;
+  }
+  switch (cmd) {
+  case 0x2a:                      // column address set
+    window_arg(&x0, &x1, argn++, b);
+    break;
+  case 0x2b:                      // page address set
+    window_arg(&y0, &y1, argn++, b);
+    break;
+  case 0x2c:                      // memory write
+    color[ci++] = b;
+    if (ci == 3) {
+      ci = 0;
+      if (px < WIDTH && py < HEIGHT)
+        memcpy(fb[py][px], color, 3);
+      if (++px > x1) {
+        px = x0;
+        py++;
+      }
+    }
+    break;
+  }
+}
+
+int platform_spi_send(uint8_t id, uint8_t bitlen, uint32_t data)
+{
+  spi_trans++;
+  spi_byte(data);
+  return 0;
+}
+
+int platform_spi_blkwrite(uint8_t id, const uint8_t *data, uint32_t len)
+{
+  spi_trans += (len + 63) / 64;
+  while (len--)
+    spi_byte(*data++);
+  return 0;
+}
+
+int platform_gpio_mode(unsigned pin, unsigned mode, unsigned pull)
+{
+  return 1;
+}
+
+int platform_gpio_write(unsigned pin, unsigned level)
+{
+  if (pin == PIN_CD) {
+    if (cd != (int)level)
+      cd_changes++;
+    cd = level;
+  }
+  return 1;
+}
+
+void os_delay_us(unsigned us)
+{
+}
+
+static int l_fb(lua_State *L)
+{
+  lua_pushlstring(L, (const char *)fb, sizeof(fb));
+  return 1;
+}
+
+static int l_fbclear(lua_State *L)
+{
+  memset(fb, 0, sizeof(fb));
+  return 0;
+}
+
+static int l_bus(lua_State *L)
+{
+  lua_pushnumber(L, spi_bytes);
+  lua_pushnumber(L, spi_trans);
+  lua_pushnumber(L, cd_changes);
+  spi_bytes = spi_trans = cd_changes = 0;
+  return 3;
+}
+
+void host_lua_open(lua_State *L)
+{
+  lua_register(L, "fb", l_fb);
+  lua_register(L, "fbclear", l_fbclear);
+  lua_register(L, "bus", l_bus);
+}
@@ -0,0 +1,106 @@
+/*
+ * mock_ssd1306.c
+ *
+ * An SSD1306 on the I2C bus for the u8g tests in host_lua.c. It keeps the
+ * display RAM as the controller would: the control byte after the start
+ * tells commands from data, the page and column address commands move the
+ * write position and data bytes land there. It also counts what went over
+ * the bus. Globals for the script:
+ *
+ *   ram()           the display RAM as a string, page by page
+ *   ramfill(byte)   fill the display RAM
+ *   bus()           bytes and start conditions since the last call
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "lua.h"
+#include "lauxlib.h"
+
+#define PAGES   8
+#define COLS    128
+
+static uint8_t ram[PAGES][COLS];
+static int control, data, page, col;
+static long bus_bytes, bus_starts;
+
+void platform_i2c_send_start(unsigned id)
+{
+  bus_starts++;
+  control = 1;
+}
+
+void platform_i2c_send_stop(unsigned id)
+{
+}
+
+int platform_i2c_send_address(unsigned id, uint16_t address, int direction)
+{
+  bus_bytes++;
+  return 1;
+}
+
+int platform_i2c_send_byte(unsigned id, uint8_t b)
+{
+  bus_bytes++;
+  if (control) {
+    control = 0;
+    data = b == 0x40;
+  } else if (data) {
+    ram[page][col] = b;
+    col = (col + 1) % COLS;
+  } else if (b < 0x10) {
+    col = (col & 0xf0) | b;
+  } else if (b < 0x20) {
+    col = (col & 0x0f) | ((b & 0x0f) << 4);
+  } else if ((b & 0xf8) == 0xb0) {
+    page = b & 7;
+  }
+  return 1;
+}
+
+// the display is on the bus, the other pins are not looked at
+int platform_gpio_mode(unsigned pin, unsigned mode, unsigned pull)
+{
+  return 1;
+}
+
+int platform_gpio_write(unsigned pin, unsigned level)
+{
+  return 1;
+}
+
+int platform_spi_send(uint8_t id, uint8_t bitlen, uint32_t data)
+{
+  return 0;
+}
+
+// the font data is generated outside the tree, the scripts draw no text
+const uint8_t u8g_font_6x10[1], u8g_font_chikita[1];
+
+static int l_ram(lua_State *L)
+{
+  lua_pushlstring(L, (const char *)ram, sizeof(ram));
+  return 1;
+}
+
+static int l_ramfill(lua_State *L)
+{
+  memset(ram, luaL_checkint(L, 1), sizeof(ram));
+  return 0;
+}
+
+static int l_bus(lua_State *L)
+{
+  lua_pushnumber(L, bus_bytes);
+  lua_pushnumber(L, bus_starts);
+  bus_bytes = bus_starts = 0;
+  return 2;
+}
+
+void host_lua_open(lua_State *L)
+{
+  lua_register(L, "ram", l_ram);
+  lua_register(L, "ramfill", l_ramfill);
+  lua_register(L, "bus", l_bus);
+}
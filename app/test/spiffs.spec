@@ -0,0 +1,3 @@
+# SPIFFS cannot create a file once another one has filled the fs, as
+# upstream; test_bugreports.c keeps the case
+-nodemcu_full_fs_2
@@ -0,0 +1,238 @@
+/*
+ * test_digests.c
+ *
+ * Checks app/crypto against the FIPS 180 and RFC 4231 vectors, both in
+ * one go and streamed the way the crypto module's hash and HMAC objects
+ * use it: the input split at every position, a million bytes in chunks of
+ * odd sizes, and HMAC pads computed once and used for several messages.
+ * MD5 and SHA1 are ROM code and are not built here.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The firmware is 32 bit and digests.c checks that size_t is int sized.
+// The system headers above already have the real size_t, the firmware
+// sources below see an int sized one; all calls go through prototypes.
+#define size_t unsigned int
+#include "../crypto/digests.c"
+#include "../crypto/sha2.c"
+#undef size_t
+
+static void rom_only(const char *fn)
+{
+  printf("%s is in ROM\n", fn);
+  exit(1);
+}
+
+void MD5Init(MD5_CTX *ctx) { rom_only("MD5Init"); }
+void MD5Update(MD5_CTX *ctx, const unsigned char *p, unsigned int n) { rom_only("MD5Update"); }
+void MD5Final(unsigned char d[MD5_DIGEST_LENGTH], MD5_CTX *ctx) { rom_only("MD5Final"); }
+void SHA1Init(SHA1_CTX *ctx) { rom_only("SHA1Init"); }
+void SHA1Update(SHA1_CTX *ctx, const uint8_t *p, unsigned int n) { rom_only("SHA1Update"); }
+void SHA1Final(uint8_t d[SHA1_DIGEST_LENGTH], SHA1_CTX *ctx) { rom_only("SHA1Final"); }
+
+static const char *msgs[] = {
+  "abc",
+  "",
+  "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+  "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmn"
+  "hijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu",
+};
+
+static const struct { int msg; const char *mech, *digest; } hashes[] = {
+  { 0, "SHA256", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+  { 0, "SHA384", "cb00753f45a35e8bb5a03d699ac65007272c32ab0eded1631a8b605a43ff5bed"
+                 "8086072ba1e7cc2358baeca134c825a7" },
+  { 0, "SHA512", "ddaf35a193617abacc417349ae20413112e6fa4e89a97ea20a9eeee64b55d39a"
+                 "2192992a274fc1a836ba3c23a3feebbd454d4423643ce80e2a9ac94fa54ca49f" },
+  { 1, "SHA256", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+  { 1, "SHA384", "38b060a751ac96384cd9327eb1b1e36a21fdb71114be07434c0cc7bf63f6e1da"
+                 "274edebfe76f65fbd51ad2f14898b95b" },
+  { 1, "SHA512", "cf83e1357eefb8bdf1542850d66d8007d620e4050b5715dc83f4a921d36ce9ce"
+                 "47d0d13c5d85f2b0ff8318d2877eec2f63b931bd47417a81a538327af927da3e" },
+  { 2, "SHA256", "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" },
+  { 2, "SHA384", "3391fdddfc8dc7393707a65b1b4709397cf8b1d162af05abfe8f450de5f36bc6"
+                 "b0455a8520bc4e6f5fe95b1fe3c8452b" },
+  { 2, "SHA512", "204a8fc6dda82f0a0ced7beb8e08a41657c16ef468b228a8279be331a703c335"
+                 "96fd15c13b1b07f9aa1d3bea57789ca031ad85c7a71dd70354ec631238ca3445" },
+  { 3, "SHA256", "cf5b16a778af8380036ce59e7b0492370b249b11e8f07a51afac45037afee9d1" },
+  { 3, "SHA384", "09330c33f71147e83d192fc782cd1b4753111b173b3b05d22fa08086e3b0f712"
+                 "fcc7c71a557e2db966c3e9fa91746039" },
+  { 3, "SHA512", "8e959b75dae313da8cf4f72814fc143f8f7779c6eb9f7fa17299aeadb6889018"
+                 "501d289e4900f7e4331b99dec4b5433ac7d329eeb6dd26545e96e55b874be909" },
+};
+
+static const struct { const char *mech, *digest; } millions[] = {
+  { "SHA256", "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0" },
+  { "SHA384", "9d0e1809716474cb086e834e310a4a1ced149e9c00f248527972cec5704c2a5b"
+              "07b8b3dc38ecc4ebae97ddd87f3d8985" },
+  { "SHA512", "e718483d0ce769644e2e42c7bc15b4638e1f98b13b2044285632a803afa973eb"
+              "de0ff244877ea60a4cb0432ce577c31beb009c5c2c49aa2e4eadb217ad8cc09b" },
+};
+
+// RFC 4231 test cases 1, 2, 3, 6 and 7
+static const struct { char key_byte; int key_len; const char *key; char msg_byte; int msg_len; const char *msg; } hmac_inputs[] = {
+  { 0x0b, 20, NULL, 0, 0, "Hi There" },
+  { 0, 0, "Jefe", 0, 0, "what do ya want for nothing?" },
+  { 0xaa, 20, NULL, 0xdd, 50, NULL },
+  { 0xaa, 131, NULL, 0, 0, "Test Using Larger Than Block-Size Key - Hash Key First" },
+  { 0xaa, 131, NULL, 0, 0, "This is a test using a larger than block-size key and a larger "
+    "than block-size data. The key needs to be hashed before being used by the HMAC algorithm." },
+};
+
+static const struct { int input; const char *mech, *digest; } hmacs[] = {
+  { 0, "SHA256", "b0344c61d8db38535ca8afceaf0bf12b881dc200c9833da726e9376c2e32cff7" },
+  { 0, "SHA384", "afd03944d84895626b0825f4ab46907f15f9dadbe4101ec682aa034c7cebc59c"
+                 "faea9ea9076ede7f4af152e8b2fa9cb6" },
+  { 0, "SHA512", "87aa7cdea5ef619d4ff0b4241a1d6cb02379f4e2ce4ec2787ad0b30545e17cde"
+                 "daa833b7d6b8a702038b274eaea3f4e4be9d914eeb61f1702e696c203a126854" },
+  { 1, "SHA256", "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843" },
+  { 1, "SHA384", "af45d2e376484031617f78d2b58a6b1b9c7ef464f5a01b47e42ec3736322445e"
+                 "8e2240ca5e69e2c78b3239ecfab21649" },
+  { 1, "SHA512", "164b7a7bfcf819e2e395fbe73b56e0a387bd64222e831fd610270cd7ea250554"
+                 "9758bf75c05a994a6d034f65f8f0e6fdcaeab1a34d4a6b4b636e070a38bce737" },
+  { 2, "SHA256", "773ea91e36800e46854db8ebd09181a72959098b3ef8c122d9635514ced565fe" },
+  { 2, "SHA384", "88062608d3e6ad8a0aa2ace014c8a86f0aa635d947ac9febe83ef4e55966144b"
+                 "2a5ab39dc13814b94e3ab6e101a34f27" },
+  { 2, "SHA512", "fa73b0089d56a284efb0f0756c890be9b1b5dbdd8ee81a3655f83e33b2279d39"
+                 "bf3e848279a722c806b485a47e67c807b946a337bee8942674278859e13292fb" },
+  { 3, "SHA256", "60e431591ee0b67f0d8a26aacbf5b77f8e0bc6213728c5140546040f0ee37f54" },
+  { 3, "SHA384", "4ece084485813e9088d2c63a041bc5b44f9ef1012a2b588f3cd11f05033ac4c6"
+                 "0c2ef6ab4030fe8296248df163f44952" },
+  { 3, "SHA512", "80b24263c7c1a3ebb71493c1dd7be8b49b46d1f41b4aeec1121b013783f8f352"
+                 "6b56d037e05f2598bd0fd2215d6a1e5295e64f73f63f0aec8b915a985d786598" },
+  { 4, "SHA256", "9b09ffa71b942fcb27635fbcd5b0e944bfdc63644f0713938a7f51535c3a35e2" },
+  { 4, "SHA384", "6617178e941f020d351e2f254e8fd32c602420feb0b8fb9adccebb82461e99c5"
+                 "a678cc31e799176d3860e6110c46523e" },
+  { 4, "SHA512", "e37b6a775dc87dbaa4dfa9f96e5e3ffddebd71f8867289865df5a32d20cdc944"
+                 "b6022cac3c4982b10d5eeb55c3e4de15134676fb6de0446065c97440fa8c6a58" },
+};
+
+#define COUNT(a) (sizeof(a) / sizeof((a)[0]))
+
+static int failed;
+
+static void check(const char *what, const char *mech, const uint8_t *digest, const char *want)
+{
+  char hex[2 * 64 + 1];
+  unsigned i, n = strlen(want) / 2;
+
+  for (i = 0; i < n; i++)
+    sprintf(hex + 2 * i, "%02x", digest[i]);
+  if (strcmp(hex, want)) {
+    printf("%s %s: %s\n", what, mech, hex);
+    failed = 1;
+  }
+}
+
+static const digest_mech_info_t *mech(const char *name)
+{
+  const digest_mech_info_t *mi = crypto_digest_mech(name);
+  if (!mi) {
+    printf("no %s\n", name);
+    exit(1);
+  }
+  return mi;
+}
+
+static void test_hashes(void)
+{
+  unsigned i, j, k, len;
+  uint8_t digest[64];
+  uint64_t ctx[64];   // room for any context
+
+  for (i = 0; i < COUNT(hashes); i++) {
+    const digest_mech_info_t *mi = mech(hashes[i].mech);
+    const char *msg = msgs[hashes[i].msg];
+
+    len = strlen(msg);
+    crypto_hash(mi, msg, len, digest);
+    check("hash", hashes[i].mech, digest, hashes[i].digest);
+    for (j = 0; j <= len; j++) {
+      for (k = j; k <= len; k += 7) {
+        mi->create(ctx);
+        mi->update(ctx, (const uint8_t *)msg, j);
+        mi->update(ctx, (const uint8_t *)msg + j, k - j);
+        mi->update(ctx, (const uint8_t *)msg + k, len - k);
+        mi->finalize(digest, ctx);
+        check("split hash", hashes[i].mech, digest, hashes[i].digest);
+      }
+    }
+  }
+}
+
+static void test_millions(void)
+{
+  static uint8_t a[1000000];
+  unsigned i, off, n;
+  uint8_t digest[64];
+  uint64_t ctx[64];   // room for any context
+
+  memset(a, 'a', sizeof(a));
+  for (i = 0; i < COUNT(millions); i++) {
+    const digest_mech_info_t *mi = mech(millions[i].mech);
+    mi->create(ctx);
+    for (off = 0, n = 1; off < sizeof(a); off += n, n = n * 3 % 257 + 1) {
+      if (n > sizeof(a) - off)
+        n = sizeof(a) - off;
+      mi->update(ctx, a + off, n);
+    }
+    mi->finalize(digest, ctx);
+    check("million", millions[i].mech, digest, millions[i].digest);
+  }
+}
+
+static void test_hmacs(void)
+{
+  unsigned i, j, round;
+  char key[256], msg[256];
+  uint8_t digest[64], k_ipad[128], k_opad[128];
+  uint64_t ctx[64];   // room for any context
+
+  for (i = 0; i < COUNT(hmacs); i++) {
+    const digest_mech_info_t *mi = mech(hmacs[i].mech);
+    unsigned key_len, msg_len, in = hmacs[i].input;
+
+    if (hmac_inputs[in].key) {
+      key_len = strlen(hmac_inputs[in].key);
+      memcpy(key, hmac_inputs[in].key, key_len);
+    } else {
+      key_len = hmac_inputs[in].key_len;
+      memset(key, hmac_inputs[in].key_byte, key_len);
+    }
+    if (hmac_inputs[in].msg) {
+      msg_len = strlen(hmac_inputs[in].msg);
+      memcpy(msg, hmac_inputs[in].msg, msg_len);
+    } else {
+      msg_len = hmac_inputs[in].msg_len;
+      memset(msg, hmac_inputs[in].msg_byte, msg_len);
+    }
+
+    crypto_hmac(mi, msg, msg_len, key, key_len, digest);
+    check("hmac", hmacs[i].mech, digest, hmacs[i].digest);
+
+    // the pads are made once and serve every message, as for hmac objects
+    crypto_hmac_pads(mi, ctx, key, key_len, k_ipad, k_opad);
+    for (round = 0; round < 2; round++) {
+      for (j = 0; j <= msg_len; j++) {
+        crypto_hmac_begin(mi, ctx, k_ipad);
+        mi->update(ctx, (const uint8_t *)msg, j);
+        mi->update(ctx, (const uint8_t *)msg + j, msg_len - j);
+        crypto_hmac_finalize(mi, ctx, k_opad, digest);
+        check("streamed hmac", hmacs[i].mech, digest, hmacs[i].digest);
+      }
+    }
+  }
+}
+
+int main(void)
+{
+  test_hashes();
+  test_millions();
+  test_hmacs();
+  if (!failed)
+    printf("ok\n");
+  return failed;
+}
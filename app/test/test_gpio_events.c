@@ -0,0 +1,172 @@
+/*
+ * test_gpio_events.c
+ *
+ * Stress test of the GPIO edge queue in platform.c. SIGALRM plays the GPIO
+ * interrupt and raises edges on several pins at once, while the main loop
+ * plays the Lua task, runs platform_gpio_process_events() for every post
+ * and takes the events in bursts with pauses in between, so the queue
+ * overflows now and then. Every event must arrive untorn and in order,
+ * the losses must match the overflow counter, no event may be left
+ * queued without a post, and a level pin must stay disarmed while its
+ * event is queued.
+ */
+
+#include "platform.h"
+#include "c_stdio.h"
+#include "c_string.h"
+#include "c_stdlib.h"
+#include "gpio.h"
+#include "user_interface.h"
+#include "driver/uart.h"
+#include "driver/i2c_master.h"
+#include "host_sdk.h"
+
+#include "../platform/platform.c"
+#include "../platform/pin_map.c"
+
+#include <stdio.h>
+
+#define EDGE_FIRST  1     // pins 1..8 trigger on both edges
+#define EDGE_LAST   8
+#define LEVEL_PIN   9     // and pin 9 on a high level
+#define EVENTS      1000000
+
+static volatile uint32_t status;      // GPIO_STATUS
+static volatile uint32_t produced, level_raised, seed = 1;
+static uint32_t taken, next_ccount, last_pin;
+static int failed;
+
+static bool gpio_regs(uint32_t addr, uint32_t *val, bool write)
+{
+  if (addr == PERIPHS_GPIO_BASEADDR + GPIO_STATUS_ADDRESS && !write)
+    *val = status;
+  else if (addr == PERIPHS_GPIO_BASEADDR + GPIO_STATUS_W1TC_ADDRESS && write)
+    status &= ~*val;
+  else
+    return false;
+  return true;
+}
+
+static uint32_t next_rand(void)
+{
+  seed = seed * 1103515245 + 12345;
+  return seed >> 16;
+}
+
+static bool armed(unsigned pin)
+{
+  return host_gpio_armed[pin_num[pin]] != GPIO_PIN_INTR_DISABLE;
+}
+
+// the consumer moves tail before it rearms, so this is exact in the irq
+static bool queued(unsigned pin)
+{
+  uint32_t i;
+  for (i = gpio_event_tail; i != gpio_event_head; i++)
+    if (gpio_events[i & (PLATFORM_GPIO_EVENTS - 1)].pin == pin)
+      return true;
+  return false;
+}
+
+// the GPIO interrupt: edges on a random set of pins, level derived from
+// the count so that the consumer can check it
+static void gpio_irq(void)
+{
+  unsigned pin;
+  uint32_t r = next_rand();
+
+  host_ccount++;
+  for (pin = EDGE_FIRST; pin <= EDGE_LAST; pin++) {
+    if ((r >> pin) & 1 && armed(pin)) {
+      status |= BIT(pin_num[pin]);
+      produced++;
+    }
+  }
+  if (armed(LEVEL_PIN)) {
+    if (queued(LEVEL_PIN)) {
+      printf("level pin armed while its event is queued\n");
+      failed = 1;
+    }
+    status |= BIT(pin_num[LEVEL_PIN]);
+    produced++;
+    level_raised++;
+  }
+  host_gpio_in = 0;
+  for (pin = EDGE_FIRST; pin <= LEVEL_PIN; pin++)
+    if ((host_ccount + pin) & 1)
+      host_gpio_in |= BIT(pin_num[pin]);
+  platform_gpio_intr_dispatcher(NULL);
+}
+
+// the gpio module's handler: at most one queue worth per run
+static void take_events(void)
+{
+  platform_gpio_event_t ev;
+  int n;
+
+  for (n = 0; n < PLATFORM_GPIO_EVENTS && platform_gpio_event_get(&ev); n++) {
+    if (ev.ccount < next_ccount || (ev.ccount == next_ccount && ev.pin <= last_pin && taken)) {
+      printf("event %u out of order\n", taken);
+      failed = 1;
+    }
+    if (ev.level != ((ev.ccount + ev.pin) & 1) || ev.pin < EDGE_FIRST || ev.pin > LEVEL_PIN) {
+      printf("event %u torn: pin %u level %u\n", taken, ev.pin, ev.level);
+      failed = 1;
+    }
+    next_ccount = ev.ccount;
+    last_pin = ev.pin;
+    taken++;
+  }
+}
+
+static void run_posts(uint32_t *done)
+{
+  while (*done < host_posts[LUA_GPIO_SIG]) {
+    (*done)++;
+    platform_gpio_process_events();
+  }
+}
+
+int main(void)
+{
+  uint32_t done = 0, lost;
+  unsigned pin;
+
+  host_reg_hook = gpio_regs;
+  platform_gpio_init(take_events);
+  for (pin = EDGE_FIRST; pin <= EDGE_LAST; pin++)
+    platform_gpio_intr_init(pin, GPIO_PIN_INTR_ANYEDGE);
+  platform_gpio_intr_init(LEVEL_PIN, GPIO_PIN_INTR_HILEVEL);
+
+  host_irq_start(gpio_irq, 20);
+  while (produced < EVENTS && !failed) {
+    run_posts(&done);
+    if ((taken & 0x3ff) == 0) {
+      volatile int d;
+      for (d = 0; d < 100000; d++);   // the Lua task is busy elsewhere
+    }
+    ets_isr_mask(1 << ETS_GPIO_INUM);
+    if (gpio_event_head != gpio_event_tail && done == host_posts[LUA_GPIO_SIG]) {
+      printf("events queued without a post\n");
+      failed = 1;
+    }
+    ets_isr_unmask(1 << ETS_GPIO_INUM);
+  }
+  host_irq_stop();
+  run_posts(&done);
+
+  lost = produced - taken;
+  printf("produced %u taken %u overflow %u level %u\n",
+    produced, taken, platform_gpio_event_overflow(0), level_raised);
+  if (gpio_event_head != gpio_event_tail) {
+    printf("events left in the queue\n");
+    failed = 1;
+  }
+  if (lost != platform_gpio_event_overflow(1) || platform_gpio_event_overflow(0) != 0) {
+    printf("lost %u events, overflow counted differently\n", lost);
+    failed = 1;
+  }
+  if (!failed)
+    printf("ok\n");
+  return failed;
+}
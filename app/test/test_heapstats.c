@@ -0,0 +1,245 @@
+/*
+ * test_heapstats.c
+ *
+ * The HEAP_STATS accounting of c_heapstats.c, through the wrappers
+ * c_malloc() and friends turn into: allocations, reallocs and frees, failed
+ * allocations counted globally and per site, the lowest free heap and the
+ * Lua heap peak, the site table filling up into the overflow count, and
+ * the hand over of the luaM_* call site to the Lua allocator. The heap is
+ * the host's, with a free heap size and failures the test sets.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HEAP_STATS
+#define HEAP_STATS_SITES 8
+
+// the SDK heap, failing on demand
+#include "mem.h"
+#undef os_malloc
+#undef os_zalloc
+#undef os_realloc
+#define os_malloc(s) host_malloc(s)
+#define os_zalloc(s) host_zalloc(s)
+#define os_realloc(p, s) host_realloc((p), (s))
+
+static int fail_next;
+static uint32_t free_heap = 40000;
+
+static void *host_malloc(size_t size)
+{
+  if (fail_next) {
+    fail_next = 0;
+    return NULL;
+  }
+  return malloc(size);
+}
+
+static void *host_zalloc(size_t size)
+{
+  void *p = host_malloc(size);
+  if (p)
+    memset(p, 0, size);
+  return p;
+}
+
+static void *host_realloc(void *ptr, size_t size)
+{
+  if (fail_next) {
+    fail_next = 0;
+    return NULL;
+  }
+  return realloc(ptr, size);
+}
+
+uint32_t system_get_free_heap_size(void)
+{
+  return free_heap;
+}
+
+// c_heapstats.c would find c_string.h and c_stddef.h next to it, with a
+// 32 bit ptrdiff_t; the host's string functions and types stand in
+#include "c_string.h"
+#define _C_STRING_H_
+#define __c_stddef_h
+#include "../libc/c_heapstats.c"
+
+// as c_stdlib.h has them with HEAP_STATS
+#undef c_malloc
+#undef c_zalloc
+#undef c_realloc
+#undef c_free
+#define c_malloc(s) heap_stats_malloc((s), __FILE__, __LINE__)
+#define c_zalloc(s) heap_stats_zalloc((s), __FILE__, __LINE__)
+#define c_realloc(p, s) heap_stats_realloc((p), (s), __FILE__, __LINE__)
+#define c_free(p) heap_stats_release(p)
+
+static int failed;
+
+#define EXPECT(what, got, want) expect(what, __LINE__, (got), (want))
+
+static void expect(const char *what, int line, uint32_t got, uint32_t want)
+{
+  if (got != want) {
+    printf("line %d: %s is %u, not %u\n", line, what, got, want);
+    failed = 1;
+  }
+}
+
+static const char this_file[] = __FILE__;
+
+static heap_site *site(int line)
+{
+  int i;
+  for (i = 0; i < HEAP_STATS_SITES; i++)
+    if (strcmp(heap_stats_data.sites[i].file ? heap_stats_data.sites[i].file : "", this_file) == 0 && heap_stats_data.sites[i].line == line)
+      return &heap_stats_data.sites[i];
+  printf("no site for line %d\n", line);
+  exit(1);
+}
+
+static void test_counts(void)
+{
+  heap_site *a, *b;
+  char *p, *q;
+  int la, lb;
+
+  heap_stats_reset();
+  la = __LINE__; p = c_malloc(100);
+  lb = __LINE__; q = c_zalloc(50);
+  EXPECT("zalloc'd byte", q[49], 0);
+  p = c_realloc(p, 300);
+  p = c_realloc(p, 20);
+  c_free(p);
+  c_free(q);
+  c_free(NULL);
+
+  EXPECT("allocs", heap_stats_data.allocs, 2);
+  EXPECT("reallocs", heap_stats_data.reallocs, 2);
+  EXPECT("frees", heap_stats_data.frees, 2);
+  EXPECT("bytes", heap_stats_data.bytes, 100 + 50 + 300 + 20);
+  EXPECT("failed", heap_stats_data.failed, 0);
+  EXPECT("overflow", heap_stats_data.overflow, 0);
+  a = site(la);
+  b = site(lb);
+  EXPECT("malloc site count", a->count, 1);
+  EXPECT("malloc site bytes", a->bytes, 100);
+  EXPECT("zalloc site count", b->count, 1);
+  EXPECT("zalloc site bytes", b->bytes, 50);
+
+  // a site called again adds up; realloc of NULL is an allocation
+  heap_stats_reset();
+  for (la = 0; la < 3; la++) {
+    lb = __LINE__; p = c_realloc(NULL, 10);
+    c_free(p);
+  }
+  EXPECT("allocs", heap_stats_data.allocs, 3);
+  EXPECT("reallocs", heap_stats_data.reallocs, 0);
+  EXPECT("frees", heap_stats_data.frees, 3);
+  EXPECT("realloc site count", site(lb)->count, 3);
+  EXPECT("realloc site bytes", site(lb)->bytes, 30);
+}
+
+static void test_failures(void)
+{
+  char *p, *q;
+  int l;
+
+  heap_stats_reset();
+  fail_next = 1;
+  l = __LINE__; p = c_malloc(1000);
+  EXPECT("failed malloc", p != NULL, 0);
+  fail_next = 1;
+  p = c_zalloc(1000);
+  EXPECT("failed zalloc", p != NULL, 0);
+  p = c_malloc(10);
+  fail_next = 1;
+  q = c_realloc(p, 5000);
+  EXPECT("failed realloc", q != NULL, 0);
+  c_free(p);
+
+  EXPECT("failed", heap_stats_data.failed, 3);
+  EXPECT("allocs", heap_stats_data.allocs, 1);
+  EXPECT("reallocs", heap_stats_data.reallocs, 0);
+  EXPECT("bytes", heap_stats_data.bytes, 10);
+  EXPECT("site failed", site(l)->failed, 1);
+  EXPECT("site count", site(l)->count, 0);
+  EXPECT("site bytes", site(l)->bytes, 0);
+}
+
+static void test_peaks(void)
+{
+  char *p;
+
+  heap_stats_reset();
+  EXPECT("min_free before any allocation", heap_stats_data.min_free, 0);
+  free_heap = 30000;
+  p = c_malloc(10);
+  free_heap = 20000;
+  p = c_realloc(p, 20);
+  free_heap = 25000;
+  c_free(p);
+  p = c_zalloc(10);
+  c_free(p);
+  EXPECT("min_free", heap_stats_data.min_free, 20000);
+
+  heap_stats_lua(5000);
+  heap_stats_lua(9000);
+  heap_stats_lua(7000);
+  EXPECT("lua_peak", heap_stats_data.lua_peak, 9000);
+
+  EXPECT("frag, one block", heap_stats_frag(20000, 20000), 0);
+  EXPECT("frag, no heap", heap_stats_frag(0, 0), 0);
+  EXPECT("frag, a quarter", heap_stats_frag(20000, 15000), 25);
+}
+
+static void test_overflow(void)
+{
+  int i;
+
+  // one site per line; the table takes HEAP_STATS_SITES of them
+  heap_stats_reset();
+  for (i = 0; i < HEAP_STATS_SITES + 3; i++)
+    c_free(heap_stats_malloc(8, "site.c", 1000 + i));
+  EXPECT("allocs", heap_stats_data.allocs, HEAP_STATS_SITES + 3);
+  EXPECT("overflow", heap_stats_data.overflow, 3);
+  for (i = 0; i < HEAP_STATS_SITES; i++)
+    EXPECT("site count", heap_stats_data.sites[i].count, 1);
+
+  // sites in the table still count, failures of the others go to overflow
+  c_free(heap_stats_malloc(8, "site.c", 1000));
+  fail_next = 1;
+  heap_stats_malloc(8, "site.c", 2000);
+  EXPECT("allocs", heap_stats_data.allocs, HEAP_STATS_SITES + 4);
+  EXPECT("overflow", heap_stats_data.overflow, 4);
+  EXPECT("failed", heap_stats_data.failed, 1);
+}
+
+static void test_lua_site(void)
+{
+  const char *file;
+  int line;
+
+  heap_stats_reset();
+  EXPECT("site without a luaM_* call", heap_stats_take_lua_site(&file, &line), 0);
+  heap_stats_lua_site("lstring.c", 42);
+  EXPECT("site taken", heap_stats_take_lua_site(&file, &line), 1);
+  EXPECT("line", line, 42);
+  EXPECT("file", strcmp(file, "lstring.c"), 0);
+  EXPECT("site taken once", heap_stats_take_lua_site(&file, &line), 0);
+}
+
+int main(void)
+{
+  test_counts();
+  test_failures();
+  test_peaks();
+  test_overflow();
+  test_lua_site();
+  if (!failed)
+    printf("ok\n");
+  return failed;
+}
@@ -0,0 +1,157 @@
+/*
+ * test_mqtt_parser.c
+ *
+ * Fuzzes the MQTT stream parser. Random streams of publishes (small, and
+ * larger than max_length so they come out in chunks) and short packets
+ * are cut into random segments; the packets and chunks handed out must
+ * add up to the original stream. Then random bytes are fed to it, which
+ * must never crash it or leave a buffer behind after a reset.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mqtt_parser.h"
+
+#define MAX_LENGTH 1024
+
+static uint8_t stream[200000];
+static int stream_len;
+static uint8_t out[200000];
+static int out_len;
+
+static void on_packet(void *arg, uint8_t *packet, uint16_t length)
+{
+  if (length > MAX_LENGTH) {
+    printf("packet of %u bytes over max_length\n", length);
+    exit(1);
+  }
+  memcpy(out + out_len, packet, length);
+  out_len += length;
+}
+
+// rebuild the publish around the chunks, so the output matches the input
+static void on_chunk(void *arg, mqtt_publish_chunk_t *chunk)
+{
+  if (chunk->offset == 0) {
+    uint8_t *h = chunk->header;
+    int fixed = 1, var;
+    while (h[fixed] & 0x80)
+      fixed++;
+    fixed++;
+    var = 2 + chunk->topic_length + ((h[0] >> 1) & 3 ? 2 : 0);
+    memcpy(out + out_len, h, fixed + var);
+    out_len += fixed + var;
+  }
+  memcpy(out + out_len, chunk->data, chunk->data_length);
+  out_len += chunk->data_length;
+}
+
+static void put_length(uint32_t n)
+{
+  do {
+    uint8_t b = n & 0x7f;
+    n >>= 7;
+    if (n)
+      b |= 0x80;
+    stream[stream_len++] = b;
+  } while (n);
+}
+
+static void put_publish(void)
+{
+  int qos = rand() % 3, topic = 1 + rand() % 20, k;
+  int payload = rand() % (rand() % 2 ? 3000 : 100);
+
+  stream[stream_len++] = 0x30 | (qos << 1);
+  put_length(2 + topic + (qos ? 2 : 0) + payload);
+  stream[stream_len++] = topic >> 8;
+  stream[stream_len++] = topic & 0xff;
+  for (k = 0; k < topic; k++)
+    stream[stream_len++] = 'a' + k;
+  if (qos) {
+    stream[stream_len++] = 0x12;
+    stream[stream_len++] = 0x34;
+  }
+  for (k = 0; k < payload; k++)
+    stream[stream_len++] = rand();
+}
+
+static void feed_segments(mqtt_parser_t *p, int max_segment)
+{
+  int pos = 0;
+  while (pos < stream_len) {
+    int n = 1 + rand() % max_segment;
+    uint8_t *seg;
+    if (n > stream_len - pos)
+      n = stream_len - pos;
+    seg = malloc(n);    // so that reads past the segment are caught
+    memcpy(seg, stream + pos, n);
+    mqtt_parser_feed(p, seg, n);
+    free(seg);
+    pos += n;
+  }
+}
+
+static int round_trip(int iterations)
+{
+  int iter, i;
+  for (iter = 0; iter < iterations; iter++) {
+    mqtt_parser_t p;
+    int packets = 1 + rand() % 10;
+
+    stream_len = out_len = 0;
+    for (i = 0; i < packets; i++) {
+      switch (rand() % 3) {
+        case 0:   // PINGRESP
+          stream[stream_len++] = 0xd0;
+          stream[stream_len++] = 0;
+          break;
+        default:
+          put_publish();
+          break;
+      }
+    }
+    mqtt_parser_init(&p, MAX_LENGTH, on_packet, on_chunk, NULL);
+    feed_segments(&p, rand() % 2 ? 5 : 1500);
+    if (out_len != stream_len || memcmp(out, stream, stream_len) ||
+        p.state != MQTT_PARSER_FIXED_HEADER || p.buffer) {
+      printf("round trip %d: %d bytes in, %d out\n", iter, stream_len, out_len);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int garbage(int iterations)
+{
+  int iter, i;
+  for (iter = 0; iter < iterations; iter++) {
+    mqtt_parser_t p;
+
+    stream_len = 1 + rand() % 4000;
+    for (i = 0; i < stream_len; i++)
+      stream[i] = rand();
+    // mostly small lengths, so that many packets actually complete
+    for (i = 0; i + 1 < stream_len; i += 1 + rand() % 64)
+      stream[i + 1] &= rand() % 4 ? 0x3f : 0xff;
+    out_len = 0;
+    mqtt_parser_init(&p, MAX_LENGTH, on_packet, on_chunk, NULL);
+    feed_segments(&p, 1 + rand() % 300);
+    mqtt_parser_reset(&p);
+    if (p.buffer || p.state != MQTT_PARSER_FIXED_HEADER) {
+      printf("garbage %d: parser not reset\n", iter);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int main(void)
+{
+  srand(1);
+  if (round_trip(2000) || garbage(2000))
+    return 1;
+  printf("ok\n");
+  return 0;
+}
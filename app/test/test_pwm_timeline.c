@@ -0,0 +1,160 @@
+/*
+ * test_pwm_timeline.c
+ *
+ * Runs the PWM driver's timer interrupt on a virtual clock: every call of
+ * the handler advances the clock by what it loaded into FRC1. New duties
+ * and frequencies are started at random points of a period. Every period
+ * must be exactly one whole timeline, either the one before or the one
+ * started last, with each pin high for the ticks its duty asks for and all
+ * pins from the same timeline.
+ */
+
+#include "platform.h"
+#include "c_string.h"
+#include "gpio.h"
+#include "user_interface.h"
+#include "driver/pwm.h"
+#include "host_sdk.h"
+
+#include "../driver/pwm.c"
+#include "../platform/pin_map.c"
+
+#include <stdio.h>
+
+#define PINS        PWM_CHANNEL   // pins 1..12, all on different gpios
+#define PERIODS     200000
+
+typedef struct {
+  uint32 end;                   // period in ticks
+  uint32 high[PINS + 1];        // ticks each pin is high
+} timing_t;
+
+static uint32 frc1_load;
+static uint32 outputs;
+static uint32 seed = 1;
+static timing_t started;        // what pwm_start was last given
+static timing_t running;        // what the current period has to be
+static uint32 high[PINS + 1], elapsed;
+static unsigned periods;
+static int failed;
+
+static bool timer_regs(uint32_t addr, uint32_t *val, bool write)
+{
+  if (addr == PERIPHS_TIMER_BASEDDR + FRC1_LOAD_ADDRESS && write) {
+    frc1_load = *val;
+    return true;
+  }
+  return false;
+}
+
+void gpio_output_set(uint32 set_mask, uint32 clear_mask, uint32 enable_mask, uint32 disable_mask)
+{
+  outputs = (outputs | set_mask) & ~clear_mask;
+}
+
+static uint32 next_rand(void)
+{
+  seed = seed * 1103515245 + 12345;
+  return seed >> 16;
+}
+
+static bool pin_high(unsigned pin)
+{
+  return (outputs >> pin_num[pin]) & 1;
+}
+
+// what the driver is expected to make of a duty, see pwm_build_timeline()
+static uint32 duty_ticks(uint32 period, uint16 duty, uint32 end)
+{
+  uint32 t = US_TO_RTC_TIMER_TICKS(period * duty / PWM_DEPTH);
+  return t > end ? end : t;
+}
+
+static void period_start(void)
+{
+  running = started;
+  memset(high, 0, sizeof(high));
+  elapsed = 0;
+}
+
+// a stopped timer is restarted at once, which starts a new period
+static void new_timing(void)
+{
+  unsigned pin;
+  int r = next_rand() % 8;
+  bool restart = pwm_timer_down;
+
+  if (r == 0)
+    pwm_set_freq(1 + next_rand() % PWM_FREQ_MAX, 0);
+  for (pin = 1; pin <= PINS; pin++) {
+    r = next_rand() % 8;
+    if (r < 3)
+      continue;   // keeps its duty
+    pwm_set_duty(r == 3 ? 0 : r == 4 ? PWM_DEPTH : next_rand() % (PWM_DEPTH + 1), pin);
+  }
+  started.end = US_TO_RTC_TIMER_TICKS(pwm.period);
+  for (pin = 1; pin <= PINS; pin++)
+    started.high[pin] = duty_ticks(pwm.period, pwm_get_duty(pin), started.end);
+  pwm_start();
+  if (restart)
+    period_start();
+}
+
+static void period_check(void)
+{
+  unsigned pin;
+
+  if (elapsed != running.end) {
+    printf("period %u: %u ticks, not %u\n", periods, elapsed, running.end);
+    failed = 1;
+  }
+  for (pin = 1; pin <= PINS; pin++) {
+    if (high[pin] != running.high[pin]) {
+      printf("period %u: pin %u high %u ticks, not %u\n", periods, pin, high[pin], running.high[pin]);
+      failed = 1;
+    }
+  }
+  periods++;
+}
+
+int main(void)
+{
+  unsigned pin;
+
+  host_reg_hook = timer_regs;
+  pwm_init(500, NULL);
+  for (pin = 1; pin <= PINS; pin++)
+    pwm_add(pin);
+  new_timing();
+
+  while (periods < PERIODS && !failed) {
+    if (pwm_timer_down) {
+      // all pins at 0 or full duty, the timer stopped and the pins keep
+      // their level until the next pwm_start
+      for (pin = 1; pin <= PINS; pin++) {
+        if (pin_high(pin) != (started.high[pin] != 0)) {
+          printf("timer stopped, pin %u is %u\n", pin, pin_high(pin));
+          failed = 1;
+        }
+      }
+      new_timing();
+      continue;
+    }
+    for (pin = 1; pin <= PINS; pin++)
+      if (pin_high(pin))
+        high[pin] += frc1_load;
+    elapsed += frc1_load;
+    pwm_tim1_intr_handler();
+    if (pwm_current == 0) {
+      // the period boundary, the handler took the pending timeline if any
+      period_check();
+      period_start();
+    }
+    if (next_rand() % 16 == 0)
+      new_timing();
+  }
+  printf("%u periods\n", periods);
+  if (!failed)
+    printf("ok\n");
+  return failed;
+}
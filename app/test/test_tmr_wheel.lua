@@ -0,0 +1,115 @@
+-- test_tmr_wheel.lua
+--
+-- The tmr timer wheel on a virtual clock: alarms must fire on the
+-- millisecond they are due, however they fall onto the levels of the
+-- wheel, and the modes, the numbered alarms and collection must behave
+-- as they did with one SDK timer per alarm.
+
+local function late(at, due, what)
+  assert(at, what .. " did not fire")
+  assert(at == due, what .. " fired at " .. at .. " us, due at " .. due)
+end
+
+-- the virtual clock starts at 0 with the wheel, so ticks are known here.
+-- An alarm that ends a wake on the last tick of a level 0 turn leaves the
+-- next level 1 slot to be spread on the next tick: the wheel must wake
+-- then and not a level 1 turn later.
+do
+  local at
+  tmr.create():alarm(127, tmr.ALARM_SINGLE, function() end)
+  tmr.create():alarm(150, tmr.ALARM_SINGLE, function() at = vnow() end)
+  run(200)
+  late(at, 150000, "alarm behind a level 0 wrap")
+end
+
+-- many periodic alarms fire exactly on their period
+local timers, counts = {}, {}
+for i = 1, 40 do
+  local t = tmr.create()
+  counts[i] = 0
+  t:alarm(10 * i, tmr.ALARM_AUTO, function(self)
+    assert(self == t)
+    counts[i] = counts[i] + 1
+  end)
+  timers[i] = t
+end
+tmr.stats(true)
+run(60000)
+for i = 1, 40 do
+  assert(counts[i] == math.floor(60000 / (10 * i)), "period " .. 10 * i .. " ran " .. counts[i] .. " times")
+end
+local s = tmr.stats(true)
+assert(s.late_max == 0 and s.timers == 40)
+-- due ticks are shared: fewer wakes than callbacks
+assert(s.wakes < s.callbacks, s.wakes .. " wakes for " .. s.callbacks .. " callbacks")
+for i = 1, 40 do assert(timers[i]:stop()) end
+assert(tmr.stats().timers == 0)
+
+-- single, semi, numbered, state, stop from the callback
+local single, semi, c = nil, 0, 0
+local s1 = tmr.create()
+s1:register(50, tmr.ALARM_SINGLE, function() single = vnow() end)
+assert(s1:state() == false)
+local base = vnow()
+s1:start()
+assert(s1:state() == true)
+tmr.alarm(3, 25, tmr.ALARM_SEMI, function() semi = semi + 1 end)
+tmr.create():alarm(5, tmr.ALARM_AUTO, function(self)
+  c = c + 1
+  if c == 7 then self:stop() end
+end)
+run(1000)
+late(single, base + 50000, "single alarm")
+assert(s1:state() == nil, "single alarm still registered")
+assert(semi == 1)
+assert(tmr.start(3))
+run(100)
+assert(semi == 2 and c == 7)
+
+-- a new interval restarts the alarm
+local iv = 0
+local ti = tmr.create()
+ti:alarm(1000, tmr.ALARM_AUTO, function() iv = iv + 1 end)
+run(500)
+ti:interval(100)
+run(1050)
+assert(iv == 10, "interval ran " .. iv .. " times")
+ti:unregister()
+assert(ti:state() == nil)
+
+-- started alarms survive collection
+local fired = false
+do
+  tmr.create():alarm(200, tmr.ALARM_SINGLE, function() fired = true end)
+end
+collectgarbage()
+collectgarbage()
+run(300)
+assert(fired, "a started alarm was collected")
+
+-- alarms on every level and past the span of the wheel, across the wrap
+-- of system_get_time()
+settime(0xFFFFFFFF - 5000000)
+for _, ms in ipairs({ 63, 64, 4095, 4096, 70000, 5 * 3600 * 1000, 20 * 3600 * 1000 }) do
+  local at
+  local due = (vnow() + ms * 1000) % 2^32
+  tmr.create():alarm(ms, tmr.ALARM_SINGLE, function() at = vnow() end)
+  run(ms - 1)
+  assert(not at, ms .. " ms alarm early")
+  run(2)
+  late(at, due, ms .. " ms alarm")
+end
+
+assert(not pcall(tmr.register, 7, 10, tmr.ALARM_SINGLE, print))
+assert(not pcall(tmr.create().register, tmr.create(), 0, tmr.ALARM_SINGLE, print))
+
+-- a late SDK timer is seen in the statistics
+for i = 1, 30 do
+  tmr.create():alarm(100 * (i % 3 + 1), tmr.ALARM_AUTO, function() end)
+end
+jitter(3000)
+tmr.stats(true)
+run(6000)
+s = tmr.stats()
+assert(s.late_max >= 3000 and s.late_avg >= 3000, "late " .. s.late_max .. " max, " .. s.late_avg .. " on average")
+print("ok")
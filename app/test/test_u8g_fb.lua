@@ -0,0 +1,75 @@
+-- test_u8g_fb.lua
+--
+-- The u8g framebuffer against the picture loop on a mock SSD1306: every
+-- frame drawn into the framebuffer and sent with updateDisplay(), or with
+-- a picture loop in framebuffer mode, must leave the display RAM exactly
+-- as the plain picture loop does, upright and rotated, starting from
+-- garbage on the display.
+
+local FRAMES = 40
+
+local d = u8g.ssd1306_128x64_i2c(0x3c)
+d:begin()
+
+local function scene(d, f)
+  d:drawFrame(0, 0, 128, 64)
+  d:drawBox(4, 50, (f * 7) % 120, 6)            -- progress bar, bottom pages
+  d:drawLine(64, 32, 64 + (f % 20) - 10, 10)
+  d:drawCircle(100, 20, 10)
+  d:drawDisc(20, 20, 3 + f % 5)
+  if f % 10 == 0 then d:drawPixel(70, 3) end
+  d:drawVLine(110, 35, 12)
+end
+
+local function pageloop(d, f)
+  d:firstPage()
+  repeat scene(d, f) until not d:nextPage()
+end
+
+for _, rot in ipairs({ false, true }) do
+  if rot then d:setRot180() end
+  local ref = {}
+  for f = 1, FRAMES do
+    pageloop(d, f)
+    ref[f] = ram()
+  end
+
+  d:setFramebuffer(true)
+  ramfill(0x5a)
+  local sent = 0
+  for f = 1, FRAMES do
+    d:clearBuffer()
+    scene(d, f)
+    sent = sent + d:updateDisplay()
+    assert(ram() == ref[f], "framebuffer frame " .. f .. " differs")
+  end
+  assert(sent < FRAMES * 8, "unchanged pages were sent")
+
+  -- the picture loop runs once per frame
+  local runs = 0
+  for f = 1, FRAMES do
+    d:firstPage()
+    repeat
+      runs = runs + 1
+      scene(d, f)
+    until not d:nextPage()
+    assert(ram() == ref[f], "framebuffer picture loop frame " .. f .. " differs")
+  end
+  assert(runs == FRAMES)
+  assert(d:updateDisplay() == 0)
+
+  d:setFramebuffer(false)
+  pageloop(d, 3)
+  assert(ram() == ref[3], "page mode after the framebuffer differs")
+  print("rotated", rot, "pages sent", sent, "of", FRAMES * 8)
+  d:undoRotation()
+end
+
+-- a display collected with its framebuffer on, and calls in page mode
+local e = u8g.ssd1306_128x64_i2c(0x3c)
+e:setFramebuffer(true)
+e = nil
+collectgarbage()
+assert(not pcall(d.updateDisplay, d))
+assert(not pcall(d.clearBuffer, d))
+print("ok")
@@ -0,0 +1,200 @@
+/*
+ * test_uart_tx.c
+ *
+ * Stress test of the UART0 transmit ring in driver/uart.c and of the sent
+ * notification in platform.c. SIGALRM plays the UART: it shifts a few
+ * bytes out of the tx fifo onto the wire and raises the fifo empty
+ * interrupt while the fifo is below its threshold. The main loop plays
+ * the Lua task: it writes a counting byte stream in random pieces, with
+ * and without blocking, asks to be told once the output is sent, writes
+ * more behind such a request as print() would, now and then waits for
+ * the callback or resizes the ring, and runs platform_uart_process_sent()
+ * for every post. The wire must carry the stream complete and in order,
+ * and a sent callback must come once per request, only when everything
+ * written so far is on the wire.
+ */
+
+#include "platform.h"
+#include "c_stdio.h"
+#include "c_string.h"
+#include "c_stdlib.h"
+#include "gpio.h"
+#include "user_interface.h"
+#include "driver/uart.h"
+#include "driver/i2c_master.h"
+#include "host_sdk.h"
+
+#include "../platform/platform.c"
+#include "../platform/pin_map.c"
+#include "../driver/uart.c"
+
+#include <stdio.h>
+
+#define BYTES       400000
+#define FIFO_SIZE   128
+
+UartDevice UartDev;
+
+static volatile uint8_t fifo[FIFO_SIZE];
+static volatile uint32_t fifo_head, fifo_tail;
+static volatile uint32_t wire;            // bytes shifted out
+static volatile uint32_t seed = 1;
+static uint32_t written;                  // bytes the driver took
+static uint32_t sent_calls, requests;
+static bool requested;
+static volatile int failed;
+
+static uint32_t fifo_count(void)
+{
+  return fifo_head - fifo_tail;
+}
+
+static bool uart_regs(uint32_t addr, uint32_t *val, bool write)
+{
+  uint32_t ena, thrhd;
+
+  if (addr == UART_FIFO(UART0) && write) {
+    if (fifo_count() == FIFO_SIZE) {
+      printf("tx fifo written while full\n");
+      failed = 1;
+    }
+    // the task writes the fifo unmasked without a ring: the byte must be
+    // in place before the uart sees it
+    fifo[fifo_head % FIFO_SIZE] = *val;
+    fifo_head++;
+  } else if (addr == UART_STATUS(UART0) && !write) {
+    *val = fifo_count() << UART_TXFIFO_CNT_S;
+  } else if (addr == UART_INT_ST(UART0) && !write) {
+    // raw status follows the fifo level, it cannot be cleared below it
+    ena = host_reg_read(UART_INT_ENA(UART0));
+    thrhd = (host_reg_read(UART_CONF1(UART0)) >> UART_TXFIFO_EMPTY_THRHD_S) & UART_TXFIFO_EMPTY_THRHD;
+    *val = fifo_count() < thrhd ? ena & UART_TXFIFO_EMPTY_INT_ST : 0;
+  } else if (addr == UART_INT_CLR(UART0) && write) {
+    ;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+void uart_div_modify(uint8 uart, uint32 div)
+{
+}
+
+void ets_install_putc1(void *fn)
+{
+}
+
+static uint32_t next_rand(void)
+{
+  seed = seed * 1103515245 + 12345;
+  return seed >> 16;
+}
+
+// the UART: a few bytes leave the fifo, then the interrupt if raised
+static void uart_irq(void)
+{
+  uint32_t n = next_rand() % 9;
+
+  while (n-- > 0 && fifo_count() > 0) {
+    uint8_t c = fifo[fifo_tail++ % FIFO_SIZE];
+    if (c != (uint8_t)wire) {
+      printf("byte %u on the wire is %u, not %u\n", wire, c, (uint8_t)wire);
+      failed = 1;
+    }
+    wire++;
+  }
+  if (READ_PERI_REG(UART_INT_ST(UART0)))
+    uart0_rx_intr_handler(NULL);
+}
+
+static void sent(unsigned id)
+{
+  if (!requested) {
+    printf("sent callback without a request\n");
+    failed = 1;
+  }
+  if (wire != written) {
+    printf("sent callback with %u of %u bytes on the wire\n", wire, written);
+    failed = 1;
+  }
+  requested = false;
+  sent_calls++;
+}
+
+static void write_some(void)
+{
+  char buf[300];
+  uint16_t len = 1 + next_rand() % sizeof(buf), i;
+  bool block = next_rand() % 4 != 0;
+
+  for (i = 0; i < len; i++)
+    buf[i] = written + i;
+  written += uart_tx_write(buf, len, block);
+}
+
+static void run_posts(uint32_t *done)
+{
+  while (*done < host_posts[LUA_UART_SENT_SIG]) {
+    (*done)++;
+    platform_uart_process_sent(0);
+  }
+}
+
+int main(void)
+{
+  static const uint16_t sizes[] = { 0, 1, 16, 256, 1000 };
+  uint32_t done = 0, spins;
+
+  host_reg_hook = uart_regs;
+  uart_init(BIT_RATE_115200, BIT_RATE_115200, 0, 0, LUA_UART_SENT_SIG);
+
+  host_irq_start(uart_irq, 20);
+  while (written < BYTES && !failed) {
+    int r = next_rand() % 16;
+
+    write_some();
+    if (r < 4) {
+      platform_uart_notify_sent(0, sent);
+      requested = true;
+      requests++;
+      // more output behind the request, as print() would add, also
+      // while the post for the request waits in the task queue
+      if (r == 0)
+        write_some();
+      if (r == 1) {
+        for (spins = 0; done == host_posts[LUA_UART_SENT_SIG] && spins < 100000000; spins++)
+          ;
+        write_some();
+      }
+    } else if (r == 4) {
+      // nothing more to write until the callback
+      for (spins = 0; requested && !failed && spins < 100000000; spins++)
+        run_posts(&done);
+    } else if (r == 5 && next_rand() % 16 == 0) {
+      if (!uart_tx_setup(sizes[next_rand() % (sizeof(sizes) / sizeof(sizes[0]))])) {
+        printf("no memory for the ring\n");
+        failed = 1;
+      }
+    }
+    run_posts(&done);
+  }
+  // the last request is answered once the rest has gone out
+  for (spins = 0; requested && !failed && spins < 100000000; spins++)
+    run_posts(&done);
+  uart_tx_flush();
+  host_irq_stop();
+
+  printf("wrote %u, wire %u, %u requests, %u callbacks\n", written, wire, requests, sent_calls);
+  if (requested) {
+    printf("last request not answered\n");
+    failed = 1;
+  }
+  if (wire != written) {
+    printf("output left behind\n");
+    failed = 1;
+  }
+  if (!failed)
+    printf("ok\n");
+  return failed;
+}
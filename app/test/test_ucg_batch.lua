@@ -0,0 +1,107 @@
+-- test_ucg_batch.lua
+--
+-- ucg draw batches and block transfers on a mock ILI9341: each scene is
+-- drawn once straight and once in a batch, and both must leave the same
+-- display RAM. The batch may not send more bytes, and block writes must
+-- take far fewer SPI transactions than there are bytes.
+
+local disp = ucg.ili9341_18x240x320_hw_spi(8, 2, 0)
+disp:begin(0)
+
+local scenes = {}
+
+scenes.clearScreen = function()
+  disp:clearScreen()
+end
+
+scenes.pixels = function()
+  disp:setColor(255, 0, 0)
+  for y = 10, 49 do for x = 20, 59 do disp:drawPixel(x, y) end end
+end
+
+scenes.hlines = function()
+  disp:setColor(0, 0, 255)
+  for y = 0, 59 do disp:drawHLine(30, y, 50) end
+end
+
+scenes.vlines = function()
+  disp:setColor(0, 255, 255)
+  for x = 100, 139 do disp:drawVLine(x, 20, 70) end
+end
+
+scenes.boxes = function()
+  disp:setColor(255, 255, 0)
+  disp:drawBox(10, 200, 100, 100)
+  disp:drawBox(110, 200, 20, 100)
+end
+
+-- later primitives cover earlier ones, also with a color seen before
+scenes.overlap = function()
+  disp:setColor(255, 0, 0)
+  disp:drawBox(0, 0, 50, 50)
+  disp:setColor(0, 255, 0)
+  for x = 10, 39 do disp:drawPixel(x, 25) end
+  disp:setColor(255, 0, 0)
+  disp:drawHLine(20, 25, 5)
+  disp:drawPixel(5, 5) disp:drawPixel(7, 5) disp:drawPixel(6, 5)
+end
+
+-- a call that is not recorded draws the runs before it first
+scenes.mixed = function()
+  for y = 0, 99 do
+    disp:setColor(y % 3 * 100, 50, 200)
+    for x = 0, 59 do disp:drawPixel(x, y) end
+    disp:drawHLine(60, y, 40)
+  end
+  disp:setColor(0, 255, 0)
+  disp:drawLine(0, 0, 200, 150)
+  disp:setColor(9, 9, 9)
+  for x = 0, 30 do disp:drawVLine(120 + x, 20, 80) end
+  disp:drawBox(151, 20, 10, 80)
+end
+
+local names = { "clearScreen", "pixels", "hlines", "vlines", "boxes", "overlap", "mixed" }
+
+local function draw(scene, batch)
+  fbclear()
+  bus()
+  if batch then disp:beginBatch() end
+  scene()
+  if batch then disp:endBatch() end
+  local bytes, trans = bus()
+  return fb(), bytes, trans
+end
+
+for _, name in ipairs(names) do
+  local ref, bytes, trans = draw(scenes[name], false)
+  local got, bbytes, btrans = draw(scenes[name], true)
+  assert(got == ref, name .. ": the batch draws a different picture")
+  assert(bbytes <= bytes, name .. ": the batch sends more")
+  assert(btrans * 4 < bbytes, name .. ": " .. btrans .. " transactions for " .. bbytes .. " bytes")
+  print(name, bytes, trans, bbytes, btrans)
+end
+
+-- pixels next to each other end up in a single run
+disp:beginBatch()
+for y = 0, 99 do for x = 0, 99 do disp:drawPixel(x, y) end end
+local calls, runs = disp:endBatch()
+assert(calls == 10000 and runs == 1, calls .. " calls, " .. runs .. " runs")
+
+-- a full list is drawn and recording goes on
+disp:beginBatch(2)
+for i = 1, 10 do
+  disp:setColor(i, 0, 0)
+  disp:drawPixel(i * 3, 0)
+end
+calls, runs = disp:endBatch()
+assert(calls == 10 and runs == 10)
+
+assert(not pcall(disp.beginBatch, disp, 0))
+assert(disp:endBatch() == nil)
+
+-- a display collected in the middle of a batch
+local e = ucg.ili9341_18x240x320_hw_spi(8, 2, 0)
+e:beginBatch()
+e = nil
+collectgarbage()
+print("ok")
@@ -100,17 +100,33 @@ static inline void tcp_random_port_init (void)
 void task_lua(os_event_t *e){
     char* lua_argv[] = { (char *)"lua", (char *)"-i", NULL };
     NODE_DBG("Task task_lua started.\n");
+    platform_spi_post_pending ();
     switch(e->sig){
         case SIG_LUA:
             NODE_DBG("SIG_LUA received.\n");
             lua_main( 2, lua_argv );
             break;
         case SIG_UARTINPUT:
+            uart_rx_ack ();
             lua_handle_input (false);
             break;
         case LUA_PROCESS_LINE_SIG:
             lua_handle_input (true);
             break;
+        case LUA_EGC_STEP_SIG:
+            lua_handle_egc ();
+            break;
+#ifdef GPIO_INTERRUPT_ENABLE
+        case LUA_GPIO_SIG:
+            platform_gpio_process_events ();
+            break;
+#endif
+        case LUA_SPI_SIG:
+            platform_spi_process_done (e->par);
+            break;
+        case LUA_UART_SENT_SIG:
+            platform_uart_process_sent (e->par);
+            break;
         default:
             break;
     }
@@ -181,7 +197,7 @@ void nodemcu_init(void)
 
     // test_romfs();
 #elif defined ( BUILD_SPIFFS )
-    fs_mount();
+    fs_mount( 0 );  // with the SPIFFS_CACHE_PAGES default cache
     // test_spiffs();
 #endif
     // endpoint_setup();
@@ -218,7 +234,7 @@ void user_init(void)
 
     UartBautRate br = BIT_RATE_DEFAULT;
 
-    uart_init (br, br, USER_TASK_PRIO_0, SIG_UARTINPUT);
+    uart_init (br, br, USER_TASK_PRIO_0, SIG_UARTINPUT, LUA_UART_SENT_SIG);
 
     #ifndef NODE_DEBUG
     system_set_os_print(0);
@@ -0,0 +1,70 @@
+-- Compare the heap cjson needs for a telemetry sized document, encoded and
+-- decoded whole against a chunk at a time through a file. The EGC runs on
+-- every allocation, so the lowest heap seen is what the code holds.
+
+local name = "cjson_heap.json"
+
+local function document()
+  local t = { device = "esp", readings = {}, config = {} }
+  for i = 1, 150 do
+    t.readings[i] = { ts = 1445000000 + i, temp = 21.5 + i / 10, ok = i % 3 == 0, tag = "sensor-" .. i }
+  end
+  for i = 1, 40 do
+    t.config["key" .. i] = { enabled = true, interval = i * 100, name = string.rep("n", i % 20) }
+  end
+  return t
+end
+
+local low
+local function sample()
+  local h = node.heap()
+  if h < low then low = h end
+end
+
+local function measure(label, fn)
+  collectgarbage()
+  local base = node.heap()
+  low = base
+  fn()
+  sample()
+  print(string.format("%-24s %6d bytes", label, base - low))
+end
+
+node.egc.setmode(node.egc.ALWAYS)
+local t = document()
+
+measure("encode", function()
+  local s = cjson.encode(t)
+  sample()
+  file.open(name, "w")
+  file.write(s)
+  file.close()
+end)
+
+measure("encode, 256 byte chunks", function()
+  file.open(name, "w")
+  cjson.encode(t, function(s) sample() file.write(s) end, 256)
+  file.close()
+end)
+
+t = nil
+measure("decode", function()
+  local s, c = ""
+  file.open(name)
+  repeat c = file.read(256) if c then s = s .. c end until not c
+  file.close()
+  sample()
+  local v = cjson.decode(s)
+  sample()
+end)
+
+measure("decoder, 256 byte chunks", function()
+  local dec = cjson.decoder()
+  file.open(name)
+  repeat local c = file.read(256) if c then dec:write(c) sample() end until not c
+  file.close()
+  local v = dec:result()
+  sample()
+end)
+
+file.remove(name)
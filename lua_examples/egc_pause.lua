@@ -0,0 +1,40 @@
+-- Compare garbage collector pauses of the EGC modes.
+-- Each run churns through short lived tables and strings from a timer, the
+-- way a busy application does, then prints the pause statistics.
+
+-- name, mode, memory limit, step budget in us
+local modes = {
+  { "ALWAYS", node.egc.ALWAYS, 4096, 0 },
+  { "ON_ALLOC_FAILURE", node.egc.ON_ALLOC_FAILURE, 0, 0 },
+  { "STEP", node.egc.STEP + node.egc.ON_ALLOC_FAILURE, 0, 2000 },
+}
+
+local function churn(n)
+  local keep = {}
+  for i = 1, n do
+    keep[i % 16] = { i, tostring(i), string.rep("x", i % 64) }
+  end
+end
+
+local function run(m)
+  local name, mode, limit, step = m[1], m[2], m[3], m[4]
+  node.egc.setmode(mode, limit, step)
+  node.egc.stats(true)
+  local rounds = 0
+  tmr.alarm(0, 20, 1, function()
+    churn(200)
+    rounds = rounds + 1
+    if rounds == 50 then
+      tmr.stop(0)
+      local count, max, avg, full, hist = node.egc.stats()
+      print(string.format("%-16s runs %5d full %5d max %6d us avg %5d us heap %d",
+        name, count, full, max, avg, node.heap()))
+      -- pauses under 128, 256, ... us, and longer
+      print("  pauses " .. table.concat(hist, " "))
+      table.remove(modes, 1)
+      if modes[1] then run(modes[1]) end
+    end
+  end)
+end
+
+run(modes[1])
@@ -0,0 +1,42 @@
+-- Measure i2c read throughput: byte by byte from Lua against i2c.transfer,
+-- in standard and fast mode. Needs a 24Cxx EEPROM (or any device that
+-- streams bytes after a register address) at dev on pins sda and scl.
+
+local id, sda, scl, dev = 0, 5, 6, 0x50
+local size, rounds = 64, 20
+
+-- one Lua call per byte. i2c.read nacks the last byte it reads, so only
+-- the first byte is right here; it is the timing that counts
+local function per_byte()
+  i2c.start(id)
+  i2c.address(id, dev, i2c.TRANSMITTER)
+  i2c.write(id, 0, 0)
+  i2c.start(id)
+  i2c.address(id, dev, i2c.RECEIVER)
+  local s = ""
+  for i = 1, size do
+    s = s .. i2c.read(id, 1)
+  end
+  i2c.stop(id)
+  return s
+end
+
+local function bulk()
+  return i2c.transfer(id, dev, { write = { 0, 0 }, read = size })
+end
+
+local function bench(name, speed, fn)
+  local real = i2c.setup(id, sda, scl, speed)
+  local t = tmr.now()
+  for i = 1, rounds do
+    if fn() == nil then print(name, "no ack") return end
+    tmr.wdclr()
+  end
+  t = tmr.now() - t
+  print(string.format("%-8s %6d Hz %7d bytes/s", name, real, size * rounds * 1000000 / t))
+end
+
+bench("per byte", i2c.SLOW, per_byte)
+bench("transfer", i2c.SLOW, bulk)
+bench("per byte", i2c.FAST, per_byte)
+bench("transfer", i2c.FAST, bulk)
@@ -0,0 +1,47 @@
+-- ***************************************************************************
+-- Frame rate test
+--
+-- Draws a screen where only a bar moves, first with the picture loop and
+-- then in framebuffer mode, and prints the frames per second of each.
+--
+-- Note: It is prepared for an SSD1306 on I2C, see u8g_graphics_test.lua
+--       for SPI.
+--
+-- ***************************************************************************
+
+local sda, scl, sla = 5, 6, 0x3c
+i2c.setup(0, sda, scl, i2c.SLOW)
+disp = u8g.ssd1306_128x64_i2c(sla)
+disp:setFont(u8g.font_6x10)
+
+local frames = 100
+
+local function draw(f)
+  disp:drawFrame(0, 0, 128, 64)
+  disp:drawStr(4, 14, "u8g frame rate")
+  disp:drawCircle(100, 30, 10)
+  disp:drawBox(4, 50, (f * 3) % 120, 6)
+end
+
+local function bench(name, frame)
+  local t = tmr.now()
+  for f = 1, frames do
+    frame(f)
+    tmr.wdclr()
+  end
+  t = tmr.now() - t
+  print(string.format("%-12s %5d fps/10", name, frames * 10000000 / t))
+end
+
+bench("picture loop", function(f)
+  disp:firstPage()
+  repeat draw(f) until not disp:nextPage()
+end)
+
+disp:setFramebuffer(true)
+bench("framebuffer", function(f)
+  disp:clearBuffer()
+  draw(f)
+  disp:updateDisplay()
+end)
+disp:setFramebuffer(false)
@@ -0,0 +1,61 @@
+-- Compare drawing a bar chart and a pixel pattern call by call against
+-- the same calls recorded in a batch.
+
+-- setup SPI and connect display
+function init_spi_display()
+   -- Hardware SPI CLK  = GPIO14
+   -- Hardware SPI MOSI = GPIO13
+   -- Hardware SPI MISO = GPIO12 (not used)
+   -- CS, D/C, and RES can be assigned freely to available GPIOs
+   local cs  = 8 -- GPIO15, pull-down 10k to GND
+   local dc  = 4 -- GPIO2
+   local res = 0 -- GPIO16
+
+   spi.setup(1, spi.MASTER, spi.CPOL_LOW, spi.CPHA_LOW, 8, 8)
+   disp = ucg.ili9341_18x240x320_hw_spi(cs, dc, res)
+end
+
+local function chart()
+   for i = 0, 23 do
+      local h = (i * 37) % 200 + 20
+      disp:setColor(0, 40, 40)
+      disp:drawBox(i * 10, 0, 10, 240 - h)
+      disp:setColor(i * 10, 255 - i * 10, 80)
+      -- one line per pixel row, joined into a box in a batch
+      for y = 240 - h, 239 do
+         disp:drawHLine(i * 10, y, 9)
+      end
+      disp:setColor(0, 0, 0)
+      disp:drawVLine(i * 10 + 9, 240 - h, h)
+   end
+end
+
+local function pattern()
+   for y = 250, 309 do
+      disp:setColor(y * 4 % 256, 128, 255 - y * 4 % 256)
+      for x = 0, 239 do
+         disp:drawPixel(x, y)
+      end
+      tmr.wdclr()
+   end
+end
+
+local function bench(name, batch)
+   local t = tmr.now()
+   if batch then disp:beginBatch() end
+   chart()
+   pattern()
+   local calls, runs
+   if batch then calls, runs = disp:endBatch() end
+   t = tmr.now() - t
+   print(string.format("%-10s %7d us %s", name, t, batch and (calls .. " calls, " .. runs .. " runs") or ""))
+end
+
+
+init_spi_display()
+
+disp:begin(ucg.FONT_MODE_TRANSPARENT)
+disp:clearScreen()
+
+bench("direct", false)
+bench("batch", true)
@@ -28,6 +28,7 @@ local string = string
 local ow = ow
 -- Timer module
 local tmr = tmr
+local pairs = pairs
 -- Limited to local environment
 setfenv(1,M)
 --------------------------------------------------------------------------------
@@ -139,5 +140,34 @@ function read(addr, unit)
   end
 end
 
+-- Convert all sensors on the bus at once without blocking. callback gets a
+-- table of temperatures keyed by address, nil for a failed read
+function readAll(callback, unit)
+  setup(pin)
+  ow.convert(pin, function(results)
+    local temps = {}
+    for addr, data in pairs(results) do
+      if data and (addr:byte(1) == 0x10 or addr:byte(1) == 0x28) then
+        local t = data:byte(1) + data:byte(2) * 256
+        if (t > 32767) then
+          t = t - 65536
+        end
+        if (addr:byte(1) == 0x28) then
+          t = t * 625  -- DS18B20, 4 fractional bits
+        else
+          t = t * 5000 -- DS18S20, 1 fractional bit
+        end
+        if (unit == F) then
+          t = t * 1.8 + 320000
+        elseif (unit == K) then
+          t = t + 2731500
+        end
+        temps[addr] = t / 10000
+      end
+    end
+    callback(temps)
+  end)
+end
+
 -- Return module table
 return M